@@ -0,0 +1,1302 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <glm/glm.hpp>
+#include "Ray.h"
+#include "Triangle.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "ChunkedGeometry.h"
+#include "GeometryCache.h"
+#include "SceneIndex.h"
+#include "Sphere.h"
+#include "Plane.h"
+#include "Shading.h"
+#include "ImageWriter.h"
+#include "SceneParser.h"
+#include "Octahedral.h"
+#include "Pixel.h"
+#include "Denoiser.h"
+#include <boost/tokenizer.hpp>
+
+/**
+ * Micro benchmarks for the hot kernels of the raytracer.
+ * Usage: raytracer_bench [kernel]
+ */
+
+typedef std::chrono::high_resolution_clock Clock;
+
+/**
+ * The edge/cross product test that was used before the
+ * triangle data was pre-computed. Kept as a reference
+ * for timing and for validating the results.
+ */
+static bool referenceTriangleIntersection(Ray &ray, Triangle* triangle, float &t) {
+    float d = glm::dot(ray.direction, triangle->normal);
+    if(d < 0.0f) {
+        t = glm::dot(triangle->vertices[0] - ray.origin, triangle->normal) / d;
+        if(t < 0.0f) {
+            return false;
+        }
+
+        glm::vec3 intersection = ray.origin + (t * ray.direction);
+
+        glm::vec3 ba = triangle->vertices[1] - triangle->vertices[0];
+        glm::vec3 cb = triangle->vertices[2] - triangle->vertices[1];
+        glm::vec3 ac = triangle->vertices[0] - triangle->vertices[2];
+
+        glm::vec3 pa = intersection - triangle->vertices[0];
+        glm::vec3 pb = intersection - triangle->vertices[1];
+        glm::vec3 pc = intersection - triangle->vertices[2];
+
+        float a = glm::dot(glm::cross(ba,pa), triangle->normal);
+        float b = glm::dot(glm::cross(cb,pb), triangle->normal);
+        float c = glm::dot(glm::cross(ac,pc), triangle->normal);
+
+        return a >= 0.0f && b >= 0.0f && c >= 0.0f;
+    }
+    return false;
+}
+
+static Triangle* makeTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c) {
+    Triangle* triangle = new Triangle();
+    triangle->vertices = {a, b, c};
+    triangle->precompute();
+    return triangle;
+}
+
+/**
+ * Times the triangle test against random triangles and rays,
+ * then fires rays exactly through the shared diagonals of a
+ * grid of quads to count rays that slip between two triangles.
+ */
+static void benchmarkTriangle() {
+    const int triangleCount = 1024;
+    const int rayCount = 4096;
+
+    std::mt19937 rng(371);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    auto randomPoint = [&]() {return glm::vec3(unit(rng), unit(rng), unit(rng));};
+
+    std::vector<Triangle*> triangles;
+    for(int i = 0; i < triangleCount; i++) {
+        glm::vec3 center = randomPoint() * 4.0f;
+        triangles.push_back(makeTriangle(center + randomPoint(), center + randomPoint(), center + randomPoint()));
+    }
+
+    std::vector<Ray> rays;
+    for(int i = 0; i < rayCount; i++) {
+        glm::vec3 origin = glm::normalize(randomPoint()) * 10.0f;
+        glm::vec3 target = randomPoint() * 4.0f;
+        glm::vec3 direction = glm::normalize(target - origin);
+        rays.emplace_back(origin, direction);
+    }
+
+    long long hits = 0, referenceHits = 0, mismatches = 0;
+    glm::vec3 intersection;
+    float t, referenceT;
+
+    Clock::time_point start = Clock::now();
+    for(auto & ray : rays) {
+        for(auto & triangle : triangles) {
+            hits += ray.intersects(triangle, intersection, t);
+        }
+    }
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+    start = Clock::now();
+    for(auto & ray : rays) {
+        for(auto & triangle : triangles) {
+            referenceHits += referenceTriangleIntersection(ray, triangle, referenceT);
+        }
+    }
+    std::chrono::duration<double, std::nano> referenceElapsed = Clock::now() - start;
+
+    for(auto & ray : rays) {
+        for(auto & triangle : triangles) {
+            bool hit = ray.intersects(triangle, intersection, t);
+            bool referenceHit = referenceTriangleIntersection(ray, triangle, referenceT);
+            if(hit != referenceHit) {
+                mismatches++;
+            }
+        }
+    }
+
+    double tests = (double)triangleCount * rayCount;
+    std::cout << "triangle: " << elapsed.count() / tests << " ns/test, "
+              << hits << " hits" << std::endl;
+    std::cout << "reference: " << referenceElapsed.count() / tests << " ns/test, "
+              << referenceHits << " hits" << std::endl;
+    std::cout << "mismatches: " << mismatches << " (rays grazing an edge)" << std::endl;
+
+    //A 32x32 grid of unit quads split along the diagonal
+    //with every ray aimed at a point of a shared edge
+    const int grid = 32;
+    std::vector<Triangle*> quads;
+    for(int y = 0; y < grid; y++) {
+        for(int x = 0; x < grid; x++) {
+            glm::vec3 a(x, y, 0), b(x + 1, y, 0), c(x + 1, y + 1, 0), d(x, y + 1, 0);
+            quads.push_back(makeTriangle(a, b, c));
+            quads.push_back(makeTriangle(a, c, d));
+        }
+    }
+
+    int leaks = 0, edgeRays = 0;
+    std::uniform_real_distribution<float> along(0.0f, 1.0f);
+    for(int i = 0; i < rayCount; i++) {
+        float s = along(rng);
+        int x = (int)(along(rng) * (grid - 1));
+        int y = (int)(along(rng) * (grid - 1));
+        glm::vec3 targets[] = {glm::vec3(x + s, y + s, 0), glm::vec3(x + 1, y + s, 0), glm::vec3(x + s, y + 1, 0)};
+        for(auto & target : targets) {
+            glm::vec3 origin = target + glm::vec3(unit(rng), unit(rng), 5.0f);
+            glm::vec3 direction = glm::normalize(target - origin);
+            Ray ray(origin, direction);
+            bool hit = false;
+            for(auto & quad : quads) {
+                if(ray.intersects(quad, intersection, t)) {
+                    hit = true;
+                    break;
+                }
+            }
+            leaks += !hit;
+            edgeRays++;
+        }
+    }
+    std::cout << "edge rays: " << edgeRays << ", leaked between triangles: " << leaks << std::endl;
+
+    for(auto & triangle : triangles) {
+        delete triangle;
+    }
+    for(auto & quad : quads) {
+        delete quad;
+    }
+}
+
+/**
+ * Validates the ray origin offsetting against a double precision
+ * reference. Rays hit random triangles at growing distances from
+ * the world origin; new rays are spawned from the hit point to
+ * both sides of the surface, using the constant bias and the
+ * offset along the normal. A spawned origin fails when the exact
+ * plane puts it on the wrong side, or when the new ray hits the
+ * triangle it was spawned from.
+ */
+static void benchmarkOffset() {
+    const int samples = 20000;
+    const float scales[] = {1.0f, 100.0f, 10000.0f, 1000000.0f};
+
+    std::mt19937 rng(40051123);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    auto randomPoint = [&]() {return glm::vec3(unit(rng), unit(rng), unit(rng));};
+
+    for(float scale : scales) {
+        int biasFailures = 0, offsetFailures = 0, primaryHits = 0;
+
+        for(int i = 0; i < samples; i++) {
+            glm::vec3 center = randomPoint() * scale;
+            float size = 0.5f + scale * 0.01f;
+            Triangle* triangle = makeTriangle(center + randomPoint() * size, center + randomPoint() * size, center + randomPoint() * size);
+
+            glm::vec3 eye = center + glm::normalize(randomPoint()) * size * 4.0f;
+            glm::vec3 target = (triangle->vertices[0] + triangle->vertices[1] + triangle->vertices[2]) / 3.0f;
+            glm::vec3 direction = glm::normalize(target - eye);
+            Ray primary(eye, direction);
+
+            glm::vec3 hit;
+            float t;
+            //sliver triangles have no well defined normal
+            if(triangle->area < size * size * 0.001f || !primary.intersects(triangle, hit, t, false)) {
+                delete triangle;
+                continue;
+            }
+            primaryHits++;
+
+            glm::dvec3 a(triangle->vertices[0]), b(triangle->vertices[1]), c(triangle->vertices[2]);
+            glm::dvec3 exactNormal = glm::normalize(glm::cross(b - a, c - a));
+
+            for(float side : {1.0f, -1.0f}) {
+                glm::vec3 away = glm::normalize(triangle->normal * side + randomPoint() * 0.9f);
+                if(glm::dot(away, triangle->normal * side) <= 0.0f) {
+                    continue;
+                }
+                glm::vec3 destination = hit + away * size;
+
+                Ray biased = Ray::toObject(hit, destination, 0.0001f);
+                Ray offset = Ray::toObject(hit, destination, triangle->normal);
+
+                glm::vec3 selfHit;
+                float selfT;
+                double biasedSide = glm::dot(glm::dvec3(biased.origin) - a, exactNormal) * side;
+                double offsetSide = glm::dot(glm::dvec3(offset.origin) - a, exactNormal) * side;
+                biasFailures += biasedSide <= 0.0 || biased.intersects(triangle, selfHit, selfT, false);
+                offsetFailures += offsetSide <= 0.0 || offset.intersects(triangle, selfHit, selfT, false);
+            }
+            delete triangle;
+        }
+
+        std::cout << "offset: scale " << scale << ", " << primaryHits << " hits, failures with bias: "
+                  << biasFailures << ", with normal offset: " << offsetFailures << std::endl;
+    }
+}
+
+/**
+ * Tessellated sphere of radius 4, twisted around the y axis by
+ * the given angle per unit of height and stretched along x, to
+ * stand in for a deforming mesh
+ */
+static std::vector<glm::vec3> makeSphereVertices(int rings, int segments, float twist) {
+    auto spherePoint = [&](int ring, int segment) {
+        float theta = 3.14159265f * ring / rings;
+        float phi = 2.0f * 3.14159265f * segment / segments;
+        glm::vec3 point = glm::vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)) * 4.0f;
+        float angle = twist * point.y;
+        return glm::vec3((point.x * cosf(angle) - point.z * sinf(angle)) * (1.0f + twist),
+                         point.y, point.x * sinf(angle) + point.z * cosf(angle));
+    };
+
+    std::vector<glm::vec3> vertices;
+    for(int ring = 0; ring < rings; ring++) {
+        for(int segment = 0; segment < segments; segment++) {
+            glm::vec3 a = spherePoint(ring, segment), b = spherePoint(ring, segment + 1);
+            glm::vec3 c = spherePoint(ring + 1, segment), d = spherePoint(ring + 1, segment + 1);
+            vertices.insert(vertices.end(), {a, c, b, b, c, d});
+        }
+    }
+    return vertices;
+}
+
+static std::vector<AABB> getBounds(const std::vector<Triangle*> &triangles) {
+    std::vector<AABB> bounds(triangles.size());
+    for(size_t i = 0; i < triangles.size(); i++) {
+        for(auto & vertex : triangles[i]->vertices) {
+            bounds[i].expand(vertex);
+        }
+    }
+    return bounds;
+}
+
+static std::vector<Ray> makeRays(int count, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    auto randomPoint = [&]() {return glm::vec3(unit(rng), unit(rng), unit(rng));};
+
+    std::vector<Ray> rays;
+    for(int i = 0; i < count; i++) {
+        glm::vec3 origin = glm::normalize(randomPoint()) * 10.0f;
+        glm::vec3 target = randomPoint() * 4.0f;
+        glm::vec3 direction = glm::normalize(target - origin);
+        rays.emplace_back(origin, direction);
+    }
+    return rays;
+}
+
+/**
+ * Closest hit distance of every ray, HUGE_VALF for misses
+ */
+static std::vector<float> traceBVH(const BVH &bvh, const std::vector<Triangle*> &triangles, std::vector<Ray> &rays) {
+    std::vector<float> closest;
+    const std::vector<int> &order = bvh.getOrder();
+    for(auto & ray : rays) {
+        float t = HUGE_VALF;
+        bvh.intersect(ray.origin, ray.inverseDirection, t, [&](int index, float &nearest) {
+            glm::vec3 intersection;
+            float d;
+            if(ray.intersects(triangles[order[index]], intersection, d) && d < nearest) {
+                nearest = d;
+                return true;
+            }
+            return false;
+        });
+        closest.push_back(t);
+    }
+    return closest;
+}
+
+static std::vector<float> traceWideBVH(const WideBVH &wide, const std::vector<int> &order,
+                                       const std::vector<Triangle*> &triangles, std::vector<Ray> &rays) {
+    std::vector<float> closest;
+    for(auto & ray : rays) {
+        float t = HUGE_VALF;
+        wide.intersect(ray.origin, ray.inverseDirection, t, [&](int index, float &nearest) {
+            glm::vec3 intersection;
+            float d;
+            if(ray.intersects(triangles[order[index]], intersection, d) && d < nearest) {
+                nearest = d;
+                return true;
+            }
+            return false;
+        });
+        closest.push_back(t);
+    }
+    return closest;
+}
+
+/**
+ * Builds the BVH of a large tessellated sphere with one thread
+ * and with all cores, then traces the same random rays through
+ * both trees. The trees may differ when subtrees finish in a
+ * different order, but the closest hits must not.
+ */
+static void benchmarkBVH() {
+    const int rings = 256;
+    const int segments = 512;
+    const int rayCount = 200000;
+
+    std::mt19937 rng(2017);
+    std::vector<glm::vec3> vertices = makeSphereVertices(rings, segments, 0.0f);
+    std::vector<Triangle*> triangles;
+    for(size_t i = 0; i < vertices.size(); i += 3) {
+        triangles.push_back(makeTriangle(vertices[i], vertices[i + 1], vertices[i + 2]));
+    }
+
+    std::vector<AABB> bounds = getBounds(triangles);
+    std::vector<Ray> rays = makeRays(rayCount, rng);
+
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<float> closest[2];
+    int run = 0;
+
+    for(unsigned int threads : {1u, cores}) {
+        BVH bvh;
+        bvh.build(bounds, threads);
+        const BVHStats &stats = bvh.getStats();
+
+        Clock::time_point start = Clock::now();
+        closest[run] = traceBVH(bvh, triangles, rays);
+        std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+        long long hits = std::count_if(closest[run].begin(), closest[run].end(), [](float t) {return t < HUGE_VALF;});
+
+        std::cout << "bvh: " << triangles.size() << " triangles, " << threads << " threads, build "
+                  << stats.buildSeconds * 1000.0 << " ms, SAH cost " << stats.sahCost << ", "
+                  << stats.nodeCount << " nodes, depth " << stats.maxDepth << ", "
+                  << elapsed.count() / rayCount << " ns/ray, " << hits << " hits" << std::endl;
+        run++;
+    }
+
+    int mismatches = 0;
+    for(int i = 0; i < rayCount; i++) {
+        mismatches += closest[0][i] != closest[1][i];
+    }
+    std::cout << "bvh: closest hit mismatches between builds: " << mismatches << std::endl;
+
+    for(auto & triangle : triangles) {
+        delete triangle;
+    }
+}
+
+/**
+ * Twists the sphere a little more every frame and refits its
+ * BVH, comparing the refit with a full rebuild of the same
+ * frame: time, SAH cost and the closest hits of random rays.
+ */
+static void benchmarkRefit() {
+    const int rings = 256;
+    const int segments = 512;
+    const int frames = 8;
+    const int rayCount = 20000;
+
+    std::mt19937 rng(2018);
+    std::vector<Ray> rays = makeRays(rayCount, rng);
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<glm::vec3> vertices = makeSphereVertices(rings, segments, 0.0f);
+    std::vector<Triangle*> triangles;
+    for(size_t i = 0; i < vertices.size(); i += 3) {
+        triangles.push_back(makeTriangle(vertices[i], vertices[i + 1], vertices[i + 2]));
+    }
+
+    BVH refitted;
+    refitted.build(getBounds(triangles), threads);
+    const std::vector<int> &order = refitted.getOrder();
+
+    for(int frame = 1; frame <= frames; frame++) {
+        vertices = makeSphereVertices(rings, segments, 0.05f * frame);
+        for(size_t i = 0; i < triangles.size(); i++) {
+            triangles[i]->vertices = {vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]};
+            triangles[i]->precompute();
+        }
+
+        //refit takes the bounds in the order of the leaves
+        std::vector<AABB> bounds = getBounds(triangles);
+        std::vector<AABB> leafBounds;
+        for(int index : order) {
+            leafBounds.push_back(bounds[index]);
+        }
+        float degradation = refitted.refit(leafBounds, threads);
+
+        BVH rebuilt;
+        rebuilt.build(bounds, threads);
+
+        std::vector<float> refittedHits = traceBVH(refitted, triangles, rays);
+        std::vector<float> rebuiltHits = traceBVH(rebuilt, triangles, rays);
+        int mismatches = 0;
+        for(int i = 0; i < rayCount; i++) {
+            mismatches += refittedHits[i] != rebuiltHits[i];
+        }
+
+        std::cout << "refit: frame " << frame << ", refit " << refitted.getStats().refitSeconds * 1000.0
+                  << " ms, rebuild " << rebuilt.getStats().buildSeconds * 1000.0 << " ms, SAH cost "
+                  << refitted.getStats().sahCost << " vs " << rebuilt.getStats().sahCost
+                  << ", degradation " << degradation << ", mismatches " << mismatches << std::endl;
+    }
+
+    for(auto & triangle : triangles) {
+        delete triangle;
+    }
+}
+
+/**
+ * Compares the binary BVH with the compressed wide BVH collapsed
+ * from it: bytes per node and per triangle, and time per ray.
+ * Both trees reference the same triangles, so the closest hits
+ * must be the same.
+ */
+static void benchmarkCompact() {
+    const int rings = 256;
+    const int segments = 512;
+    const int rayCount = 200000;
+
+    std::mt19937 rng(2019);
+    std::vector<Ray> rays = makeRays(rayCount, rng);
+
+    std::vector<glm::vec3> vertices = makeSphereVertices(rings, segments, 0.0f);
+    std::vector<Triangle*> triangles;
+    for(size_t i = 0; i < vertices.size(); i += 3) {
+        triangles.push_back(makeTriangle(vertices[i], vertices[i + 1], vertices[i + 2]));
+    }
+
+    BVH binary;
+    binary.build(getBounds(triangles), std::max(1u, std::thread::hardware_concurrency()));
+    WideBVH wide;
+    wide.build(binary);
+
+    Clock::time_point start = Clock::now();
+    std::vector<float> binaryHits = traceBVH(binary, triangles, rays);
+    std::chrono::duration<double, std::nano> binaryElapsed = Clock::now() - start;
+
+    start = Clock::now();
+    std::vector<float> wideHits = traceWideBVH(wide, binary.getOrder(), triangles, rays);
+    std::chrono::duration<double, std::nano> wideElapsed = Clock::now() - start;
+
+    int mismatches = 0;
+    for(int i = 0; i < rayCount; i++) {
+        mismatches += binaryHits[i] != wideHits[i];
+    }
+
+    double count = (double)triangles.size();
+    std::cout << "compact: binary " << binary.getNodes().size() << " nodes of " << sizeof(BVHNode) << " bytes, "
+              << binary.getMemoryUsage() / count << " bytes/triangle, "
+              << binaryElapsed.count() / rayCount << " ns/ray" << std::endl;
+    std::cout << "compact: wide " << wide.getNodes().size() << " nodes of " << sizeof(WideBVHNode) << " bytes, "
+              << wide.getMemoryUsage() / count << " bytes/triangle, "
+              << wideElapsed.count() / rayCount << " ns/ray, mismatches " << mismatches << std::endl;
+
+    //The compact layout stores three indices per triangle and
+    //shares the vertices, the binary layout a Triangle object
+    size_t triangleObject = sizeof(Triangle*) + sizeof(Triangle) + 3 * sizeof(glm::vec3);
+    size_t compactTriangle = 3 * sizeof(unsigned int) + sizeof(int) + sizeof(glm::vec3) * (rings * (segments + 1) + 1) / count;
+    std::cout << "compact: triangle storage " << triangleObject << " bytes/triangle as objects, about "
+              << compactTriangle << " bytes/triangle as indices" << std::endl;
+
+    for(auto & triangle : triangles) {
+        delete triangle;
+    }
+}
+
+/**
+ * A room of planes filled with small spheres. Closest hits through
+ * the scene index are compared with the plain loop over all the
+ * objects and with a single BVH that has to hold the planes as huge
+ * boxes next to the spheres.
+ */
+static void benchmarkIndex() {
+    const int sphereCount = 2000;
+    const int rayCount = 100000;
+
+    std::mt19937 rng(2020);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    std::vector<SceneObject*> objects;
+    const glm::vec3 walls[] = {{0, 1, 0}, {0, -1, 0}, {1, 0, 0}, {-1, 0, 0}, {0, 0, 1}};
+    for(auto & normal : walls) {
+        Plane* plane = new Plane();
+        plane->normal = normal;
+        plane->position = -normal * 10.0f;
+        objects.push_back(plane);
+    }
+    for(int i = 0; i < sphereCount; i++) {
+        Sphere* sphere = new Sphere();
+        sphere->position = glm::vec3(unit(rng), unit(rng), unit(rng)) * 9.0f;
+        sphere->radius = 0.1f + 0.2f * (unit(rng) + 1.0f);
+        objects.push_back(sphere);
+    }
+
+    std::vector<Ray> rays;
+    for(int i = 0; i < rayCount; i++) {
+        glm::vec3 origin(unit(rng) * 9.0f, unit(rng) * 9.0f, 12.0f);
+        glm::vec3 direction = glm::normalize(glm::vec3(unit(rng), unit(rng), -1.0f));
+        rays.emplace_back(origin, direction);
+    }
+
+    SceneIndex index;
+    index.build(objects, std::max(1u, std::thread::hardware_concurrency()));
+
+    std::vector<float> loopHits, indexHits;
+    Clock::time_point start = Clock::now();
+    for(auto & ray : rays) {
+        float closest = HUGE_VALF;
+        for(auto & object : objects) {
+            glm::vec3 intersection;
+            float d;
+            if(ray.intersects(object, intersection, d, !object->doubleSided) && d < closest) {
+                closest = d;
+            }
+        }
+        loopHits.push_back(closest);
+    }
+    std::chrono::duration<double, std::nano> loopElapsed = Clock::now() - start;
+
+    start = Clock::now();
+    for(auto & ray : rays) {
+        Hit hit;
+        index.closestHit(ray, hit);
+        indexHits.push_back(hit.distance);
+    }
+    std::chrono::duration<double, std::nano> indexElapsed = Clock::now() - start;
+
+    int mismatches = 0;
+    for(int i = 0; i < rayCount; i++) {
+        mismatches += loopHits[i] != indexHits[i];
+    }
+
+    //Planes clipped to a box far larger than the room,
+    //as a single BVH over all the objects would need
+    std::vector<AABB> bounds;
+    for(auto & object : objects) {
+        AABB box;
+        if(object->type == SceneObject::plane) {
+            glm::vec3 extent = (glm::vec3(1.0f) - glm::abs(object->normal)) * 1e6f;
+            box.expand(object->position - extent);
+            box.expand(object->position + extent);
+        } else {
+            box.expand(object->position - glm::vec3(((Sphere*)object)->radius));
+            box.expand(object->position + glm::vec3(((Sphere*)object)->radius));
+        }
+        bounds.push_back(box);
+    }
+    BVH mixed;
+    mixed.build(bounds, 1);
+    const std::vector<int> &order = mixed.getOrder();
+
+    start = Clock::now();
+    for(int i = 0; i < rayCount; i++) {
+        Ray &ray = rays[i];
+        float closest = HUGE_VALF;
+        mixed.intersect(ray.origin, ray.inverseDirection, closest, [&](int index, float &nearest) {
+            SceneObject* object = objects[order[index]];
+            glm::vec3 intersection;
+            float d;
+            if(ray.intersects(object, intersection, d, !object->doubleSided) && d < nearest) {
+                nearest = d;
+                return true;
+            }
+            return false;
+        });
+        mismatches += closest != loopHits[i];
+    }
+    std::chrono::duration<double, std::nano> mixedElapsed = Clock::now() - start;
+
+    std::cout << "index: " << objects.size() << " objects, loop " << loopElapsed.count() / rayCount
+              << " ns/ray, planes in the BVH " << mixedElapsed.count() / rayCount
+              << " ns/ray, planes apart " << indexElapsed.count() / rayCount << " ns/ray, mismatches "
+              << mismatches << std::endl;
+
+    for(auto & object : objects) {
+        delete object;
+    }
+}
+
+/**
+ * Many spheres of similar size, the case the uniform grid is
+ * meant for. Build and trace times of the scene index with the
+ * BVH and with the grid, and the hits compared between the two.
+ */
+static void benchmarkGrid() {
+    const int sphereCount = 200000;
+    const int rayCount = 200000;
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::mt19937 rng(2021);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    std::vector<SceneObject*> objects;
+    for(int i = 0; i < sphereCount; i++) {
+        Sphere* sphere = new Sphere();
+        sphere->position = glm::vec3(unit(rng), unit(rng), unit(rng)) * 50.0f;
+        sphere->radius = 0.2f + 0.1f * (unit(rng) + 1.0f);
+        objects.push_back(sphere);
+    }
+
+    std::vector<Ray> rays;
+    for(int i = 0; i < rayCount; i++) {
+        glm::vec3 origin(unit(rng) * 50.0f, unit(rng) * 50.0f, 60.0f);
+        glm::vec3 direction = glm::normalize(glm::vec3(unit(rng) * 0.5f, unit(rng) * 0.5f, -1.0f));
+        rays.emplace_back(origin, direction);
+    }
+
+    std::vector<float> hits[2];
+    const RenderOptions::Accelerator accelerators[] = {RenderOptions::bvh, RenderOptions::grid};
+    for(int a = 0; a < 2; a++) {
+        SceneIndex index;
+        Clock::time_point start = Clock::now();
+        index.build(objects, threads, accelerators[a]);
+        std::chrono::duration<double, std::milli> buildElapsed = Clock::now() - start;
+
+        start = Clock::now();
+        for(auto & ray : rays) {
+            Hit hit;
+            index.closestHit(ray, hit);
+            hits[a].push_back(hit.distance);
+        }
+        std::chrono::duration<double, std::nano> traceElapsed = Clock::now() - start;
+
+        std::cout << "grid: " << sphereCount << " spheres, " << (a == 0 ? "BVH" : "grid") << " build "
+                  << buildElapsed.count() << " ms, " << traceElapsed.count() / rayCount << " ns/ray";
+        if(index.isUsingGrid()) {
+            const GridStats &stats = index.getGrid().getStats();
+            std::cout << ", " << (double)stats.references / sphereCount << " cells per sphere, "
+                      << index.getGrid().getMemoryUsage() / (1024.0 * 1024.0) << " MB";
+        } else {
+            std::cout << ", " << index.getBVH().getMemoryUsage() / (1024.0 * 1024.0) << " MB";
+        }
+        std::cout << std::endl;
+    }
+
+    int mismatches = 0;
+    for(int i = 0; i < rayCount; i++) {
+        mismatches += hits[0][i] != hits[1][i];
+    }
+    std::cout << "grid: mismatches " << mismatches << std::endl;
+
+    for(auto & object : objects) {
+        delete object;
+    }
+}
+
+/**
+ * Writes a tessellated sphere to a chunk file, split on disk
+ * first as meshes larger than memory are, and traces camera
+ * rays through it tile by tile, as the renderer does, with the
+ * whole file in memory and with a fifth and a tenth of it. The
+ * hits must match the BVH over the triangles in memory.
+ */
+static void benchmarkStream() {
+    const int rings = 256;
+    const int segments = 512;
+    const int resolution = 512;
+    const int tileSize = 16;
+    const std::string path = "raytracer_bench.chunks";
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<glm::vec3> vertices = makeSphereVertices(rings, segments, 0.0f);
+    std::vector<unsigned int> indices(vertices.size());
+    std::vector<Triangle*> triangles;
+    for(size_t i = 0; i < vertices.size(); i++) {
+        indices[i] = (unsigned int)i;
+    }
+    for(size_t i = 0; i < vertices.size(); i += 3) {
+        triangles.push_back(makeTriangle(vertices[i], vertices[i + 1], vertices[i + 2]));
+    }
+
+    std::vector<Ray> rays;
+    glm::vec3 eye(0.0f, 0.0f, 12.0f);
+    for(int ty = 0; ty < resolution; ty += tileSize) {
+        for(int tx = 0; tx < resolution; tx += tileSize) {
+            for(int y = ty; y < ty + tileSize; y++) {
+                for(int x = tx; x < tx + tileSize; x++) {
+                    glm::vec3 target((x + 0.5f) / resolution * 10.0f - 5.0f, 5.0f - (y + 0.5f) / resolution * 10.0f, 0.0f);
+                    glm::vec3 direction = glm::normalize(target - eye);
+                    rays.emplace_back(eye, direction);
+                }
+            }
+        }
+    }
+
+    BVH bvh;
+    bvh.build(getBounds(triangles), threads);
+    std::vector<float> reference = traceBVH(bvh, triangles, rays);
+
+    Clock::time_point start = Clock::now();
+    {
+        ChunkedGeometry::Builder builder(path, 0, 0, threads, triangles.size() / 6);
+        for(auto & vertex : vertices) {
+            builder.addVertex(vertex);
+        }
+        for(size_t i = 0; i < indices.size(); i += 3) {
+            builder.addTriangle(&indices[i]);
+        }
+        builder.finish();
+    }
+    std::chrono::duration<double, std::milli> writeElapsed = Clock::now() - start;
+
+    ChunkedGeometry chunks;
+    if(!chunks.open(path, 0, 0)) {
+        std::cerr << "stream: could not open " << path << std::endl;
+        return;
+    }
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    size_t fileSize = (size_t)file.tellg();
+    std::cout << "stream: " << triangles.size() << " triangles in " << chunks.getChunkCount() << " chunks, "
+              << fileSize / 1048576.0 << " MB file written in " << writeElapsed.count() << " ms" << std::endl;
+
+    for(int divisor : {1, 5, 10}) {
+        GeometryCache cache(fileSize / divisor);
+        int mismatches = 0;
+        start = Clock::now();
+        for(size_t i = 0; i < rays.size(); i++) {
+            Ray &ray = rays[i];
+            float t = HUGE_VALF;
+            chunks.intersect(ray.origin, ray.inverseDirection, t, cache, [&](const MeshChunk &chunk, int index, float &closest) {
+                glm::vec3 intersection;
+                return ray.hasIndexedTriangleIntersection(chunk.positions.data(), &chunk.indices[index * 3],
+                                                          intersection, closest, true);
+            });
+            mismatches += t != reference[i];
+        }
+        std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+        CacheStats stats = cache.getStats();
+        std::cout << "stream: budget 1/" << divisor << " of the file, " << elapsed.count() / rays.size() << " ns/ray, "
+                  << stats.pageIns << " page-ins, " << stats.evictions << " evictions, peak "
+                  << stats.peakResidentBytes / 1048576.0 << " MB, mismatches " << mismatches << std::endl;
+    }
+
+    std::remove(path.c_str());
+    for(auto & triangle : triangles) {
+        delete triangle;
+    }
+}
+
+/**
+ * Phong shading as it was done before the shading kernel, one
+ * light at a time with std::pow and the view vector computed
+ * for every light
+ */
+static glm::vec3 referenceShade(const SceneObject* object, const std::vector<Light*> &lights, const glm::vec3 &eye,
+                                const glm::vec3 &point, const glm::vec3 &normal, const glm::vec3* directions,
+                                const char* visible) {
+    glm::vec3 lightContribution(0.0f);
+    for(size_t light = 0; light < lights.size(); light++) {
+        if(!visible[light]) {
+            continue;
+        }
+        const glm::vec3 &l = directions[light];
+        glm::vec3 r = (2.0f * glm::dot(l, normal) * normal) - l;
+        glm::vec3 v = (eye != point) ? glm::normalize(eye - point) : glm::vec3(0.0f);
+        float ln = fmax(0.0f, glm::dot(l, normal));
+        float rv = fmax(0.0f, glm::dot(r, v));
+        lightContribution += object->diffuse * lights[light]->diffuse * ln +
+                             object->specular * lights[light]->specular * pow(rv, object->shininess);
+    }
+    return glm::clamp(object->ambient + lightContribution, 0.0f, 1.0f);
+}
+
+/**
+ * Accuracy of fastPow against std::pow, and the cost per hit of
+ * shading with the old code, the scalar functions of the depth
+ * first path and the batch kernel of the wavefront path. The
+ * last two must agree exactly.
+ */
+static void benchmarkShade() {
+    const int hitCount = 1 << 16;
+    const int lightCount = 4;
+    const int repeats = 20;
+
+    const float exponents[] = {1.0f, 5.0f, 20.0f, 50.0f, 100.0f};
+    for(float y : exponents) {
+        double maxError = 0.0;
+        for(int i = 1; i <= 100000; i++) {
+            float x = i / 100000.0f;
+            double exact = std::pow((double)x, (double)y);
+            if(exact > 1e-30) {
+                maxError = std::max(maxError, std::fabs(fastPow(x, y) - exact) / exact);
+            }
+        }
+        std::cout << "shade: fastPow relative error at shininess " << y << ": " << maxError << std::endl;
+    }
+
+    std::mt19937 rng(2021);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> positive(0.0f, 1.0f);
+    auto randomDirection = [&]() {
+        glm::vec3 d;
+        do {
+            d = glm::vec3(unit(rng), unit(rng), unit(rng));
+        } while(glm::dot(d, d) < 0.01f || glm::dot(d, d) > 1.0f);
+        return glm::normalize(d);
+    };
+
+    std::vector<Light*> lights;
+    for(int i = 0; i < lightCount; i++) {
+        Light* light = new Light();
+        light->diffuse = glm::vec3(positive(rng), positive(rng), positive(rng));
+        light->specular = glm::vec3(positive(rng), positive(rng), positive(rng));
+        lights.push_back(light);
+    }
+    std::vector<Sphere*> materials;
+    for(int i = 0; i < 16; i++) {
+        Sphere* sphere = new Sphere();
+        sphere->ambient = glm::vec3(positive(rng), positive(rng), positive(rng)) * 0.2f;
+        sphere->diffuse = glm::vec3(positive(rng), positive(rng), positive(rng));
+        sphere->specular = glm::vec3(positive(rng), positive(rng), positive(rng));
+        sphere->shininess = 1.0f + positive(rng) * 99.0f;
+        materials.push_back(sphere);
+    }
+
+    glm::vec3 eye(0.0f, 0.0f, 10.0f);
+    std::vector<glm::vec3> points(hitCount), normals(hitCount), directions((size_t)hitCount * lightCount);
+    std::vector<char> visible((size_t)hitCount * lightCount);
+    std::vector<SceneObject*> objects(hitCount);
+    for(int i = 0; i < hitCount; i++) {
+        points[i] = glm::vec3(unit(rng), unit(rng), unit(rng)) * 5.0f;
+        normals[i] = randomDirection();
+        objects[i] = materials[rng() % materials.size()];
+        for(int light = 0; light < lightCount; light++) {
+            directions[(size_t)i * lightCount + light] = randomDirection();
+            visible[(size_t)i * lightCount + light] = positive(rng) < 0.75f;
+        }
+    }
+
+    std::vector<glm::vec3> colors[3];
+    for(auto & color : colors) {
+        color.resize(hitCount);
+    }
+    double elapsed[3];
+
+    Clock::time_point start = Clock::now();
+    for(int repeat = 0; repeat < repeats; repeat++) {
+        for(int i = 0; i < hitCount; i++) {
+            colors[0][i] = referenceShade(objects[i], lights, eye, points[i], normals[i],
+                                          &directions[(size_t)i * lightCount], &visible[(size_t)i * lightCount]);
+        }
+    }
+    elapsed[0] = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+    start = Clock::now();
+    for(int repeat = 0; repeat < repeats; repeat++) {
+        for(int i = 0; i < hitCount; i++) {
+            glm::vec3 view = getViewDirection(eye, points[i]);
+            float nv = glm::dot(normals[i], view);
+            glm::vec3 lightContribution(0.0f);
+            for(int light = 0; light < lightCount; light++) {
+                if(visible[(size_t)i * lightCount + light]) {
+                    lightContribution += getPhongContribution(objects[i]->getMaterial(), lights[light], normals[i], view, nv,
+                                                              directions[(size_t)i * lightCount + light]);
+                }
+            }
+            colors[1][i] = glm::clamp(objects[i]->ambient + lightContribution, 0.0f, 1.0f);
+        }
+    }
+    elapsed[1] = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+    //batches of one tile of hits at the default tile size
+    const int batchSize = 256;
+    ShadingBatch batch;
+    double kernelElapsed = 0.0;
+    start = Clock::now();
+    for(int repeat = 0; repeat < repeats; repeat++) {
+        for(int first = 0; first < hitCount; first += batchSize) {
+            batch.resize(batchSize, lightCount);
+            for(int i = 0; i < batchSize; i++) {
+                batch.setHit(i, normals[first + i], getViewDirection(eye, points[first + i]), objects[first + i]->getMaterial());
+                for(int light = 0; light < lightCount; light++) {
+                    size_t entry = (size_t)(first + i) * lightCount + light;
+                    batch.setLight(i, light, directions[entry], visible[entry] != 0 ? 1.0f : 0.0f);
+                }
+            }
+
+            Clock::time_point kernelStart = Clock::now();
+            shadeBatch(batch, lights);
+            kernelElapsed += std::chrono::duration<double, std::nano>(Clock::now() - kernelStart).count();
+
+            for(int i = 0; i < batchSize; i++) {
+                colors[2][first + i] = batch.getColor(i);
+            }
+        }
+    }
+    elapsed[2] = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+    const char* names[] = {"std::pow", "scalar", "batch"};
+    for(int k = 0; k < 3; k++) {
+        std::cout << "shade: " << names[k] << " " << elapsed[k] / ((double)hitCount * repeats) << " ns/hit ("
+                  << lightCount << " lights)" << std::endl;
+    }
+    std::cout << "shade: batch kernel alone " << kernelElapsed / ((double)hitCount * repeats) << " ns/hit" << std::endl;
+
+    int mismatches = 0;
+    float maxDifference = 0.0f;
+    for(int i = 0; i < hitCount; i++) {
+        mismatches += colors[1][i] != colors[2][i];
+        glm::vec3 difference = glm::abs(colors[0][i] - colors[2][i]);
+        maxDifference = std::max(maxDifference, std::max(difference.x, std::max(difference.y, difference.z)));
+    }
+    std::cout << "shade: scalar/batch mismatches " << mismatches << ", largest difference to std::pow "
+              << maxDifference * 255.0f << " of an 8 bit level" << std::endl;
+
+    for(auto & light : lights) {
+        delete light;
+    }
+    for(auto & material : materials) {
+        delete material;
+    }
+}
+
+/**
+ * Quantization of a frame to 8 bits, scalar and with SSE2,
+ * and PNG/PPM encoding on one thread and on all of them.
+ * The files go to the temporary directory and are removed.
+ */
+static void benchmarkEncode() {
+    const int width = 1920;
+    const int height = 1080;
+    const int repeats = 5;
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    //a smooth gradient with noise and some values out of range
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> noise(-0.05f, 0.05f);
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize((size_t)width * height * 3);
+    for(int j = 0; j < height; j++) {
+        for(int i = 0; i < width; i++) {
+            float* pixel = &image.pixels[((size_t)j * width + i) * 3];
+            pixel[0] = (float)i / width * 1.1f + noise(rng);
+            pixel[1] = (float)j / height + noise(rng);
+            pixel[2] = 0.5f + noise(rng) * 4.0f;
+        }
+    }
+
+    size_t count = image.pixels.size();
+    std::vector<unsigned char> scalar(count), simd(count);
+    Clock::time_point start = Clock::now();
+    for(int r = 0; r < repeats; r++) {
+        for(size_t i = 0; i < count; i++) {
+            float value = image.pixels[i];
+            scalar[i] = (unsigned char)(255.0f * (value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f));
+        }
+    }
+    std::chrono::duration<double, std::milli> scalarElapsed = Clock::now() - start;
+
+    start = Clock::now();
+    for(int r = 0; r < repeats; r++) {
+        ImageWriter::quantize(image, 0, height, simd.data());
+    }
+    std::chrono::duration<double, std::milli> simdElapsed = Clock::now() - start;
+
+    int mismatches = 0;
+    for(size_t i = 0; i < count; i++) {
+        mismatches += scalar[i] != simd[i];
+    }
+    std::cout << "encode: quantize " << width << "x" << height << " scalar " << scalarElapsed.count() / repeats
+              << " ms, sse2 " << simdElapsed.count() / repeats << " ms, mismatches " << mismatches << std::endl;
+
+    const char* names[] = {"ppm", "png", "pfm", "exr"};
+    std::string directory = std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp";
+    for(auto & name : names) {
+        std::string filename = directory + "/raytracer_bench." + name;
+        std::cout << "encode: " << name;
+        for(unsigned int t : {1u, threads}) {
+            start = Clock::now();
+            ImageWriter::write(filename, image, t);
+            std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+            std::cout << ", " << t << " thread" << (t == 1 ? "" : "s") << " " << elapsed.count() << " ms";
+        }
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        std::cout << ", " << file.tellg() / 1024 << " KB" << std::endl;
+        std::remove(filename.c_str());
+    }
+}
+
+/**
+ * Scene file parsing: the per line boost::tokenizer and
+ * std::stof the loader used to do, against the parser over
+ * the mapped file. Both read the same generated file of
+ * spheres and must give the same floats.
+ */
+static void benchmarkParse() {
+    const int sphereCount = 200000;
+
+    std::mt19937 rng(43);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::string filename = std::string(std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp") + "/raytracer_bench.txt";
+    {
+        std::ofstream file(filename);
+        file << sphereCount << "\n";
+        for(int i = 0; i < sphereCount; i++) {
+            file << "sphere\npos: " << unit(rng) * 100.0f << " " << unit(rng) * 100.0f << " " << unit(rng) * 100.0f
+                 << "\nrad: " << 0.5f + unit(rng) * 0.25f << "\namb: 0.1 0.1 0.1\ndif: " << (unit(rng) + 1.0f) / 2.0f
+                 << " 0.5 0.25\nspe: 0.8 0.8 0.8\nshi: 20\n";
+        }
+    }
+    std::ifstream size(filename, std::ios::binary | std::ios::ate);
+    double megabytes = size.tellg() / (1024.0 * 1024.0);
+
+    std::vector<float> values[2];
+    Clock::time_point start = Clock::now();
+    {
+        std::ifstream input(filename);
+        std::string line;
+        getline(input, line);
+        while(getline(input, line)) {
+            boost::char_separator<char> sep(" ");
+            boost::tokenizer< boost::char_separator<char> > tok(line, sep);
+            std::vector<std::string> parts(tok.begin(), tok.end());
+            for(size_t i = 1; i < parts.size(); i++) {
+                values[0].push_back(std::stof(parts[i]));
+            }
+        }
+    }
+    std::chrono::duration<double, std::milli> tokenizerElapsed = Clock::now() - start;
+
+    start = Clock::now();
+    {
+        SceneParser parser(filename);
+        parser.next();
+        while(parser.next()) {
+            for(int i = 1; i < parser.getWordCount(); i++) {
+                values[1].push_back(parser.getFloat(i));
+            }
+        }
+    }
+    std::chrono::duration<double, std::milli> parserElapsed = Clock::now() - start;
+    std::remove(filename.c_str());
+
+    int mismatches = values[0].size() != values[1].size();
+    for(size_t i = 0; i < std::min(values[0].size(), values[1].size()); i++) {
+        mismatches += values[0][i] != values[1][i];
+    }
+    std::cout << "parse: " << megabytes << " MB, tokenizer " << tokenizerElapsed.count() << " ms ("
+              << megabytes / tokenizerElapsed.count() * 1000.0 << " MB/s), parser " << parserElapsed.count()
+              << " ms (" << megabytes / parserElapsed.count() * 1000.0 << " MB/s), mismatches " << mismatches
+              << std::endl;
+}
+
+/**
+ * Round trip of random unit vectors through the octahedral
+ * encoding of vertex normals: the worst angle between a normal
+ * and its decoded value, and the time to decode one
+ */
+static void benchmarkNormals() {
+    const int count = 1 << 20;
+
+    std::mt19937 rng(44);
+    std::normal_distribution<float> gaussian;
+    std::vector<glm::vec3> normals(count);
+    for(auto & normal : normals) {
+        normal = glm::normalize(glm::vec3(gaussian(rng), gaussian(rng), gaussian(rng)));
+    }
+
+    std::vector<uint32_t> encoded(count);
+    for(int i = 0; i < count; i++) {
+        encoded[i] = encodeOctahedral(normals[i]);
+    }
+
+    Clock::time_point start = Clock::now();
+    glm::vec3 sum(0.0f);
+    for(int i = 0; i < count; i++) {
+        sum += decodeOctahedral(encoded[i]);
+    }
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+    double worst = 0.0;
+    for(int i = 0; i < count; i++) {
+        //the angle from the cross product, which unlike
+        //the dot product is accurate for tiny angles
+        glm::vec3 decoded = decodeOctahedral(encoded[i]);
+        double x = (double)normals[i].y * decoded.z - (double)normals[i].z * decoded.y;
+        double y = (double)normals[i].z * decoded.x - (double)normals[i].x * decoded.z;
+        double z = (double)normals[i].x * decoded.y - (double)normals[i].y * decoded.x;
+        worst = std::max(worst, std::asin(std::min(1.0, std::sqrt(x * x + y * y + z * z))));
+    }
+    std::cout << "normals: " << count << " normals, " << elapsed.count() / count << " ns per decode, worst error "
+              << worst << " radians, " << sizeof(uint32_t) << " bytes instead of " << sizeof(glm::vec3)
+              << " (checksum " << sum.x + sum.y + sum.z << ")" << std::endl;
+}
+
+/**
+ * A synthetic frame whose noise free image is known: a checkered
+ * wall, a floor and a sphere, crossed by a soft shadow whose
+ * penumbra every sample estimates from 4 shadow rays, as area
+ * lights do. The error of the frame before and after denoising,
+ * in 8 bit levels, with 1 sample per pixel, where the noise is
+ * taken from the neighbors, and with 4, where it comes from the
+ * variance of the samples, and the time to denoise it.
+ */
+static void benchmarkDenoise() {
+    const int width = 1024;
+    const int height = 768;
+    const int lightSamples = 4;
+    const int repeats = 3;
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t count = (size_t)width * height;
+
+    glm::vec3 light = glm::normalize(glm::vec3(0.3f, 0.8f, 0.5f));
+    float radius = height * 0.25f;
+    std::vector<PixelFeatures> features(count);
+    std::vector<float> shading(count);
+    std::vector<float> visibility(count);
+    std::vector<glm::vec3> truth(count);
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            size_t p = (size_t)y * width + x;
+            PixelFeatures &surface = features[p];
+            float cx = x - width * 0.5f;
+            float cy = y - height * 0.45f;
+            if(cx * cx + cy * cy < radius * radius) {
+                float z = std::sqrt(1.0f - (cx * cx + cy * cy) / (radius * radius));
+                surface.normal = glm::vec3(cx / radius, -cy / radius, z);
+                surface.depth = 6.0f - 2.0f * z;
+                surface.albedo = glm::vec3(0.9f, 0.8f, 0.2f);
+            } else if(y < height / 2) {
+                surface.normal = glm::vec3(0.0f, 0.0f, 1.0f);
+                surface.depth = 10.0f;
+                surface.albedo = (x / 32 + y / 32) % 2 == 0 ? glm::vec3(0.8f, 0.3f, 0.3f) : glm::vec3(0.3f, 0.3f, 0.8f);
+            } else {
+                surface.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+                surface.depth = 4.0f + 6.0f * (height - y) / (height * 0.5f);
+                surface.albedo = glm::vec3(0.7f);
+            }
+            shading[p] = std::max(0.0f, glm::dot(surface.normal, light));
+            visibility[p] = std::min(1.0f, std::max(0.0f, (x + 0.5f * y - 0.6f * width) / (0.15f * width) + 0.5f));
+            truth[p] = surface.albedo * (0.1f + 0.9f * shading[p] * visibility[p]);
+        }
+    }
+
+    auto getError = [&](const std::vector<Pixel> &pixels) {
+        double sum = 0.0;
+        for(size_t p = 0; p < count; p++) {
+            glm::vec3 difference = (pixels[p].color - truth[p]) * 255.0f;
+            sum += glm::dot(difference, difference);
+        }
+        return std::sqrt(sum / (count * 3));
+    };
+
+    for(int samplesPerPixel : {1, 4}) {
+        std::mt19937 rng(45);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        std::vector<Pixel> noisy(count);
+        for(size_t p = 0; p < count; p++) {
+            PixelSamples samples;
+            for(int s = 0; s < samplesPerPixel; s++) {
+                int visible = 0;
+                for(int l = 0; l < lightSamples; l++) {
+                    visible += uniform(rng) < visibility[p];
+                }
+                float lit = 0.1f + 0.9f * shading[p] * visible / lightSamples;
+                samples.add(features[p].albedo * lit, features[p]);
+            }
+            samples.store(noisy[p]);
+        }
+
+        std::vector<Pixel> denoised;
+        std::vector<Pixel*> rows(height);
+        std::chrono::duration<double, std::milli> elapsed(0.0);
+        for(int r = 0; r < repeats; r++) {
+            denoised = noisy;
+            for(int y = 0; y < height; y++) {
+                rows[y] = &denoised[(size_t)y * width];
+            }
+            Clock::time_point start = Clock::now();
+            Denoiser::denoise(rows.data(), width, height, samplesPerPixel, threads);
+            elapsed += Clock::now() - start;
+        }
+
+        std::cout << "denoise: " << width << "x" << height << ", " << samplesPerPixel << " spp, RMSE "
+                  << getError(noisy) << " -> " << getError(denoised) << ", "
+                  << elapsed.count() / repeats / (count / 1e6) << " ms per megapixel on " << threads
+                  << " threads" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string kernel = argc > 1 ? argv[1] : "all";
+
+    bool known = false;
+    if(kernel == "triangle" || kernel == "all") {
+        benchmarkTriangle();
+        known = true;
+    }
+    if(kernel == "offset" || kernel == "all") {
+        benchmarkOffset();
+        known = true;
+    }
+    if(kernel == "bvh" || kernel == "all") {
+        benchmarkBVH();
+        known = true;
+    }
+    if(kernel == "refit" || kernel == "all") {
+        benchmarkRefit();
+        known = true;
+    }
+    if(kernel == "compact" || kernel == "all") {
+        benchmarkCompact();
+        known = true;
+    }
+    if(kernel == "index" || kernel == "all") {
+        benchmarkIndex();
+        known = true;
+    }
+    if(kernel == "grid" || kernel == "all") {
+        benchmarkGrid();
+        known = true;
+    }
+    if(kernel == "stream" || kernel == "all") {
+        benchmarkStream();
+        known = true;
+    }
+    if(kernel == "shade" || kernel == "all") {
+        benchmarkShade();
+        known = true;
+    }
+    if(kernel == "encode" || kernel == "all") {
+        benchmarkEncode();
+        known = true;
+    }
+    if(kernel == "parse" || kernel == "all") {
+        benchmarkParse();
+        known = true;
+    }
+    if(kernel == "normals" || kernel == "all") {
+        benchmarkNormals();
+        known = true;
+    }
+    if(kernel == "denoise" || kernel == "all") {
+        benchmarkDenoise();
+        known = true;
+    }
+
+    if(!known) {
+        std::cerr << "Usage: raytracer_bench [triangle|offset|bvh|refit|compact|index|grid|stream|shade|encode|parse|normals|denoise|all]" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_AABB_H
+#define RAYTRACER_AABB_H
+
+#include <glm/glm.hpp>
+#include <cmath>
+
+/**
+ * Axis aligned bounding box. A default constructed
+ * box is empty and grows as points are added to it.
+ */
+struct AABB {
+    glm::vec3 min{HUGE_VALF};
+    glm::vec3 max{-HUGE_VALF};
+
+    inline void expand(const glm::vec3 &point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    };
+
+    inline void expand(const AABB &other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    };
+
+    inline bool isEmpty() const {return min.x > max.x;};
+
+    inline glm::vec3 getCenter() const {return (min + max) * 0.5f;};
+
+    inline glm::vec3 getExtent() const {return max - min;};
+
+    /**
+     * Half the surface area, which is all the
+     * surface area heuristic needs
+     */
+    inline float getHalfArea() const {
+        glm::vec3 e = max - min;
+        return isEmpty() ? 0.0f : e.x * e.y + e.y * e.z + e.z * e.x;
+    };
+
+    /**
+     * Slab test. Returns true if the ray enters the box
+     * before maxDistance, and the entry distance in tNear
+     */
+    inline bool intersects(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance, float &tNear) const {
+        glm::vec3 t0 = (min - origin) * inverseDirection;
+        glm::vec3 t1 = (max - origin) * inverseDirection;
+        glm::vec3 tSmall = glm::min(t0, t1);
+        glm::vec3 tBig = glm::max(t0, t1);
+        tNear = std::fmax(std::fmax(tSmall.x, tSmall.y), std::fmax(tSmall.z, 0.0f));
+        float tFar = std::fmin(std::fmin(tBig.x, tBig.y), std::fmin(tBig.z, maxDistance));
+        return tNear <= tFar;
+    };
+};
+
+#endif //RAYTRACER_AABB_H
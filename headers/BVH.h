@@ -0,0 +1,272 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_BVH_H
+#define RAYTRACER_BVH_H
+
+#include <vector>
+#include <atomic>
+#include <utility>
+#include <glm/glm.hpp>
+#include "AABB.h"
+
+/**
+ * A node of the hierarchy. Inner nodes have a count of 0
+ * and leftFirst is the index of their left child, with the
+ * right child right after it. Leaves store count primitives
+ * starting at leftFirst in the primitive order of the BVH.
+ */
+struct BVHNode {
+    AABB bounds;
+    int leftFirst;
+    int count;
+
+    inline bool isLeaf() const {return count > 0;};
+};
+
+/**
+ * Build time and quality metrics of a hierarchy
+ */
+struct BVHStats {
+    double buildSeconds = 0.0;
+    double refitSeconds = 0.0;
+    float sahCost = 0.0f;
+
+    /**
+     * SAH cost of the tree right after its last full build.
+     * Refitting keeps the topology, so the cost grows as the
+     * primitives move away from where they were built.
+     */
+    float builtSahCost = 0.0f;
+    int nodeCount = 0;
+    int leafCount = 0;
+    int maxDepth = 0;
+
+    /**
+     * Number of leaves with 1, 2, ... 8 primitives,
+     * and with more than 8 in the last entry
+     */
+    std::vector<int> leafSizes = std::vector<int>(9, 0);
+};
+
+/**
+ * Bounding volume hierarchy built with the binned surface area
+ * heuristic. Large nodes are split in parallel: their bins are
+ * filled by several threads, and their subtrees are handed to
+ * separate tasks while there are threads left to take them.
+ */
+class BVH {
+private:
+    std::vector<BVHNode> nodes;
+    std::vector<int> order;
+    std::vector<glm::vec3> centroids;
+    const std::vector<AABB>* primitiveBounds = nullptr;
+    std::atomic<int> nodeCount{0};
+    std::atomic<int> freeThreads{0};
+    unsigned int threads = 1;
+    BVHStats stats;
+
+public:
+    const static int BIN_COUNT = 16;
+    const static int MAX_LEAF_SIZE = 8;
+    constexpr static float TRAVERSAL_COST = 1.0f;
+    constexpr static float INTERSECTION_COST = 1.0f;
+
+    /**
+     * Nodes with fewer primitives than this are built
+     * by the thread that created them
+     */
+    const static int PARALLEL_THRESHOLD = 4096;
+
+    /**
+     * Deeper nodes are always leaves, which bounds the
+     * size of the traversal stack
+     */
+    const static int MAX_DEPTH = 60;
+
+    /**
+     * Ratio of the refitted to the built SAH cost past
+     * which a full rebuild is worth its time
+     */
+    constexpr static float DEFAULT_REBUILD_THRESHOLD = 1.5f;
+
+private:
+    void subdivide(int nodeIndex, int first, int count, int depth);
+
+    /**
+     * Finds the best split plane of a node. Returns false
+     * if keeping the node as a leaf is cheaper.
+     */
+    bool findSplit(const BVHNode &node, int &axis, float &splitPosition, const AABB &centroidBounds);
+
+    /**
+     * Recomputes the bounds of a subtree from its leaves up
+     */
+    void refitSubtree(int nodeIndex);
+
+    void collectStats();
+
+public:
+    BVH() = default;
+
+    BVH(const BVH& other) = delete;
+
+    BVH& operator=(const BVH& other) = delete;
+
+    /**
+     * Builds the hierarchy over the given primitive bounds
+     * using up to the given number of threads
+     */
+    void build(const std::vector<AABB> &bounds, unsigned int threads);
+
+    /**
+     * Updates the bounds of every node for primitives that moved,
+     * keeping the topology of the tree. The bounds are given in
+     * the order of the leaves, see getOrder. Disjoint subtrees are
+     * refitted in parallel, then the nodes above them. Returns the
+     * degradation of the tree, its SAH cost relative to the one it
+     * had when it was built.
+     */
+    float refit(const std::vector<AABB> &bounds, unsigned int threads);
+
+    inline float getDegradation() const {
+        return stats.builtSahCost > 0.0f ? stats.sahCost / stats.builtSahCost : 1.0f;
+    };
+
+    /**
+     * Order in which the primitives are referenced by the
+     * leaves. Callers can permute their primitives into this
+     * order so that leaves index them directly.
+     */
+    inline const std::vector<int>& getOrder() const {return order;};
+
+    inline const std::vector<BVHNode>& getNodes() const {return nodes;};
+
+    inline const BVHStats& getStats() const {return stats;};
+
+    inline bool isEmpty() const {return nodes.empty();};
+
+    /**
+     * Frees the nodes but keeps the stats of the last build
+     */
+    inline void clear() {
+        nodes.clear();
+        nodes.shrink_to_fit();
+        order.clear();
+        order.shrink_to_fit();
+    };
+
+    /**
+     * Takes over nodes built earlier, e.g. read back from
+     * a file, over primitives already in the order of the
+     * leaves. The stats are left as they are.
+     */
+    inline void load(std::vector<BVHNode> &&builtNodes) {
+        nodes = std::move(builtNodes);
+        order.clear();
+        order.shrink_to_fit();
+    };
+
+    inline size_t getMemoryUsage() const {
+        return nodes.capacity() * sizeof(BVHNode) + order.capacity() * sizeof(int);
+    };
+
+    /**
+     * Closest hit traversal. The near child is visited first
+     * and nodes further than the closest hit so far are skipped.
+     * intersectPrimitive(index, closest) must return true and
+     * lower closest when it finds a closer hit.
+     */
+    template<typename Intersect>
+    bool intersect(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float &closest, Intersect intersectPrimitive) const {
+        if(nodes.empty()) {
+            return false;
+        }
+
+        int stack[64];
+        int top = 0;
+        bool hit = false;
+        float tNear;
+
+        if(!nodes[0].bounds.intersects(origin, inverseDirection, closest, tNear)) {
+            return false;
+        }
+        stack[top++] = 0;
+
+        while(top > 0) {
+            const BVHNode &node = nodes[stack[--top]];
+
+            if(node.isLeaf()) {
+                for(int i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+                    hit |= intersectPrimitive(i, closest);
+                }
+                continue;
+            }
+
+            float tLeft, tRight;
+            bool hitLeft = nodes[node.leftFirst].bounds.intersects(origin, inverseDirection, closest, tLeft);
+            bool hitRight = nodes[node.leftFirst + 1].bounds.intersects(origin, inverseDirection, closest, tRight);
+
+            //the near child is pushed last so it is popped first
+            if(hitLeft && hitRight) {
+                if(tLeft < tRight) {
+                    stack[top++] = node.leftFirst + 1;
+                    stack[top++] = node.leftFirst;
+                } else {
+                    stack[top++] = node.leftFirst;
+                    stack[top++] = node.leftFirst + 1;
+                }
+            } else if(hitLeft) {
+                stack[top++] = node.leftFirst;
+            } else if(hitRight) {
+                stack[top++] = node.leftFirst + 1;
+            }
+        }
+
+        return hit;
+    };
+
+    /**
+     * Any hit traversal for shadow rays. Stops at the first
+     * primitive for which isBlocking(index) returns true, in
+     * no particular order.
+     */
+    template<typename Blocking>
+    bool occluded(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance, Blocking isBlocking) const {
+        if(nodes.empty()) {
+            return false;
+        }
+
+        int stack[64];
+        int top = 0;
+        float tNear;
+        stack[top++] = 0;
+
+        while(top > 0) {
+            const BVHNode &node = nodes[stack[--top]];
+            if(!node.bounds.intersects(origin, inverseDirection, maxDistance, tNear)) {
+                continue;
+            }
+
+            if(node.isLeaf()) {
+                for(int i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+                    if(isBlocking(i)) {
+                        return true;
+                    }
+                }
+            } else {
+                stack[top++] = node.leftFirst;
+                stack[top++] = node.leftFirst + 1;
+            }
+        }
+
+        return false;
+    };
+};
+
+#endif //RAYTRACER_BVH_H
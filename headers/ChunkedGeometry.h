@@ -0,0 +1,295 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_CHUNKEDGEOMETRY_H
+#define RAYTRACER_CHUNKEDGEOMETRY_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <memory>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "AABB.h"
+#include "BVH.h"
+#include "GeometryCache.h"
+
+/**
+ * A spatially compact part of an out-of-core mesh as it is
+ * held in memory: its own vertices, three local indices per
+ * triangle in the order of the leaves of its BVH, and the BVH.
+ */
+struct MeshChunk {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    BVH bvh;
+
+    inline size_t getMemoryUsage() const {
+        return positions.capacity() * sizeof(glm::vec3) + indices.capacity() * sizeof(unsigned int) +
+               bvh.getMemoryUsage();
+    };
+};
+
+/**
+ * Triangles of a mesh partitioned into chunks in a file, so
+ * that only the chunks rays actually reach have to be in
+ * memory. The chunks are subtrees of a BVH over the whole
+ * mesh, each one built with its own BVH and stored with it.
+ * What stays in memory is the table of the chunks and a BVH
+ * over their bounds. Chunks are read through a GeometryCache.
+ *
+ * The file starts with a header, followed by the positions,
+ * indices and BVH nodes of every chunk and then the table.
+ * The header records the size and modification time of the
+ * .obj file, so that a file that is out of date is written
+ * again.
+ */
+class ChunkedGeometry {
+private:
+    struct ChunkRecord {
+        float min[3];
+        float max[3];
+        uint64_t offset;
+        uint32_t vertexCount;
+        uint32_t triangleCount;
+        uint32_t nodeCount;
+        uint32_t reserved;
+    };
+
+    std::string path;
+    int file = -1;
+    std::vector<ChunkRecord> chunks;
+    std::vector<AABB> chunkBounds;
+    size_t triangleCount = 0;
+    AABB bounds;
+    BVH bvh;
+
+    /**
+     * Cuts the triangles into chunks and appends them to the
+     * output, adding their records to the table
+     */
+    static void writeChunks(std::ofstream &output, const std::vector<glm::vec3> &positions,
+                            const std::vector<unsigned int> &indices, unsigned int threads,
+                            std::vector<ChunkRecord> &records);
+
+public:
+    /**
+     * Triangles per chunk, at most. Chunks are whole subtrees
+     * of the mesh BVH, so they follow its splits rather than
+     * all holding the same number of triangles.
+     */
+    const static int CHUNK_TRIANGLES = 4096;
+
+    /**
+     * Triangles cut into chunks in memory at once, at most.
+     * Meshes with more are first split on disk, so writing
+     * one takes about as much memory whatever its size.
+     */
+    const static size_t PARTITION_TRIANGLES = 1 << 20;
+
+    const static uint32_t VERSION = 2;
+
+    /**
+     * One number for a triangle of the mesh, from its chunk
+     * and its index in that chunk. 64 bits wide, since meshes
+     * kept out of core can have more triangles than an int.
+     */
+    static inline int64_t getPrimitive(int chunk, int index) {
+        return (int64_t)chunk * CHUNK_TRIANGLES + index;
+    };
+
+    static inline int getChunkOf(int64_t primitive) {return (int)(primitive / CHUNK_TRIANGLES);};
+
+    static inline int getIndexInChunk(int64_t primitive) {return (int)(primitive % CHUNK_TRIANGLES);};
+
+    ChunkedGeometry() = default;
+
+    ~ChunkedGeometry();
+
+    ChunkedGeometry(const ChunkedGeometry& other) = delete;
+
+    ChunkedGeometry& operator=(const ChunkedGeometry& other) = delete;
+
+    /**
+     * Writes the chunk file of a mesh given one vertex and one
+     * triangle at a time, as its .obj file is read, so that
+     * meshes larger than memory can be converted. Until finish,
+     * the vertices and triangles are kept in temporary files
+     * next to the path, which are removed with the builder.
+     */
+    class Builder {
+    public:
+        /**
+         * The source size and time identify the .obj file the
+         * triangles come from. Throws std::runtime_error if the
+         * temporary files cannot be created.
+         */
+        Builder(const std::string &path, uint64_t sourceSize, int64_t sourceTime, unsigned int threads,
+                size_t partitionTriangles = PARTITION_TRIANGLES);
+        ~Builder();
+
+        Builder(const Builder &) = delete;
+        Builder& operator=(const Builder &) = delete;
+
+        void addVertex(const glm::vec3 &position);
+
+        /**
+         * Three indices into the vertices added, which
+         * may be added before or after the triangle
+         */
+        void addTriangle(const unsigned int* triangle);
+
+        /**
+         * Partitions the triangles into chunks and writes them to
+         * the path. Throws std::invalid_argument if a triangle
+         * refers to a vertex that was not added, and
+         * std::runtime_error if the files cannot be written.
+         */
+        void finish();
+
+    private:
+        std::string path;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        unsigned int threads;
+        size_t partitionTriangles;
+        std::string positionsPath;
+        std::string trianglesPath;
+        std::string sortedPath;
+        std::ofstream positions;
+        std::ofstream triangles;
+        uint64_t vertexCount = 0;
+        uint64_t triangleCount = 0;
+        unsigned int maxVertex = 0;
+
+        //while finishing
+        const glm::vec3* vertices = nullptr;
+        std::ofstream* output = nullptr;
+        std::vector<ChunkRecord> records;
+
+        void partition(int from, int to, uint64_t first, uint64_t count, const AABB &centroidBounds);
+
+        void writeBucket(int file, uint64_t first, uint64_t count);
+    };
+
+    /**
+     * Opens a file written by a Builder and reads its table. Returns
+     * false if the file is missing, of another version, was
+     * written for a different source, or has a chunk of more
+     * than CHUNK_TRIANGLES triangles.
+     */
+    bool open(const std::string &path, uint64_t sourceSize, int64_t sourceTime);
+
+    /**
+     * Reads a chunk from the file. Called by GeometryCache
+     * from any thread.
+     */
+    MeshChunk* read(int chunk) const;
+
+    inline size_t getChunkCount() const {return chunks.size();};
+
+    inline size_t getTriangleCount() const {return triangleCount;};
+
+    inline const AABB& getBounds() const {return bounds;};
+
+    inline const std::string& getPath() const {return path;};
+
+    /**
+     * Bytes held in memory for the table and the
+     * BVH over the chunks
+     */
+    inline size_t getMemoryUsage() const {
+        return chunks.capacity() * sizeof(ChunkRecord) + chunkBounds.capacity() * sizeof(AABB) +
+               bvh.getMemoryUsage();
+    };
+
+    /**
+     * Closest hit traversal over the chunks and then over the
+     * triangles of each chunk reached, with the contract of
+     * BVH::intersect. intersectTriangle(chunk, index, closest)
+     * gets the chunk and the index of a triangle in it. Paging
+     * in a chunk costs far more than testing its bounds, so the
+     * chunks of a leaf are visited nearest first, like the
+     * nodes, and those beyond the closest hit are never read.
+     */
+    template<typename Intersect>
+    bool intersect(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float &closest,
+                   GeometryCache &cache, Intersect intersectTriangle) const {
+        const std::vector<BVHNode> &nodes = bvh.getNodes();
+        if(nodes.empty()) {
+            return false;
+        }
+
+        int stack[64];
+        int top = 0;
+        bool hit = false;
+        float tNear;
+
+        if(!nodes[0].bounds.intersects(origin, inverseDirection, closest, tNear)) {
+            return false;
+        }
+        stack[top++] = 0;
+
+        while(top > 0) {
+            const BVHNode &node = nodes[stack[--top]];
+
+            if(node.isLeaf()) {
+                //only leaves at the depth limit can hold more
+                //chunks than that, and they are sorted in batches
+                for(int first = node.leftFirst; first < node.leftFirst + node.count; first += BVH::MAX_LEAF_SIZE) {
+                    std::pair<float, int> reached[BVH::MAX_LEAF_SIZE];
+                    int count = 0;
+                    int last = std::min(first + BVH::MAX_LEAF_SIZE, node.leftFirst + node.count);
+                    //insertion sort, as there are only a few of them
+                    for(int i = first; i < last; i++) {
+                        if(chunkBounds[i].intersects(origin, inverseDirection, closest, tNear)) {
+                            int slot = count++;
+                            for(; slot > 0 && reached[slot - 1].first > tNear; slot--) {
+                                reached[slot] = reached[slot - 1];
+                            }
+                            reached[slot] = std::make_pair(tNear, i);
+                        }
+                    }
+
+                    for(int i = 0; i < count && reached[i].first <= closest; i++) {
+                        std::shared_ptr<const MeshChunk> chunk = cache.acquire(*this, reached[i].second);
+                        hit |= chunk->bvh.intersect(origin, inverseDirection, closest, [&](int triangle, float &t) {
+                            return intersectTriangle(*chunk, triangle, t);
+                        });
+                    }
+                }
+                continue;
+            }
+
+            float tLeft, tRight;
+            bool hitLeft = nodes[node.leftFirst].bounds.intersects(origin, inverseDirection, closest, tLeft);
+            bool hitRight = nodes[node.leftFirst + 1].bounds.intersects(origin, inverseDirection, closest, tRight);
+
+            //the near child is pushed last so it is popped first
+            if(hitLeft && hitRight) {
+                if(tLeft < tRight) {
+                    stack[top++] = node.leftFirst + 1;
+                    stack[top++] = node.leftFirst;
+                } else {
+                    stack[top++] = node.leftFirst;
+                    stack[top++] = node.leftFirst + 1;
+                }
+            } else if(hitLeft) {
+                stack[top++] = node.leftFirst;
+            } else if(hitRight) {
+                stack[top++] = node.leftFirst + 1;
+            }
+        }
+
+        return hit;
+    };
+};
+
+#endif //RAYTRACER_CHUNKEDGEOMETRY_H
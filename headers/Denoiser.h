@@ -0,0 +1,53 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_DENOISER_H
+#define RAYTRACER_DENOISER_H
+
+#include "Pixel.h"
+
+/**
+ * Edge-avoiding à-trous wavelet filter, after Dammertz et al.,
+ * Edge-Avoiding À-Trous Wavelet Transform for Fast Global
+ * Illumination Filtering, HPG (2010), with the luminance weight
+ * scaled by the variance of the pixels as in Schied et al.,
+ * Spatiotemporal Variance-Guided Filtering, HPG (2017).
+ *
+ * Each pass blurs with a 5x5 B3 spline kernel whose taps are
+ * twice as far apart as in the pass before, so five passes
+ * reach 64 pixels wide in 125 taps per pixel. Taps are weighted
+ * down where the normal, depth or albedo of the surface differ,
+ * so edges and textures stay sharp, and where the luminance
+ * differs by more than the noise the pixel is expected to have.
+ * Pixels without noise are left as they are.
+ */
+class Denoiser {
+public:
+    /**
+     * Side in pixels of the tiles each pass is cut into
+     * and handed out to the threads
+     */
+    const static int TILE_SIZE = 32;
+
+    const static int PASSES = 5;
+
+    /**
+     * Renders with fewer samples than this get the variance
+     * of their pixels from their neighbors instead, since a
+     * handful of samples says little about it
+     */
+    const static int MIN_VARIANCE_SAMPLES = 4;
+
+    /**
+     * Filters the colors on screen in place, guided by the
+     * features and variance recorded with them
+     */
+    static void denoise(Pixel** screen, int width, int height, int samplesPerPixel, unsigned int threads);
+};
+
+#endif //RAYTRACER_DENOISER_H
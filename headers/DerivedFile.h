@@ -0,0 +1,96 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_DERIVEDFILE_H
+#define RAYTRACER_DERIVEDFILE_H
+
+#include <string>
+#include <fstream>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Start of the header of every derived file: what kind of file
+ * it is, the version of its format, one number of its layout
+ * that must match the reader, such as the size of its records,
+ * and the size and modification time of its source
+ */
+struct DerivedFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+};
+
+/**
+ * Files written next to a source file from what it holds, in a
+ * layout that can be read piece by piece, such as the chunks
+ * of meshes and the tiles of textures. They are written once
+ * and reused for as long as the source keeps its size and
+ * modification time. Each format starts its own header with
+ * a DerivedFileHeader.
+ */
+class DerivedFile {
+public:
+    /**
+     * Writes to a temporary file that is renamed to the path
+     * only once complete, so that an interrupted conversion
+     * never leaves a truncated file behind. The temporary file
+     * is removed if the writer is destroyed before commit.
+     */
+    class Writer {
+    public:
+        /**
+         * Throws std::runtime_error if the file cannot be created
+         */
+        explicit Writer(const std::string &path);
+        ~Writer();
+
+        Writer(const Writer &) = delete;
+        Writer& operator=(const Writer &) = delete;
+
+        inline std::ofstream& getStream() {return output;};
+
+        /**
+         * Closes the file and moves it into place. Throws
+         * std::runtime_error if anything failed to write.
+         */
+        void commit();
+
+    private:
+        std::string path;
+        std::string temporary;
+        std::ofstream output;
+        bool committed = false;
+    };
+
+    static DerivedFileHeader makeHeader(const char* magic, uint32_t version, uint32_t layout,
+                                        uint64_t sourceSize, int64_t sourceTime);
+
+    /**
+     * Opens a derived file and reads the first headerSize bytes
+     * into header, which starts with a DerivedFileHeader. Returns
+     * the file descriptor, or -1 if the file is missing or is not
+     * what expected describes, e.g. written for another source.
+     */
+    static int open(const std::string &path, void* header, size_t headerSize, const DerivedFileHeader &expected);
+
+    /**
+     * pread until all the bytes are in, since it may
+     * return fewer than asked for
+     */
+    static bool readAt(int file, void* buffer, size_t size, uint64_t offset);
+
+    /**
+     * pwrite until all the bytes are out, likewise
+     */
+    static bool writeAt(int file, const void* buffer, size_t size, uint64_t offset);
+};
+
+#endif //RAYTRACER_DERIVEDFILE_H
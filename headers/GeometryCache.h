@@ -0,0 +1,32 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_GEOMETRYCACHE_H
+#define RAYTRACER_GEOMETRYCACHE_H
+
+#include "LRUCache.h"
+
+class ChunkedGeometry;
+struct MeshChunk;
+
+/**
+ * Chunks of out-of-core meshes that are currently in memory,
+ * shared by all the meshes of a scene. Rays hold on to the
+ * chunks they are tracing.
+ */
+class GeometryCache : public LRUCache<ChunkedGeometry, MeshChunk> {
+public:
+    /**
+     * Budget in bytes for the chunks kept in memory
+     */
+    explicit GeometryCache(size_t budget) : LRUCache(budget) {};
+};
+
+extern template class LRUCache<ChunkedGeometry, MeshChunk>;
+
+#endif //RAYTRACER_GEOMETRYCACHE_H
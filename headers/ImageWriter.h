@@ -0,0 +1,83 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_IMAGEWRITER_H
+#define RAYTRACER_IMAGEWRITER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Colors of a rendered frame as RGB floats,
+ * row after row from the top
+ */
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<float> pixels;
+
+    inline const float* getRow(int y) const {return &pixels[(size_t)y * width * 3];};
+};
+
+/**
+ * Encoders of rendered images, picked by the extension of the
+ * file. .pfm and .exr keep the floats as they are, without any
+ * clamping or tonemapping. .ppm and .png are quantized to 8 bits
+ * with SSE2, and PNG rows are filtered and compressed in chunks
+ * on several threads.
+ *
+ * Quantization clamps to [0, 1] and truncates, like CImg did and
+ * like Scene::getChecksum, so the checksum describes the file.
+ */
+class ImageWriter {
+public:
+    /**
+     * Rows of a PNG compressed as one piece of work
+     */
+    const static int PNG_CHUNK_ROWS = 64;
+
+    /**
+     * zlib level of the PNG compression, when zlib is
+     * available. Without it, PNG data is stored as is.
+     */
+    const static int PNG_LEVEL = 6;
+
+    /**
+     * Writes the image in the format of the extension of the
+     * file. Returns false if it is none of the above.
+     */
+    static bool write(const std::string &filename, const Image &image, unsigned int threads);
+
+    /**
+     * 8 bit values of the rows from first to last, exclusive,
+     * three bytes per pixel
+     */
+    static void quantize(const Image &image, int first, int last, unsigned char* out);
+
+    /**
+     * Portable float map, little endian, rows from the bottom
+     */
+    static void writePFM(const std::string &filename, const Image &image);
+
+    /**
+     * Uncompressed scanline OpenEXR with 32 bit float channels
+     */
+    static void writeEXR(const std::string &filename, const Image &image);
+
+    static void writePPM(const std::string &filename, const Image &image, unsigned int threads);
+
+    static void writePNG(const std::string &filename, const Image &image, unsigned int threads);
+
+    /**
+     * CRC-32 as used by PNG chunks, continuing from crc
+     */
+    static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t length);
+};
+
+#endif //RAYTRACER_IMAGEWRITER_H
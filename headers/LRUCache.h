@@ -0,0 +1,181 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_LRUCACHE_H
+#define RAYTRACER_LRUCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+
+/**
+ * Counters of a cache since it was created
+ */
+struct CacheStats {
+    unsigned long long lookups = 0;
+    unsigned long long pageIns = 0;
+    unsigned long long evictions = 0;
+    size_t bytesRead = 0;
+    size_t residentBytes = 0;
+    size_t peakResidentBytes = 0;
+};
+
+/**
+ * Pieces of files that are currently in memory, shared by all
+ * the sources of a scene. Pieces are read on their first use
+ * and the least recently used ones are evicted once the total
+ * size exceeds the budget. Users hold on to the pieces they
+ * are working with, so a piece evicted in the meantime is only
+ * freed once they are done with it.
+ *
+ * Source::read(index) allocates the piece of the given index,
+ * read from the file, and Item::getMemoryUsage is its size.
+ */
+template<typename Source, typename Item>
+class LRUCache {
+private:
+    struct Entry {
+        uint64_t key;
+        std::shared_ptr<const Item> item;
+        size_t bytes;
+    };
+
+    size_t budget;
+    std::list<Entry> recent;
+    std::unordered_map<uint64_t, typename std::list<Entry>::iterator> entries;
+    std::unordered_map<const Source*, uint32_t> sourceIds;
+    uint32_t nextSourceId = 0;
+    CacheStats stats;
+    mutable std::mutex mutex;
+
+    /**
+     * Drops the least recently used pieces until the rest
+     * fits in the budget, always keeping the newest one
+     */
+    void evict();
+
+public:
+    /**
+     * Budget in bytes for the pieces kept in memory
+     */
+    explicit LRUCache(size_t budget) : budget(budget) {};
+
+    LRUCache(const LRUCache& other) = delete;
+
+    LRUCache& operator=(const LRUCache& other) = delete;
+
+    /**
+     * Returns the piece of the given index, reading it from
+     * its file if it is not in memory. Safe to call from any
+     * number of threads; the file is read without holding the
+     * lock, so other threads keep using resident pieces.
+     */
+    std::shared_ptr<const Item> acquire(const Source &source, uint32_t index);
+
+    /**
+     * Drops all the pieces of a source, which must be
+     * done before it is destroyed
+     */
+    void release(const Source &source);
+
+    CacheStats getStats() const;
+
+    inline size_t getBudget() const {return budget;};
+};
+
+/**
+ * Keys combine an id handed out to each source with the
+ * index of the piece. Ids are used instead of the address of
+ * the source since a new one may be allocated at the address
+ * of one that was released.
+ */
+template<typename Source, typename Item>
+std::shared_ptr<const Item> LRUCache<Source, Item>::acquire(const Source &source, uint32_t index) {
+    uint64_t key;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.lookups++;
+
+        auto id = sourceIds.find(&source);
+        if(id == sourceIds.end()) {
+            id = sourceIds.emplace(&source, nextSourceId++).first;
+        }
+        key = (uint64_t)id->second << 32 | index;
+
+        auto found = entries.find(key);
+        if(found != entries.end()) {
+            recent.splice(recent.begin(), recent, found->second);
+            return found->second->item;
+        }
+    }
+
+    std::shared_ptr<const Item> loaded(source.read(index));
+    size_t bytes = loaded->getMemoryUsage();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.pageIns++;
+    stats.bytesRead += bytes;
+
+    //another thread may have read the same
+    //piece while this one was reading it
+    auto found = entries.find(key);
+    if(found != entries.end()) {
+        recent.splice(recent.begin(), recent, found->second);
+        return found->second->item;
+    }
+
+    recent.push_front({key, loaded, bytes});
+    entries[key] = recent.begin();
+    stats.residentBytes += bytes;
+    stats.peakResidentBytes = std::max(stats.peakResidentBytes, stats.residentBytes);
+    evict();
+    return loaded;
+}
+
+template<typename Source, typename Item>
+void LRUCache<Source, Item>::evict() {
+    while(stats.residentBytes > budget && recent.size() > 1) {
+        Entry &oldest = recent.back();
+        stats.residentBytes -= oldest.bytes;
+        stats.evictions++;
+        entries.erase(oldest.key);
+        recent.pop_back();
+    }
+}
+
+template<typename Source, typename Item>
+void LRUCache<Source, Item>::release(const Source &source) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto id = sourceIds.find(&source);
+    if(id == sourceIds.end()) {
+        return;
+    }
+
+    for(auto entry = recent.begin(); entry != recent.end();) {
+        if(entry->key >> 32 == id->second) {
+            stats.residentBytes -= entry->bytes;
+            entries.erase(entry->key);
+            entry = recent.erase(entry);
+        } else {
+            ++entry;
+        }
+    }
+    sourceIds.erase(id);
+}
+
+template<typename Source, typename Item>
+CacheStats LRUCache<Source, Item>::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+#endif //RAYTRACER_LRUCACHE_H
@@ -13,14 +13,54 @@
 #include "SceneObject.h"
 
 /**
- * Represents a point light in the scene
+ * Represents a light in the scene: a point, or a sphere or
+ * rectangle that casts soft shadows. Area lights are not
+ * seen by camera rays, only in what they light, and light
+ * a point as much as a point light would, spread over the
+ * directions in which the point sees them.
  */
 class Light: public SceneObject {
 public:
+    enum Shape {
+        pointLight, sphereLight, rectangleLight
+    };
+
     float attenuation;
 
+    /**
+     * Radius of a sphere light, 0 for other lights
+     */
+    float radius = 0.0f;
+
+    /**
+     * Perpendicular edges of a rectangle light, which is
+     * centered on the position of the light and emits from
+     * both of its faces. Both are zero for other lights.
+     */
+    glm::vec3 edge1 = glm::vec3(0.0f);
+    glm::vec3 edge2 = glm::vec3(0.0f);
+
 public:
     Light() {type = light; attenuation = 0.0001f;};
+
+    inline Shape getShape() const {
+        if(radius > 0.0f) {
+            return sphereLight;
+        }
+        return glm::dot(glm::cross(edge1, edge2), glm::cross(edge1, edge2)) > 0.0f ? rectangleLight : pointLight;
+    };
+
+    inline bool isArea() const {return getShape() != pointLight;};
+
+    /**
+     * Points of the light for the given samples of the unit
+     * square, placed so that equal areas of the square cover
+     * equal solid angles of the light as seen from a point.
+     * Samples that are well spread over the square are then
+     * well spread over what the point sees of the light. The
+     * position is returned for every sample of a point light.
+     */
+    void sample(const glm::vec3 &from, const glm::vec2* samples, int count, glm::vec3* points) const;
 };
 
 #endif //RAYTRACER_LIGHT_H
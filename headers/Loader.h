@@ -14,6 +14,8 @@
 #include "SceneObject.h"
 #include "Light.h"
 #include "Camera.h"
+#include "GeometryCache.h"
+#include "SceneParser.h"
 #include <boost/filesystem.hpp>
 
 /**
@@ -22,11 +24,30 @@
  */
 class Loader {
 public:
-    static void loadScene(const std::string &filename, std::vector<SceneObject*> &sceneObjects, std::vector<Light*> &lights, Camera* &camera, boost::filesystem::path &scenePath);
+    /**
+     * Meshes are loaded out of core through geometryCache
+     * when one is given, and their chunk files written on
+     * the given number of threads. Errors are thrown with
+     * the file and line they were found on.
+     */
+    static void loadScene(const std::string &filename, std::vector<SceneObject*> &sceneObjects, std::vector<Light*> &lights, Camera* &camera, boost::filesystem::path &scenePath,
+                          GeometryCache* geometryCache = nullptr, unsigned int threads = 1);
+
+    /**
+     * Applies a single property line in scene file syntax,
+     * e.g. "dif: 0.5 0.5 0.5", to an already loaded object
+     */
+    static void applyProperty(SceneObject* object, const std::string &line, boost::filesystem::path &scenePath);
 private:
-    static void parseLine(std::vector<SceneObject*> &objects, std::string &line, boost::filesystem::path &scenePath);
-    static void addToScene(std::vector<SceneObject*> &objects, std::vector<std::string> parts, boost::filesystem::path &scenePath);
-    static void setProperty(SceneObject* object, std::vector<std::string> data, boost::filesystem::path &scenePath);
+    static void addToScene(std::vector<SceneObject*> &objects, const SceneParser &line, boost::filesystem::path &scenePath, GeometryCache* geometryCache,
+                           unsigned int threads);
+    static void setProperty(SceneObject* object, const SceneParser &line, boost::filesystem::path &scenePath);
+
+    /**
+     * Throws if the radius and edges of a light do not
+     * make a point, a sphere or a rectangle
+     */
+    static void checkLightShape(const Light* light);
 };
 
 
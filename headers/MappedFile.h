@@ -0,0 +1,42 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_MAPPEDFILE_H
+#define RAYTRACER_MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+
+/**
+ * Read only view of a whole file, memory mapped when possible.
+ * Files that cannot be mapped, such as pipes, are read into
+ * memory instead. The data is page aligned when mapped.
+ */
+class MappedFile {
+public:
+    /**
+     * Throws std::invalid_argument if the file cannot be read
+     */
+    explicit MappedFile(const std::string &filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile& operator=(const MappedFile &) = delete;
+
+    inline const char* getData() const {return data;};
+    inline size_t getSize() const {return size;};
+    inline bool isMapped() const {return mapping != nullptr;};
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+    void* mapping = nullptr;
+    std::string contents;
+};
+
+#endif //RAYTRACER_MAPPEDFILE_H
@@ -12,14 +12,38 @@
 #include <glm/glm.hpp>
 #include "SceneObject.h"
 #include "Triangle.h"
+#include "AABB.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "ChunkedGeometry.h"
+#include "GeometryCache.h"
+#include "TiledTexture.h"
+#include "Octahedral.h"
 #include <string>
 #include <vector>
 #include <boost/filesystem.hpp>
 
 /**
  * Represents a mesh composed of triangles.
- * The mesh keeps a std::vector of its component
- * triangles
+ * The mesh keeps the vertex positions and indices of
+ * its .obj file, and their bounding box so that rays
+ * missing the mesh skip all of its triangles.
+ * Once the BVH is built, the indices are stored in
+ * the order of its leaves. Depending on the layout
+ * chosen at build time, the mesh then either owns a
+ * Triangle object for every triangle, traced through
+ * the binary BVH, or keeps only the indices and traces
+ * them through the compressed wide BVH.
+ * Later frames of a deforming mesh only have to supply
+ * new vertex positions.
+ * Meshes given a GeometryCache are kept out of core: their
+ * triangles stay in a chunk file next to the .obj file and
+ * are paged in through the cache as rays reach them.
+ * Texture coordinates are kept with their own indices, three
+ * per triangle, since a vertex may have different coordinates
+ * in the triangles on either side of a seam. So are the vertex
+ * normals, octahedral encoded, unless the file indexes them
+ * like the positions, which it mostly does.
  */
 class Mesh: public SceneObject {
 public:
@@ -27,20 +51,199 @@ public:
 private:
     std::string filename;
     std::vector<Triangle*> triangles;
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    std::vector<glm::vec2> uvs;
+    std::vector<unsigned int> uvIndices;
+    std::vector<uint32_t> normals;
+    std::vector<unsigned int> normalIndices;
+    std::string textureFile;
+    const TiledTexture* texture = nullptr;
+    AABB bounds;
+    BVH bvh;
+    WideBVH wideBVH;
+    GeometryCache* geometryCache = nullptr;
+    unsigned int chunkThreads = 1;
+    ChunkedGeometry* chunks = nullptr;
+
+    /**
+     * Index of each triangle in the .obj file, since the
+     * BVH reorders the triangles
+     */
+    std::vector<int> sourceTriangles;
+
+    void computeBounds();
+
+    std::vector<AABB> getTriangleBounds() const;
+
+    /**
+     * Instantiates the Triangle objects of the binary
+     * layout, in the current order of the indices
+     */
+    void createTriangles();
+
+    void deleteTriangles();
+
+    /**
+     * Opens the chunk file of the .obj file, writing it first
+     * if it is missing or out of date, and frees everything
+     * else the mesh holds in memory
+     */
+    void loadChunks();
+
+    void releaseChunks();
+
+    /**
+     * Encodes the normals of the .obj file, dropping their
+     * indices if they are those of the positions
+     */
+    void setNormals(const std::vector<glm::vec3> &vertexNormals, std::vector<unsigned int> &indicesOfNormals);
 
 public:
     Mesh() {type = mesh;};
 
+    ~Mesh() override;
+
+    Mesh(const Mesh& other) = delete;
+
+    Mesh& operator=(const Mesh& other) = delete;
+
     /**
-     * Open a .obj file and populate the std::vector
-     * of its triangles.
+     * Open a .obj file and read its vertex positions
+     * and indices. The triangles are ready to be traced
+     * once buildBVH has been called.
      */
     void loadObj(std::string &filename, boost::filesystem::path &scenePath);
 
+    /**
+     * Loads the mesh out of core through the given cache,
+     * which must outlive it, writing its chunk file on the
+     * given number of threads if it has none yet. Must be
+     * called before loadObj.
+     */
+    inline void setGeometryCache(GeometryCache* cache, unsigned int threads) {
+        geometryCache = cache;
+        chunkThreads = threads;
+    };
+
+    inline GeometryCache* getGeometryCache() const {return geometryCache;};
+
+    inline const ChunkedGeometry* getChunks() const {return chunks;};
+
+    inline bool isStreamed() const {return chunks != nullptr;};
+
     inline std::string& getFilename() {return filename;};
 
     inline std::vector<Triangle*>& getTriangles() {return triangles;};
 
+    inline const std::vector<glm::vec3>& getPositions() const {return positions;};
+
+    /**
+     * Three vertex indices per triangle, in the
+     * order of the BVH leaves once it is built
+     */
+    inline const std::vector<unsigned int>& getIndices() const {return indices;};
+
+    /**
+     * Sets the image that multiplies the ambient and diffuse
+     * colors of the mesh, a path relative to the scene file
+     * like that of the .obj file. The texture itself is opened
+     * by SceneGeometry, once the scene is loaded.
+     */
+    void setTextureFile(const std::string &filename, boost::filesystem::path &scenePath);
+    inline const std::string& getTextureFile() const {return textureFile;};
+    inline void setTexture(const TiledTexture* texture) {this->texture = texture;};
+    inline const TiledTexture* getTexture() const {return texture;};
+
+    /**
+     * Whether the triangles have texture coordinates. Out-of-core
+     * meshes keep only their positions and never do.
+     */
+    inline bool hasTextureCoordinates() const {return !uvIndices.empty();};
+
+    /**
+     * Texture coordinates of a point of the triangle of the given
+     * index, in the order of getIndices, from its barycentric
+     * coordinates relative to the second and third vertex.
+     * areaRatio is set to the area of the triangle in texture
+     * space over its area in the scene.
+     */
+    glm::vec2 getTextureCoordinates(int triangle, const glm::vec2 &barycentrics, float &areaRatio) const;
+
+    /**
+     * Whether the triangles have vertex normals to be shaded
+     * smooth with. Out-of-core meshes are always shaded flat.
+     */
+    inline bool hasVertexNormals() const {return !normals.empty();};
+
+    /**
+     * Vertex normals of the triangle of the given index
+     * interpolated like getTextureCoordinates, normalized
+     */
+    inline glm::vec3 getVertexNormal(int triangle, const glm::vec2 &barycentrics) const {
+        const unsigned int* corners = normalIndices.empty() ? &indices[triangle * 3] : &normalIndices[triangle * 3];
+        glm::vec3 a = decodeOctahedral(normals[corners[0]]);
+        glm::vec3 b = decodeOctahedral(normals[corners[1]]);
+        glm::vec3 c = decodeOctahedral(normals[corners[2]]);
+        return glm::normalize(a * (1.0f - barycentrics.x - barycentrics.y) + b * barycentrics.x + c * barycentrics.y);
+    };
+
+    inline size_t getTriangleCount() const {
+        return chunks != nullptr ? chunks->getTriangleCount() : indices.size() / 3;
+    };
+
+    inline const AABB& getBounds() const {return bounds;};
+
+    /**
+     * Builds the BVH over the triangles with up to the
+     * given number of threads. The compact layout collapses
+     * it into a compressed wide BVH and drops the Triangle
+     * objects, trading some speed for a fraction of the memory.
+     * Out-of-core meshes read their BVHs from their chunk file
+     * and have nothing to build.
+     */
+    void buildBVH(unsigned int threads, bool compact = false);
+
+    inline const BVH& getBVH() const {return bvh;};
+
+    inline const WideBVH& getWideBVH() const {return wideBVH;};
+
+    inline bool isCompact() const {return !wideBVH.isEmpty();};
+
+    /**
+     * Bytes used by the triangles: positions, indices, texture
+     * coordinates, normals and the Triangle objects of the
+     * binary layout
+     */
+    size_t getGeometryMemory() const;
+
+    inline size_t getBVHMemory() const {
+        return bvh.getMemoryUsage() + wideBVH.getMemoryUsage() + (chunks != nullptr ? chunks->getMemoryUsage() : 0);
+    };
+
+    /**
+     * Moves the vertices of the mesh to the given positions,
+     * indexed like the vertices of the .obj file, and refits
+     * the BVH. The BVH is rebuilt instead once its SAH cost
+     * exceeds rebuildThreshold times the cost it was built with.
+     * The quantized bounds of the compact layout cannot be
+     * refitted, so compact meshes are always rebuilt.
+     * Out-of-core meshes cannot be deformed.
+     * Returns true if it was rebuilt.
+     */
+    bool deform(const std::vector<glm::vec3> &vertices, unsigned int threads,
+                float rebuildThreshold = BVH::DEFAULT_REBUILD_THRESHOLD);
+
+    /**
+     * Reads the vertex positions of the next frame from a .obj
+     * file with the same faces as the loaded one, then deforms
+     * the mesh to them. Its vertex normals replace those of the
+     * mesh when it has as many. Returns true if the BVH was
+     * rebuilt.
+     */
+    bool loadFrame(std::string &filename, boost::filesystem::path &scenePath, unsigned int threads,
+                   float rebuildThreshold = BVH::DEFAULT_REBUILD_THRESHOLD);
+
     void setAmbient(glm::vec3 ambient) override;
 
     void setDiffuse(glm::vec3 diffuse) override;
@@ -48,6 +251,8 @@ public:
     void setSpecular(glm::vec3 specular) override;
 
     void setShininess(float shininess) override;
+
+    void setDoubleSided(bool doubleSided) override;
 };
 
 #endif //RAYTRACER_MESH_H
@@ -5,16 +5,52 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+// Reads the indices of a face line in any of the formats below,
+// telling whether it has texture coordinates and normals. Returns
+// false if the line has none of them.
+bool parseFace(const char * line, int * vertexIndex, int * uvIndex, int * normalIndex, bool & uv, bool & norm) {
+    uv = true;
+    norm = true;
+    //vertex, uv, norm
+    int matches = sscanf(line, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2]);
+    if (matches != 9) {
+        //vertex, norm
+        matches = sscanf(line, "%d//%d %d//%d %d//%d\n", &vertexIndex[0], &normalIndex[0], &vertexIndex[1], &normalIndex[1], &vertexIndex[2], &normalIndex[2]);
+        if (matches != 6) {
+            //vertex, uv
+            matches = sscanf(line, "%d/%d %d/%d %d/%d\n", &vertexIndex[0], &uvIndex[0], &vertexIndex[1], &uvIndex[1], &vertexIndex[2], &uvIndex[2]);
+            if (matches != 6) {
+                //vertex
+                matches = sscanf(line, "%d %d %d\n", &vertexIndex[0], &vertexIndex[1], &vertexIndex[2]);
+                if (matches != 3) {
+                    return false;
+                }
+                uv = false;
+                norm = false;
+            }
+            else {
+                norm = false;
+            }
+        }
+        else {
+            uv = false;
+        }
+    }
+    return true;
+}
+
+// Reads the positions, normals and texture coordinates of the file
+// as they are listed, with three indices into each per triangle.
+// Faces without normals or texture coordinates leave those index
+// arrays empty.
 bool loadOBJ(
         const char * path,
         std::vector<unsigned int> & vertexIndices,
         std::vector<glm::vec3> & temp_vertices,
-        std::vector<glm::vec3> & out_normals,
-        std::vector<glm::vec2> & out_uvs) {
-
-    std::vector<unsigned int> uvIndices, normalIndices;
-    std::vector<glm::vec2> temp_uvs;
-    std::vector<glm::vec3> temp_normals;
+        std::vector<glm::vec3> & temp_normals,
+        std::vector<glm::vec2> & temp_uvs,
+        std::vector<unsigned int> & normalIndices,
+        std::vector<unsigned int> & uvIndices) {
 
     FILE * file = fopen(path, "r");
     if (file == NULL) {
@@ -51,35 +87,14 @@ bool loadOBJ(
         }
         else if (strcmp(lineHeader, "f") == 0) {
             int vertexIndex[3], uvIndex[3], normalIndex[3];
-            bool uv = true;
-            bool norm = true;
+            bool uv, norm;
             char line[128];
             fgets(line, 128, file);
-            //vertex, uv, norm
-            int matches = sscanf(line, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2]);
-            if (matches != 9) {
-                //vertex, norm
-                matches = sscanf(line, "%d//%d %d//%d %d//%d\n", &vertexIndex[0], &normalIndex[0], &vertexIndex[1], &normalIndex[1], &vertexIndex[2], &normalIndex[2]);
-                if (matches != 6) {
-                    //vertex, uv
-                    matches = sscanf(line, "%d/%d %d/%d %d/%d\n", &vertexIndex[0], &uvIndex[0], &vertexIndex[1], &uvIndex[1], &vertexIndex[2], &uvIndex[2]);
-                    if (matches != 6) {
-                        //vertex
-                        matches = sscanf(line, "%d %d %d\n", &vertexIndex[0], &vertexIndex[1], &vertexIndex[2]);
-                        if (matches != 6) {
-                            printf("File can't be read by our simple parser. 'f' format expected: d/d/d d/d/d d/d/d || d/d d/d d/d || d//d d//d d//d\n");
-                            printf("Character at %d", ftell(file));
-                            return false;
-                        }
-                        uv, norm = false;
-                    }
-                    else {
-                        norm = false;
-                    }
-                }
-                else {
-                    uv = false;
-                }
+            if (!parseFace(line, vertexIndex, uvIndex, normalIndex, uv, norm)) {
+                printf("File can't be read by our simple parser. 'f' format expected: d/d/d d/d/d d/d/d || d/d d/d d/d || d//d d//d d//d\n");
+                printf("Character at %d", ftell(file));
+                fclose(file);
+                return false;
             }
             vertexIndices.push_back(abs(vertexIndex[0]) - 1);
             vertexIndices.push_back(abs(vertexIndex[1]) - 1);
@@ -101,24 +116,74 @@ bool loadOBJ(
         }
 
     }
-    if (normalIndices.size() != 0)
-        out_normals.resize(temp_normals.size());
-    if (uvIndices.size() != 0)
-        out_uvs.resize(temp_normals.size());
-    for (unsigned int i = 0; i<vertexIndices.size(); i++) {
-        int vi = vertexIndices[i];
-        if (normalIndices.size() != 0) {
-            unsigned int ni = normalIndices[i];
-            out_normals[vi] = temp_normals[ni];
-        }
-        if (uvIndices.size() != 0 && i < uvIndices.size()) {
-            unsigned int ui = uvIndices[i];
-            out_uvs[vi] = temp_uvs[ui];
+    fclose(file);
+
+    // attributes that only some faces have are dropped
+    if (normalIndices.size() != vertexIndices.size())
+        normalIndices.clear();
+    if (uvIndices.size() != vertexIndices.size())
+        uvIndices.clear();
+    for (unsigned int i = 0; i < vertexIndices.size(); i++) {
+        if (vertexIndices[i] >= temp_vertices.size() ||
+            (!normalIndices.empty() && normalIndices[i] >= temp_normals.size()) ||
+            (!uvIndices.empty() && uvIndices[i] >= temp_uvs.size())) {
+            printf("Face %u refers to a vertex that does not exist\n", i / 3);
+            return false;
         }
     }
 
+    return true;
+}
+
+// Reads only the positions and the faces of the file, handing each
+// one to vertex and face as it is read instead of keeping them, so
+// that files larger than memory can be converted. face gets the
+// three indices of the positions of a triangle, which are not
+// checked against the number of positions.
+template <typename Vertex, typename Face>
+bool streamOBJ(const char * path, Vertex vertex, Face face) {
 
+    FILE * file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Impossible to open the file ! Are you in the right path ?\n");
+        return false;
+    }
+
+    while (1) {
 
+        char lineHeader[128];
+        int res = fscanf(file, "%127s", lineHeader);
+        if (res == EOF)
+            break;
+
+        if (strcmp(lineHeader, "v") == 0) {
+            glm::vec3 position;
+            fscanf(file, "%f %f %f\n", &position.x, &position.y, &position.z);
+            vertex(position);
+        }
+        else if (strcmp(lineHeader, "f") == 0) {
+            int vertexIndex[3], uvIndex[3], normalIndex[3];
+            bool uv, norm;
+            char line[128];
+            fgets(line, 128, file);
+            if (!parseFace(line, vertexIndex, uvIndex, normalIndex, uv, norm)) {
+                printf("File can't be read by our simple parser. 'f' format expected: d/d/d d/d/d d/d/d || d/d d/d d/d || d//d d//d d//d\n");
+                fclose(file);
+                return false;
+            }
+            unsigned int indices[3];
+            for (int i = 0; i < 3; i++) {
+                indices[i] = abs(vertexIndex[i]) - 1;
+            }
+            face(indices);
+        }
+        else {
+            char clear[1000];
+            fgets(clear, 1000, file);
+        }
+
+    }
+    fclose(file);
     return true;
 }
 
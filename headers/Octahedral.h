@@ -0,0 +1,63 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_OCTAHEDRAL_H
+#define RAYTRACER_OCTAHEDRAL_H
+
+#include <cstdint>
+#include <cmath>
+#include <glm/glm.hpp>
+
+/**
+ * Sign that is 1 for zero, so that no vector folds onto the origin
+ */
+inline float signNotZero(float value) {
+    return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+/**
+ * Unit vectors in 32 bits, from Cigolle et al., A Survey of
+ * Efficient Representations for Independent Unit Vectors, JCGT
+ * (2014). The sphere is projected onto an octahedron, which is
+ * unfolded into a square; each of its two coordinates is then
+ * quantized to 16 bits. Decoded vectors are within 1e-4 radians
+ * of the original, a third of the size of three floats.
+ */
+inline uint32_t encodeOctahedral(const glm::vec3 &vector) {
+    float length = std::fabs(vector.x) + std::fabs(vector.y) + std::fabs(vector.z);
+    if(length == 0.0f) {
+        return 0;
+    }
+    float x = vector.x / length;
+    float y = vector.y / length;
+
+    //the lower half folds over the corners of the square
+    if(vector.z < 0.0f) {
+        float folded = (1.0f - std::fabs(y)) * signNotZero(x);
+        y = (1.0f - std::fabs(x)) * signNotZero(y);
+        x = folded;
+    }
+
+    int16_t qx = (int16_t)std::lround(glm::clamp(x, -1.0f, 1.0f) * 32767.0f);
+    int16_t qy = (int16_t)std::lround(glm::clamp(y, -1.0f, 1.0f) * 32767.0f);
+    return (uint32_t)(uint16_t)qx | (uint32_t)(uint16_t)qy << 16;
+}
+
+inline glm::vec3 decodeOctahedral(uint32_t encoded) {
+    float x = (float)(int16_t)(encoded & 0xffff) / 32767.0f;
+    float y = (float)(int16_t)(encoded >> 16) / 32767.0f;
+    float z = 1.0f - std::fabs(x) - std::fabs(y);
+    if(z < 0.0f) {
+        float folded = (1.0f - std::fabs(y)) * signNotZero(x);
+        y = (1.0f - std::fabs(x)) * signNotZero(y);
+        x = folded;
+    }
+    return glm::normalize(glm::vec3(x, y, z));
+}
+
+#endif //RAYTRACER_OCTAHEDRAL_H
@@ -10,8 +10,21 @@
 #define RAYTRACER_PIXEL_H
 
 #include <glm/glm.hpp>
+#include <algorithm>
 #include "Camera.h"
 
+/**
+ * What the denoiser tells the surfaces seen in a pixel apart
+ * by, averaged over its samples: the diffuse color and shading
+ * normal of the surface and its distance to the eye. Samples
+ * that miss everything count as zero.
+ */
+struct PixelFeatures {
+    glm::vec3 albedo = glm::vec3(0.0f);
+    glm::vec3 normal = glm::vec3(0.0f);
+    float depth = 0.0f;
+};
+
 /**
  * Represents one pixel on screen.
  */
@@ -21,6 +34,17 @@ public:
     float width;
     float height;
 
+    /**
+     * Recorded with the color on every render
+     */
+    PixelFeatures features;
+
+    /**
+     * Variance of the luminance of the color, i.e. of the
+     * mean of the samples, 0 with a single sample
+     */
+    float variance = 0.0f;
+
     /**
      * Calculates the position and dimensions in world space of this pixel
      * based on the camera properties and the width/height resolution of the
@@ -29,4 +53,44 @@ public:
     void initialize(const int &resolutionWidth, const int &resolutionHeight, const int &x, const int &y, const Camera* camera);
 };
 
+/**
+ * Sums over the samples of a pixel, which then sets its
+ * color to their mean and its features and variance
+ */
+struct PixelSamples {
+    glm::vec3 color = glm::vec3(0.0f);
+    PixelFeatures features;
+    float luminance = 0.0f;
+    float luminance2 = 0.0f;
+    int count = 0;
+
+    inline void add(const glm::vec3 &sampleColor, const PixelFeatures &sampleFeatures) {
+        color += sampleColor;
+        features.albedo += sampleFeatures.albedo;
+        features.normal += sampleFeatures.normal;
+        features.depth += sampleFeatures.depth;
+        float l = getLuminance(sampleColor);
+        luminance += l;
+        luminance2 += l * l;
+        count++;
+    };
+
+    inline void store(Pixel &pixel) const {
+        float n = (float)count;
+        pixel.color = color / n;
+        pixel.features.albedo = features.albedo / n;
+        pixel.features.normal = features.normal / n;
+        pixel.features.depth = features.depth / n;
+        float mean = luminance / n;
+        pixel.variance = count > 1 ? std::max(0.0f, luminance2 / n - mean * mean) / (n - 1.0f) : 0.0f;
+    };
+
+    /**
+     * Rec. 709 luminance of a linear color
+     */
+    static inline float getLuminance(const glm::vec3 &color) {
+        return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+    };
+};
+
 #endif //RAYTRACER_PIXEL_H
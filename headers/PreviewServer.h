@@ -0,0 +1,88 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_PREVIEWSERVER_H
+#define RAYTRACER_PREVIEWSERVER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "Scene.h"
+
+/**
+ * Long running render server listening on a Unix domain socket.
+ * Scenes stay loaded between requests so that repeated renders
+ * only pay for the raytracing itself. The protocol is line based
+ * and reuses the property syntax of the scene files:
+ *
+ *   load [scene file path]         -> ok [width] [height] [objects] [lights]
+ *   camera [property]              -> ok
+ *   light [index] [property]       -> ok
+ *   object [index] [property]      -> ok
+ *   frame [index] [obj file path] [rebuild threshold]
+ *                                  -> ok refit|rebuild [milliseconds] [degradation]
+ *   render [tile size]             -> tile [x] [y] [w] [h] + w*h*3 bytes of RGB, ...
+ *                                     done [milliseconds]
+ *   unload [scene file path]       -> ok
+ *   quit                           -> closes the connection
+ *   shutdown                       -> stops the server
+ *
+ * Any failing command is answered with "error [message]".
+ */
+class PreviewServer {
+private:
+    std::string socketPath;
+    int listenSocket;
+    bool running;
+    std::map<std::string, Scene*> scenes;
+    Scene* activeScene;
+
+public:
+    const static int DEFAULT_TILE_SIZE = 32;
+
+private:
+    /**
+     * Serves one client connection until it disconnects
+     */
+    void serveClient(int client);
+
+    /**
+     * Executes one command line and writes the reply
+     * to the client
+     */
+    void handleCommand(int client, const std::string &line);
+
+    void load(int client, const std::string &filename);
+
+    void render(int client, int tileSize);
+
+    /**
+     * Moves the vertices of a mesh to those of the next frame
+     * of its animation and refits or rebuilds its BVH
+     */
+    void loadFrame(int client, int index, std::string &filename, float rebuildThreshold);
+
+    Scene* requireScene();
+
+public:
+    explicit PreviewServer(const std::string &socketPath);
+
+    ~PreviewServer();
+
+    PreviewServer(const PreviewServer& other) = delete;
+
+    PreviewServer& operator=(const PreviewServer& other) = delete;
+
+    /**
+     * Binds the socket and serves clients one after
+     * the other until a shutdown command is received
+     */
+    void run();
+};
+
+#endif //RAYTRACER_PREVIEWSERVER_H
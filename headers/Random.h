@@ -0,0 +1,87 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_RANDOM_H
+#define RAYTRACER_RANDOM_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * Small PCG32 random number generator. Every pixel gets its
+ * own sequence derived from the render seed and its screen
+ * coordinates, so the samples a pixel draws do not depend on
+ * which thread renders it or in which order.
+ */
+class Random {
+private:
+    uint64_t state;
+
+    /**
+     * SplitMix64 finalizer, used to scatter the seed
+     * and coordinates over the whole state space
+     */
+    static inline uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    };
+
+public:
+    /**
+     * Streams other than 0 give a pixel more sequences that are
+     * independent of the one its camera samples are drawn from
+     */
+    Random(uint32_t seed, uint32_t x, uint32_t y, uint32_t stream = 0) {
+        state = mix(((uint64_t)seed << 32 | stream) ^ mix(((uint64_t)y << 32) | x));
+    };
+
+    inline uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint32_t shifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+        uint32_t rotation = (uint32_t)(old >> 59u);
+        return (shifted >> rotation) | (shifted << ((-rotation) & 31));
+    };
+
+    /**
+     * Uniform float in [0, 1)
+     */
+    inline float nextFloat() {
+        return (float)(next() >> 8) * (1.0f / 16777216.0f);
+    };
+};
+
+/**
+ * Point i of the Sobol (0,2)-sequence in the unit square, its
+ * digits flipped by the given scrambles. Any 2^k consecutive
+ * points from the start have one point in each of the 2^k
+ * cells of every grid of 2^a by 2^b cells with a + b = k, so
+ * every prefix of a power of two length is stratified. The
+ * scrambles keep that property and decorrelate the pixels.
+ */
+inline glm::vec2 getSobolPoint(uint32_t i, uint32_t scrambleX, uint32_t scrambleY) {
+    //the first dimension is the van der Corput sequence
+    uint32_t x = i;
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+
+    uint32_t y = 0;
+    for(uint32_t v = 1u << 31; i != 0; i >>= 1, v ^= v >> 1) {
+        if(i & 1u) {
+            y ^= v;
+        }
+    }
+
+    return glm::vec2((float)((x ^ scrambleX) >> 8), (float)((y ^ scrambleY) >> 8)) * (1.0f / 16777216.0f);
+}
+
+#endif //RAYTRACER_RANDOM_H
@@ -0,0 +1,233 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_RASTERIZER_H
+#define RAYTRACER_RASTERIZER_H
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "SceneObject.h"
+#include "Camera.h"
+#include "Pixel.h"
+
+/**
+ * Setup time and outcome of a rasterized frame
+ */
+struct RasterStats {
+    double setupSeconds = 0.0;
+    size_t triangles = 0;
+    size_t spheres = 0;
+    size_t binReferences = 0;
+    size_t resolvedPixels = 0;
+    size_t ambiguousPixels = 0;
+};
+
+/**
+ * Primary visibility of the pinhole camera found by rasterizing
+ * the spheres and mesh triangles of the scene into a G-buffer
+ * on the CPU, instead of tracing a ray through every pixel.
+ *
+ * Primitives are projected and binned by render tile in parallel
+ * once per frame. Each tile is then rasterized by the thread
+ * that renders it, right before its pixels are shaded. For every
+ * pixel center the buffer keeps the nearest primitive, and the
+ * depth along the camera ray of the two nearest fragments.
+ *
+ * The G-buffer only picks the primitive; the hit itself is still
+ * computed by the ray tracer, testing that one primitive and the
+ * planes, which are infinite and never rasterized. Pixels whose
+ * answer the rasterizer cannot be sure of, because they lie
+ * within rounding distance of an edge or the two nearest depths
+ * are too close to call, are marked ambiguous and traced in full.
+ * The image is therefore the one the ray tracer would render.
+ */
+class Rasterizer {
+private:
+    /**
+     * A triangle as seen from the camera. Each edge is the line
+     * a x + b y + c = 0 in pixel coordinates, normalized and
+     * facing inwards, so it gives the distance in pixels of a
+     * pixel center to the edge. The reciprocal of the depth
+     * along the view direction is affine in screen space.
+     */
+    struct ScreenTriangle {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float inverseDepth[3];
+        int minX, minY, maxX, maxY;
+        SceneObject* object;
+        int64_t primitive;
+
+        /**
+         * Set for slivers seen edge on, which cover
+         * nothing for certain but may cover anything
+         * within their bounds
+         */
+        bool sliver;
+        float nearestDepth;
+    };
+
+    struct ScreenSphere {
+        int minX, minY, maxX, maxY;
+        SceneObject* object;
+    };
+
+    /**
+     * Primitives set up by one thread and the bins
+     * they fall in, lists of indices into them
+     */
+    struct BinSet {
+        std::vector<ScreenTriangle> triangles;
+        std::vector<std::vector<int>> triangleBins;
+        std::vector<ScreenSphere> spheres;
+        std::vector<std::vector<int>> sphereBins;
+    };
+
+    int width = 0;
+    int height = 0;
+    int binSize = 16;
+    int binsX = 0;
+    int binsY = 0;
+    Pixel** screen = nullptr;
+    glm::vec3 eye;
+    glm::vec3 forward;
+
+    /**
+     * Projection of a point in camera space, d being its
+     * offset from the eye, onto the pixel coordinates
+     */
+    glm::vec3 right, up;
+    float screenDistance = 0.0f;
+    float offsetX = 0.0f, offsetY = 0.0f;
+    float pixelWidth = 1.0f, pixelHeight = 1.0f;
+
+    std::vector<BinSet> binSets;
+
+    std::vector<glm::vec3> directions;
+    std::vector<float> nearest;
+    std::vector<float> second;
+    std::vector<float> ambiguous;
+    std::vector<SceneObject*> objects;
+    std::vector<int64_t> primitives;
+
+    RasterStats stats;
+
+    inline glm::vec2 project(const glm::vec3 &d) const {
+        float scale = screenDistance / glm::dot(d, forward);
+        return glm::vec2((glm::dot(d, right) * scale - offsetX) / pixelWidth,
+                         -(glm::dot(d, up) * scale - offsetY) / pixelHeight);
+    };
+
+    /**
+     * Projects a triangle, clipped against the near plane,
+     * and adds it to the bins it overlaps
+     */
+    void setupTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c, SceneObject* object,
+                       int64_t primitive, BinSet &bins);
+
+    void addScreenTriangle(const glm::vec3* corners, const glm::vec2* points, SceneObject* object, int64_t primitive,
+                           bool sliver, BinSet &bins);
+
+    void setupSphere(SceneObject* sphere, BinSet &bins);
+
+    /**
+     * Keeps a fragment at a pixel if it is nearer than
+     * what is there, and records it as ambiguous if the
+     * coverage is in doubt
+     */
+    inline void addFragment(int pixel, float depth, bool certain, SceneObject* object, int64_t primitive) {
+        if(!certain) {
+            ambiguous[pixel] = std::fmin(ambiguous[pixel], depth);
+        } else if(depth < nearest[pixel]) {
+            second[pixel] = nearest[pixel];
+            nearest[pixel] = depth;
+            objects[pixel] = object;
+            primitives[pixel] = primitive;
+        } else if(depth < second[pixel]) {
+            second[pixel] = depth;
+        }
+    };
+
+public:
+    /**
+     * Distance in pixels to an edge below which the coverage
+     * of a pixel center is left to the ray tracer
+     */
+    constexpr static float EDGE_MARGIN = 1e-2f;
+
+    /**
+     * Relative difference of the two nearest depths
+     * below which a pixel is left to the ray tracer
+     */
+    constexpr static float DEPTH_MARGIN = 1e-3f;
+
+    /**
+     * Near plane, relative to the distance of the screen
+     */
+    constexpr static float NEAR_PLANE = 1e-5f;
+
+    /**
+     * Triangles per unit of setup work
+     */
+    const static int SETUP_BATCH = 16384;
+
+    /**
+     * What the G-buffer knows about a pixel
+     */
+    enum Coverage {
+        empty, resolved, unresolved
+    };
+
+    Rasterizer() = default;
+
+    Rasterizer(const Rasterizer& other) = delete;
+
+    Rasterizer& operator=(const Rasterizer& other) = delete;
+
+    /**
+     * Projects the spheres and mesh triangles among the objects
+     * and bins them into square bins of the given size, which
+     * must be the size of the render tiles. Out-of-core meshes
+     * are read chunk by chunk through their cache.
+     */
+    void setup(const std::vector<SceneObject*> &sceneObjects, Camera &camera, Pixel** screen, int width, int height,
+               int binSize, unsigned int threads);
+
+    /**
+     * Rasterizes the bin of the tile at the given pixel. Tiles
+     * can be rasterized from different threads at the same time.
+     */
+    void rasterizeTile(int tx, int ty, int tw, int th);
+
+    /**
+     * Nearest sphere or mesh at a pixel of a rasterized tile,
+     * nullptr when the pixel is empty. primitive is the index of the triangle in the mesh: in
+     * the order of its indices, or ChunkedGeometry::getPrimitive
+     * of its chunk and its index there for out-of-core meshes.
+     */
+    inline Coverage getCoverage(int x, int y, SceneObject* &object, int64_t &primitive) const {
+        int pixel = y * width + x;
+        object = objects[pixel];
+        primitive = primitives[pixel];
+        if(object == nullptr) {
+            return ambiguous[pixel] < HUGE_VALF ? unresolved : empty;
+        }
+
+        float limit = nearest[pixel] * (1.0f + DEPTH_MARGIN);
+        return ambiguous[pixel] <= limit || second[pixel] <= limit ? unresolved : resolved;
+    };
+
+    /**
+     * Counts of the pixels are taken over the whole
+     * frame, so all tiles must be rasterized
+     */
+    RasterStats getStats() const;
+};
+
+#endif //RAYTRACER_RASTERIZER_H
@@ -9,6 +9,7 @@
 #ifndef RAYTRACER_RAY_H
 #define RAYTRACER_RAY_H
 
+#include <cstdint>
 #include <glm/glm.hpp>
 #include "SceneObject.h"
 #include "Camera.h"
@@ -17,8 +18,35 @@
 #include "Plane.h"
 #include "Light.h"
 #include "Triangle.h"
+#include "Mesh.h"
 #include <vector>
 
+/**
+ * Where a ray hit the triangle of a mesh, which shading needs
+ * beyond the object that was hit
+ */
+struct MeshHit {
+    /**
+     * Geometric normal of the triangle, for compact and
+     * out-of-core meshes which keep no Triangle objects
+     */
+    glm::vec3 normal;
+
+    const Mesh* mesh = nullptr;
+
+    /**
+     * Index of the triangle in the order of Mesh::getIndices,
+     * or -1 for out-of-core meshes
+     */
+    int primitive = -1;
+
+    /**
+     * Barycentric coordinates of the point relative to
+     * the second and third vertex of the triangle
+     */
+    glm::vec2 barycentrics;
+};
+
 /**
  * Represents a ray with an origin and direction
  */
@@ -26,14 +54,50 @@ class Ray {
 public:
     glm::vec3 origin;
     glm::vec3 direction;
+    glm::vec3 inverseDirection;
+
+    /**
+     * The last triangle of a mesh hit by this ray
+     */
+    MeshHit meshHit;
+
+    /**
+     * Relative distance to a triangle edge below which the
+     * fast intersection test defers to the watertight one
+     */
+    constexpr static float EDGE_EPSILON = 1e-4f;
 
 private:
 
-    bool hasSphereIntersection(Sphere* sphere, glm::vec3 &intersection, float &distance);
+    bool hasSphereIntersection(Sphere* sphere, glm::vec3 &intersection, float &distance, bool cullBackfaces);
+
+    bool hasPlaneIntersection(Plane* plane, glm::vec3 &intersection, float &distance, bool cullBackfaces);
+
+    /**
+     * barycentrics are those of the second and third vertex
+     */
+    bool hasTriangleIntersection(Triangle* triangle, glm::vec3 &intersection, float &distance, bool cullBackfaces,
+                                 glm::vec2 &barycentrics);
+
+    bool hasTriangleIntersection(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c,
+                                 const glm::vec3 &edge1, const glm::vec3 &edge2,
+                                 glm::vec3 &intersection, float &distance, bool cullBackfaces,
+                                 glm::vec2 &barycentrics);
 
-    bool hasPlaneIntersection(Plane* plane, glm::vec3 &intersection, float &distance);
+    /**
+     * Tests the bounding box of the mesh first, then finds
+     * the closest of its triangles. hitObject is set to
+     * the triangle that was hit, or to the mesh itself for
+     * compact and out-of-core meshes, and meshHit to where
+     * its triangle was hit.
+     */
+    bool hasMeshIntersection(Mesh* mesh, glm::vec3 &intersection, float &distance, bool cullBackfaces, SceneObject* &hitObject);
 
-    bool hasTriangleIntersection(Triangle* triangle, glm::vec3 &intersection, float &distance);
+    /**
+     * Exact inside test used for rays that pass within
+     * rounding distance of a triangle edge
+     */
+    bool isInsideWatertight(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c);
 
 public:
     Ray(glm::vec3 &origin, glm::vec3 &direction);
@@ -42,6 +106,39 @@ public:
 
     bool intersects(SceneObject *target, glm::vec3 &intersection, float &distance);
 
+    /**
+     * Same as above, but back faces are only skipped when
+     * cullBackfaces is true. Shadow rays must not cull, since
+     * an object blocks the light whichever side faces it.
+     */
+    bool intersects(SceneObject *target, glm::vec3 &intersection, float &distance, bool cullBackfaces);
+
+    /**
+     * Full form of the intersection test. hitObject is the
+     * primitive that was actually hit, which is the target
+     * itself except for meshes, where it is the triangle.
+     */
+    bool intersects(SceneObject *target, glm::vec3 &intersection, float &distance, bool cullBackfaces, SceneObject* &hitObject);
+
+    /**
+     * Tests a single primitive of the target: for meshes the
+     * triangle of the given index, see Rasterizer::getCoverage,
+     * for anything else the target itself. Hits, intersection,
+     * hitObject and meshHit come out as they do from the full
+     * test when that triangle is the closest of the mesh.
+     */
+    bool intersectsPrimitive(SceneObject *target, int64_t primitive, glm::vec3 &intersection, float &distance,
+                             bool cullBackfaces, SceneObject* &hitObject);
+
+    /**
+     * Tests the triangle of the three given indices into
+     * positions, as compact and out-of-core meshes store them.
+     * A hit closer than closest updates closest, intersection,
+     * and the normal and barycentrics of meshHit.
+     */
+    bool hasIndexedTriangleIntersection(const glm::vec3* positions, const unsigned int* indices,
+                                        glm::vec3 &intersection, float &closest, bool cullBackfaces);
+
     /**
      * Creates a ray going from the center of the camera to the
      * given pixel
@@ -56,11 +153,27 @@ public:
      */
     static Ray toObject(glm::vec3 &origin, glm::vec3 &destination, float bias = 0.0f);
 
+    /**
+     * Creates a ray from a point on a surface towards any
+     * other point. The origin is pushed off the surface along
+     * the normal, on the side the ray leaves from, by an amount
+     * that scales with the magnitude of the coordinates.
+     */
+    static Ray toObject(const glm::vec3 &origin, const glm::vec3 &destination, const glm::vec3 &normal);
+
+    /**
+     * Offsets a point on a surface along the normal by a few
+     * units in the last place of each coordinate, which is enough
+     * to escape the rounding error of the intersection at any
+     * scale. Based on Wächter and Binder, Ray Tracing Gems (2019).
+     */
+    static glm::vec3 offsetOrigin(const glm::vec3 &point, const glm::vec3 &normal);
+
     /**
      * Returns true if a shadow ray from currentObject to light is
      * obscured by any of the other scene objects
      */
-    bool isLightBlockedBy(SceneObject* currentObject, Light* light, std::vector<SceneObject*> sceneObjects);
+    bool isLightBlockedBy(SceneObject* currentObject, Light* light, const std::vector<SceneObject*> &sceneObjects);
 };
 
 #endif //RAYTRACER_RAY_H
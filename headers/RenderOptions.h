@@ -0,0 +1,199 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_RENDEROPTIONS_H
+#define RAYTRACER_RENDEROPTIONS_H
+
+#include <thread>
+#include <algorithm>
+#include <cstddef>
+
+/**
+ * Settings that control how a frame is rendered, as
+ * opposed to what is rendered, which comes from the
+ * scene file. Rendering with the same options and seed
+ * gives the same image for any number of threads.
+ */
+struct RenderOptions {
+    /**
+     * Acceleration structures the scene index can use
+     * for its spheres and meshes
+     */
+    enum Accelerator {
+        automatic, bvh, grid
+    };
+
+    /**
+     * Processors the render threads are pinned to
+     */
+    enum Affinity {
+        unpinned, node, core
+    };
+
+    /**
+     * Number of render threads. 0 means two per logical core.
+     */
+    unsigned int threads = 0;
+
+    /**
+     * Width and height in pixels of the tiles handed
+     * out to the render threads
+     */
+    int tileSize = 16;
+
+    /**
+     * Jittered samples per pixel. With one sample the
+     * ray goes through the center of the pixel.
+     */
+    int samplesPerPixel = 1;
+
+    /**
+     * Most shadow rays sent to an area light from each hit.
+     * Hits send a few first and only the rest when those do
+     * not agree on whether the light is visible, i.e. when
+     * the hit is in the penumbra. A power of two.
+     */
+    int lightSamples = 16;
+
+    /**
+     * Seed of the per-pixel random sequences
+     */
+    unsigned int seed = 0;
+
+    /**
+     * Filter the noise of the frame once it is rendered,
+     * see Denoiser. The frame itself is still deterministic.
+     */
+    bool denoise = false;
+
+    /**
+     * Print a checksum of the framebuffer after rendering
+     */
+    bool checksum = false;
+
+    /**
+     * Show the result in a window after rendering
+     */
+    bool display = true;
+
+    /**
+     * Store meshes in the compact layout, with quantized
+     * wide BVH nodes and shared vertices, when memory is
+     * tighter than render time. Applies when a scene loads.
+     */
+    bool compactGeometry = false;
+
+    /**
+     * Structure over the bounded objects of the scene. The
+     * automatic choice looks at the objects, see SceneIndex.
+     */
+    Accelerator accelerator = automatic;
+
+    /**
+     * Bytes of mesh chunks kept in memory when meshes are
+     * loaded out of core. 0 keeps every mesh in memory.
+     * Applies when a scene loads.
+     */
+    size_t geometryBudget = 0;
+
+    /**
+     * Bytes of texture tiles kept in memory. Textures are
+     * always read tile by tile, whatever their size.
+     */
+    size_t textureBudget = (size_t)256 << 20;
+
+    /**
+     * Trace each tile in waves, all camera rays and then all
+     * shadow rays, sorted for coherence, instead of one pixel
+     * at a time. The image is the same either way.
+     */
+    bool wavefront = false;
+
+    /**
+     * Find what the camera rays hit by rasterizing the spheres
+     * and meshes instead, tracing only the pixels that cannot
+     * be decided that way. The image is the same either way.
+     * Only applies with one sample per pixel.
+     */
+    bool raster = false;
+
+    /**
+     * Pins each render thread to a NUMA node or to one core
+     * of it. Pinned threads first render the tiles of their
+     * node, a band of the screen whose pixels were first
+     * touched there. The geometry of a scene loaded with
+     * threads pinned is interleaved over the nodes.
+     */
+    Affinity affinity = unpinned;
+
+    /**
+     * Worker processes started on this host to render the
+     * tiles of a frame, see TileCoordinator
+     */
+    unsigned int workers = 0;
+
+    /**
+     * TCP port on which the coordinator also accepts workers
+     * from other hosts. -1 only accepts the local workers.
+     */
+    int listenPort = -1;
+
+    /**
+     * Whether the frame is rendered by worker processes
+     */
+    inline bool isDistributed() const {
+        return workers > 0 || listenPort >= 0;
+    };
+
+    inline unsigned int getThreadCount() const {
+        return threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency() * 2);
+    };
+};
+
+/**
+ * Counters collected while rendering. Every tile keeps its
+ * own counters, which are added up in tile order once all
+ * threads are done.
+ */
+struct RenderStats {
+    unsigned long long primaryRays = 0;
+    unsigned long long shadowRays = 0;
+
+    /**
+     * Shadow rays sent to area lights, for how many pairs
+     * of a hit and an area light, and how many of those
+     * pairs were found in the penumbra
+     */
+    unsigned long long areaShadowRays = 0;
+    unsigned long long areaLightHits = 0;
+    unsigned long long penumbraHits = 0;
+
+    inline RenderStats& operator+=(const RenderStats &other) {
+        primaryRays += other.primaryRays;
+        shadowRays += other.shadowRays;
+        areaShadowRays += other.areaShadowRays;
+        areaLightHits += other.areaLightHits;
+        penumbraHits += other.penumbraHits;
+        return *this;
+    };
+};
+
+/**
+ * What the threads of one NUMA node did during a render.
+ * The time is until the last of them ran out of tiles.
+ */
+struct NodeStats {
+    int node = 0;
+    unsigned int threads = 0;
+    int tiles = 0;
+    int stolenTiles = 0;
+    double seconds = 0.0;
+    RenderStats rays;
+};
+
+#endif //RAYTRACER_RENDEROPTIONS_H
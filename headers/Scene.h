@@ -16,6 +16,20 @@
 #include "Light.h"
 #include "Pixel.h"
 #include "Ray.h"
+#include "RenderOptions.h"
+#include "SceneIndex.h"
+#include "GeometryCache.h"
+#include "Wavefront.h"
+#include "Rasterizer.h"
+#include "Topology.h"
+#include "ImageWriter.h"
+#include "SceneGeometry.h"
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <future>
+#include <cstdint>
 #include <boost/filesystem.hpp>
 
 /**
@@ -27,22 +41,112 @@ class Scene {
 private:
     int width;
     int height;
-    Camera* camera;
+    Camera* camera = nullptr;
     std::vector<Light*> lights;
-    std::vector<SceneObject*> sceneObjects;
-    Pixel** screen;
-    boost::filesystem::path scenePath;
+    Pixel** screen = nullptr;
+
+    /**
+     * Objects and acceleration structures, shared with
+     * the copies of this scene
+     */
+    std::shared_ptr<SceneGeometry> geometry;
+
+    /**
+     * Materials this scene gives objects in place
+     * of their own, by object id
+     */
+    std::unordered_map<int, Material> materials;
+
+    /**
+     * G-buffer of the frame being rendered, used when
+     * rasterized is set
+     */
+    Rasterizer rasterizer;
+    bool rasterized = false;
+
+    /**
+     * NUMA nodes the frame is rendered on, a single one
+     * unless threads are pinned, and what each one did
+     */
+    std::vector<NumaNode> nodes;
+    std::vector<NodeStats> nodeStats;
+
+    /**
+     * Tile size the rows of the screen were last
+     * placed on the nodes for, 0 if they were not
+     */
+    int placedTileSize = 0;
 
 public:
     const static int MAX_DEPTH = 10;
 
+    /**
+     * Shadow rays sent to an area light from every hit to
+     * find whether the hit is in its penumbra, and the most
+     * that can be sent to it in all
+     */
+    const static int PENUMBRA_SAMPLES = 4;
+    const static int MAX_LIGHT_SAMPLES = 64;
+
 private:
 
     /**
-     * Calculates the color at a given point of an
-     * object
+     * Calculates the color at a given point of an object,
+     * hit by the given sample of the pixel at x, y, and the
+     * features of the surface there
      */
-    glm::vec3 getIlluminationAt(Ray &ray, SceneObject* &object, glm::vec3 &intersection);
+    glm::vec3 getIlluminationAt(Ray &ray, SceneObject* &object, glm::vec3 &intersection, const RenderOptions &options,
+                                int x, int y, int sample, PixelFeatures &features, RenderStats &stats);
+
+    /**
+     * Points of an area light that the shadow rays from a hit
+     * go to, from the first sample of its sequence on. The
+     * sequence is scrambled for each sample of each pixel and
+     * each light, so it does not depend on the render order.
+     */
+    void getLightTargets(int light, const glm::vec3 &point, const RenderOptions &options, int x, int y, int sample,
+                         int first, int count, glm::vec3* targets) const;
+
+    /**
+     * Shadow rays sent to an area light from a hit whose
+     * first ones found the given number of visible samples
+     */
+    inline int getLightSampleCount(int visible, const RenderOptions &options) const {
+        int initial = std::min(PENUMBRA_SAMPLES, options.lightSamples);
+        return visible == 0 || visible == initial ? initial : options.lightSamples;
+    };
+
+    /**
+     * Closest hit of the camera ray through a pixel, looked
+     * up in the G-buffer when the frame is rasterized
+     */
+    bool getPrimaryHit(int x, int y, Ray &ray, Hit &hit) const;
+
+    /**
+     * Normal to shade a hit with, interpolated from the vertex
+     * normals of meshes that have them, and the normal of the
+     * surface itself, which shadow rays are offset along. Both
+     * are turned towards the viewer for double sided objects.
+     * Returns false for objects that are not shaded.
+     */
+    bool getShadingNormal(const Ray &ray, SceneObject* object, const glm::vec3 &intersection, glm::vec3 &normal,
+                          glm::vec3 &geometricNormal) const;
+
+    /**
+     * Material to shade a hit with: that of the object, times
+     * the color of its texture at the hit for textured meshes
+     */
+    Material getSurfaceMaterial(const Ray &ray, const SceneObject* object, const glm::vec3 &intersection,
+                                const glm::vec3 &normal) const;
+
+    /**
+     * Object the shadow rays of a hit must ignore. A compact
+     * or out-of-core mesh is hit as a whole, and its triangles
+     * can still shadow each other.
+     */
+    inline const SceneObject* getShadowCaster(SceneObject* object) const {
+        return object->type == SceneObject::mesh ? nullptr : object;
+    };
 
     /**
      * Initialize the array of pixels that represent
@@ -50,7 +154,26 @@ private:
      */
     void initializeScreen();
 
-    void deepCopy(const Scene& other);
+    /**
+     * Node whose threads render a row of pixels. The screen is
+     * cut into one band of whole tile rows per node.
+     */
+    inline int getRowNode(int y, int tileSize) const {
+        int tileRows = (height + tileSize - 1) / tileSize;
+        return (int)((long long)(y / tileSize) * (int)nodes.size() / tileRows);
+    };
+
+    /**
+     * Moves every row of pixels to memory first touched by a
+     * thread running on the node that renders it
+     */
+    void placeScreen(int tileSize);
+
+    /**
+     * Shares the geometry of the other scene and copies
+     * its camera, lights, materials and screen size
+     */
+    void copyFrom(const Scene& other);
 
     void deallocateResources();
 
@@ -58,16 +181,29 @@ private:
      * Use raytracing to calculate the pixel color
      * at the given screen coordinates
      */
-    inline void raytrace(int &x, int &y);
+    void raytrace(int x, int y, const RenderOptions &options, RenderStats &stats);
+
+    /**
+     * Same result as raytrace for every pixel of a tile, but
+     * each stage runs over the whole tile before the next one:
+     * all camera rays are traced, then all shadow rays, then
+     * all hits are shaded
+     */
+    void raytraceTile(int tx, int ty, int tw, int th, const RenderOptions &options, Wavefront &wavefront, RenderStats &stats);
 
 public:
-    Scene() {camera = nullptr; screen = nullptr;};
+    Scene() {};
 
-    Scene(std::string filename) : Scene(0,0,filename) {};
+    Scene(std::string filename, const RenderOptions &options = RenderOptions()) : Scene(0,0,filename,options) {};
 
+    /**
+     * Copies share the objects and acceleration structures of
+     * the scene, and have their own camera, lights, materials
+     * and screen to render variations of it with
+     */
     Scene(const Scene& other);
 
-    Scene(unsigned int width, unsigned int height, const std::string &filename);
+    Scene(unsigned int width, unsigned int height, const std::string &filename, const RenderOptions &options = RenderOptions());
 
     ~Scene();
 
@@ -77,10 +213,129 @@ public:
      * Raytraces the image and outputs an image at the
      * given file path
      */
-    void renderToImage(const char* filename);
+    void renderToImage(const char* filename, const RenderOptions &options = RenderOptions());
+
+    /**
+     * Raytraces the image on all threads, showing the
+     * progress and printing statistics when done
+     */
+    void render(const RenderOptions &options);
+
+    /**
+     * Raytraces the image in square tiles, starting from the
+     * center of the screen and moving outwards. The callback is
+     * invoked from the render threads as soon as each tile is
+     * finished, so it must be thread safe.
+     */
+    RenderStats renderTiles(const RenderOptions &options, const std::function<void(int x, int y, int w, int h)> &onTileDone);
+
+    /**
+     * Corners of the square tiles covering the screen,
+     * in the order they are rendered
+     */
+    std::vector<glm::ivec2> getTileOrder(int tileSize) const;
+
+    /**
+     * Prepares what the tiles of a frame share. Must be called
+     * before renderTile, with the same options, and again
+     * whenever the scene or the options change.
+     */
+    void beginFrame(const RenderOptions &options);
+
+    /**
+     * Raytraces the pixels of one tile. Tiles can be rendered
+     * from different threads at the same time, each with its
+     * own wavefront buffers.
+     */
+    void renderTile(int tx, int ty, int tw, int th, const RenderOptions &options, Wavefront &wavefront, RenderStats &stats);
+
+    /**
+     * Saves the colors on screen to an image file, printing
+     * their checksum and showing them if asked to
+     */
+    void saveImage(const char* filename, const RenderOptions &options);
+
+    /**
+     * Like saveImage, without showing the image, and encodes
+     * it in the background. The screen can be rendered again
+     * or the scene deleted before the encoding is done.
+     */
+    std::future<void> saveImageAsync(const char* filename, const RenderOptions &options) const;
+
+    /**
+     * Copy of the colors on screen
+     */
+    Image getImage() const;
+
+    /**
+     * Hash of the rendered image, to compare renders
+     * without storing the images
+     */
+    uint64_t getChecksum() const;
+
+    /**
+     * Recalculates the camera coordinate system and the
+     * position of every pixel. Must be called after the
+     * camera properties change.
+     */
+    void resetView();
+
+    /**
+     * Rebuilds the index over the scene objects. Must be
+     * called after objects move, resize or change sides.
+     */
+    void updateIndex();
 
     bool isSceneLoaded();
 
+    inline int getWidth() const {return width;};
+
+    inline int getHeight() const {return height;};
+
+    inline Camera* getCamera() {return camera;};
+
+    inline std::vector<Light*>& getLights() {return lights;};
+
+    inline const std::vector<SceneObject*>& getSceneObjects() const {return geometry->getObjects();};
+
+    /**
+     * Objects to change in place, which is only allowed
+     * while no copy of the scene shares them
+     */
+    std::vector<SceneObject*>& editSceneObjects();
+
+    inline bool isGeometryShared() const {return geometry.use_count() > 1;};
+
+    /**
+     * Material of an object in this scene, its own
+     * unless the scene overrides it
+     */
+    inline Material getMaterial(const SceneObject* object) const {
+        if(!materials.empty()) {
+            auto found = materials.find(object->id);
+            if(found != materials.end()) {
+                return found->second;
+            }
+        }
+        return object->getMaterial();
+    };
+
+    /**
+     * Overrides the material of the object at the given
+     * index for this scene only
+     */
+    void setMaterial(int object, const Material &material);
+
+    inline boost::filesystem::path& getScenePath() {return geometry->getScenePath();};
+
+    inline const glm::vec3& getColor(int x, int y) const {return screen[y][x].color;};
+
+    inline void setColor(int x, int y, const glm::vec3 &color) {screen[y][x].color = color;};
+
+    inline const GeometryCache* getGeometryCache() const {return geometry->getGeometryCache();};
+
+    inline const TextureCache* getTextureCache() const {return geometry->getTextureCache();};
+
 };
 
 #endif //RAYTRACER_SCENE_H
@@ -0,0 +1,78 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_SCENEFILE_H
+#define RAYTRACER_SCENEFILE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "SceneObject.h"
+#include "Plane.h"
+#include "Sphere.h"
+#include "Light.h"
+#include "Camera.h"
+#include "GeometryCache.h"
+#include <boost/filesystem.hpp>
+
+/**
+ * Planes and spheres of a binary scene, constructed in one
+ * array per type instead of one allocation each. The scene
+ * objects point into these.
+ */
+struct SceneArrays {
+    std::vector<Plane> planes;
+    std::vector<Sphere> spheres;
+};
+
+/**
+ * Binary scene files, converted once from the text format and
+ * then loaded without parsing. The file is memory mapped and
+ * holds fixed size records, one array per type, all in native
+ * byte order:
+ *
+ *   Header      magic "RTSCENE", version, counts, camera
+ *   uint32_t    order[objects]   type << 30 | index, in the
+ *                                order of the text file
+ *   Record      planes[planes], spheres[spheres]
+ *   LightRecord lights[lights]
+ *   MeshRecord  meshes[meshes]
+ *   char        paths[pathBytes] of the .obj files and textures,
+ *                                relative to the binary file
+ *
+ * Meshes are still read from their .obj files, and out of core
+ * through the geometry cache when one is given, and textures
+ * from their images. Version 2 added the texture paths, and
+ * version 3 the shapes of area lights.
+ */
+class SceneFile {
+public:
+    const static uint32_t VERSION = 3;
+
+    /**
+     * Reads the text scene with Loader::loadScene and writes
+     * it as a binary scene. Returns the size of that file.
+     */
+    static size_t convert(const std::string &textFile, const std::string &binaryFile);
+
+    /**
+     * Whether the file starts like a binary scene
+     */
+    static bool isBinary(const std::string &filename);
+
+    /**
+     * Fills the arrays from the file and points the objects into
+     * them. Only the meshes, lights and camera are allocated one
+     * by one.
+     */
+    static void load(const std::string &filename, std::vector<SceneObject*> &sceneObjects, std::vector<Light*> &lights,
+                     Camera* &camera, boost::filesystem::path &scenePath, GeometryCache* geometryCache,
+                     unsigned int threads, SceneArrays &arrays);
+};
+
+#endif //RAYTRACER_SCENEFILE_H
@@ -0,0 +1,113 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_SCENEGEOMETRY_H
+#define RAYTRACER_SCENEGEOMETRY_H
+
+#include <string>
+#include <vector>
+#include "SceneObject.h"
+#include "Light.h"
+#include "Camera.h"
+#include "RenderOptions.h"
+#include "SceneIndex.h"
+#include "GeometryCache.h"
+#include "TextureCache.h"
+#include "TiledTexture.h"
+#include "SceneFile.h"
+#include <boost/filesystem.hpp>
+
+/**
+ * The objects of a scene, the meshes with their BVHs and the
+ * index over them. Once built it is only read, so that copies
+ * of a Scene share one instead of loading the meshes again.
+ * The camera, lights and materials, which copies may change,
+ * are kept by each Scene.
+ */
+class SceneGeometry {
+private:
+    std::vector<SceneObject*> objects;
+    boost::filesystem::path scenePath;
+    SceneIndex index;
+    RenderOptions::Accelerator accelerator = RenderOptions::automatic;
+
+    /**
+     * Chunks of the out-of-core meshes in memory, or
+     * nullptr when meshes are kept whole
+     */
+    GeometryCache* geometryCache = nullptr;
+
+    /**
+     * Textures of the meshes, one per image however many
+     * meshes use it, and their tiles in memory. The cache
+     * is only created once a mesh has a texture.
+     */
+    std::vector<TiledTexture*> textures;
+    TextureCache* textureCache = nullptr;
+    size_t textureBudget;
+
+    /**
+     * Planes and spheres of a binary scene, which the
+     * objects point into, or nullptr for a text scene
+     */
+    SceneArrays* arrays = nullptr;
+
+    void deallocateResources();
+
+    /**
+     * Opens the textures of the meshes that name one and do
+     * not have it yet, writing the tiled file of an image
+     * first if it is missing or out of date
+     */
+    void openTextures();
+
+public:
+    /**
+     * Loads a text or binary scene file. Its lights and
+     * camera are handed to the caller, which owns them.
+     */
+    SceneGeometry(const std::string &filename, const RenderOptions &options, std::vector<Light*> &lights,
+                  Camera* &camera);
+
+    ~SceneGeometry();
+
+    SceneGeometry(const SceneGeometry &) = delete;
+    SceneGeometry& operator=(const SceneGeometry &) = delete;
+
+    /**
+     * Builds the BVH of every mesh and prints its build
+     * time, quality metrics and memory usage, then the
+     * index over all the objects
+     */
+    void buildAccelerationStructures(const RenderOptions &options);
+
+    /**
+     * Rebuilds the index over the objects after they were
+     * edited, with the accelerator it was built with, and
+     * opens the textures they were given
+     */
+    void updateIndex();
+
+    inline const std::vector<SceneObject*>& getObjects() const {return objects;};
+
+    inline std::vector<SceneObject*>& getObjects() {return objects;};
+
+    inline const SceneIndex& getIndex() const {return index;};
+
+    inline boost::filesystem::path& getScenePath() {return scenePath;};
+
+    inline const GeometryCache* getGeometryCache() const {return geometryCache;};
+
+    /**
+     * Tiles of the textures in memory, or nullptr when
+     * no mesh has a texture
+     */
+    inline TextureCache* getTextureCache() const {return textureCache;};
+};
+
+#endif //RAYTRACER_SCENEGEOMETRY_H
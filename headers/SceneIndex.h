@@ -0,0 +1,135 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_SCENEINDEX_H
+#define RAYTRACER_SCENEINDEX_H
+
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "SceneObject.h"
+#include "Plane.h"
+#include "Ray.h"
+#include "BVH.h"
+#include "UniformGrid.h"
+#include "RenderOptions.h"
+
+/**
+ * Closest intersection found by the scene index
+ */
+struct Hit {
+    /**
+     * The object to shade: the triangle that was hit
+     * for meshes with Triangle objects
+     */
+    SceneObject* object = nullptr;
+    glm::vec3 point;
+    float distance = HUGE_VALF;
+
+    /**
+     * The triangle that was hit for meshes, see Ray::meshHit
+     */
+    MeshHit meshHit;
+};
+
+/**
+ * Top level acceleration structure over the objects of a scene.
+ * Planes are infinite and would make every node of a spatial index
+ * infinite too, so they are kept apart in flat arrays and tested
+ * in one tight loop. Spheres and meshes are bounded and go into a
+ * BVH over their bounding boxes, or into a uniform grid for scenes
+ * of many spheres of similar size. Queries test the planes first,
+ * so that the BVH or grid can skip whatever is behind the nearest
+ * plane.
+ */
+class SceneIndex {
+private:
+    std::vector<Plane*> planes;
+    std::vector<float> planeX, planeY, planeZ;
+    std::vector<float> normalX, normalY, normalZ;
+    std::vector<char> planeDoubleSided;
+
+    std::vector<SceneObject*> boundedObjects;
+    BVH bvh;
+    UniformGrid grid;
+    bool useGrid = false;
+
+    /**
+     * Index of the closest plane hit closer than
+     * maxDistance, or -1
+     */
+    int intersectPlanes(const Ray &ray, float maxDistance, bool cullBackfaces, const SceneObject* skip, float &t) const;
+
+    /**
+     * Picks the grid for large sets of bounded objects that
+     * are nearly all spheres of similar radius, the BVH for
+     * everything else
+     */
+    static bool prefersGrid(const std::vector<SceneObject*> &bounded);
+
+public:
+    /**
+     * The grid is only considered from this many
+     * bounded objects
+     */
+    const static int GRID_MIN_OBJECTS = 1024;
+
+    /**
+     * Largest ratio between the radii of the spheres
+     * for which the grid is considered
+     */
+    constexpr static float GRID_MAX_RADIUS_RATIO = 4.0f;
+
+    SceneIndex() = default;
+
+    SceneIndex(const SceneIndex& other) = delete;
+
+    SceneIndex& operator=(const SceneIndex& other) = delete;
+
+    /**
+     * Sorts the objects into planes and bounded objects and
+     * builds the BVH or grid over the latter. Must be called
+     * again after objects move or change.
+     */
+    void build(const std::vector<SceneObject*> &objects, unsigned int threads,
+               RenderOptions::Accelerator accelerator = RenderOptions::automatic);
+
+    /**
+     * Closest hit of a camera ray. Back faces are culled
+     * for the objects that are not double sided.
+     */
+    bool closestHit(Ray &ray, Hit &hit) const;
+
+    /**
+     * Closest hit of a camera ray whose nearest sphere or mesh
+     * is already known, e.g. from Rasterizer: only the planes
+     * and that primitive are tested. candidate is nullptr when
+     * the ray misses every bounded object. Falls back to the
+     * full query if the ray misses the candidate after all.
+     */
+    bool closestHit(Ray &ray, Hit &hit, SceneObject* candidate, int64_t primitive) const;
+
+    /**
+     * True if anything other than skip lies on the ray closer
+     * than maxDistance. Back faces block too, since single
+     * sided objects still cast shadows from both sides.
+     */
+    bool isOccluded(Ray &ray, float maxDistance, const SceneObject* skip) const;
+
+    inline size_t getPlaneCount() const {return planes.size();};
+
+    inline size_t getBoundedCount() const {return boundedObjects.size();};
+
+    inline const BVH& getBVH() const {return bvh;};
+
+    inline const UniformGrid& getGrid() const {return grid;};
+
+    inline bool isUsingGrid() const {return useGrid;};
+};
+
+#endif //RAYTRACER_SCENEINDEX_H
@@ -11,6 +11,16 @@
 
 #include <glm/glm.hpp>
 
+/**
+ * How a surface reflects light
+ */
+struct Material {
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    float shininess;
+};
+
 /**
  * The base class of all objects on the scene
  */
@@ -27,10 +37,26 @@ public:
     float shininess;
     Type type;
 
+    /**
+     * Double sided objects can be hit from behind. Single
+     * sided ones are invisible from the back, but still
+     * cast shadows from both sides.
+     */
+    bool doubleSided{false};
+
+    /**
+     * Index of the object in its scene. The triangles
+     * of a mesh have the index of the mesh.
+     */
+    int id{-1};
+
+    inline Material getMaterial() const {return {ambient, diffuse, specular, shininess};};
+
     virtual inline void setAmbient(glm::vec3 ambient) {this->ambient = ambient;};
     virtual inline void setDiffuse(glm::vec3 diffuse) {this->diffuse = diffuse;};
     virtual inline void setSpecular(glm::vec3 specular) {this->specular = specular;};
     virtual inline void setShininess(float shininess) {this->shininess = shininess;};
+    virtual inline void setDoubleSided(bool doubleSided) {this->doubleSided = doubleSided;};
     virtual ~SceneObject() = default;
     friend inline bool operator==(const SceneObject& lhs, const SceneObject& rhs);
 };
@@ -0,0 +1,91 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_SCENEPARSER_H
+#define RAYTRACER_SCENEPARSER_H
+
+#include <string>
+#include <glm/glm.hpp>
+#include <boost/utility/string_view.hpp>
+#include "MappedFile.h"
+
+/**
+ * Reads a scene file line by line without copying it. The file
+ * is memory mapped and the words of the current line are views
+ * into it, split on spaces, tabs and carriage returns. Numbers
+ * are parsed in place and give the same floats as std::stof,
+ * but a word that is not entirely a number is an error.
+ */
+class SceneParser {
+public:
+    /**
+     * Words of a line past this many are ignored
+     */
+    const static int MAX_WORDS = 8;
+
+    /**
+     * Maps the file, throwing std::invalid_argument
+     * if it cannot be read
+     */
+    explicit SceneParser(const std::string &filename);
+
+    /**
+     * Parses text that outlives the parser
+     */
+    explicit SceneParser(boost::string_view text);
+
+    ~SceneParser();
+
+    SceneParser(const SceneParser &) = delete;
+    SceneParser& operator=(const SceneParser &) = delete;
+
+    /**
+     * Moves to the next line, blank or not.
+     * Returns false past the last one.
+     */
+    bool next();
+
+    /**
+     * One-based number of the current line
+     */
+    inline int getLineNumber() const {return lineNumber;};
+    inline int getWordCount() const {return wordCount;};
+
+    /**
+     * Throws std::invalid_argument naming the first
+     * word of the line if there is no such word
+     */
+    boost::string_view getWord(int index) const;
+    float getFloat(int index) const;
+    int getInt(int index) const;
+
+    /**
+     * The three numbers from the given word on
+     */
+    glm::vec3 getVec3(int index) const;
+
+    /**
+     * Parses a whole word as a float like strtof. Returns
+     * false if it is empty or not entirely a number.
+     */
+    static bool parseFloat(boost::string_view word, float &value);
+    static bool parseInt(boost::string_view word, int &value);
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+
+    MappedFile* file = nullptr;
+
+    int lineNumber = 0;
+    int wordCount = 0;
+    boost::string_view words[MAX_WORDS];
+};
+
+#endif //RAYTRACER_SCENEPARSER_H
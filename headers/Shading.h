@@ -0,0 +1,199 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_SHADING_H
+#define RAYTRACER_SHADING_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "SceneObject.h"
+#include "Light.h"
+
+/**
+ * log2 of a positive float: the exponent is read from the bits
+ * and a polynomial in the mantissa does the rest. Absolute error
+ * is within 3e-6. Zero comes out as -127.
+ */
+inline float fastLog2(float x) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    float exponent = (float)((int32_t)(bits >> 23) - 127);
+    bits = (bits & 0x007fffffu) | 0x3f800000u;
+    float t;
+    std::memcpy(&t, &bits, sizeof(t));
+    t -= 1.0f;
+
+    float p = -0.02512318f;
+    p = p * t + 0.11929818f;
+    p = p * t - 0.27462318f;
+    p = p * t + 0.45552707f;
+    p = p * t - 0.71755785f;
+    p = p * t + 1.44247532f;
+    p = p * t + 2.1237527e-6f;
+    return exponent + p;
+}
+
+/**
+ * 2 to the power of x, relative error within 2e-7 and exactly
+ * 1 at 0. The integer part goes into the exponent bits, a
+ * polynomial handles the fraction. Results are clamped to the
+ * normal float range.
+ */
+inline float fastExp2(float x) {
+    x = std::min(std::max(x, -126.0f), 126.0f);
+    int32_t whole = (int32_t)x;
+    whole -= (x < (float)whole) ? 1 : 0;
+    float f = x - (float)whole;
+
+    float p = 0.0018762329f;
+    p = p * f + 0.0089925844f;
+    p = p * f + 0.0558236055f;
+    p = p * f + 0.2401545346f;
+    p = p * f + 0.6931529641f;
+    p = p * f + 1.0f;
+
+    uint32_t bits = (uint32_t)(whole + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return scale * p;
+}
+
+/**
+ * pow for x in [0, 1] and y >= 0, which is all a specular
+ * highlight needs. Relative error grows with y, about 1e-4 at
+ * a shininess of 100, far below what 8 bit output can show.
+ * Results under 2^-100 are flushed to zero: multiplied by the
+ * colors they would become denormals, which are many times
+ * slower to compute with. pow(0, 0) is 1, like std::pow.
+ */
+inline float fastPow(float x, float y) {
+    float exponent = y * fastLog2(x);
+    float result = fastExp2(exponent);
+    return (x > 0.0f && exponent > -100.0f) ? result : (y == 0.0f ? 1.0f : 0.0f);
+}
+
+/**
+ * Direction from a point to the eye, or zero
+ * if the point is the eye itself
+ */
+inline glm::vec3 getViewDirection(const glm::vec3 &eye, const glm::vec3 &point) {
+    return (eye != point) ? glm::normalize(eye - point) : glm::vec3(0.0f);
+}
+
+/**
+ * Diffuse and specular factors of the Phong model from the dot
+ * products of the normal n, the direction to the light l and
+ * the view direction v. The reflection of l is never formed:
+ * r.v = 2(l.n)(n.v) - l.v, and n.v is the same for all lights.
+ */
+inline void getPhongFactors(float ln, float nv, float lv, float shininess, float &diffuse, float &specular) {
+    diffuse = std::max(0.0f, ln);
+    float rv = std::max(0.0f, 2.0f * ln * nv - lv);
+    specular = fastPow(rv, shininess);
+}
+
+/**
+ * Diffuse and specular light reaching a point from a light that
+ * is not occluded, l being the direction to the light. Gives
+ * the same result as one lane of shadeBatch.
+ */
+inline glm::vec3 getPhongContribution(const Material &material, const Light* light, const glm::vec3 &normal,
+                                      const glm::vec3 &view, float nv, const glm::vec3 &l) {
+    float ln = l.x * normal.x + l.y * normal.y + l.z * normal.z;
+    float lv = l.x * view.x + l.y * view.y + l.z * view.z;
+    float diffuse, specular;
+    getPhongFactors(ln, nv, lv, material.shininess, diffuse, specular);
+    return material.diffuse * light->diffuse * diffuse + material.specular * light->specular * specular;
+}
+
+/**
+ * Clamps a color channel to [0, 1]
+ */
+inline float clampUnit(float x) {
+    return std::min(std::max(x, 0.0f), 1.0f);
+}
+
+/**
+ * Hits to be shaded together, one array per component so the
+ * kernel runs over many hits at once in SIMD registers. The
+ * arrays of the lights hold the direction to each light and
+ * whether it is visible, light after light, each one with an
+ * entry for every hit.
+ */
+struct ShadingBatch {
+    int count = 0;
+    int lightCount = 0;
+
+    std::vector<float> normalX, normalY, normalZ;
+    std::vector<float> viewX, viewY, viewZ, normalDotView;
+    std::vector<float> ambientR, ambientG, ambientB;
+    std::vector<float> diffuseR, diffuseG, diffuseB;
+    std::vector<float> specularR, specularG, specularB;
+    std::vector<float> shininess;
+
+    std::vector<float> lightX, lightY, lightZ, visible;
+
+    std::vector<float> red, green, blue;
+
+    /**
+     * Makes room for the given number of hits and lights,
+     * keeping the memory of earlier batches
+     */
+    void resize(int count, int lightCount);
+
+    /**
+     * Normal and view direction at hit i and
+     * the material of the object hit
+     */
+    inline void setHit(int i, const glm::vec3 &normal, const glm::vec3 &view, const Material &material) {
+        normalX[i] = normal.x;
+        normalY[i] = normal.y;
+        normalZ[i] = normal.z;
+        viewX[i] = view.x;
+        viewY[i] = view.y;
+        viewZ[i] = view.z;
+        normalDotView[i] = glm::dot(normal, view);
+        ambientR[i] = material.ambient.x;
+        ambientG[i] = material.ambient.y;
+        ambientB[i] = material.ambient.z;
+        diffuseR[i] = material.diffuse.x;
+        diffuseG[i] = material.diffuse.y;
+        diffuseB[i] = material.diffuse.z;
+        specularR[i] = material.specular.x;
+        specularG[i] = material.specular.y;
+        specularB[i] = material.specular.z;
+        shininess[i] = material.shininess;
+    };
+
+    /**
+     * Direction from hit i to a light and the weight of its
+     * light there: 1 if it is visible and 0 if it is not, or
+     * a share of an area light for each of its samples
+     */
+    inline void setLight(int i, int light, const glm::vec3 &direction, float weight) {
+        size_t entry = (size_t)light * count + i;
+        lightX[entry] = direction.x;
+        lightY[entry] = direction.y;
+        lightZ[entry] = direction.z;
+        visible[entry] = weight;
+    };
+
+    inline glm::vec3 getColor(int i) const {return glm::vec3(red[i], green[i], blue[i]);};
+};
+
+/**
+ * Phong shading of every hit of the batch for all the lights,
+ * ambient included and clamped like the depth first path. The
+ * lights must be the ones the batch was filled with, in order.
+ */
+void shadeBatch(ShadingBatch &batch, const std::vector<Light*> &lights);
+
+#endif //RAYTRACER_SHADING_H
@@ -0,0 +1,39 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_SOCKETIO_H
+#define RAYTRACER_SOCKETIO_H
+
+#include <string>
+#include <cstddef>
+
+/**
+ * Reads and writes of the line based protocols spoken
+ * over sockets by the preview server and the tile
+ * coordinator and its workers
+ */
+class SocketIO {
+public:
+    /**
+     * Takes the next complete line out of the bytes
+     * received so far, without the line break
+     */
+    static bool takeLine(std::string &buffer, std::string &line);
+
+    /**
+     * Receives until a complete line is buffered. Returns
+     * false when the peer closed the connection first.
+     */
+    static bool readLine(int socket, std::string &buffer, std::string &line);
+
+    static void writeAll(int socket, const void* data, size_t length);
+
+    static void writeLine(int socket, const std::string &line);
+};
+
+#endif //RAYTRACER_SOCKETIO_H
@@ -0,0 +1,33 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_TEXTURECACHE_H
+#define RAYTRACER_TEXTURECACHE_H
+
+#include "LRUCache.h"
+
+class TiledTexture;
+struct TextureTile;
+
+/**
+ * Texture tiles that are currently in memory, shared by all
+ * the textures of a scene. Lookups hold on to the tiles they
+ * are filtering. Lookups that find their tile count as hits
+ * and the others, the page-ins of the stats, as misses.
+ */
+class TextureCache : public LRUCache<TiledTexture, TextureTile> {
+public:
+    /**
+     * Budget in bytes for the tiles kept in memory
+     */
+    explicit TextureCache(size_t budget) : LRUCache(budget) {};
+};
+
+extern template class LRUCache<TiledTexture, TextureTile>;
+
+#endif //RAYTRACER_TEXTURECACHE_H
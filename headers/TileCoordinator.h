@@ -0,0 +1,161 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_TILECOORDINATOR_H
+#define RAYTRACER_TILECOORDINATOR_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <sys/types.h>
+#include "Scene.h"
+#include "RenderOptions.h"
+
+/**
+ * Renders one frame across worker processes, on this host or
+ * on others, instead of threads of one process. The screen is
+ * split into the usual tiles, which are handed out center first
+ * over TCP to whichever worker has room for more. Each worker
+ * loads the scene file itself, so remote hosts need it at the
+ * same absolute path. The protocol is line based like the one
+ * of the preview server, the coordinator speaking first:
+ *
+ *   scene [samples per pixel] [light samples] [seed] [tile size] [scene file path]
+ *                                  -> ok [width] [height] [threads]
+ *   tile [x] [y] [w] [h]           -> tile [x] [y] [w] [h] + w*h*3 floats of RGB
+ *   quit                           -> closes the connection
+ *
+ * Any failing command is answered with "error [message]".
+ * Colors travel as the raw floats of the framebuffer, so the
+ * image is the one a single process would render, as long as
+ * all hosts have the same byte order.
+ *
+ * A worker that disconnects, fails or stops answering has its
+ * tiles handed out again. Local workers that die are restarted.
+ */
+class TileCoordinator {
+private:
+    struct Tile {
+        int x, y, w, h;
+        int attempts = 0;
+        bool done = false;
+    };
+
+    struct Worker {
+        int socket = -1;
+        std::string buffer;
+        bool ready = false;
+        int capacity = 0;
+        std::vector<int> tiles;
+        std::chrono::steady_clock::time_point lastReply;
+
+        /**
+         * Tile whose colors are being received
+         * and how many bytes of them to expect
+         */
+        int receiving = -1;
+        size_t payloadBytes = 0;
+    };
+
+    Scene &scene;
+    std::string scenePath;
+    std::string programPath;
+    RenderOptions options;
+    int tileSize;
+    int tilesX;
+
+    int listenSocket = -1;
+    int port = 0;
+    std::vector<Tile> tiles;
+    std::deque<int> queue;
+    std::vector<Worker> workers;
+    std::vector<pid_t> processes;
+    int remainingTiles = 0;
+    int retries = 0;
+    int restarts = 0;
+
+public:
+    /**
+     * Seconds a worker may keep tiles without
+     * sending any back before it is dropped
+     */
+    constexpr static double WORKER_TIMEOUT = 60.0;
+
+    /**
+     * Times a tile is handed out before the
+     * frame is given up on
+     */
+    const static int MAX_ATTEMPTS = 3;
+
+    /**
+     * Tiles in flight per render thread of a worker
+     */
+    const static int TILES_PER_THREAD = 2;
+
+private:
+    void listen();
+
+    /**
+     * Starts a worker process connecting back to this one,
+     * with the load options and a share of the threads
+     */
+    void startWorker();
+
+    /**
+     * Collects local workers that exited and restarts them
+     * while tiles are left
+     */
+    void reapWorkers();
+
+    /**
+     * Waits for the local workers to exit, killing
+     * those still running after the grace period
+     */
+    void stopWorkers(double gracePeriod);
+
+    void acceptWorker();
+
+    /**
+     * Receives what a worker sent and handles every complete
+     * reply. Throws if the worker broke the protocol.
+     */
+    void receive(Worker &worker);
+
+    void dispatch(Worker &worker);
+
+    /**
+     * Closes the connection to a worker and queues its
+     * unfinished tiles again, first in line
+     */
+    void dropWorker(size_t index, const std::string &reason);
+
+    int getTileIndex(int x, int y) const;
+
+public:
+    /**
+     * The scene must have been loaded from the given file,
+     * whose path is sent to the workers
+     */
+    TileCoordinator(Scene &scene, const std::string &scenePath, const RenderOptions &options,
+                    const std::string &programPath);
+
+    ~TileCoordinator();
+
+    TileCoordinator(const TileCoordinator& other) = delete;
+
+    TileCoordinator& operator=(const TileCoordinator& other) = delete;
+
+    /**
+     * Renders the frame on the workers into the screen of the
+     * scene and saves it like Scene::renderToImage
+     */
+    void renderToImage(const char* filename);
+};
+
+#endif //RAYTRACER_TILECOORDINATOR_H
@@ -0,0 +1,43 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_TILEWORKER_H
+#define RAYTRACER_TILEWORKER_H
+
+#include <string>
+#include "RenderOptions.h"
+
+/**
+ * Renders the tiles a TileCoordinator sends, see there for
+ * the protocol. The worker connects to the coordinator, loads
+ * the scene it names with the load options given here and
+ * renders tiles on its threads as they come in, sending each
+ * one back as soon as it is done.
+ */
+class TileWorker {
+private:
+    std::string host;
+    std::string port;
+    RenderOptions options;
+
+    int connectToCoordinator();
+
+public:
+    /**
+     * The address is given as host:port
+     */
+    TileWorker(const std::string &address, const RenderOptions &options);
+
+    /**
+     * Serves the coordinator until it sends quit
+     * or closes the connection
+     */
+    void run();
+};
+
+#endif //RAYTRACER_TILEWORKER_H
@@ -0,0 +1,110 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_TILEDTEXTURE_H
+#define RAYTRACER_TILEDTEXTURE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "TextureCache.h"
+
+/**
+ * Square block of RGB texels of one mip level, as
+ * it is held in memory by a TextureCache
+ */
+struct TextureTile {
+    std::vector<unsigned char> texels;
+
+    inline size_t getMemoryUsage() const {return texels.capacity();};
+};
+
+/**
+ * Image texture split into tiles in a file, so that only the
+ * tiles rays actually reach have to be in memory. The file
+ * holds every level of the mip chain, each one a box filtered
+ * half of the one before, down to a single texel. Tiles are
+ * read through a TextureCache.
+ *
+ * The file starts with a header and the table of the levels,
+ * followed by the tiles of every level in row order. Like the
+ * chunk files of meshes, the header records the size and
+ * modification time of the image, so that a file that is out
+ * of date is written again.
+ */
+class TiledTexture {
+private:
+    struct LevelRecord {
+        uint32_t width;
+        uint32_t height;
+        uint32_t tilesX;
+        uint32_t tilesY;
+        uint64_t firstTile;
+    };
+
+    std::string path;
+    int file = -1;
+    std::vector<LevelRecord> levels;
+    uint64_t tileOffset = 0;
+
+    /**
+     * Bilinear lookup in a single level, the coordinates
+     * wrapping around the edges of the texture
+     */
+    glm::vec3 sampleLevel(int level, const glm::vec2 &uv, TextureCache &cache) const;
+
+public:
+    /**
+     * Texels along each side of a tile
+     */
+    const static int TILE_SIZE = 64;
+    const static int TILE_BYTES = TILE_SIZE * TILE_SIZE * 3;
+    const static uint32_t VERSION = 1;
+
+    TiledTexture() = default;
+    ~TiledTexture();
+
+    TiledTexture(const TiledTexture& other) = delete;
+    TiledTexture& operator=(const TiledTexture& other) = delete;
+
+    /**
+     * Decodes the image, builds its mip chain and writes the
+     * tiles of every level to the given path. The source size
+     * and time identify the image the tiles came from.
+     */
+    static void write(const std::string &path, const std::string &image, uint64_t sourceSize, int64_t sourceTime);
+
+    /**
+     * Opens a file written by write and reads its table. Returns
+     * false if the file is missing, of another version, or was
+     * written for a different image.
+     */
+    bool open(const std::string &path, uint64_t sourceSize, int64_t sourceTime);
+
+    /**
+     * Reads a tile from the file. Called by TextureCache
+     * from any thread.
+     */
+    TextureTile* read(uint32_t tile) const;
+
+    /**
+     * Trilinear lookup at the given level of detail, the log2
+     * of the texels of the first level covered by a sample.
+     * Coordinates repeat outside of [0, 1], and v runs down
+     * the image as loadOBJ flips it.
+     */
+    glm::vec3 sample(const glm::vec2 &uv, float lod, TextureCache &cache) const;
+
+    inline int getLevelCount() const {return (int)levels.size();};
+    inline uint32_t getWidth() const {return levels.empty() ? 0 : levels[0].width;};
+    inline uint32_t getHeight() const {return levels.empty() ? 0 : levels[0].height;};
+    inline const std::string& getPath() const {return path;};
+};
+
+#endif //RAYTRACER_TILEDTEXTURE_H
@@ -0,0 +1,114 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_TIMELINE_H
+#define RAYTRACER_TIMELINE_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * A span of time spent by one thread on one step of a run,
+ * in nanoseconds since tracing started. Tiles and bands of
+ * rows keep their top left corner, other spans -1 for both.
+ */
+struct TimelineEvent {
+    const char* name;
+    int64_t begin;
+    int64_t end;
+    int x;
+    int y;
+};
+
+/**
+ * Records what every thread spends its time on, loading,
+ * building, rendering tiles and encoding, and writes it as
+ * Chrome trace event JSON, which chrome://tracing and
+ * Perfetto show as one row of spans per thread.
+ *
+ * Each thread writes to its own ring buffer, so recording
+ * takes no lock and no thread waits for another. A buffer is
+ * taken the first time its thread records. When a thread
+ * exits, its buffer goes to the next thread that starts
+ * recording, which keeps appending to it, so there are only
+ * as many buffers as threads that ever recorded at once, and
+ * runs that start new threads for every scene, such as batch
+ * renders and the preview server, do not keep allocating. A
+ * new buffer is registered by pushing it onto a list with a
+ * compare and swap. When a buffer is full its oldest spans
+ * are overwritten, and counted as dropped. Spans stay in their
+ * buffer after their thread is gone, until the trace is
+ * written, and are shown in the row of the buffer, which is
+ * named after the last thread that used it.
+ *
+ * Nothing is recorded until start is called, and a span then
+ * costs two reads of the clock and a store.
+ */
+class Timeline {
+public:
+    /**
+     * Spans each thread keeps before it starts overwriting
+     * its oldest ones, a power of two
+     */
+    const static size_t EVENTS_PER_THREAD = (size_t)1 << 16;
+
+    /**
+     * Records the time from its construction to its
+     * destruction under the given name, which must be a
+     * string literal since only its address is kept
+     */
+    class Span {
+    public:
+        Span(const char* name, int x = -1, int y = -1);
+        ~Span();
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        const char* name;
+        int64_t begin;
+        int x;
+        int y;
+    };
+
+    /**
+     * Starts recording, with times counted from now
+     */
+    static void start();
+
+    static bool isEnabled();
+
+    /**
+     * Name the calling thread is shown under, a string literal.
+     * Threads without one are shown by number.
+     */
+    static void nameThread(const char* name);
+
+    static void record(const char* name, int64_t begin, int64_t end, int x = -1, int y = -1);
+
+    /**
+     * Nanoseconds since recording started
+     */
+    static int64_t now();
+
+    /**
+     * Writes the spans of every thread to a JSON file.
+     * Returns the number of spans written.
+     */
+    static size_t write(const std::string &filename);
+
+    /**
+     * Spans overwritten because their thread recorded more
+     * than its buffer holds
+     */
+    static size_t getDroppedCount();
+};
+
+#endif //RAYTRACER_TIMELINE_H
@@ -0,0 +1,52 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_TOPOLOGY_H
+#define RAYTRACER_TOPOLOGY_H
+
+#include <vector>
+
+/**
+ * A NUMA node and the processors of it
+ * the process is allowed to run on
+ */
+struct NumaNode {
+    int id = 0;
+    std::vector<int> cpus;
+};
+
+/**
+ * NUMA layout of the machine and control over where threads
+ * run and where their memory goes. Only Linux is supported;
+ * elsewhere the machine is one node and the calls do nothing.
+ * libnuma is not needed, the kernel interface is used as is.
+ */
+class Topology {
+public:
+    /**
+     * Nodes with processors available to the process, by id.
+     * Without NUMA information this is a single node.
+     */
+    static std::vector<NumaNode> detect();
+
+    /**
+     * Restricts the calling thread to the given processors.
+     * Returns false if that is not possible.
+     */
+    static bool pinThread(const std::vector<int> &cpus);
+
+    /**
+     * Spreads the pages the calling thread allocates from now
+     * on round robin over the given nodes, or goes back to
+     * allocating them on the node that first touches them.
+     * Threads started in between inherit the choice.
+     */
+    static void setInterleaved(const std::vector<NumaNode> &nodes, bool interleaved);
+};
+
+#endif //RAYTRACER_TOPOLOGY_H
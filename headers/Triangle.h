@@ -18,7 +18,19 @@ public:
     std::vector<glm::vec3> vertices;
     float area;
 
+    /**
+     * Edges from the first vertex, used by the
+     * Möller–Trumbore intersection test
+     */
+    glm::vec3 edge1, edge2;
+
     Triangle() {type = triangle;};
+
+    /**
+     * Pre-computes the normal, area and edges of the
+     * triangle. Must be called whenever the vertices change.
+     */
+    void precompute();
 };
 
 #endif //RAYTRACER_TRIANGLE_H
@@ -0,0 +1,205 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_UNIFORMGRID_H
+#define RAYTRACER_UNIFORMGRID_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include "AABB.h"
+
+/**
+ * Build time and occupancy of a grid
+ */
+struct GridStats {
+    double buildSeconds = 0.0;
+    int cellCount = 0;
+    int emptyCells = 0;
+    size_t references = 0;
+};
+
+/**
+ * Uniform grid over the bounding boxes of a set of primitives,
+ * traversed cell by cell with the 3D-DDA of Amanatides and Woo.
+ * For many primitives of similar size it builds faster than a
+ * BVH and finds hits in a few cell steps. Each cell lists the
+ * primitives overlapping it, all lists stored back to back.
+ */
+class UniformGrid {
+private:
+    AABB bounds;
+    int resolution[3] = {0, 0, 0};
+    glm::vec3 cellSize;
+    glm::vec3 inverseCellSize;
+    std::vector<int> cellStart;
+    std::vector<int> cellPrimitives;
+    GridStats stats;
+
+    inline int cellIndex(int x, int y, int z) const {
+        return (z * resolution[1] + y) * resolution[0] + x;
+    };
+
+    /**
+     * Range of cells overlapped by a box
+     */
+    void getCellRange(const AABB &box, int lower[3], int upper[3]) const;
+
+public:
+    /**
+     * Target number of cells per primitive. The resolution
+     * of each axis is chosen so the cells come out roughly
+     * cubic, following Cleary and Wyvill.
+     */
+    constexpr static float DENSITY = 2.0f;
+
+    const static int MAX_RESOLUTION = 1024;
+
+    const static int MAX_CELLS = 1 << 24;
+
+    /**
+     * Primitives tested recently by a ray, skipped when
+     * they show up again in the next cells
+     */
+    const static int MAILBOX_SIZE = 8;
+
+    /**
+     * Builds the grid over the given primitive bounds using
+     * up to the given number of threads. Each cell lists its
+     * primitives in increasing order, so that traversal does
+     * not depend on the number of threads.
+     */
+    void build(const std::vector<AABB> &primitiveBounds, unsigned int threads);
+
+    inline void clear() {
+        cellStart.clear();
+        cellStart.shrink_to_fit();
+        cellPrimitives.clear();
+        cellPrimitives.shrink_to_fit();
+    };
+
+    inline bool isEmpty() const {return cellStart.empty();};
+
+    inline const GridStats& getStats() const {return stats;};
+
+    inline const int* getResolution() const {return resolution;};
+
+    inline size_t getMemoryUsage() const {
+        return (cellStart.capacity() + cellPrimitives.capacity()) * sizeof(int);
+    };
+
+    /**
+     * Closest hit traversal with the same contract as
+     * BVH::intersect. The cells are visited in the order the
+     * ray crosses them, and the walk stops at the first cell
+     * that ends beyond the closest hit found so far.
+     */
+    template<typename Intersect>
+    bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 &inverseDirection,
+                   float &closest, Intersect intersectPrimitive) const {
+        bool hit = false;
+        walk(origin, direction, inverseDirection, closest, [&](int primitive) {
+            hit |= intersectPrimitive(primitive, closest);
+            return false;
+        }, [&](float cellExit) {
+            return closest <= cellExit;
+        });
+        return hit;
+    };
+
+    /**
+     * Any hit traversal with the same contract as
+     * BVH::occluded
+     */
+    template<typename Blocking>
+    bool occluded(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 &inverseDirection,
+                  float maxDistance, Blocking isBlocking) const {
+        return walk(origin, direction, inverseDirection, maxDistance, [&](int primitive) {
+            return isBlocking(primitive);
+        }, [](float) {
+            return false;
+        });
+    };
+
+private:
+    /**
+     * Steps through the cells crossed by the ray before
+     * maxDistance, calling visit for each primitive of each
+     * cell. Stops when visit returns true, which is then
+     * returned, or when done returns true after a cell.
+     */
+    template<typename Visit, typename Done>
+    bool walk(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 &inverseDirection,
+              const float &maxDistance, Visit visit, Done done) const {
+        float tEnter;
+        if(cellStart.empty() || !bounds.intersects(origin, inverseDirection, maxDistance, tEnter)) {
+            return false;
+        }
+
+        int cell[3], step[3], end[3];
+        float tNext[3], tDelta[3];
+        glm::vec3 entry = origin + direction * tEnter;
+        for(int axis = 0; axis < 3; axis++) {
+            cell[axis] = (int)std::floor((entry[axis] - bounds.min[axis]) * inverseCellSize[axis]);
+            cell[axis] = std::min(std::max(cell[axis], 0), resolution[axis] - 1);
+
+            if(direction[axis] > 0.0f) {
+                step[axis] = 1;
+                end[axis] = resolution[axis];
+                tNext[axis] = (bounds.min[axis] + (cell[axis] + 1) * cellSize[axis] - origin[axis]) * inverseDirection[axis];
+                tDelta[axis] = cellSize[axis] * inverseDirection[axis];
+            } else if(direction[axis] < 0.0f) {
+                step[axis] = -1;
+                end[axis] = -1;
+                tNext[axis] = (bounds.min[axis] + cell[axis] * cellSize[axis] - origin[axis]) * inverseDirection[axis];
+                tDelta[axis] = -cellSize[axis] * inverseDirection[axis];
+            } else {
+                step[axis] = 0;
+                end[axis] = -1;
+                tNext[axis] = HUGE_VALF;
+                tDelta[axis] = HUGE_VALF;
+            }
+        }
+
+        int mailbox[MAILBOX_SIZE];
+        std::fill(mailbox, mailbox + MAILBOX_SIZE, -1);
+        int mailboxSlot = 0;
+
+        while(true) {
+            int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+            float cellExit = tNext[axis];
+
+            int index = cellIndex(cell[0], cell[1], cell[2]);
+            for(int i = cellStart[index]; i < cellStart[index + 1]; i++) {
+                int primitive = cellPrimitives[i];
+                if(std::find(mailbox, mailbox + MAILBOX_SIZE, primitive) != mailbox + MAILBOX_SIZE) {
+                    continue;
+                }
+                mailbox[mailboxSlot] = primitive;
+                mailboxSlot = (mailboxSlot + 1) % MAILBOX_SIZE;
+
+                if(visit(primitive)) {
+                    return true;
+                }
+            }
+
+            if(done(cellExit) || cellExit > maxDistance) {
+                return false;
+            }
+
+            cell[axis] += step[axis];
+            if(cell[axis] == end[axis]) {
+                return false;
+            }
+            tNext[axis] += tDelta[axis];
+        }
+    };
+};
+
+#endif //RAYTRACER_UNIFORMGRID_H
@@ -0,0 +1,160 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_WAVEFRONT_H
+#define RAYTRACER_WAVEFRONT_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "AABB.h"
+#include "Ray.h"
+#include "SceneIndex.h"
+#include "Shading.h"
+#include "Pixel.h"
+
+/**
+ * Spreads the lower 10 bits of v so that two zero bits
+ * follow each of them, for 30 bit Morton codes
+ */
+inline uint32_t spreadBits(uint32_t v) {
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+/**
+ * Sort key that brings together rays going the same way
+ * from nearby origins: the octant of the direction first,
+ * then the Morton code of the origin within the bounds.
+ * Such rays visit the same nodes and primitives, which are
+ * then still in cache from the ray before.
+ */
+inline uint64_t getCoherenceKey(const glm::vec3 &origin, const glm::vec3 &direction, const AABB &bounds) {
+    uint32_t octant = (direction.x < 0.0f ? 1 : 0) | (direction.y < 0.0f ? 2 : 0) | (direction.z < 0.0f ? 4 : 0);
+    glm::vec3 extent = glm::max(bounds.getExtent(), glm::vec3(1e-20f));
+    glm::vec3 cell = glm::clamp((origin - bounds.min) / extent, 0.0f, 1.0f) * 1023.0f;
+    uint32_t morton = spreadBits((uint32_t)cell.x) | (spreadBits((uint32_t)cell.y) << 1) | (spreadBits((uint32_t)cell.z) << 2);
+    return (uint64_t)octant << 32 | morton;
+}
+
+/**
+ * A wave of rays and the order to trace them in
+ */
+struct RayBatch {
+    std::vector<Ray> rays;
+    std::vector<int> order;
+    std::vector<std::pair<uint64_t, int>> keys;
+
+    inline void clear() {
+        rays.clear();
+        order.clear();
+    };
+
+    /**
+     * Orders the rays by their coherence key. Ties keep the
+     * order the rays were added in.
+     */
+    inline void sort() {
+        AABB bounds;
+        for(auto & ray : rays) {
+            bounds.expand(ray.origin);
+        }
+
+        keys.clear();
+        for(size_t i = 0; i < rays.size(); i++) {
+            keys.emplace_back(getCoherenceKey(rays[i].origin, rays[i].direction, bounds), (int)i);
+        }
+        std::sort(keys.begin(), keys.end());
+
+        order.resize(rays.size());
+        for(size_t i = 0; i < keys.size(); i++) {
+            order[i] = keys[i].second;
+        }
+    };
+};
+
+/**
+ * Shadow rays of a wave, and how far each one goes, the
+ * object it must ignore and whether it got through
+ */
+struct ShadowRayBatch {
+    RayBatch rays;
+    std::vector<float> distances;
+    std::vector<const SceneObject*> casters;
+    std::vector<char> visible;
+
+    inline void clear() {
+        rays.clear();
+        distances.clear();
+        casters.clear();
+    };
+
+    /**
+     * Ray from a hit to a point of a light, leaving the
+     * surface along its geometric normal
+     */
+    inline void add(const glm::vec3 &point, const glm::vec3 &target, const glm::vec3 &normal, const SceneObject* caster) {
+        rays.rays.push_back(Ray::toObject(point, target, normal));
+        distances.push_back(glm::length(target - rays.rays.back().origin));
+        casters.push_back(caster);
+    };
+
+    inline size_t size() const {return rays.rays.size();};
+};
+
+/**
+ * Shadow rays of one shaded hit to one light: the first ones
+ * in the first wave, and for an area light whose first samples
+ * found the hit in its penumbra, the rest in the second one
+ */
+struct LightRays {
+    int hit;
+    int light;
+    int first;
+    int count;
+    int penumbraFirst;
+    int penumbraCount;
+};
+
+/**
+ * Buffers of a render thread in wavefront mode, reused from
+ * tile to tile. Camera rays are traced as one wave, then the
+ * shadow rays of all their hits as another, sorted for
+ * coherence, and then the rest of the samples of the area
+ * lights whose penumbra the hits are in as a third. Results are kept in the order the rays were
+ * created, so shading sees them as the depth first path would.
+ * Finally all shaded hits go through the shading kernel at once.
+ */
+struct Wavefront {
+    RayBatch cameraRays;
+    std::vector<Hit> hits;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec3> geometricNormals;
+    std::vector<char> shaded;
+    std::vector<PixelFeatures> features;
+
+    ShadowRayBatch shadowRays;
+    ShadowRayBatch penumbraRays;
+    std::vector<LightRays> lightRays;
+
+    /**
+     * Light of each column of the shading batch, where
+     * area lights have a column for each of their samples
+     */
+    std::vector<Light*> slotLights;
+
+    ShadingBatch shading;
+};
+
+#endif //RAYTRACER_WAVEFRONT_H
@@ -0,0 +1,151 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#ifndef RAYTRACER_WIDEBVH_H
+#define RAYTRACER_WIDEBVH_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include "BVH.h"
+
+/**
+ * Node of the compressed BVH, with up to WIDTH children.
+ * The bounds of the children are stored as 8 bit steps on a
+ * grid spanning the node: the grid starts at origin and its
+ * step on each axis is a power of two. The steps are rounded
+ * outwards, so the decoded boxes always contain the children.
+ * A child with a count of 0 is an inner node, otherwise it is
+ * a leaf of count primitives starting at child. Unused slots
+ * have a child of -1.
+ */
+struct WideBVHNode {
+    const static int WIDTH = 4;
+
+    float origin[3];
+    float scale[3];
+    uint8_t lower[3][WIDTH];
+    uint8_t upper[3][WIDTH];
+    int32_t child[WIDTH];
+    uint16_t count[WIDTH];
+};
+
+/**
+ * Four wide BVH with quantized child bounds, collapsed from
+ * a binary BVH. A node holds four children in 72 bytes where
+ * the binary tree needs 32 bytes for each node, and the four
+ * child boxes are tested together, lane by lane.
+ */
+class WideBVH {
+private:
+    std::vector<WideBVHNode> nodes;
+
+    /**
+     * Creates the wide node for a binary inner node
+     * and returns its index
+     */
+    int collapse(const std::vector<BVHNode> &binary, int binaryIndex);
+
+    static void quantize(WideBVHNode &node, const AABB* bounds, int childCount);
+
+public:
+    /**
+     * Builds the wide tree from a binary one. Leaves keep
+     * their primitive ranges, so the primitives stay in the
+     * order given by the binary tree.
+     */
+    void build(const BVH &binary);
+
+    inline void clear() {nodes.clear(); nodes.shrink_to_fit();};
+
+    inline bool isEmpty() const {return nodes.empty();};
+
+    inline const std::vector<WideBVHNode>& getNodes() const {return nodes;};
+
+    inline size_t getMemoryUsage() const {return nodes.capacity() * sizeof(WideBVHNode);};
+
+    /**
+     * Closest hit traversal with the same contract as
+     * BVH::intersect. The children of a node are tested
+     * together and visited from the nearest one.
+     */
+    template<typename Intersect>
+    bool intersect(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float &closest, Intersect intersectPrimitive) const {
+        if(nodes.empty()) {
+            return false;
+        }
+
+        //Every level pushes at most WIDTH entries
+        //and the depth is bounded by BVH::MAX_DEPTH
+        struct Entry {
+            int index;
+            int count;
+            float tNear;
+        };
+        Entry stack[WideBVHNode::WIDTH * (BVH::MAX_DEPTH + 1)];
+        int top = 0;
+        bool hit = false;
+
+        stack[top++] = {0, 0, 0.0f};
+        while(top > 0) {
+            Entry entry = stack[--top];
+            if(entry.tNear > closest) {
+                continue;
+            }
+
+            if(entry.count > 0) {
+                for(int i = entry.index; i < entry.index + entry.count; i++) {
+                    hit |= intersectPrimitive(i, closest);
+                }
+                continue;
+            }
+
+            const WideBVHNode &node = nodes[entry.index];
+            float tNear[WideBVHNode::WIDTH];
+            float tFar[WideBVHNode::WIDTH];
+            for(int lane = 0; lane < WideBVHNode::WIDTH; lane++) {
+                tNear[lane] = 0.0f;
+                tFar[lane] = closest;
+            }
+            for(int axis = 0; axis < 3; axis++) {
+                for(int lane = 0; lane < WideBVHNode::WIDTH; lane++) {
+                    float low = node.origin[axis] + node.lower[axis][lane] * node.scale[axis];
+                    float high = node.origin[axis] + node.upper[axis][lane] * node.scale[axis];
+                    float t0 = (low - origin[axis]) * inverseDirection[axis];
+                    float t1 = (high - origin[axis]) * inverseDirection[axis];
+                    tNear[lane] = std::fmax(tNear[lane], std::fmin(t0, t1));
+                    tFar[lane] = std::fmin(tFar[lane], std::fmax(t0, t1));
+                }
+            }
+
+            //Insertion sort of the hit children, farthest
+            //first, so that the nearest is popped first
+            Entry hits[WideBVHNode::WIDTH];
+            int hitCount = 0;
+            for(int lane = 0; lane < WideBVHNode::WIDTH; lane++) {
+                if(node.child[lane] < 0 || tNear[lane] > tFar[lane]) {
+                    continue;
+                }
+                int i = hitCount++;
+                while(i > 0 && hits[i - 1].tNear < tNear[lane]) {
+                    hits[i] = hits[i - 1];
+                    i--;
+                }
+                hits[i] = {node.child[lane], node.count[lane], tNear[lane]};
+            }
+            for(int i = 0; i < hitCount; i++) {
+                stack[top++] = hits[i];
+            }
+        }
+
+        return hit;
+    };
+};
+
+#endif //RAYTRACER_WIDEBVH_H
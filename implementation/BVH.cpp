@@ -0,0 +1,370 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <BVH.h>
+#include <algorithm>
+#include <future>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+/**
+ * One bin of the surface area heuristic
+ */
+struct Bin {
+    AABB bounds;
+    int count = 0;
+};
+
+void BVH::build(const std::vector<AABB> &bounds, unsigned int threads) {
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    this->threads = std::max(1u, threads);
+    primitiveBounds = &bounds;
+    nodes.clear();
+    order.clear();
+    stats = BVHStats();
+
+    int count = (int)bounds.size();
+    if(count > 0) {
+        order.resize(count);
+        centroids.resize(count);
+        for(int i = 0; i < count; i++) {
+            order[i] = i;
+            centroids[i] = bounds[i].getCenter();
+        }
+
+        //A binary tree with n leaves has 2n - 1 nodes.
+        //Children are taken from an atomic counter, so the
+        //tasks building separate subtrees never collide and
+        //a child always comes after its parent.
+        nodes.resize(2 * count - 1);
+        nodeCount = 1;
+        freeThreads = (int)this->threads - 1;
+
+        nodes[0].leftFirst = 0;
+        nodes[0].count = count;
+        subdivide(0, 0, count, 0);
+
+        nodes.resize(nodeCount);
+        nodes.shrink_to_fit();
+    }
+
+    centroids.clear();
+    centroids.shrink_to_fit();
+    primitiveBounds = nullptr;
+
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    stats.buildSeconds = std::chrono::duration<double>(end - start).count();
+    collectStats();
+    stats.builtSahCost = stats.sahCost;
+}
+
+float BVH::refit(const std::vector<AABB> &bounds, unsigned int threads) {
+    if(bounds.size() != order.size()) {
+        throw std::invalid_argument("Refit needs the bounds of all " + std::to_string(order.size()) + " primitives");
+    }
+    if(nodes.empty()) {
+        return 1.0f;
+    }
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    primitiveBounds = &bounds;
+    threads = std::max(1u, threads);
+
+    //Breadth first walk down to enough disjoint subtrees
+    //to keep every thread busy. The nodes above them are
+    //in the order they were found, so walking that list
+    //backwards visits children before their parents.
+    std::vector<int> top;
+    std::vector<int> subtrees = {0};
+    while(threads > 1 && subtrees.size() < threads * 4) {
+        std::vector<int> next;
+        for(int index : subtrees) {
+            if(nodes[index].isLeaf()) {
+                next.push_back(index);
+            } else {
+                top.push_back(index);
+                next.push_back(nodes[index].leftFirst);
+                next.push_back(nodes[index].leftFirst + 1);
+            }
+        }
+        if(next.size() == subtrees.size()) {
+            break; //only leaves left
+        }
+        subtrees.swap(next);
+    }
+
+    std::atomic<int> nextSubtree(0);
+    auto worker = [&]() {
+        int claimed;
+        while((claimed = nextSubtree++) < (int)subtrees.size()) {
+            refitSubtree(subtrees[claimed]);
+        }
+    };
+
+    std::vector<std::future<void>> workers;
+    for(unsigned int t = 1; t < std::min<size_t>(threads, subtrees.size()); t++) {
+        workers.push_back(std::async(std::launch::async, worker));
+    }
+    worker();
+    for(auto & task : workers) {
+        task.get();
+    }
+
+    for(auto index = top.rbegin(); index != top.rend(); index++) {
+        BVHNode &node = nodes[*index];
+        node.bounds = nodes[node.leftFirst].bounds;
+        node.bounds.expand(nodes[node.leftFirst + 1].bounds);
+    }
+
+    primitiveBounds = nullptr;
+
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    stats.refitSeconds = std::chrono::duration<double>(end - start).count();
+
+    collectStats();
+    return getDegradation();
+}
+
+void BVH::refitSubtree(int nodeIndex) {
+    BVHNode &node = nodes[nodeIndex];
+    node.bounds = AABB();
+
+    if(node.isLeaf()) {
+        for(int i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+            node.bounds.expand((*primitiveBounds)[i]);
+        }
+        return;
+    }
+
+    refitSubtree(node.leftFirst);
+    refitSubtree(node.leftFirst + 1);
+    node.bounds = nodes[node.leftFirst].bounds;
+    node.bounds.expand(nodes[node.leftFirst + 1].bounds);
+}
+
+void BVH::subdivide(int nodeIndex, int first, int count, int depth) {
+    BVHNode &node = nodes[nodeIndex];
+    node.leftFirst = first;
+    node.count = count;
+
+    AABB centroidBounds;
+    node.bounds = AABB();
+    for(int i = first; i < first + count; i++) {
+        node.bounds.expand((*primitiveBounds)[order[i]]);
+        centroidBounds.expand(centroids[order[i]]);
+    }
+
+    int axis;
+    float splitPosition;
+    if(count <= 1 || depth >= MAX_DEPTH || !findSplit(node, axis, splitPosition, centroidBounds)) {
+        return;
+    }
+
+    int* middle = std::partition(order.data() + first, order.data() + first + count, [&](int index) {
+        return centroids[index][axis] < splitPosition;
+    });
+    int leftCount = (int)(middle - (order.data() + first));
+
+    //All centroids on one side of the plane can only happen
+    //when they are (nearly) equal. The primitives are then
+    //split in two halves to keep leaves small.
+    if(leftCount == 0 || leftCount == count) {
+        if(count <= MAX_LEAF_SIZE) {
+            return;
+        }
+        leftCount = count / 2;
+    }
+
+    int left = nodeCount.fetch_add(2);
+    node.leftFirst = left;
+    node.count = 0;
+
+    bool parallel = false;
+    if(count >= PARALLEL_THRESHOLD) {
+        int available = freeThreads.load();
+        while(available > 0 && !freeThreads.compare_exchange_weak(available, available - 1)) {}
+        parallel = available > 0;
+    }
+
+    if(parallel) {
+        std::future<void> leftTask = std::async(std::launch::async, [=]() {
+            subdivide(left, first, leftCount, depth + 1);
+        });
+        subdivide(left + 1, first + leftCount, count - leftCount, depth + 1);
+        leftTask.get();
+        freeThreads++;
+    } else {
+        subdivide(left, first, leftCount, depth + 1);
+        subdivide(left + 1, first + leftCount, count - leftCount, depth + 1);
+    }
+}
+
+/**
+ * Bins the centroids along the longest axis of their bounds
+ * and sweeps the bin boundaries for the cheapest split. Bins
+ * of very large nodes are filled by several threads at once,
+ * each one into its own set of bins, when there are threads
+ * to spare.
+ */
+bool BVH::findSplit(const BVHNode &node, int &axis, float &splitPosition, const AABB &centroidBounds) {
+    glm::vec3 extent = centroidBounds.getExtent();
+    axis = 0;
+    if(extent.y > extent.x) {
+        axis = 1;
+    }
+    if(extent.z > extent[axis]) {
+        axis = 2;
+    }
+
+    int first = node.leftFirst;
+    int count = node.count;
+    float leafCost = INTERSECTION_COST * count;
+
+    if(extent[axis] <= 0.0f) {
+        //identical centroids, only a forced split can help
+        splitPosition = centroidBounds.min[axis];
+        return count > MAX_LEAF_SIZE;
+    }
+
+    float binMin = centroidBounds.min[axis];
+    float scale = BIN_COUNT / extent[axis];
+
+    auto fillBins = [&](int begin, int end, Bin* bins) {
+        for(int i = begin; i < end; i++) {
+            int index = order[i];
+            int bin = std::min(BIN_COUNT - 1, (int)((centroids[index][axis] - binMin) * scale));
+            bins[bin].count++;
+            bins[bin].bounds.expand((*primitiveBounds)[index]);
+        }
+    };
+
+    //the helpers are taken from the threads left over by the
+    //subtrees built in parallel, and given back once done
+    int helpers = 0;
+    if(count >= PARALLEL_THRESHOLD * 16) {
+        int available = freeThreads.load();
+        while(available > 0) {
+            helpers = std::min(available, (int)threads - 1);
+            if(freeThreads.compare_exchange_weak(available, available - helpers)) {
+                break;
+            }
+            helpers = 0;
+        }
+    }
+
+    Bin bins[BIN_COUNT];
+    if(helpers > 0) {
+        int tasks = helpers + 1;
+        std::vector<std::vector<Bin>> partial(tasks, std::vector<Bin>(BIN_COUNT));
+        std::vector<std::future<void>> futures;
+        int chunk = (count + tasks - 1) / tasks;
+        for(int t = 0; t < tasks; t++) {
+            int begin = first + t * chunk;
+            int end = std::min(first + count, begin + chunk);
+            if(t == tasks - 1) {
+                fillBins(begin, end, partial[t].data());
+            } else {
+                futures.push_back(std::async(std::launch::async, [&, t, begin, end]() {
+                    fillBins(begin, end, partial[t].data());
+                }));
+            }
+        }
+        for(int t = 0; t < tasks; t++) {
+            if(t < helpers) {
+                futures[t].get();
+            }
+            for(int b = 0; b < BIN_COUNT; b++) {
+                bins[b].count += partial[t][b].count;
+                bins[b].bounds.expand(partial[t][b].bounds);
+            }
+        }
+        freeThreads += helpers;
+    } else {
+        fillBins(first, first + count, bins);
+    }
+
+    //Sweep from the right to get the cost of every right side,
+    //then from the left to evaluate each of the split planes
+    float rightArea[BIN_COUNT - 1];
+    int rightCount[BIN_COUNT - 1];
+    AABB rightBounds;
+    int rightSum = 0;
+    for(int b = BIN_COUNT - 1; b > 0; b--) {
+        rightBounds.expand(bins[b].bounds);
+        rightSum += bins[b].count;
+        rightArea[b - 1] = rightBounds.getHalfArea();
+        rightCount[b - 1] = rightSum;
+    }
+
+    float parentArea = node.bounds.getHalfArea();
+    float bestCost = HUGE_VALF;
+    int bestSplit = -1;
+    AABB leftBounds;
+    int leftSum = 0;
+    for(int b = 0; b < BIN_COUNT - 1; b++) {
+        leftBounds.expand(bins[b].bounds);
+        leftSum += bins[b].count;
+        if(leftSum == 0 || rightCount[b] == 0) {
+            continue;
+        }
+        float cost = TRAVERSAL_COST + INTERSECTION_COST *
+                (leftBounds.getHalfArea() * leftSum + rightArea[b] * rightCount[b]) / parentArea;
+        if(cost < bestCost) {
+            bestCost = cost;
+            bestSplit = b;
+        }
+    }
+
+    if(bestSplit < 0 || (bestCost >= leafCost && count <= MAX_LEAF_SIZE)) {
+        return false;
+    }
+
+    splitPosition = binMin + (bestSplit + 1) / scale;
+    return true;
+}
+
+/**
+ * The SAH cost of the tree is the expected cost of a random
+ * ray that hits the root: every node is weighted by the
+ * probability of hitting it, the ratio of its area to the
+ * area of the root.
+ */
+void BVH::collectStats() {
+    stats.nodeCount = (int)nodes.size();
+    stats.leafCount = 0;
+    stats.maxDepth = 0;
+    stats.sahCost = 0.0f;
+    std::fill(stats.leafSizes.begin(), stats.leafSizes.end(), 0);
+    if(nodes.empty()) {
+        return;
+    }
+
+    float rootArea = std::max(nodes[0].bounds.getHalfArea(), 1e-12f);
+    std::vector<std::pair<int, int>> stack = {{0, 0}};
+    while(!stack.empty()) {
+        int index = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+
+        const BVHNode &node = nodes[index];
+        float probability = node.bounds.getHalfArea() / rootArea;
+        stats.maxDepth = std::max(stats.maxDepth, depth);
+
+        if(node.isLeaf()) {
+            stats.leafCount++;
+            stats.leafSizes[std::min(node.count, 9) - 1]++;
+            stats.sahCost += probability * INTERSECTION_COST * node.count;
+        } else {
+            stats.sahCost += probability * TRAVERSAL_COST;
+            stack.emplace_back(node.leftFirst, depth + 1);
+            stack.emplace_back(node.leftFirst + 1, depth + 1);
+        }
+    }
+}
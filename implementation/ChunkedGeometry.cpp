@@ -0,0 +1,484 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <ChunkedGeometry.h>
+#include "DerivedFile.h"
+#include "MappedFile.h"
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "Chunk files store positions as packed floats");
+
+//std::min takes it by reference
+const int ChunkedGeometry::CHUNK_TRIANGLES;
+
+namespace {
+    const char MAGIC[8] = {'R', 'T', 'C', 'H', 'U', 'N', 'K', 'S'};
+
+    /**
+     * The layout number is the size of a BVH node
+     */
+    struct ChunkFileHeader {
+        DerivedFileHeader file;
+        uint64_t triangleCount;
+        uint64_t tableOffset;
+        uint32_t chunkCount;
+        uint32_t reserved;
+    };
+
+    //triangles read from or written to the temporary files at once
+    const size_t BLOCK_TRIANGLES = 4096;
+
+    //parts a range of triangles is split into on disk
+    const int SLABS = 16;
+
+    /**
+     * Calls visit with the three vertices of each triangle in a
+     * range of a temporary file, reading a block at a time
+     */
+    template<typename Visit>
+    void forEachTriangle(int file, uint64_t first, uint64_t count, Visit visit) {
+        std::vector<unsigned int> block(BLOCK_TRIANGLES * 3);
+        for(uint64_t done = 0; done < count; done += BLOCK_TRIANGLES) {
+            size_t size = (size_t)std::min<uint64_t>(BLOCK_TRIANGLES, count - done);
+            if(!DerivedFile::readAt(file, block.data(), size * 3 * sizeof(unsigned int),
+                                    (first + done) * 3 * sizeof(unsigned int))) {
+                throw std::runtime_error("Could not read back the triangles of a mesh");
+            }
+            for(size_t i = 0; i < size; i++) {
+                visit(&block[i * 3]);
+            }
+        }
+    }
+
+    inline glm::vec3 getCentroid(const glm::vec3* vertices, const unsigned int* triangle) {
+        return (vertices[triangle[0]] + vertices[triangle[1]] + vertices[triangle[2]]) * (1.0f / 3.0f);
+    }
+}
+
+ChunkedGeometry::~ChunkedGeometry() {
+    if(file >= 0) {
+        close(file);
+    }
+}
+
+/**
+ * Chunks are the largest subtrees of a BVH over the triangles
+ * that hold at most CHUNK_TRIANGLES triangles. The triangles of
+ * a subtree are contiguous in the order of its leaves, and the
+ * subtrees are taken depth first, so neighbouring chunks end up
+ * next to each other in the file.
+ */
+void ChunkedGeometry::writeChunks(std::ofstream &output, const std::vector<glm::vec3> &positions,
+                                  const std::vector<unsigned int> &indices, unsigned int threads,
+                                  std::vector<ChunkRecord> &records) {
+    size_t count = indices.size() / 3;
+    std::vector<AABB> triangleBounds(count);
+    for(size_t i = 0; i < count; i++) {
+        for(int corner = 0; corner < 3; corner++) {
+            triangleBounds[i].expand(positions[indices[i * 3 + corner]]);
+        }
+    }
+
+    BVH meshBVH;
+    meshBVH.build(triangleBounds, threads);
+    const std::vector<BVHNode> &nodes = meshBVH.getNodes();
+    const std::vector<int> &order = meshBVH.getOrder();
+
+    //children always come after their parent, so the
+    //triangle counts are summed up from the back
+    std::vector<int> nodeTriangles(nodes.size());
+    for(int i = (int)nodes.size() - 1; i >= 0; i--) {
+        nodeTriangles[i] = nodes[i].isLeaf() ? nodes[i].count :
+                           nodeTriangles[nodes[i].leftFirst] + nodeTriangles[nodes[i].leftFirst + 1];
+    }
+
+    std::vector<std::pair<int, int>> ranges;
+    std::vector<std::pair<int, int>> stack;
+    if(!nodes.empty()) {
+        stack.emplace_back(0, 0);
+    }
+    while(!stack.empty()) {
+        int node = stack.back().first;
+        int first = stack.back().second;
+        stack.pop_back();
+        if(nodes[node].isLeaf() || nodeTriangles[node] <= CHUNK_TRIANGLES) {
+            //leaves at the depth limit can be larger, and are
+            //cut into slices, as ids assume full chunks at most
+            for(int slice = 0; slice < nodeTriangles[node]; slice += CHUNK_TRIANGLES) {
+                ranges.emplace_back(first + slice, std::min(CHUNK_TRIANGLES, nodeTriangles[node] - slice));
+            }
+            continue;
+        }
+        int left = nodes[node].leftFirst;
+        stack.emplace_back(left + 1, first + nodeTriangles[left]);
+        stack.emplace_back(left, first);
+    }
+
+    std::vector<int> localIndex(positions.size(), -1);
+    for(size_t c = 0; c < ranges.size(); c++) {
+        int first = ranges[c].first;
+        int triangles = ranges[c].second;
+
+        std::vector<glm::vec3> chunkPositions;
+        std::vector<unsigned int> chunkIndices;
+        std::vector<AABB> localBounds(triangles);
+        AABB box;
+        for(int i = 0; i < triangles; i++) {
+            int triangle = order[first + i];
+            for(int corner = 0; corner < 3; corner++) {
+                unsigned int vertex = indices[triangle * 3 + corner];
+                if(localIndex[vertex] < 0) {
+                    localIndex[vertex] = (int)chunkPositions.size();
+                    chunkPositions.push_back(positions[vertex]);
+                }
+                chunkIndices.push_back((unsigned int)localIndex[vertex]);
+            }
+            localBounds[i] = triangleBounds[triangle];
+            box.expand(triangleBounds[triangle]);
+        }
+        for(int i = 0; i < triangles; i++) {
+            for(int corner = 0; corner < 3; corner++) {
+                localIndex[indices[order[first + i] * 3 + corner]] = -1;
+            }
+        }
+
+        BVH chunkBVH;
+        chunkBVH.build(localBounds, threads);
+        const std::vector<int> &chunkOrder = chunkBVH.getOrder();
+        std::vector<unsigned int> orderedIndices(chunkIndices.size());
+        for(size_t i = 0; i < chunkOrder.size(); i++) {
+            for(int corner = 0; corner < 3; corner++) {
+                orderedIndices[i * 3 + corner] = chunkIndices[chunkOrder[i] * 3 + corner];
+            }
+        }
+        const std::vector<BVHNode> &chunkNodes = chunkBVH.getNodes();
+
+        ChunkRecord record;
+        for(int axis = 0; axis < 3; axis++) {
+            record.min[axis] = box.min[axis];
+            record.max[axis] = box.max[axis];
+        }
+        record.offset = (uint64_t)output.tellp();
+        record.vertexCount = (uint32_t)chunkPositions.size();
+        record.triangleCount = (uint32_t)triangles;
+        record.nodeCount = (uint32_t)chunkNodes.size();
+        record.reserved = 0;
+        records.push_back(record);
+
+        output.write((const char*)chunkPositions.data(), chunkPositions.size() * sizeof(glm::vec3));
+        output.write((const char*)orderedIndices.data(), orderedIndices.size() * sizeof(unsigned int));
+        output.write((const char*)chunkNodes.data(), chunkNodes.size() * sizeof(BVHNode));
+    }
+}
+
+ChunkedGeometry::Builder::Builder(const std::string &path, uint64_t sourceSize, int64_t sourceTime,
+                                  unsigned int threads, size_t partitionTriangles) :
+        path(path), sourceSize(sourceSize), sourceTime(sourceTime), threads(threads),
+        partitionTriangles(std::max<size_t>(partitionTriangles, 1)), positionsPath(path + ".positions.tmp"),
+        trianglesPath(path + ".triangles.tmp"), sortedPath(path + ".sorted.tmp") {
+    positions.open(positionsPath, std::ios::binary | std::ios::trunc);
+    triangles.open(trianglesPath, std::ios::binary | std::ios::trunc);
+    if(!positions.is_open() || !triangles.is_open()) {
+        positions.close();
+        triangles.close();
+        std::remove(positionsPath.c_str());
+        std::remove(trianglesPath.c_str());
+        throw std::runtime_error("Could not write " + positionsPath);
+    }
+}
+
+ChunkedGeometry::Builder::~Builder() {
+    positions.close();
+    triangles.close();
+    std::remove(positionsPath.c_str());
+    std::remove(trianglesPath.c_str());
+    std::remove(sortedPath.c_str());
+}
+
+void ChunkedGeometry::Builder::addVertex(const glm::vec3 &position) {
+    positions.write((const char*)&position, sizeof(glm::vec3));
+    vertexCount++;
+}
+
+void ChunkedGeometry::Builder::addTriangle(const unsigned int* triangle) {
+    triangles.write((const char*)triangle, 3 * sizeof(unsigned int));
+    triangleCount++;
+    maxVertex = std::max(maxVertex, std::max(triangle[0], std::max(triangle[1], triangle[2])));
+}
+
+/**
+ * Meshes of at most partitionTriangles triangles are cut into
+ * chunks in one go, in the order of their file. Larger ones
+ * are first split on disk, so that only the vertices, which
+ * are mapped, and one bucket of triangles are in memory.
+ */
+void ChunkedGeometry::Builder::finish() {
+    positions.close();
+    triangles.close();
+    if(positions.fail() || triangles.fail()) {
+        throw std::runtime_error("Could not write " + trianglesPath);
+    }
+    if(triangleCount > 0 && maxVertex >= vertexCount) {
+        throw std::invalid_argument("A triangle of " + path + " refers to a vertex that does not exist");
+    }
+
+    DerivedFile::Writer writer(path);
+    std::ofstream &stream = writer.getStream();
+
+    //the header is written again once the table is
+    ChunkFileHeader header;
+    header.file = DerivedFile::makeHeader(MAGIC, VERSION, sizeof(BVHNode), sourceSize, sourceTime);
+    header.triangleCount = triangleCount;
+    header.tableOffset = 0;
+    header.chunkCount = 0;
+    header.reserved = 0;
+    stream.write((const char*)&header, sizeof(header));
+
+    records.clear();
+    if(triangleCount > 0) {
+        MappedFile mapped(positionsPath);
+        vertices = (const glm::vec3*)mapped.getData();
+        output = &stream;
+
+        int from = ::open(trianglesPath.c_str(), O_RDWR);
+        int to = ::open(sortedPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        try {
+            if(from < 0 || to < 0) {
+                throw std::runtime_error("Could not write " + sortedPath);
+            }
+            AABB centroidBounds;
+            if(triangleCount > partitionTriangles) {
+                forEachTriangle(from, 0, triangleCount, [&](const unsigned int* triangle) {
+                    centroidBounds.expand(getCentroid(vertices, triangle));
+                });
+            }
+            partition(from, to, 0, triangleCount, centroidBounds);
+        } catch (...) {
+            if(from >= 0) {
+                close(from);
+            }
+            if(to >= 0) {
+                close(to);
+            }
+            vertices = nullptr;
+            output = nullptr;
+            throw;
+        }
+        close(from);
+        close(to);
+        vertices = nullptr;
+        output = nullptr;
+    }
+
+    header.tableOffset = (uint64_t)stream.tellp();
+    header.chunkCount = (uint32_t)records.size();
+    stream.write((const char*)records.data(), records.size() * sizeof(ChunkRecord));
+    stream.seekp(0);
+    stream.write((const char*)&header, sizeof(header));
+    records.clear();
+    records.shrink_to_fit();
+    writer.commit();
+}
+
+/**
+ * Splits the range of triangles, read from one file, into
+ * slabs along the longest axis of the bounds of their
+ * centroids, written to the same range of the other file.
+ * Neighbouring slabs are gathered into buckets of at most
+ * partitionTriangles, and slabs larger than that are split
+ * again in turn, back into the first file.
+ */
+void ChunkedGeometry::Builder::partition(int from, int to, uint64_t first, uint64_t count,
+                                         const AABB &centroidBounds) {
+    glm::vec3 extent = centroidBounds.getExtent();
+    int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+    float low = centroidBounds.min[axis];
+    float scale = SLABS / extent[axis];
+    if(count <= partitionTriangles || !std::isfinite(scale)) {
+        writeBucket(from, first, count);
+        return;
+    }
+
+    auto getSlab = [&](const unsigned int* triangle) {
+        int slab = (int)((getCentroid(vertices, triangle)[axis] - low) * scale);
+        return std::min(std::max(slab, 0), SLABS - 1);
+    };
+
+    uint64_t slabCounts[SLABS] = {};
+    AABB slabBounds[SLABS];
+    forEachTriangle(from, first, count, [&](const unsigned int* triangle) {
+        int slab = getSlab(triangle);
+        slabCounts[slab]++;
+        slabBounds[slab].expand(getCentroid(vertices, triangle));
+    });
+
+    //triangles whose centroids are too close together
+    //to tell apart stay in one bucket
+    uint64_t slabFirst[SLABS];
+    for(int slab = 0; slab < SLABS; slab++) {
+        if(slabCounts[slab] == count) {
+            writeBucket(from, first, count);
+            return;
+        }
+        slabFirst[slab] = slab == 0 ? first : slabFirst[slab - 1] + slabCounts[slab - 1];
+    }
+
+    {
+        //each slab is written a block at a time
+        std::vector<unsigned int> buffers[SLABS];
+        uint64_t written[SLABS] = {};
+        auto flush = [&](int slab) {
+            std::vector<unsigned int> &buffer = buffers[slab];
+            if(!DerivedFile::writeAt(to, buffer.data(), buffer.size() * sizeof(unsigned int),
+                                     (slabFirst[slab] + written[slab]) * 3 * sizeof(unsigned int))) {
+                throw std::runtime_error("Could not write " + sortedPath);
+            }
+            written[slab] += buffer.size() / 3;
+            buffer.clear();
+        };
+        forEachTriangle(from, first, count, [&](const unsigned int* triangle) {
+            int slab = getSlab(triangle);
+            buffers[slab].insert(buffers[slab].end(), triangle, triangle + 3);
+            if(buffers[slab].size() == BLOCK_TRIANGLES * 3) {
+                flush(slab);
+            }
+        });
+        for(int slab = 0; slab < SLABS; slab++) {
+            if(!buffers[slab].empty()) {
+                flush(slab);
+            }
+        }
+    }
+
+    uint64_t bucketFirst = first;
+    uint64_t bucketCount = 0;
+    for(int slab = 0; slab < SLABS; slab++) {
+        if(bucketCount > 0 && bucketCount + slabCounts[slab] > partitionTriangles) {
+            writeBucket(to, bucketFirst, bucketCount);
+            bucketFirst = slabFirst[slab];
+            bucketCount = 0;
+        }
+        if(slabCounts[slab] > partitionTriangles) {
+            partition(to, from, slabFirst[slab], slabCounts[slab], slabBounds[slab]);
+            bucketFirst = slabFirst[slab] + slabCounts[slab];
+            continue;
+        }
+        bucketCount += slabCounts[slab];
+    }
+    if(bucketCount > 0) {
+        writeBucket(to, bucketFirst, bucketCount);
+    }
+}
+
+/**
+ * Reads a range of triangles and the vertices they use, which
+ * are numbered anew in the order they are first used, and cuts
+ * them into chunks
+ */
+void ChunkedGeometry::Builder::writeBucket(int file, uint64_t first, uint64_t count) {
+    std::unordered_map<unsigned int, unsigned int> localIndex;
+    std::vector<glm::vec3> bucketPositions;
+    std::vector<unsigned int> bucketIndices;
+    bucketIndices.reserve(count * 3);
+    forEachTriangle(file, first, count, [&](const unsigned int* triangle) {
+        for(int corner = 0; corner < 3; corner++) {
+            auto found = localIndex.emplace(triangle[corner], (unsigned int)bucketPositions.size());
+            if(found.second) {
+                bucketPositions.push_back(vertices[triangle[corner]]);
+            }
+            bucketIndices.push_back(found.first->second);
+        }
+    });
+    writeChunks(*output, bucketPositions, bucketIndices, threads, records);
+}
+
+bool ChunkedGeometry::open(const std::string &path, uint64_t sourceSize, int64_t sourceTime) {
+    if(file >= 0) {
+        close(file);
+    }
+    this->path = path;
+    chunks.clear();
+    chunkBounds.clear();
+    bvh.clear();
+    bounds = AABB();
+    triangleCount = 0;
+
+    ChunkFileHeader header;
+    file = DerivedFile::open(path, &header, sizeof(header),
+                             DerivedFile::makeHeader(MAGIC, VERSION, sizeof(BVHNode), sourceSize, sourceTime));
+    if(file < 0) {
+        return false;
+    }
+
+    chunks.resize(header.chunkCount);
+    if(!DerivedFile::readAt(file, chunks.data(), chunks.size() * sizeof(ChunkRecord), header.tableOffset)) {
+        close(file);
+        file = -1;
+        chunks.clear();
+        return false;
+    }
+    triangleCount = header.triangleCount;
+
+    //ids of triangles assume no chunk is larger
+    for(auto & chunk : chunks) {
+        if(chunk.triangleCount > (uint32_t)CHUNK_TRIANGLES) {
+            close(file);
+            file = -1;
+            chunks.clear();
+            triangleCount = 0;
+            return false;
+        }
+    }
+
+    std::vector<AABB> tableBounds(chunks.size());
+    for(size_t i = 0; i < chunks.size(); i++) {
+        tableBounds[i].min = glm::vec3(chunks[i].min[0], chunks[i].min[1], chunks[i].min[2]);
+        tableBounds[i].max = glm::vec3(chunks[i].max[0], chunks[i].max[1], chunks[i].max[2]);
+        bounds.expand(tableBounds[i]);
+    }
+
+    //the table is put in the order of the leaves
+    //so that leaves index the chunks directly
+    bvh.build(tableBounds, 1);
+    std::vector<ChunkRecord> ordered(chunks.size());
+    chunkBounds.resize(chunks.size());
+    for(size_t i = 0; i < chunks.size(); i++) {
+        ordered[i] = chunks[bvh.getOrder()[i]];
+        chunkBounds[i] = tableBounds[bvh.getOrder()[i]];
+    }
+    chunks.swap(ordered);
+    chunks.shrink_to_fit();
+    return true;
+}
+
+MeshChunk* ChunkedGeometry::read(int chunk) const {
+    const ChunkRecord &record = chunks[chunk];
+    MeshChunk* loaded = new MeshChunk();
+    loaded->positions.resize(record.vertexCount);
+    loaded->indices.resize(record.triangleCount * 3);
+    std::vector<BVHNode> nodes(record.nodeCount);
+
+    uint64_t offset = record.offset;
+    size_t positionBytes = loaded->positions.size() * sizeof(glm::vec3);
+    size_t indexBytes = loaded->indices.size() * sizeof(unsigned int);
+    if(!DerivedFile::readAt(file, loaded->positions.data(), positionBytes, offset) ||
+       !DerivedFile::readAt(file, loaded->indices.data(), indexBytes, offset + positionBytes) ||
+       !DerivedFile::readAt(file, nodes.data(), nodes.size() * sizeof(BVHNode), offset + positionBytes + indexBytes)) {
+        delete loaded;
+        throw std::runtime_error("Could not read chunk " + std::to_string(chunk) + " of " + path);
+    }
+
+    loaded->bvh.load(std::move(nodes));
+    return loaded;
+}
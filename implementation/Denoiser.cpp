@@ -0,0 +1,343 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <Denoiser.h>
+#include "Shading.h"
+#include <vector>
+#include <future>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+/**
+ * How quickly the weight of a tap falls as its luminance, normal,
+ * depth and albedo move away from those of the pixel. The normal
+ * weight is the cosine between the normals to this power.
+ */
+static const float SIGMA_LUMINANCE = 4.0f;
+static const int NORMAL_POWER_SQUARINGS = 7;
+static const float SIGMA_DEPTH = 1.0f;
+static const float SIGMA_ALBEDO = 0.1f;
+
+static const float LOG2_E = 1.44269504f;
+
+/**
+ * B3 spline, the 1D kernel of every pass
+ */
+static const float KERNEL[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+/**
+ * What the filter compares of the surfaces seen by two pixels,
+ * packed so that a tap reads it from one place
+ */
+struct DenoiseSurface {
+    glm::vec3 albedo;
+    float depth;
+    glm::vec3 normal;
+    float depthGradient;
+};
+
+/**
+ * The screen as flat arrays, row after row. The color of each
+ * pixel is kept with its variance in the last component. They
+ * are read from one of two copies and written to the other,
+ * swapping them after every pass.
+ */
+struct DenoiseBuffers {
+    int width;
+    int height;
+    std::vector<DenoiseSurface> surfaces;
+    std::vector<glm::vec4> colors[2];
+    std::vector<float> residuals;
+
+    inline size_t index(int x, int y) const {return (size_t)y * width + x;};
+};
+
+static void forEachTile(int width, int height, unsigned int threads,
+                        const std::function<void(int x0, int y0, int x1, int y1)> &work) {
+    int tilesX = (width + Denoiser::TILE_SIZE - 1) / Denoiser::TILE_SIZE;
+    int tiles = tilesX * ((height + Denoiser::TILE_SIZE - 1) / Denoiser::TILE_SIZE);
+    std::atomic<int> next(0);
+
+    std::vector<std::future<void>> futures;
+    for(int i = 0; i < (int)std::min(threads, (unsigned int)tiles); i++) {
+        futures.push_back(std::async(std::launch::async, [&]() {
+            for(int tile = next++; tile < tiles; tile = next++) {
+                int x0 = tile % tilesX * Denoiser::TILE_SIZE;
+                int y0 = tile / tilesX * Denoiser::TILE_SIZE;
+                work(x0, y0, std::min(x0 + Denoiser::TILE_SIZE, width), std::min(y0 + Denoiser::TILE_SIZE, height));
+            }
+        }));
+    }
+    for(auto & future : futures) {
+        future.get();
+    }
+}
+
+/**
+ * Part of the weight of a tap that comes from the surfaces, as
+ * the exponent of e for the depth and albedo, and as a factor
+ * for the normals. Samples that missed everything have a zero
+ * normal, which takes them apart from surfaces and from pixels
+ * that are only partly covered by them.
+ */
+static inline float getSurfaceWeight(const DenoiseSurface &p, const DenoiseSurface &q, float depthScale,
+                                     float &exponent) {
+    float cosine = std::max(0.0f, glm::dot(p.normal, q.normal));
+    for(int i = 0; i < NORMAL_POWER_SQUARINGS; i++) {
+        cosine *= cosine;
+    }
+
+    exponent = std::fabs(p.depth - q.depth) * depthScale + glm::length(p.albedo - q.albedo) * (1.0f / SIGMA_ALBEDO);
+    return cosine;
+}
+
+/**
+ * How much the depth may change from the pixel to taps at each
+ * squared distance up to 8 times the step, in pixels, inverted so
+ * that the taps multiply by it. Depth is allowed to change along
+ * its gradient, and by a small part of itself for flat surfaces
+ * seen face on.
+ */
+static inline void getDepthScales(const DenoiseSurface &surface, int step, float* scales) {
+    float slope = SIGMA_DEPTH * surface.depthGradient * step;
+    float offset = 1e-4f * surface.depth + 1e-6f;
+    for(int distance2 = 0; distance2 <= 8; distance2++) {
+        scales[distance2] = 1.0f / (slope * std::sqrt((float)distance2) + offset);
+    }
+}
+
+static inline float getLuminance(const glm::vec4 &color) {
+    return PixelSamples::getLuminance(glm::vec3(color));
+}
+
+/**
+ * The gradient is taken as the largest change in depth
+ * to a neighbor, per pixel of distance
+ */
+static void computeDepthGradient(DenoiseBuffers &buffers, int x0, int y0, int x1, int y1) {
+    std::vector<DenoiseSurface> &surfaces = buffers.surfaces;
+    for(int y = y0; y < y1; y++) {
+        for(int x = x0; x < x1; x++) {
+            size_t p = buffers.index(x, y);
+            float depth = surfaces[p].depth;
+            float gradient = 0.0f;
+            if(x > 0) gradient = std::max(gradient, std::fabs(depth - surfaces[p - 1].depth));
+            if(x + 1 < buffers.width) gradient = std::max(gradient, std::fabs(depth - surfaces[p + 1].depth));
+            if(y > 0) gradient = std::max(gradient, std::fabs(depth - surfaces[p - buffers.width].depth));
+            if(y + 1 < buffers.height) gradient = std::max(gradient, std::fabs(depth - surfaces[p + buffers.width].depth));
+            surfaces[p].depthGradient = gradient;
+        }
+    }
+}
+
+/**
+ * How far the luminance of a pixel lies from the mean of its 3x3
+ * neighbors on the same surface, squared. Smooth changes in the
+ * lighting cancel out in the mean, so what is left is the noise.
+ */
+static void computeResiduals(DenoiseBuffers &buffers, int x0, int y0, int x1, int y1) {
+    const std::vector<glm::vec4> &colors = buffers.colors[0];
+    for(int y = y0; y < y1; y++) {
+        for(int x = x0; x < x1; x++) {
+            size_t p = buffers.index(x, y);
+            const DenoiseSurface &surface = buffers.surfaces[p];
+            float depthScales[9];
+            getDepthScales(surface, 1, depthScales);
+
+            float sum = 0.0f, weights = 0.0f;
+            for(int dy = -1; dy <= 1; dy++) {
+                for(int dx = -1; dx <= 1; dx++) {
+                    int qx = x + dx, qy = y + dy;
+                    if((dx == 0 && dy == 0) || qx < 0 || qx >= buffers.width || qy < 0 || qy >= buffers.height) {
+                        continue;
+                    }
+                    size_t q = buffers.index(qx, qy);
+                    float exponent;
+                    float weight = getSurfaceWeight(surface, buffers.surfaces[q], depthScales[dx * dx + dy * dy], exponent);
+                    weight *= fastExp2(-exponent * LOG2_E);
+                    sum += weight * getLuminance(colors[q]);
+                    weights += weight;
+                }
+            }
+            float residual = weights > 0.0f ? getLuminance(colors[p]) - sum / weights : 0.0f;
+            buffers.residuals[p] = residual * residual;
+        }
+    }
+}
+
+/**
+ * Mean of the squared residuals over the 5x5 neighbors on the
+ * same surface, so that edges do not pass for noise. How much
+ * the neighbors stray from their own surroundings stands for
+ * how much the pixel itself would over renders. A residual has
+ * the noise of the pixel and about an eighth of it again from
+ * the mean it is taken from.
+ */
+static void estimateVariance(DenoiseBuffers &buffers, int x0, int y0, int x1, int y1) {
+    for(int y = y0; y < y1; y++) {
+        for(int x = x0; x < x1; x++) {
+            size_t p = buffers.index(x, y);
+            const DenoiseSurface &surface = buffers.surfaces[p];
+            float depthScales[9];
+            getDepthScales(surface, 1, depthScales);
+
+            float sum = 0.0f, weights = 0.0f;
+            for(int dy = -2; dy <= 2; dy++) {
+                int qy = y + dy;
+                if(qy < 0 || qy >= buffers.height) {
+                    continue;
+                }
+                for(int dx = -2; dx <= 2; dx++) {
+                    int qx = x + dx;
+                    if(qx < 0 || qx >= buffers.width) {
+                        continue;
+                    }
+                    size_t q = buffers.index(qx, qy);
+                    float weight = 1.0f;
+                    if(q != p) {
+                        float exponent;
+                        weight = getSurfaceWeight(surface, buffers.surfaces[q], depthScales[dx * dx + dy * dy], exponent);
+                        weight *= fastExp2(-exponent * LOG2_E);
+                    }
+                    sum += weight * buffers.residuals[q];
+                    weights += weight;
+                }
+            }
+            buffers.colors[0][p].w = sum / weights * (8.0f / 9.0f);
+        }
+    }
+}
+
+/**
+ * The luminance weight compares to the standard deviation of the
+ * pixel, from its variance blurred over 3x3 pixels so that a few
+ * lucky samples do not stop the filter. Variances are filtered
+ * along with the colors, with the squares of the weights, which
+ * is how the variance of a weighted mean goes.
+ */
+static void filter(DenoiseBuffers &buffers, int source, int step, int x0, int y0, int x1, int y1) {
+    const std::vector<glm::vec4> &colors = buffers.colors[source];
+    std::vector<glm::vec4> &outColors = buffers.colors[1 - source];
+
+    for(int y = y0; y < y1; y++) {
+        for(int x = x0; x < x1; x++) {
+            size_t p = buffers.index(x, y);
+
+            float blurred = 0.0f, blurWeights = 0.0f;
+            for(int dy = -1; dy <= 1; dy++) {
+                for(int dx = -1; dx <= 1; dx++) {
+                    int qx = x + dx, qy = y + dy;
+                    if(qx >= 0 && qx < buffers.width && qy >= 0 && qy < buffers.height) {
+                        float weight = KERNEL[dx + 2] * KERNEL[dy + 2];
+                        blurred += weight * colors[buffers.index(qx, qy)].w;
+                        blurWeights += weight;
+                    }
+                }
+            }
+            float deviation = std::sqrt(blurred / blurWeights);
+            if(deviation <= 0.0f) {
+                outColors[p] = colors[p];
+                continue;
+            }
+            float luminanceScale = 1.0f / (SIGMA_LUMINANCE * deviation);
+            float luminance = getLuminance(colors[p]);
+            const DenoiseSurface &surface = buffers.surfaces[p];
+            float depthScales[9];
+            getDepthScales(surface, step, depthScales);
+
+            glm::vec3 sum(0.0f);
+            float sumVariance = 0.0f, weights = 0.0f;
+            for(int dy = -2; dy <= 2; dy++) {
+                int qy = y + dy * step;
+                if(qy < 0 || qy >= buffers.height) {
+                    continue;
+                }
+                for(int dx = -2; dx <= 2; dx++) {
+                    int qx = x + dx * step;
+                    if(qx < 0 || qx >= buffers.width) {
+                        continue;
+                    }
+                    size_t q = buffers.index(qx, qy);
+                    const glm::vec4 &color = colors[q];
+                    float weight = KERNEL[dx + 2] * KERNEL[dy + 2];
+                    if(q != p) {
+                        float exponent;
+                        weight *= getSurfaceWeight(surface, buffers.surfaces[q], depthScales[dx * dx + dy * dy], exponent);
+                        exponent += std::fabs(luminance - getLuminance(color)) * luminanceScale;
+                        weight *= fastExp2(-exponent * LOG2_E);
+                    }
+                    sum += weight * glm::vec3(color);
+                    sumVariance += weight * weight * color.w;
+                    weights += weight;
+                }
+            }
+            outColors[p] = glm::vec4(sum / weights, sumVariance / (weights * weights));
+        }
+    }
+}
+
+/**
+ * The buffers are gathered from the rows of the screen, which may
+ * lie on different NUMA nodes, into arrays the passes can index
+ * with any offset. Every pass waits for the one before, since its
+ * taps reach into the tiles of others.
+ */
+void Denoiser::denoise(Pixel** screen, int width, int height, int samplesPerPixel, unsigned int threads) {
+    if(width <= 0 || height <= 0) {
+        return;
+    }
+
+    DenoiseBuffers buffers;
+    buffers.width = width;
+    buffers.height = height;
+    size_t count = (size_t)width * height;
+    buffers.surfaces.resize(count);
+    buffers.colors[0].resize(count);
+    buffers.colors[1].resize(count);
+
+    forEachTile(width, height, threads, [&](int x0, int y0, int x1, int y1) {
+        for(int y = y0; y < y1; y++) {
+            for(int x = x0; x < x1; x++) {
+                const Pixel &pixel = screen[y][x];
+                size_t p = buffers.index(x, y);
+                buffers.surfaces[p] = {pixel.features.albedo, pixel.features.depth, pixel.features.normal, 0.0f};
+                buffers.colors[0][p] = glm::vec4(pixel.color, pixel.variance);
+            }
+        }
+    });
+
+    forEachTile(width, height, threads, [&](int x0, int y0, int x1, int y1) {
+        computeDepthGradient(buffers, x0, y0, x1, y1);
+    });
+    if(samplesPerPixel < MIN_VARIANCE_SAMPLES) {
+        buffers.residuals.resize(count);
+        forEachTile(width, height, threads, [&](int x0, int y0, int x1, int y1) {
+            computeResiduals(buffers, x0, y0, x1, y1);
+        });
+        forEachTile(width, height, threads, [&](int x0, int y0, int x1, int y1) {
+            estimateVariance(buffers, x0, y0, x1, y1);
+        });
+    }
+
+    int source = 0;
+    for(int pass = 0; pass < PASSES; pass++, source = 1 - source) {
+        forEachTile(width, height, threads, [&](int x0, int y0, int x1, int y1) {
+            filter(buffers, source, 1 << pass, x0, y0, x1, y1);
+        });
+    }
+
+    forEachTile(width, height, threads, [&](int x0, int y0, int x1, int y1) {
+        for(int y = y0; y < y1; y++) {
+            for(int x = x0; x < x1; x++) {
+                screen[y][x].color = glm::vec3(buffers.colors[source][buffers.index(x, y)]);
+            }
+        }
+    });
+}
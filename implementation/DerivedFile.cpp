@@ -0,0 +1,101 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <DerivedFile.h>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+DerivedFile::Writer::Writer(const std::string &path) : path(path), temporary(path + ".tmp") {
+    output.open(temporary, std::ios::binary | std::ios::trunc);
+    if(!output.is_open()) {
+        throw std::runtime_error("Could not write " + temporary);
+    }
+}
+
+DerivedFile::Writer::~Writer() {
+    if(!committed) {
+        output.close();
+        std::remove(temporary.c_str());
+    }
+}
+
+void DerivedFile::Writer::commit() {
+    output.close();
+    if(output.fail()) {
+        throw std::runtime_error("Could not write " + temporary);
+    }
+    if(std::rename(temporary.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Could not write " + path);
+    }
+    committed = true;
+}
+
+DerivedFileHeader DerivedFile::makeHeader(const char* magic, uint32_t version, uint32_t layout,
+                                          uint64_t sourceSize, int64_t sourceTime) {
+    DerivedFileHeader header;
+    std::memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.layout = layout;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    return header;
+}
+
+int DerivedFile::open(const std::string &path, void* header, size_t headerSize, const DerivedFileHeader &expected) {
+    int file = ::open(path.c_str(), O_RDONLY);
+    if(file < 0) {
+        return -1;
+    }
+
+    const DerivedFileHeader* found = (const DerivedFileHeader*)header;
+    if(!readAt(file, header, headerSize, 0) || std::memcmp(found->magic, expected.magic, sizeof(expected.magic)) != 0 ||
+       found->version != expected.version || found->layout != expected.layout ||
+       found->sourceSize != expected.sourceSize || found->sourceTime != expected.sourceTime) {
+        close(file);
+        return -1;
+    }
+    return file;
+}
+
+bool DerivedFile::readAt(int file, void* buffer, size_t size, uint64_t offset) {
+    char* data = (char*)buffer;
+    while(size > 0) {
+        ssize_t count = pread(file, data, size, (off_t)offset);
+        if(count < 0 && errno == EINTR) {
+            continue;
+        }
+        if(count <= 0) {
+            return false;
+        }
+        data += count;
+        size -= count;
+        offset += count;
+    }
+    return true;
+}
+
+bool DerivedFile::writeAt(int file, const void* buffer, size_t size, uint64_t offset) {
+    const char* data = (const char*)buffer;
+    while(size > 0) {
+        ssize_t count = pwrite(file, data, size, (off_t)offset);
+        if(count < 0 && errno == EINTR) {
+            continue;
+        }
+        if(count <= 0) {
+            return false;
+        }
+        data += count;
+        size -= count;
+        offset += count;
+    }
+    return true;
+}
@@ -0,0 +1,12 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <GeometryCache.h>
+#include "ChunkedGeometry.h"
+
+template class LRUCache<ChunkedGeometry, MeshChunk>;
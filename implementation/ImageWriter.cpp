@@ -0,0 +1,424 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "ImageWriter.h"
+#include "Timeline.h"
+#include <fstream>
+#include <future>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef cimg_use_zlib
+#include <zlib.h>
+#endif
+
+/**
+ * Runs work on consecutive ranges of rows, split
+ * evenly over the threads
+ */
+static void forEachRows(int rows, unsigned int threads, const std::function<void(int first, int last)> &work) {
+    int count = (int)std::max(1u, std::min(threads, (unsigned int)std::max(rows, 1)));
+    std::vector<std::future<void>> futures;
+    for(int i = 0; i < count; i++) {
+        int first = (int)((long long)rows * i / count);
+        int last = (int)((long long)rows * (i + 1) / count);
+        futures.push_back(std::async(std::launch::async, [&work, first, last]() {
+            Timeline::nameThread("encode");
+            Timeline::Span span("encode rows", 0, first);
+            work(first, last);
+        }));
+    }
+    for(auto & future : futures) {
+        future.get();
+    }
+}
+
+static std::ofstream openFile(const std::string &filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if(!file) {
+        throw std::runtime_error("Unable to write " + filename);
+    }
+    return file;
+}
+
+static void appendInt(std::string &out, uint32_t value, bool bigEndian) {
+    for(int i = 0; i < 4; i++) {
+        out.push_back((char)(value >> (bigEndian ? 24 - 8 * i : 8 * i)));
+    }
+}
+
+static void appendFloat(std::string &out, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    appendInt(out, bits, false);
+}
+
+bool ImageWriter::write(const std::string &filename, const Image &image, unsigned int threads) {
+    size_t dot = filename.find_last_of("./\\");
+    std::string extension = (dot != std::string::npos && filename[dot] == '.') ? filename.substr(dot) : "";
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    if(extension == ".pfm") {
+        writePFM(filename, image);
+    } else if(extension == ".exr") {
+        writeEXR(filename, image);
+    } else if(extension == ".ppm") {
+        writePPM(filename, image, threads);
+    } else if(extension == ".png") {
+        writePNG(filename, image, threads);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The clamps are written as comparisons the way the SSE2
+ * min and max work, so a NaN comes out as 0 either way.
+ */
+void ImageWriter::quantize(const Image &image, int first, int last, unsigned char* out) {
+    const float* in = image.getRow(first);
+    size_t count = (size_t)(last - first) * image.width * 3;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    for(; i + 16 <= count; i += 16) {
+        __m128i a = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), zero), one), scale));
+        __m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), zero), one), scale));
+        __m128i c = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 8), zero), one), scale));
+        __m128i d = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 12), zero), one), scale));
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i*)(out + i), packed);
+    }
+#endif
+
+    for(; i < count; i++) {
+        float value = in[i] > 0.0f ? in[i] : 0.0f;
+        value = value < 1.0f ? value : 1.0f;
+        out[i] = (unsigned char)(value * 255.0f);
+    }
+}
+
+/**
+ * The sign of the scale gives the byte order
+ */
+void ImageWriter::writePFM(const std::string &filename, const Image &image) {
+    std::ofstream file = openFile(filename);
+    file << "PF\n" << image.width << " " << image.height << "\n-1.0\n";
+
+    std::string row;
+    for(int y = image.height - 1; y >= 0; y--) {
+        row.clear();
+        const float* colors = image.getRow(y);
+        for(int i = 0; i < image.width * 3; i++) {
+            appendFloat(row, colors[i]);
+        }
+        file.write(row.data(), row.size());
+    }
+}
+
+/**
+ * The header lists the attributes every OpenEXR reader requires.
+ * Each scanline is stored as its row number, its size and then
+ * the row of every channel, in alphabetical order.
+ */
+void ImageWriter::writeEXR(const std::string &filename, const Image &image) {
+    std::string header;
+    appendInt(header, 20000630, false); //magic number
+    appendInt(header, 2, false); //version 2, single part scanline
+
+    auto attribute = [&header](const std::string &name, const std::string &type, const std::string &value) {
+        header += name;
+        header.push_back('\0');
+        header += type;
+        header.push_back('\0');
+        appendInt(header, (uint32_t)value.size(), false);
+        header += value;
+    };
+
+    std::string channels;
+    for(const char* name : {"B", "G", "R"}) {
+        channels += name;
+        channels.push_back('\0');
+        appendInt(channels, 2, false); //32 bit float
+        appendInt(channels, 0, false); //linear flag and reserved bytes
+        appendInt(channels, 1, false); //x sampling
+        appendInt(channels, 1, false); //y sampling
+    }
+    channels.push_back('\0');
+
+    std::string window;
+    appendInt(window, 0, false);
+    appendInt(window, 0, false);
+    appendInt(window, (uint32_t)(image.width - 1), false);
+    appendInt(window, (uint32_t)(image.height - 1), false);
+
+    std::string one, center;
+    appendFloat(one, 1.0f);
+    appendFloat(center, 0.0f);
+    appendFloat(center, 0.0f);
+
+    attribute("channels", "chlist", channels);
+    attribute("compression", "compression", std::string(1, '\0'));
+    attribute("dataWindow", "box2i", window);
+    attribute("displayWindow", "box2i", window);
+    attribute("lineOrder", "lineOrder", std::string(1, '\0'));
+    attribute("pixelAspectRatio", "float", one);
+    attribute("screenWindowCenter", "v2f", center);
+    attribute("screenWindowWidth", "float", one);
+    header.push_back('\0');
+
+    uint32_t rowBytes = (uint32_t)image.width * 3 * sizeof(float);
+    uint64_t offset = header.size() + (uint64_t)image.height * sizeof(uint64_t);
+    for(int y = 0; y < image.height; y++) {
+        uint64_t start = offset + (uint64_t)y * (8 + rowBytes);
+        appendInt(header, (uint32_t)start, false);
+        appendInt(header, (uint32_t)(start >> 32), false);
+    }
+
+    std::ofstream file = openFile(filename);
+    file.write(header.data(), header.size());
+
+    std::string row;
+    for(int y = 0; y < image.height; y++) {
+        row.clear();
+        appendInt(row, (uint32_t)y, false);
+        appendInt(row, rowBytes, false);
+        const float* colors = image.getRow(y);
+        for(int channel = 2; channel >= 0; channel--) {
+            for(int x = 0; x < image.width; x++) {
+                appendFloat(row, colors[3 * x + channel]);
+            }
+        }
+        file.write(row.data(), row.size());
+    }
+}
+
+void ImageWriter::writePPM(const std::string &filename, const Image &image, unsigned int threads) {
+    std::vector<unsigned char> bytes((size_t)image.width * image.height * 3);
+    forEachRows(image.height, threads, [&](int first, int last) {
+        quantize(image, first, last, &bytes[(size_t)first * image.width * 3]);
+    });
+
+    std::ofstream file = openFile(filename);
+    file << "P6\n" << image.width << " " << image.height << "\n255\n";
+    file.write((const char*)bytes.data(), bytes.size());
+}
+
+/**
+ * Value the PNG filter predicts for a byte from the ones to its
+ * left, above and above left
+ */
+static inline int predict(int filter, int left, int up, int upLeft) {
+    switch(filter) {
+        case 1:
+            return left;
+        case 2:
+            return up;
+        case 3:
+            return (left + up) / 2;
+        case 4: {
+            int p = left + up - upLeft;
+            int pa = std::abs(p - left), pb = std::abs(p - up), pc = std::abs(p - upLeft);
+            return (pa <= pb && pa <= pc) ? left : (pb <= pc ? up : upLeft);
+        }
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Each row gets the PNG filter giving the smallest sum of
+ * absolute differences, the usual heuristic of encoders.
+ * The first row has a row of zeros above it.
+ */
+static void filterRow(const unsigned char* row, const unsigned char* previous, int length, unsigned char* out) {
+    int bestFilter = 0;
+    long long best = -1;
+    for(int filter = 0; filter < 5; filter++) {
+        long long sum = 0;
+        for(int i = 0; i < length && (best < 0 || sum < best); i++) {
+            int up = previous != nullptr ? previous[i] : 0;
+            int left = i >= 3 ? row[i - 3] : 0;
+            int upLeft = (previous != nullptr && i >= 3) ? previous[i - 3] : 0;
+            unsigned char value = (unsigned char)(row[i] - predict(filter, left, up, upLeft));
+            sum += value < 128 ? value : 256 - value;
+        }
+        if(best < 0 || sum < best) {
+            best = sum;
+            bestFilter = filter;
+        }
+    }
+
+    out[0] = (unsigned char)bestFilter;
+    for(int i = 0; i < length; i++) {
+        int up = previous != nullptr ? previous[i] : 0;
+        int left = i >= 3 ? row[i - 3] : 0;
+        int upLeft = (previous != nullptr && i >= 3) ? previous[i - 3] : 0;
+        out[i + 1] = (unsigned char)(row[i] - predict(bestFilter, left, up, upLeft));
+    }
+}
+
+/**
+ * Raw deflate data for one chunk of filtered rows. With zlib,
+ * the chunk is primed with the 32 KB before it so that matches
+ * can reach back into the previous chunk, and every chunk but
+ * the last ends on a byte boundary so that they can be joined
+ * as they are. Without zlib, the bytes go in stored blocks.
+ */
+static std::string deflateChunk(const unsigned char* data, size_t length, const unsigned char* dictionary,
+                                size_t dictionaryLength, bool last) {
+    std::string out;
+
+#ifdef cimg_use_zlib
+    z_stream stream{};
+    if(deflateInit2(&stream, ImageWriter::PNG_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Unable to initialize zlib");
+    }
+    if(dictionaryLength > 0) {
+        deflateSetDictionary(&stream, dictionary, (uInt)dictionaryLength);
+    }
+
+    out.resize(deflateBound(&stream, (uLong)length) + 16);
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = (uInt)length;
+    stream.next_out = (Bytef*)&out[0];
+    stream.avail_out = (uInt)out.size();
+    int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    out.resize(out.size() - stream.avail_out);
+    deflateEnd(&stream);
+
+    if(result != (last ? Z_STREAM_END : Z_OK)) {
+        throw std::runtime_error("Unable to compress the image");
+    }
+#else
+    (void)dictionary;
+    (void)dictionaryLength;
+    size_t offset = 0;
+    do {
+        size_t block = std::min(length - offset, (size_t)65535);
+        bool final = last && offset + block == length;
+        out.push_back(final ? 1 : 0);
+        out.push_back((char)(block & 0xff));
+        out.push_back((char)(block >> 8));
+        out.push_back((char)(~block & 0xff));
+        out.push_back((char)((~block >> 8) & 0xff));
+        out.append((const char*)data + offset, block);
+        offset += block;
+    } while(offset < length);
+#endif
+
+    return out;
+}
+
+static uint32_t adler32(const unsigned char* data, size_t length) {
+    uint32_t a = 1, b = 0;
+    while(length > 0) {
+        size_t block = std::min(length, (size_t)5552); //largest run without overflow
+        for(size_t i = 0; i < block; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += block;
+        length -= block;
+    }
+    return (b << 16) | a;
+}
+
+uint32_t ImageWriter::crc32(uint32_t crc, const unsigned char* data, size_t length) {
+    static uint32_t table[256];
+    static bool initialized = [&]() {
+        for(uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return true;
+    }();
+    (void)initialized;
+
+    crc = ~crc;
+    for(size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void writeChunk(std::ofstream &file, const char* type, const std::string &data) {
+    std::string chunk;
+    appendInt(chunk, (uint32_t)data.size(), true);
+    chunk.append(type, 4);
+    chunk += data;
+    uint32_t crc = ImageWriter::crc32(0, (const unsigned char*)chunk.data() + 4, chunk.size() - 4);
+    appendInt(chunk, crc, true);
+    file.write(chunk.data(), chunk.size());
+}
+
+/**
+ * Quantization and filtering run over all rows first, since a
+ * filter looks at the row above. The chunks of filtered rows are
+ * then compressed in parallel and joined into one zlib stream.
+ */
+void ImageWriter::writePNG(const std::string &filename, const Image &image, unsigned int threads) {
+    size_t rowBytes = (size_t)image.width * 3;
+    std::vector<unsigned char> bytes(rowBytes * image.height);
+    std::vector<unsigned char> filtered((rowBytes + 1) * image.height);
+    forEachRows(image.height, threads, [&](int first, int last) {
+        quantize(image, first, last, &bytes[first * rowBytes]);
+    });
+    forEachRows(image.height, threads, [&](int first, int last) {
+        for(int y = first; y < last; y++) {
+            filterRow(&bytes[y * rowBytes], y > 0 ? &bytes[(y - 1) * rowBytes] : nullptr, (int)rowBytes,
+                      &filtered[y * (rowBytes + 1)]);
+        }
+    });
+
+    int chunks = std::max(1, (image.height + PNG_CHUNK_ROWS - 1) / PNG_CHUNK_ROWS);
+    std::vector<std::string> compressed(chunks);
+    forEachRows(chunks, threads, [&](int first, int last) {
+        for(int chunk = first; chunk < last; chunk++) {
+            size_t start = (size_t)chunk * PNG_CHUNK_ROWS * (rowBytes + 1);
+            size_t end = std::min(filtered.size(), start + (size_t)PNG_CHUNK_ROWS * (rowBytes + 1));
+            size_t dictionary = std::min(start, (size_t)32768);
+            compressed[chunk] = deflateChunk(filtered.data() + start, end - start, filtered.data() + start - dictionary,
+                                             dictionary, chunk == chunks - 1);
+        }
+    });
+
+    std::string header;
+    appendInt(header, (uint32_t)image.width, true);
+    appendInt(header, (uint32_t)image.height, true);
+    header += std::string("\x08\x02\x00\x00\x00", 5); //8 bit RGB, deflate, no interlacing
+
+    std::string data = "\x78\x01"; //zlib header, 32 KB window
+    for(auto & chunk : compressed) {
+        data += chunk;
+    }
+    appendInt(data, adler32(filtered.data(), filtered.size()), true);
+
+    std::ofstream file = openFile(filename);
+    file.write("\x89PNG\r\n\x1a\n", 8);
+    writeChunk(file, "IHDR", header);
+    writeChunk(file, "IDAT", data);
+    writeChunk(file, "IEND", std::string());
+}
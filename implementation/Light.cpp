@@ -6,3 +6,154 @@
  * Final Project
  */
 
+#include "Light.h"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+    const float PI = 3.14159265358979f;
+
+    /**
+     * Two unit vectors that make an orthonormal basis with the
+     * unit vector n, from Duff et al., Building an Orthonormal
+     * Basis, Revisited, JCGT (2017)
+     */
+    void getBasis(const glm::vec3 &n, glm::vec3 &tangent, glm::vec3 &bitangent) {
+        float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+        float a = -1.0f / (sign + n.z);
+        float b = n.x * n.y * a;
+        tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+        bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+    }
+
+    /**
+     * The cone of directions in which a point sees the sphere
+     * is sampled uniformly, and each direction is followed to
+     * the near side of the sphere. Points inside the sphere
+     * get points spread uniformly over its surface.
+     */
+    void sampleSphere(const glm::vec3 &center, float radius, const glm::vec3 &from, const glm::vec2* samples,
+                      int count, glm::vec3* points) {
+        glm::vec3 toCenter = center - from;
+        float distance2 = glm::dot(toCenter, toCenter);
+        float radius2 = radius * radius;
+
+        if(distance2 <= radius2) {
+            for(int i = 0; i < count; i++) {
+                float z = 1.0f - 2.0f * samples[i].x;
+                float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+                float phi = 2.0f * PI * samples[i].y;
+                points[i] = center + radius * glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+            }
+            return;
+        }
+
+        float distance = std::sqrt(distance2);
+        glm::vec3 axis = toCenter / distance;
+        glm::vec3 tangent, bitangent;
+        getBasis(axis, tangent, bitangent);
+
+        //1 - cos of the half angle of the cone, written so
+        //that it does not cancel out for distant spheres
+        float sinMax2 = radius2 / distance2;
+        float oneMinusCosMax = sinMax2 / (1.0f + std::sqrt(1.0f - sinMax2));
+
+        for(int i = 0; i < count; i++) {
+            float oneMinusCos = samples[i].x * oneMinusCosMax;
+            float cosTheta = 1.0f - oneMinusCos;
+            float sinTheta2 = oneMinusCos * (2.0f - oneMinusCos);
+            float sinTheta = std::sqrt(sinTheta2);
+            float phi = 2.0f * PI * samples[i].y;
+
+            float along = distance * cosTheta - std::sqrt(std::max(0.0f, radius2 - distance2 * sinTheta2));
+            glm::vec3 direction = axis * cosTheta + (tangent * std::cos(phi) + bitangent * std::sin(phi)) * sinTheta;
+            points[i] = from + direction * along;
+        }
+    }
+
+    /**
+     * Ureña et al., An Area-Preserving Parametrization for
+     * Spherical Rectangles, EGSR (2013). In a frame whose z
+     * axis is the normal of the rectangle, the first coordinate
+     * of a sample picks a slice of the solid angle, which is
+     * a closed form of its area, and the second a point along
+     * that slice. Rectangles too small or too far to measure
+     * that area in floats, or seen edge on, are sampled by
+     * their area instead, which is then nearly the same.
+     */
+    void sampleRectangle(const glm::vec3 &center, const glm::vec3 &edge1, const glm::vec3 &edge2,
+                         const glm::vec3 &from, const glm::vec2* samples, int count, glm::vec3* points) {
+        glm::vec3 corner = center - 0.5f * edge1 - 0.5f * edge2;
+        float width = glm::length(edge1);
+        float height = glm::length(edge2);
+        glm::vec3 x = edge1 / width;
+        glm::vec3 y = edge2 / height;
+        glm::vec3 z = glm::cross(x, y);
+
+        glm::vec3 d = corner - from;
+        float z0 = glm::dot(d, z);
+        if(z0 > 0.0f) {
+            z = -z;
+            z0 = -z0;
+        }
+        float x0 = glm::dot(d, x);
+        float y0 = glm::dot(d, y);
+        float x1 = x0 + width;
+        float y1 = y0 + height;
+
+        //normals of the planes through the point and each edge
+        glm::vec3 v00(x0, y0, z0), v01(x0, y1, z0), v10(x1, y0, z0), v11(x1, y1, z0);
+        glm::vec3 n0 = glm::normalize(glm::cross(v00, v10));
+        glm::vec3 n1 = glm::normalize(glm::cross(v10, v11));
+        glm::vec3 n2 = glm::normalize(glm::cross(v11, v01));
+        glm::vec3 n3 = glm::normalize(glm::cross(v01, v00));
+
+        float g0 = std::acos(glm::clamp(-glm::dot(n0, n1), -1.0f, 1.0f));
+        float g1 = std::acos(glm::clamp(-glm::dot(n1, n2), -1.0f, 1.0f));
+        float g2 = std::acos(glm::clamp(-glm::dot(n2, n3), -1.0f, 1.0f));
+        float g3 = std::acos(glm::clamp(-glm::dot(n3, n0), -1.0f, 1.0f));
+        float k = 2.0f * PI - g2 - g3;
+        float solidAngle = g0 + g1 - k;
+
+        if(!(solidAngle > 1e-4f) || -z0 < 1e-6f * std::max(width, height)) {
+            for(int i = 0; i < count; i++) {
+                points[i] = corner + edge1 * samples[i].x + edge2 * samples[i].y;
+            }
+            return;
+        }
+
+        float b0 = n0.z;
+        float b1 = n2.z;
+        float b0sq = b0 * b0;
+        float z0sq = z0 * z0;
+        for(int i = 0; i < count; i++) {
+            float au = samples[i].x * solidAngle + k;
+            float fu = (std::cos(au) * b0 - b1) / std::sin(au);
+            float cu = glm::clamp((fu > 0.0f ? 1.0f : -1.0f) / std::sqrt(fu * fu + b0sq), -1.0f, 1.0f);
+            float xu = glm::clamp(-(cu * z0) / std::sqrt(std::max(1e-12f, 1.0f - cu * cu)), x0, x1);
+
+            float distance = std::sqrt(xu * xu + z0sq);
+            float h0 = y0 / std::sqrt(distance * distance + y0 * y0);
+            float h1 = y1 / std::sqrt(distance * distance + y1 * y1);
+            float hv = h0 + samples[i].y * (h1 - h0);
+            float hv2 = hv * hv;
+            float yv = hv2 < 1.0f - 1e-6f ? glm::clamp(hv * distance / std::sqrt(1.0f - hv2), y0, y1) : y1;
+
+            points[i] = from + x * xu + y * yv + z * z0;
+        }
+    }
+}
+
+void Light::sample(const glm::vec3 &from, const glm::vec2* samples, int count, glm::vec3* points) const {
+    switch(getShape()) {
+        case sphereLight:
+            sampleSphere(position, radius, from, samples, count, points);
+            break;
+        case rectangleLight:
+            sampleRectangle(position, edge1, edge2, from, samples, count, points);
+            break;
+        default:
+            std::fill(points, points + count, position);
+            break;
+    }
+}
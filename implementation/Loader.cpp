@@ -6,42 +6,46 @@
  * Final Project
  */
 
-#include <fstream>
-#include <boost/token_functions.hpp>
-#include <boost/tokenizer.hpp>
 #include <Plane.h>
 #include <Sphere.h>
 #include <Mesh.h>
 #include "Loader.h"
 #include "SceneObject.h"
+#include <cmath>
 
 /**
  * Reads and parses the scene file and places all scene objects
  * into a temporary std::vector. Then separates lights from
- * geometry objects. Meshes are discarded and instead their
- * triangles are kept
+ * geometry objects. Meshes are kept whole so that their
+ * bounding box can reject rays before their triangles
  */
 void Loader::loadScene(const std::string &filename, std::vector<SceneObject*> &sceneObjects, std::vector<Light*> &lights,
-                       Camera* &camera, boost::filesystem::path &scenePath) {
-
-    std::ifstream input(filename);
-    std::string line;
-    bool isFirst = true;
+                       Camera* &camera, boost::filesystem::path &scenePath, GeometryCache* geometryCache,
+                       unsigned int threads) {
 
+    SceneParser parser(filename);
     std::vector<SceneObject*> tempObjects;
 
-    if(input.is_open()) {
-        while (getline(input, line)) {
-            if(isFirst) {
-                isFirst = false;
-            } else {
-                parseLine(tempObjects, line, scenePath);
+    //the first line is the object count
+    parser.next();
+
+    try {
+        while(parser.next()) {
+            if(parser.getWordCount() > 0) {
+                addToScene(tempObjects, parser, scenePath, geometryCache, threads);
             }
         }
+    } catch (std::exception& e) {
+        for(auto & object : tempObjects) {
+            delete object;
+        }
+        std::string message = filename + ":" + std::to_string(parser.getLineNumber()) + ": " + e.what();
+        if(dynamic_cast<std::runtime_error*>(&e) != nullptr) {
+            throw std::runtime_error(message);
+        }
+        throw std::invalid_argument(message);
     }
 
-    input.close();
-
     for(auto & object : tempObjects) {
         switch(object->type) {
             case SceneObject::camera:
@@ -49,30 +53,24 @@ void Loader::loadScene(const std::string &filename, std::vector<SceneObject*> &s
                 break;
             case SceneObject::plane:
             case SceneObject::sphere:
-                sceneObjects.push_back(object);
-                break;
             case SceneObject::mesh:
-                sceneObjects.insert(sceneObjects.end(), ((Mesh*)object)->getTriangles().begin(), ((Mesh*)object)->getTriangles().end());
-                delete object;  //The Mesh* structure is no longer needed
+                sceneObjects.push_back(object);
                 break;
             case SceneObject::light:
                 lights.push_back((Light*)object);
                 break;
+            case SceneObject::triangle:
+                //only made by meshes, never by a scene file
+                break;
         }
     }
 }
 
-void Loader::parseLine(std::vector<SceneObject*> &objects, std::string &line, boost::filesystem::path &scenePath) {
-    boost::char_separator<char> sep(" ");
-    boost::tokenizer< boost::char_separator<char> > tok(line, sep);
-    std::vector<std::string> parts;
-    for(boost::tokenizer< boost::char_separator<char> >::iterator beg = tok.begin(); beg != tok.end(); ++beg)
-    {
-        parts.push_back(*beg);
-    }
+void Loader::applyProperty(SceneObject* object, const std::string &line, boost::filesystem::path &scenePath) {
+    SceneParser parser(line);
 
-    if(parts.size() > 0) {
-        addToScene(objects, parts, scenePath);
+    if(parser.next() && parser.getWordCount() > 0) {
+        setProperty(object, parser, scenePath);
     }
 }
 
@@ -86,8 +84,20 @@ constexpr unsigned int hash(const char *str, int h = 0) {
     return !str[h] ? 5381 : (hash(str, h+1)*33) ^ str[h];
 }
 
-void Loader::addToScene(std::vector<SceneObject*> &objects, std::vector<std::string> parts, boost::filesystem::path &scenePath) {
-    switch(hash(parts[0].c_str())) {
+/**
+ * The same hash of a word of the scene file
+ */
+static unsigned int hash(boost::string_view word) {
+    unsigned int h = 5381;
+    for(auto c = word.rbegin(); c != word.rend(); ++c) {
+        h = (h * 33) ^ *c;
+    }
+    return h;
+}
+
+void Loader::addToScene(std::vector<SceneObject*> &objects, const SceneParser &line, boost::filesystem::path &scenePath, GeometryCache* geometryCache,
+                        unsigned int threads) {
+    switch(hash(line.getWord(0))) {
         case hash("camera"): {
             Camera* camera = new Camera();
             objects.push_back(camera);
@@ -105,6 +115,7 @@ void Loader::addToScene(std::vector<SceneObject*> &objects, std::vector<std::str
             break;
         case hash("mesh"):{
             Mesh* mesh = new Mesh();
+            mesh->setGeometryCache(geometryCache, threads);
             objects.push_back(mesh);
         }
             break;
@@ -114,46 +125,106 @@ void Loader::addToScene(std::vector<SceneObject*> &objects, std::vector<std::str
         }
             break;
         default:
-            setProperty(objects.back(), parts, scenePath);
+            if(objects.empty()) {
+                throw std::invalid_argument("Property " + line.getWord(0).to_string() + " before any object");
+            }
+            setProperty(objects.back(), line, scenePath);
             break;
     }
 }
 
-void Loader::setProperty(SceneObject* object, std::vector<std::string> data, boost::filesystem::path &scenePath) {
+/**
+ * Checked as each property is set, so that
+ * errors point at the line that caused them
+ */
+void Loader::checkLightShape(const Light* light) {
+    if(light->radius < 0.0f) {
+        throw std::invalid_argument("The radius of a light cannot be negative");
+    }
+    bool hasEdges = light->edge1 != glm::vec3(0.0f) || light->edge2 != glm::vec3(0.0f);
+    if(light->radius > 0.0f && hasEdges) {
+        throw std::invalid_argument("A light is either a sphere or a rectangle");
+    }
+    float length1 = glm::length(light->edge1);
+    float length2 = glm::length(light->edge2);
+    if(length1 > 0.0f && length2 > 0.0f && std::fabs(glm::dot(light->edge1, light->edge2)) > 1e-3f * length1 * length2) {
+        throw std::invalid_argument("The edges of a rectangle light must be perpendicular");
+    }
+}
+
+void Loader::setProperty(SceneObject* object, const SceneParser &line, boost::filesystem::path &scenePath) {
+    //every property has a value
+    line.getWord(1);
 
-    switch(hash(data[0].c_str())) {
+    auto require = [&line, object](SceneObject::Type type) {
+        if(object->type != type) {
+            throw std::invalid_argument("Property " + line.getWord(0).to_string() + " does not apply to this object");
+        }
+    };
+
+    switch(hash(line.getWord(0))) {
         case hash("pos:"):
-            object->position = glm::vec3(std::stof(data[1]), std::stof(data[2]), std::stof(data[3]));
+            object->position = line.getVec3(1);
             break;
         case hash("fov:"):
-            ((Camera*)object)->fieldOfView = std::stof(data[1]);
+            require(SceneObject::camera);
+            ((Camera*)object)->fieldOfView = line.getFloat(1);
             break;
         case hash("f:"):
-            ((Camera*)object)->focalLength = std::stof(data[1]);
+            require(SceneObject::camera);
+            ((Camera*)object)->focalLength = line.getFloat(1);
             break;
         case hash("a:"):
-            ((Camera*)object)->aspectRatio = std::stof(data[1]);
+            require(SceneObject::camera);
+            ((Camera*)object)->aspectRatio = line.getFloat(1);
             break;
         case hash("nor:"):
-            object->normal = glm::vec3(std::stof(data[1]), std::stof(data[2]), std::stof(data[3]));
+            object->normal = line.getVec3(1);
             break;
         case hash("amb:"):
-            object->setAmbient(glm::vec3(std::stof(data[1]), std::stof(data[2]), std::stof(data[3])));
+            object->setAmbient(line.getVec3(1));
             break;
         case hash("dif:"):
-            object->setDiffuse(glm::vec3(std::stof(data[1]), std::stof(data[2]), std::stof(data[3])));
+            object->setDiffuse(line.getVec3(1));
             break;
         case hash("spe:"):
-            object->setSpecular(glm::vec3(std::stof(data[1]), std::stof(data[2]), std::stof(data[3])));
+            object->setSpecular(line.getVec3(1));
             break;
         case hash("shi:"):
-            object->setShininess(std::stof(data[1]));
+            object->setShininess(line.getFloat(1));
             break;
         case hash("file:"):
-            ((Mesh*)object)->loadObj(data[1], scenePath);
+            require(SceneObject::mesh);
+            {
+                std::string file = line.getWord(1).to_string();
+                ((Mesh*)object)->loadObj(file, scenePath);
+            }
+            break;
+        case hash("tex:"):
+            require(SceneObject::mesh);
+            ((Mesh*)object)->setTextureFile(line.getWord(1).to_string(), scenePath);
+            break;
+        case hash("sid:"):
+            object->setDoubleSided(line.getInt(1) >= 2);
             break;
         case hash("rad:"):
-            ((Sphere*)object)->radius = std::stof(data[1]);
+            if(object->type == SceneObject::light) {
+                ((Light*)object)->radius = line.getFloat(1);
+                checkLightShape((Light*)object);
+                break;
+            }
+            require(SceneObject::sphere);
+            ((Sphere*)object)->radius = line.getFloat(1);
+            break;
+        case hash("ed1:"):
+            require(SceneObject::light);
+            ((Light*)object)->edge1 = line.getVec3(1);
+            checkLightShape((Light*)object);
+            break;
+        case hash("ed2:"):
+            require(SceneObject::light);
+            ((Light*)object)->edge2 = line.getVec3(1);
+            checkLightShape((Light*)object);
             break;
     }
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "MappedFile.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string &filename) {
+    int file = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if(file < 0) {
+        throw std::invalid_argument("Unable to read " + filename);
+    }
+
+    struct stat status;
+    if(fstat(file, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+        void* mapped = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if(mapped != MAP_FAILED) {
+            madvise(mapped, (size_t)status.st_size, MADV_SEQUENTIAL);
+            mapping = mapped;
+            data = (const char*)mapped;
+            size = (size_t)status.st_size;
+        }
+    }
+    close(file);
+
+    //pipes and the like are read whole instead
+    if(mapping == nullptr) {
+        std::ifstream input(filename, std::ios::binary);
+        std::stringstream buffer;
+        buffer << input.rdbuf();
+        contents = buffer.str();
+        data = contents.data();
+        size = contents.size();
+    }
+}
+
+MappedFile::~MappedFile() {
+    if(mapping != nullptr) {
+        munmap(mapping, size);
+    }
+}
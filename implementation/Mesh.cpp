@@ -10,10 +10,12 @@
 #include "OBJloader.h"
 #include <boost/filesystem.hpp>
 #include <Loader.h>
+#include <cmath>
+#include <algorithm>
 
 /**
- * Iterates through the index array three-by-three and instantiates
- * triangles on the heap with the corresponding vertices.
+ * Reads the vertex positions and the index array of the file,
+ * three indices per triangle.
  * .obj files should be in the same path as scene files. Because these
  * may be different from the path of the executable, the scene path
  * is passed to this function.
@@ -22,61 +24,364 @@ void Mesh::loadObj(std::string &filename, boost::filesystem::path &scenePath) {
 
     this->filename = scenePath.generic_string() + "/" + filename;
 
-    std::vector<unsigned int> vertexIndices;
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec3> normals;
-    std::vector<glm::vec2> uvs;
-
-    if(loadOBJ(this->filename.c_str(), vertexIndices, vertices, normals, uvs)) {
-        int v(0);
-        for(auto& index : vertexIndices) {
-            if(v % 3 == 0) {
-                Triangle* triangle = new Triangle();
-                triangle->ambient = ambient;
-                triangle->diffuse = diffuse;
-                triangle->specular = specular;
-                triangle->shininess = shininess;
-                triangles.push_back(triangle);
+    if(geometryCache != nullptr) {
+        loadChunks();
+        return;
+    }
+
+    std::vector<glm::vec3> vertexNormals;
+    std::vector<unsigned int> indicesOfNormals;
+
+    if(loadOBJ(this->filename.c_str(), indices, positions, vertexNormals, uvs, indicesOfNormals, uvIndices)) {
+        indices.resize(indices.size() - indices.size() % 3);
+        uvIndices.resize(std::min(uvIndices.size(), indices.size()));
+        indicesOfNormals.resize(std::min(indicesOfNormals.size(), indices.size()));
+        setNormals(vertexNormals, indicesOfNormals);
+        sourceTriangles.resize(indices.size() / 3);
+        for(size_t i = 0; i < sourceTriangles.size(); i++) {
+            sourceTriangles[i] = (int)i;
+        }
+        computeBounds();
+    } else {
+        throw std::invalid_argument("Mesh could not be loaded");
+    }
+}
+
+Mesh::~Mesh() {
+    deleteTriangles();
+    releaseChunks();
+}
+
+/**
+ * The chunk file is written once, as the .obj file is read,
+ * and reused by later runs for as long as the .obj file keeps
+ * its size and modification time. The mesh is never held in
+ * memory whole, so meshes larger than memory can be loaded.
+ */
+void Mesh::loadChunks() {
+    releaseChunks();
+
+    boost::filesystem::path source(filename);
+    if(!boost::filesystem::exists(source)) {
+        throw std::invalid_argument("Mesh could not be loaded");
+    }
+    uint64_t sourceSize = boost::filesystem::file_size(source);
+    int64_t sourceTime = (int64_t)boost::filesystem::last_write_time(source);
+    std::string path = filename + ".chunks";
+
+    chunks = new ChunkedGeometry();
+    if(!chunks->open(path, sourceSize, sourceTime)) {
+        try {
+            ChunkedGeometry::Builder builder(path, sourceSize, sourceTime, chunkThreads);
+            bool loaded = streamOBJ(filename.c_str(), [&builder](const glm::vec3 &position) {
+                builder.addVertex(position);
+            }, [&builder](const unsigned int* vertices) {
+                builder.addTriangle(vertices);
+            });
+            if(!loaded) {
+                throw std::invalid_argument("Mesh could not be loaded");
             }
-            triangles.back()->vertices.push_back(vertices[index]);
-            v++;
+            builder.finish();
+        } catch (...) {
+            releaseChunks();
+            throw;
         }
+        if(!chunks->open(path, sourceSize, sourceTime)) {
+            releaseChunks();
+            throw std::runtime_error("Could not read back " + path);
+        }
+    }
+
+    bounds = chunks->getBounds();
+    positions.clear();
+    positions.shrink_to_fit();
+    indices.clear();
+    indices.shrink_to_fit();
+    uvs.clear();
+    uvs.shrink_to_fit();
+    uvIndices.clear();
+    uvIndices.shrink_to_fit();
+    normals.clear();
+    normals.shrink_to_fit();
+    normalIndices.clear();
+    normalIndices.shrink_to_fit();
+    sourceTriangles.clear();
+    sourceTriangles.shrink_to_fit();
+    deleteTriangles();
+    bvh.clear();
+    wideBVH.clear();
+}
+
+void Mesh::releaseChunks() {
+    if(chunks == nullptr) {
+        return;
+    }
+    if(geometryCache != nullptr) {
+        geometryCache->release(*chunks);
+    }
+    delete chunks;
+    chunks = nullptr;
+}
+
+void Mesh::computeBounds() {
+    bounds = AABB();
+    for(auto& index: indices) {
+        bounds.expand(positions[index]);
+    }
+}
+
+void Mesh::createTriangles() {
+    deleteTriangles();
+    triangles.reserve(getTriangleCount());
+    for(size_t i = 0; i < indices.size(); i += 3) {
+        Triangle* triangle = new Triangle();
+        triangle->ambient = ambient;
+        triangle->diffuse = diffuse;
+        triangle->specular = specular;
+        triangle->shininess = shininess;
+        triangle->doubleSided = doubleSided;
+        triangle->id = id;
+        triangle->vertices = {positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]};
+
+        //Pre-computing the normal, area and edges of every
+        //triangle to save CPU time during the intersection
+        //testing and lighting calculations
+        triangle->precompute();
+        triangles.push_back(triangle);
+    }
+}
+
+void Mesh::deleteTriangles() {
+    for(auto& triangle: triangles) {
+        delete triangle;
+    }
+    triangles.clear();
+    triangles.shrink_to_fit();
+}
+
+/**
+ * The indices are reordered to match the leaves of the
+ * hierarchy, so that each leaf covers a contiguous range
+ * of triangles.
+ */
+void Mesh::buildBVH(unsigned int threads, bool compact) {
+    if(isStreamed()) {
+        return;
+    }
+
+    std::vector<AABB> triangleBounds = getTriangleBounds();
+    bvh.build(triangleBounds, threads);
 
-        //Pre-computing the normal and area of every triangle
-        //to save CPU time during the intersection testing and
-        //lighting calculations
-        for(auto& triangle : triangles) {
-            glm::vec3 ab = triangle->vertices[1] - triangle->vertices[0];
-            glm::vec3 ac = triangle->vertices[2] - triangle->vertices[0];
-            glm::vec3 bc = triangle->vertices[2] - triangle->vertices[1];
-            triangle->normal = glm::normalize(glm::cross(ab, ac));
-            triangle->area = glm::length(glm::cross(ab, ac)) / 2.0f;
+    const std::vector<int> &order = bvh.getOrder();
+    //every array of three indices per triangle follows
+    auto reorder = [&order](std::vector<unsigned int> &cornerIndices) {
+        if(cornerIndices.empty()) {
+            return;
         }
+        std::vector<unsigned int> ordered(cornerIndices.size());
+        for(size_t i = 0; i < order.size(); i++) {
+            for(int corner = 0; corner < 3; corner++) {
+                ordered[i * 3 + corner] = cornerIndices[order[i] * 3 + corner];
+            }
+        }
+        cornerIndices.swap(ordered);
+    };
+    reorder(indices);
+    reorder(uvIndices);
+    reorder(normalIndices);
+
+    std::vector<int> orderedSources(order.size());
+    for(size_t i = 0; i < order.size(); i++) {
+        orderedSources[i] = sourceTriangles[order[i]];
+    }
+    sourceTriangles.swap(orderedSources);
+
+    if(compact) {
+        wideBVH.build(bvh);
+        bvh.clear();
+        deleteTriangles();
     } else {
-        throw std::invalid_argument("Mesh could not be loaded");
+        wideBVH.clear();
+        createTriangles();
+    }
+}
+
+std::vector<AABB> Mesh::getTriangleBounds() const {
+    std::vector<AABB> triangleBounds(getTriangleCount());
+    for(size_t i = 0; i < triangleBounds.size(); i++) {
+        for(int corner = 0; corner < 3; corner++) {
+            triangleBounds[i].expand(positions[indices[i * 3 + corner]]);
+        }
     }
+    return triangleBounds;
+}
+
+size_t Mesh::getGeometryMemory() const {
+    size_t bytes = positions.capacity() * sizeof(glm::vec3) +
+                   indices.capacity() * sizeof(unsigned int) +
+                   uvs.capacity() * sizeof(glm::vec2) +
+                   uvIndices.capacity() * sizeof(unsigned int) +
+                   normals.capacity() * sizeof(uint32_t) +
+                   normalIndices.capacity() * sizeof(unsigned int) +
+                   sourceTriangles.capacity() * sizeof(int) +
+                   triangles.capacity() * sizeof(Triangle*);
+    for(auto& triangle: triangles) {
+        bytes += sizeof(Triangle) + triangle->vertices.capacity() * sizeof(glm::vec3);
+    }
+    return bytes;
+}
+
+/**
+ * The indices are already in the order of the BVH leaves,
+ * so the bounds of the triangles can be handed to the
+ * refit as they are.
+ */
+bool Mesh::deform(const std::vector<glm::vec3> &vertices, unsigned int threads, float rebuildThreshold) {
+    if(isStreamed()) {
+        throw std::invalid_argument("Out-of-core mesh " + filename + " cannot be deformed");
+    }
+
+    if(vertices.size() != positions.size()) {
+        throw std::invalid_argument("Expected " + std::to_string(positions.size()) + " vertices for " + filename +
+                                    " but got " + std::to_string(vertices.size()));
+    }
+
+    positions = vertices;
+    computeBounds();
+
+    if(isCompact()) {
+        buildBVH(threads, true);
+        return true;
+    }
+
+    for(size_t i = 0; i < triangles.size(); i++) {
+        Triangle* triangle = triangles[i];
+        for(int corner = 0; corner < 3; corner++) {
+            triangle->vertices[corner] = positions[indices[i * 3 + corner]];
+        }
+        triangle->precompute();
+    }
+
+    if(bvh.isEmpty()) {
+        return false;
+    }
+
+    if(bvh.refit(getTriangleBounds(), threads) > rebuildThreshold) {
+        buildBVH(threads);
+        return true;
+    }
+    return false;
+}
+
+bool Mesh::loadFrame(std::string &filename, boost::filesystem::path &scenePath, unsigned int threads, float rebuildThreshold) {
+    std::string path = scenePath.generic_string() + "/" + filename;
+    if(isStreamed()) {
+        throw std::invalid_argument("Out-of-core mesh " + this->filename + " cannot be deformed");
+    }
+
+    std::vector<unsigned int> frameIndices;
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> frameNormals;
+    std::vector<glm::vec2> frameUVs;
+    std::vector<unsigned int> normalFrameIndices;
+    std::vector<unsigned int> uvFrameIndices;
+
+    if(!loadOBJ(path.c_str(), frameIndices, vertices, frameNormals, frameUVs, normalFrameIndices, uvFrameIndices)) {
+        throw std::invalid_argument("Frame " + path + " could not be loaded");
+    }
+
+    //the indices of the mesh are in BVH order
+    bool sameFaces = frameIndices.size() - frameIndices.size() % 3 == indices.size();
+    for(size_t i = 0; sameFaces && i < sourceTriangles.size(); i++) {
+        for(int corner = 0; corner < 3; corner++) {
+            sameFaces &= frameIndices[sourceTriangles[i] * 3 + corner] == indices[i * 3 + corner];
+        }
+    }
+    if(!sameFaces) {
+        throw std::invalid_argument("Frame " + path + " does not have the faces of " + this->filename);
+    }
+
+    //the indices of the normals are kept, only their values change
+    if(frameNormals.size() == normals.size()) {
+        for(size_t i = 0; i < normals.size(); i++) {
+            normals[i] = encodeOctahedral(frameNormals[i]);
+        }
+    }
+
+    return deform(vertices, threads, rebuildThreshold);
+}
+
+void Mesh::setNormals(const std::vector<glm::vec3> &vertexNormals, std::vector<unsigned int> &indicesOfNormals) {
+    normals.clear();
+    normalIndices.clear();
+    if(indicesOfNormals.size() != indices.size()) {
+        return;
+    }
+
+    normals.resize(vertexNormals.size());
+    for(size_t i = 0; i < vertexNormals.size(); i++) {
+        normals[i] = encodeOctahedral(vertexNormals[i]);
+    }
+    if(indicesOfNormals != indices) {
+        normalIndices.swap(indicesOfNormals);
+    }
+}
+
+void Mesh::setTextureFile(const std::string &filename, boost::filesystem::path &scenePath) {
+    textureFile = scenePath.generic_string() + "/" + filename;
+    texture = nullptr;
+}
+
+/**
+ * Barycentric interpolation of the coordinates of the three
+ * corners, the same weights that interpolate the positions.
+ */
+glm::vec2 Mesh::getTextureCoordinates(int triangle, const glm::vec2 &barycentrics, float &areaRatio) const {
+    const unsigned int* corners = &uvIndices[triangle * 3];
+    const glm::vec2 &a = uvs[corners[0]];
+    glm::vec2 edge1 = uvs[corners[1]] - a;
+    glm::vec2 edge2 = uvs[corners[2]] - a;
+
+    const unsigned int* vertices = &indices[triangle * 3];
+    const glm::vec3 &p = positions[vertices[0]];
+    float area = glm::length(glm::cross(positions[vertices[1]] - p, positions[vertices[2]] - p));
+    float uvArea = std::fabs(edge1.x * edge2.y - edge1.y * edge2.x);
+    areaRatio = area > 0.0f ? uvArea / area : 0.0f;
+
+    return a + barycentrics.x * edge1 + barycentrics.y * edge2;
 }
 
 void Mesh::setAmbient(glm::vec3 ambient) {
+    this->ambient = ambient;
     for(auto& triangle: triangles) {
         triangle->ambient = ambient;
     }
 }
 
 void Mesh::setDiffuse(glm::vec3 diffuse) {
+    this->diffuse = diffuse;
     for(auto& triangle: triangles) {
         triangle->diffuse = diffuse;
     }
 }
 
 void Mesh::setSpecular(glm::vec3 specular) {
+    this->specular = specular;
     for(auto& triangle: triangles) {
         triangle->specular = specular;
     }
 }
 
 void Mesh::setShininess(float shininess) {
+    this->shininess = shininess;
     for(auto& triangle: triangles) {
         triangle->shininess = shininess;
     }
-}
\ No newline at end of file
+}
+
+void Mesh::setDoubleSided(bool doubleSided) {
+    this->doubleSided = doubleSided;
+    for(auto& triangle: triangles) {
+        triangle->doubleSided = doubleSided;
+    }
+}
@@ -0,0 +1,260 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "PreviewServer.h"
+#include "Loader.h"
+#include "Mesh.h"
+#include "SocketIO.h"
+#include <iostream>
+#include <sstream>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+PreviewServer::PreviewServer(const std::string &socketPath) {
+    this->socketPath = socketPath;
+    listenSocket = -1;
+    running = false;
+    activeScene = nullptr;
+}
+
+PreviewServer::~PreviewServer() {
+    for(auto & entry : scenes) {
+        delete entry.second;
+    }
+    scenes.clear();
+
+    if(listenSocket >= 0) {
+        close(listenSocket);
+        unlink(socketPath.c_str());
+    }
+}
+
+void PreviewServer::run() {
+    sockaddr_un address{};
+    if(socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Socket path is too long");
+    }
+
+    listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenSocket < 0) {
+        throw std::runtime_error(std::string("Unable to create socket: ") + strerror(errno));
+    }
+
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    unlink(socketPath.c_str()); //a stale socket file from a previous run
+
+    if(bind(listenSocket, (sockaddr*)&address, sizeof(address)) < 0 || listen(listenSocket, 4) < 0) {
+        throw std::runtime_error(std::string("Unable to listen on ") + socketPath + ": " + strerror(errno));
+    }
+
+    std::cout << "Preview server listening on " << socketPath << std::endl;
+
+    running = true;
+    while(running) {
+        int client = accept(listenSocket, nullptr, nullptr);
+        if(client < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("Unable to accept client: ") + strerror(errno));
+        }
+
+        try {
+            serveClient(client);
+        } catch (std::exception& e) {
+            //a client that disconnects in the middle of a
+            //render should not take the server down
+            std::cerr << "Client dropped: " << e.what() << std::endl;
+        }
+        close(client);
+    }
+}
+
+void PreviewServer::serveClient(int client) {
+    std::string buffer;
+    std::string line;
+
+    while(running && SocketIO::readLine(client, buffer, line)) {
+        if(line == "quit") {
+            break;
+        }
+        handleCommand(client, line);
+    }
+}
+
+/**
+ * Every command is answered with exactly one "ok" or "error"
+ * line, except render which streams its tiles first and
+ * finishes with "done".
+ */
+void PreviewServer::handleCommand(int client, const std::string &line) {
+    std::istringstream stream(line);
+    std::string command;
+    stream >> command;
+
+    try {
+        if(command == "load") {
+            std::string filename;
+            stream >> filename;
+            load(client, filename);
+        } else if(command == "unload") {
+            std::string filename;
+            stream >> filename;
+            auto found = scenes.find(filename);
+            if(found != scenes.end()) {
+                if(found->second == activeScene) {
+                    activeScene = nullptr;
+                }
+                delete found->second;
+                scenes.erase(found);
+            }
+            SocketIO::writeLine(client, "ok");
+        } else if(command == "camera") {
+            Scene* scene = requireScene();
+            std::string property;
+            std::getline(stream >> std::ws, property);
+            Loader::applyProperty(scene->getCamera(), property, scene->getScenePath());
+            scene->resetView();
+            SocketIO::writeLine(client, "ok");
+        } else if(command == "light" || command == "object") {
+            Scene* scene = requireScene();
+            int index = -1;
+            std::string property;
+            stream >> index;
+            std::getline(stream >> std::ws, property);
+
+            SceneObject* target = nullptr;
+            if(command == "light" && index >= 0 && index < (int)scene->getLights().size()) {
+                target = scene->getLights()[index];
+            } else if(command == "object" && index >= 0 && index < (int)scene->getSceneObjects().size()) {
+                target = scene->editSceneObjects()[index];
+            }
+            if(target == nullptr) {
+                throw std::out_of_range("No " + command + " with index " + std::to_string(index));
+            }
+
+            Loader::applyProperty(target, property, scene->getScenePath());
+            if(command == "object") {
+                scene->updateIndex();
+            }
+            SocketIO::writeLine(client, "ok");
+        } else if(command == "frame") {
+            int index = -1;
+            std::string filename;
+            float rebuildThreshold = BVH::DEFAULT_REBUILD_THRESHOLD;
+            stream >> index >> filename >> rebuildThreshold;
+            loadFrame(client, index, filename, rebuildThreshold);
+        } else if(command == "render") {
+            int tileSize = DEFAULT_TILE_SIZE;
+            stream >> tileSize;
+            render(client, tileSize > 0 ? tileSize : DEFAULT_TILE_SIZE);
+        } else if(command == "shutdown") {
+            running = false;
+            SocketIO::writeLine(client, "ok");
+        } else {
+            SocketIO::writeLine(client, "error unknown command " + command);
+        }
+    } catch (std::exception& e) {
+        //includes scenes that fail to load or render; if the
+        //socket itself failed, writing the reply throws again
+        //and the client is dropped
+        SocketIO::writeLine(client, std::string("error ") + e.what());
+    }
+}
+
+/**
+ * Scenes are cached by file path. Loading a scene that
+ * is already in memory only makes it the active one.
+ */
+void PreviewServer::load(int client, const std::string &filename) {
+    auto found = scenes.find(filename);
+    if(found == scenes.end()) {
+        Scene* scene = new Scene(filename);
+        found = scenes.insert(std::make_pair(filename, scene)).first;
+    }
+    activeScene = found->second;
+
+    SocketIO::writeLine(client, "ok " + std::to_string(activeScene->getWidth()) + " " +
+                                std::to_string(activeScene->getHeight()) + " " +
+                                std::to_string(activeScene->getSceneObjects().size()) + " " +
+                                std::to_string(activeScene->getLights().size()));
+}
+
+/**
+ * Tiles are written to the socket by whichever render thread
+ * finished them, so the writes are serialized with a mutex.
+ */
+void PreviewServer::render(int client, int tileSize) {
+    Scene* scene = requireScene();
+    std::mutex socketMutex;
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    RenderOptions options;
+    options.tileSize = tileSize;
+
+    scene->renderTiles(options, [&](int x, int y, int w, int h) {
+        std::vector<unsigned char> pixels;
+        pixels.reserve(w * h * 3);
+        for(int j = y; j < y + h; j++) {
+            for(int i = x; i < x + w; i++) {
+                const glm::vec3 &color = scene->getColor(i, j);
+                pixels.push_back((unsigned char)(glm::clamp(color.x, 0.0f, 1.0f) * 255.0f));
+                pixels.push_back((unsigned char)(glm::clamp(color.y, 0.0f, 1.0f) * 255.0f));
+                pixels.push_back((unsigned char)(glm::clamp(color.z, 0.0f, 1.0f) * 255.0f));
+            }
+        }
+
+        std::string header = "tile " + std::to_string(x) + " " + std::to_string(y) + " " +
+                             std::to_string(w) + " " + std::to_string(h) + "\n";
+
+        std::lock_guard<std::mutex> lock(socketMutex);
+        SocketIO::writeAll(client, header.data(), header.size());
+        SocketIO::writeAll(client, pixels.data(), pixels.size());
+    });
+
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> elapsed = end-start;
+    SocketIO::writeLine(client, "done " + std::to_string(elapsed.count()));
+}
+
+/**
+ * Frame paths are relative to the scene file,
+ * like the meshes they replace.
+ */
+void PreviewServer::loadFrame(int client, int index, std::string &filename, float rebuildThreshold) {
+    Scene* scene = requireScene();
+    std::vector<SceneObject*> &objects = scene->editSceneObjects();
+    if(index < 0 || index >= (int)objects.size() || objects[index]->type != SceneObject::mesh) {
+        throw std::out_of_range("No mesh with index " + std::to_string(index));
+    }
+
+    Mesh* mesh = (Mesh*)objects[index];
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    bool rebuilt = mesh->loadFrame(filename, scene->getScenePath(), RenderOptions().getThreadCount(), rebuildThreshold);
+    scene->updateIndex();
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> elapsed = end-start;
+
+    SocketIO::writeLine(client, std::string(rebuilt ? "ok rebuild " : "ok refit ") + std::to_string(elapsed.count()) + " " +
+                                std::to_string(mesh->getBVH().getDegradation()));
+}
+
+Scene* PreviewServer::requireScene() {
+    if(activeScene == nullptr) {
+        throw std::invalid_argument("No scene loaded");
+    }
+    return activeScene;
+}
@@ -0,0 +1,400 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <Rasterizer.h>
+#include "Ray.h"
+#include "Sphere.h"
+#include "Mesh.h"
+#include "ChunkedGeometry.h"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <algorithm>
+
+//std::min takes it by reference
+const int Rasterizer::SETUP_BATCH;
+
+namespace {
+    /**
+     * Part of the setup handed to one thread: a range of
+     * spheres, a range of the triangles of a mesh in memory,
+     * or one chunk of an out-of-core mesh
+     */
+    struct SetupWork {
+        Mesh* mesh;
+        int first;
+        int count;
+        int chunk;
+    };
+}
+
+/**
+ * Pixel centers sit at integer coordinates: the center of
+ * pixel (x, y) is the first one moved x pixel widths along
+ * the right vector of the camera and y heights down its up
+ * vector, exactly as Pixel::initialize places them. A point
+ * is projected onto the plane of the pixel centers along the
+ * line to the eye, which is the ray that would hit it.
+ */
+void Rasterizer::setup(const std::vector<SceneObject*> &sceneObjects, Camera &camera, Pixel** screen, int width,
+                       int height, int binSize, unsigned int threads) {
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    this->width = width;
+    this->height = height;
+    this->binSize = binSize;
+    this->screen = screen;
+    binsX = (width + binSize - 1) / binSize;
+    binsY = (height + binSize - 1) / binSize;
+
+    eye = camera.position;
+    forward = -camera.getN();
+    right = camera.getU();
+    up = camera.getV();
+    glm::vec3 corner = screen[0][0].position - eye;
+    screenDistance = glm::dot(corner, forward);
+    offsetX = glm::dot(corner, right);
+    offsetY = glm::dot(corner, up);
+    pixelWidth = screen[0][0].width;
+    pixelHeight = screen[0][0].height;
+
+    size_t pixels = (size_t)width * height;
+    directions.resize(pixels);
+    nearest.resize(pixels);
+    second.resize(pixels);
+    ambiguous.resize(pixels);
+    objects.resize(pixels);
+    primitives.resize(pixels);
+
+    std::vector<SceneObject*> spheres;
+    std::vector<SetupWork> work;
+    for(auto & object : sceneObjects) {
+        if(object->type == SceneObject::sphere) {
+            spheres.push_back(object);
+        } else if(object->type == SceneObject::mesh) {
+            Mesh* mesh = (Mesh*)object;
+            if(mesh->isStreamed()) {
+                for(int chunk = 0; chunk < (int)mesh->getChunks()->getChunkCount(); chunk++) {
+                    work.push_back({mesh, 0, 0, chunk});
+                }
+            } else {
+                int count = (int)mesh->getTriangleCount();
+                for(int first = 0; first < count; first += SETUP_BATCH) {
+                    work.push_back({mesh, first, std::min(SETUP_BATCH, count - first), -1});
+                }
+            }
+        }
+    }
+    for(int first = 0; first < (int)spheres.size(); first += SETUP_BATCH) {
+        work.push_back({nullptr, first, std::min(SETUP_BATCH, (int)spheres.size() - first), -1});
+    }
+
+    threads = std::max(1u, std::min(threads, (unsigned int)work.size()));
+    binSets.resize(threads);
+    for(auto & bins : binSets) {
+        bins.triangles.clear();
+        bins.spheres.clear();
+        bins.triangleBins.assign((size_t)binsX * binsY, std::vector<int>());
+        bins.sphereBins.assign((size_t)binsX * binsY, std::vector<int>());
+    }
+
+    std::atomic<int> next(0);
+    std::vector<std::future<void>> tasks;
+    for(unsigned int t = 0; t < threads; t++) {
+        tasks.push_back(std::async(std::launch::async, [&, t]() {
+            BinSet &bins = binSets[t];
+            while(true) {
+                int index = next++;
+                if(index >= (int)work.size()) {
+                    break;
+                }
+
+                const SetupWork &unit = work[index];
+                if(unit.mesh == nullptr) {
+                    for(int i = unit.first; i < unit.first + unit.count; i++) {
+                        setupSphere(spheres[i], bins);
+                    }
+                } else if(unit.chunk >= 0) {
+                    std::shared_ptr<const MeshChunk> chunk =
+                            unit.mesh->getGeometryCache()->acquire(*unit.mesh->getChunks(), unit.chunk);
+                    const glm::vec3* positions = chunk->positions.data();
+                    const unsigned int* indices = chunk->indices.data();
+                    int count = (int)chunk->indices.size() / 3;
+                    for(int i = 0; i < count; i++) {
+                        setupTriangle(positions[indices[i * 3]], positions[indices[i * 3 + 1]],
+                                      positions[indices[i * 3 + 2]], unit.mesh,
+                                      ChunkedGeometry::getPrimitive(unit.chunk, i), bins);
+                    }
+                } else {
+                    const glm::vec3* positions = unit.mesh->getPositions().data();
+                    const unsigned int* indices = unit.mesh->getIndices().data();
+                    for(int i = unit.first; i < unit.first + unit.count; i++) {
+                        setupTriangle(positions[indices[i * 3]], positions[indices[i * 3 + 1]],
+                                      positions[indices[i * 3 + 2]], unit.mesh, i, bins);
+                    }
+                }
+            }
+        }));
+    }
+    for(auto & task : tasks) {
+        task.get();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    stats = RasterStats();
+    stats.setupSeconds = elapsed.count();
+}
+
+/**
+ * Back faces of single sided meshes are dropped here, with the
+ * same test the ray tracer makes: the sign of the normal against
+ * any line from the eye to the plane of the triangle. Triangles
+ * seen almost edge on are kept as slivers whatever their side,
+ * since rounding could flip it.
+ */
+void Rasterizer::setupTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c, SceneObject* object,
+                               int64_t primitive, BinSet &bins) {
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    float normalLength = glm::length(normal);
+    if(normalLength == 0.0f) {
+        return;
+    }
+
+    float side = glm::dot(a - eye, normal);
+    bool edgeOn = std::fabs(side) <= 1e-4f * normalLength * glm::length(a - eye);
+    if(!edgeOn && side > 0.0f && !object->doubleSided) {
+        return;
+    }
+
+    //Sutherland-Hodgman against the near plane, which
+    //leaves a triangle or a quad split in two
+    const glm::vec3 corners[3] = {a, b, c};
+    float nearPlane = NEAR_PLANE * screenDistance;
+    glm::vec3 clipped[4];
+    int count = 0;
+    for(int i = 0; i < 3; i++) {
+        const glm::vec3 &current = corners[i];
+        const glm::vec3 &following = corners[(i + 1) % 3];
+        float currentDepth = glm::dot(current - eye, forward) - nearPlane;
+        float followingDepth = glm::dot(following - eye, forward) - nearPlane;
+        if(currentDepth >= 0.0f) {
+            clipped[count++] = current;
+        }
+        if((currentDepth >= 0.0f) != (followingDepth >= 0.0f)) {
+            clipped[count++] = current + (following - current) * (currentDepth / (currentDepth - followingDepth));
+        }
+    }
+
+    for(int i = 1; i + 1 < count; i++) {
+        const glm::vec3 fan[3] = {clipped[0], clipped[i], clipped[i + 1]};
+        const glm::vec2 points[3] = {project(fan[0] - eye), project(fan[1] - eye), project(fan[2] - eye)};
+        addScreenTriangle(fan, points, object, primitive, edgeOn, bins);
+    }
+}
+
+void Rasterizer::addScreenTriangle(const glm::vec3* corners, const glm::vec2* points, SceneObject* object,
+                                   int64_t primitive, bool sliver, BinSet &bins) {
+    ScreenTriangle triangle;
+    float minX = std::min(points[0].x, std::min(points[1].x, points[2].x));
+    float maxX = std::max(points[0].x, std::max(points[1].x, points[2].x));
+    float minY = std::min(points[0].y, std::min(points[1].y, points[2].y));
+    float maxY = std::max(points[0].y, std::max(points[1].y, points[2].y));
+    triangle.minX = std::max(0, (int)std::ceil(minX - EDGE_MARGIN));
+    triangle.maxX = std::min(width - 1, (int)std::floor(maxX + EDGE_MARGIN));
+    triangle.minY = std::max(0, (int)std::ceil(minY - EDGE_MARGIN));
+    triangle.maxY = std::min(height - 1, (int)std::floor(maxY + EDGE_MARGIN));
+
+    //most triangles of a dense mesh fall
+    //between the pixel centers altogether
+    if(triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+        return;
+    }
+
+    float depths[3];
+    for(int i = 0; i < 3; i++) {
+        depths[i] = glm::dot(corners[i] - eye, forward);
+    }
+
+    glm::vec2 edge1 = points[1] - points[0];
+    glm::vec2 edge2 = points[2] - points[0];
+    float area = edge1.x * edge2.y - edge1.y * edge2.x;
+    triangle.sliver = sliver || std::fabs(area) < 1e-6f;
+    triangle.nearestDepth = std::min(depths[0], std::min(depths[1], depths[2]));
+    triangle.object = object;
+    triangle.primitive = primitive;
+
+    if(!triangle.sliver) {
+        float orientation = area > 0.0f ? 1.0f : -1.0f;
+        for(int i = 0; i < 3; i++) {
+            const glm::vec2 &from = points[i];
+            glm::vec2 edge = points[(i + 1) % 3] - from;
+            float scale = orientation / glm::length(edge);
+            triangle.edgeA[i] = -edge.y * scale;
+            triangle.edgeB[i] = edge.x * scale;
+            triangle.edgeC[i] = (edge.y * from.x - edge.x * from.y) * scale;
+        }
+
+        float w0 = 1.0f / depths[0];
+        float dw1 = 1.0f / depths[1] - w0;
+        float dw2 = 1.0f / depths[2] - w0;
+        float gradientX = (dw1 * edge2.y - dw2 * edge1.y) / area;
+        float gradientY = (dw2 * edge1.x - dw1 * edge2.x) / area;
+        triangle.inverseDepth[0] = gradientX;
+        triangle.inverseDepth[1] = gradientY;
+        triangle.inverseDepth[2] = w0 - gradientX * points[0].x - gradientY * points[0].y;
+    }
+
+    int index = (int)bins.triangles.size();
+    bins.triangles.push_back(triangle);
+    for(int by = triangle.minY / binSize; by <= triangle.maxY / binSize; by++) {
+        for(int bx = triangle.minX / binSize; bx <= triangle.maxX / binSize; bx++) {
+            bins.triangleBins[by * binsX + bx].push_back(index);
+        }
+    }
+}
+
+/**
+ * Spheres are bounded on screen by the projection of their
+ * bounding box, and hit exactly per pixel. Those reaching the
+ * near plane may cover any pixel.
+ */
+void Rasterizer::setupSphere(SceneObject* object, BinSet &bins) {
+    Sphere* sphere = (Sphere*)object;
+    float depth = glm::dot(sphere->position - eye, forward);
+    if(depth + sphere->radius <= 0.0f) {
+        return;
+    }
+
+    ScreenSphere screenSphere;
+    screenSphere.object = sphere;
+    if(depth - sphere->radius <= NEAR_PLANE * screenDistance) {
+        screenSphere.minX = 0;
+        screenSphere.minY = 0;
+        screenSphere.maxX = width - 1;
+        screenSphere.maxY = height - 1;
+    } else {
+        glm::vec2 lower(HUGE_VALF), upper(-HUGE_VALF);
+        for(int i = 0; i < 8; i++) {
+            glm::vec3 corner = sphere->position - eye + glm::vec3((i & 1) ? sphere->radius : -sphere->radius,
+                                                                  (i & 2) ? sphere->radius : -sphere->radius,
+                                                                  (i & 4) ? sphere->radius : -sphere->radius);
+            glm::vec2 point = project(corner);
+            lower = glm::min(lower, point);
+            upper = glm::max(upper, point);
+        }
+        //a pixel of slack for the rounding of the projection
+        screenSphere.minX = std::max(0, (int)std::floor(lower.x) - 1);
+        screenSphere.maxX = std::min(width - 1, (int)std::ceil(upper.x) + 1);
+        screenSphere.minY = std::max(0, (int)std::floor(lower.y) - 1);
+        screenSphere.maxY = std::min(height - 1, (int)std::ceil(upper.y) + 1);
+        if(screenSphere.minX > screenSphere.maxX || screenSphere.minY > screenSphere.maxY) {
+            return;
+        }
+    }
+
+    int index = (int)bins.spheres.size();
+    bins.spheres.push_back(screenSphere);
+    for(int by = screenSphere.minY / binSize; by <= screenSphere.maxY / binSize; by++) {
+        for(int bx = screenSphere.minX / binSize; bx <= screenSphere.maxX / binSize; bx++) {
+            bins.sphereBins[by * binsX + bx].push_back(index);
+        }
+    }
+}
+
+/**
+ * The direction of each pixel is computed as the camera ray is,
+ * so spheres are tested with the very ray the ray tracer casts.
+ * Triangle depths are turned into distances along that ray.
+ */
+void Rasterizer::rasterizeTile(int tx, int ty, int tw, int th) {
+    for(int y = ty; y < ty + th; y++) {
+        for(int x = tx; x < tx + tw; x++) {
+            int pixel = y * width + x;
+            directions[pixel] = glm::normalize(screen[y][x].position - eye);
+            nearest[pixel] = HUGE_VALF;
+            second[pixel] = HUGE_VALF;
+            ambiguous[pixel] = HUGE_VALF;
+            objects[pixel] = nullptr;
+            primitives[pixel] = -1;
+        }
+    }
+
+    int bin = (ty / binSize) * binsX + tx / binSize;
+    for(auto & bins : binSets) {
+        for(int index : bins.triangleBins[bin]) {
+            const ScreenTriangle &triangle = bins.triangles[index];
+            int minX = std::max(tx, triangle.minX), maxX = std::min(tx + tw - 1, triangle.maxX);
+            int minY = std::max(ty, triangle.minY), maxY = std::min(ty + th - 1, triangle.maxY);
+
+            for(int y = minY; y <= maxY; y++) {
+                for(int x = minX; x <= maxX; x++) {
+                    int pixel = y * width + x;
+                    if(triangle.sliver) {
+                        addFragment(pixel, triangle.nearestDepth, false, triangle.object, triangle.primitive);
+                        continue;
+                    }
+
+                    float distance = HUGE_VALF;
+                    for(int i = 0; i < 3; i++) {
+                        distance = std::min(distance, triangle.edgeA[i] * x + triangle.edgeB[i] * y + triangle.edgeC[i]);
+                    }
+                    if(distance < -EDGE_MARGIN) {
+                        continue;
+                    }
+
+                    float inverseDepth = triangle.inverseDepth[0] * x + triangle.inverseDepth[1] * y + triangle.inverseDepth[2];
+                    float depth = 1.0f / (inverseDepth * glm::dot(directions[pixel], forward));
+                    addFragment(pixel, depth, distance > EDGE_MARGIN, triangle.object, triangle.primitive);
+                }
+            }
+        }
+
+        for(int index : bins.sphereBins[bin]) {
+            const ScreenSphere &sphere = bins.spheres[index];
+            int minX = std::max(tx, sphere.minX), maxX = std::min(tx + tw - 1, sphere.maxX);
+            int minY = std::max(ty, sphere.minY), maxY = std::min(ty + th - 1, sphere.maxY);
+
+            for(int y = minY; y <= maxY; y++) {
+                for(int x = minX; x <= maxX; x++) {
+                    int pixel = y * width + x;
+                    Ray ray(eye, directions[pixel]);
+                    glm::vec3 point;
+                    float distance;
+                    if(ray.intersects(sphere.object, point, distance, !sphere.object->doubleSided)) {
+                        addFragment(pixel, distance, true, sphere.object, -1);
+                    }
+                }
+            }
+        }
+    }
+}
+
+RasterStats Rasterizer::getStats() const {
+    RasterStats counts = stats;
+    for(auto & bins : binSets) {
+        counts.triangles += bins.triangles.size();
+        counts.spheres += bins.spheres.size();
+        for(auto & bin : bins.triangleBins) {
+            counts.binReferences += bin.size();
+        }
+        for(auto & bin : bins.sphereBins) {
+            counts.binReferences += bin.size();
+        }
+    }
+
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            SceneObject* object;
+            int64_t primitive;
+            Coverage coverage = getCoverage(x, y, object, primitive);
+            counts.resolvedPixels += coverage != unresolved;
+            counts.ambiguousPixels += coverage == unresolved;
+        }
+    }
+    return counts;
+}
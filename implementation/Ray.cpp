@@ -8,10 +8,14 @@
 
 #include <Ray.h>
 #include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
 
 Ray::Ray(glm::vec3 &origin, glm::vec3 &direction) {
     this->origin = origin;
     this->direction = direction;
+    this->inverseDirection = 1.0f / direction;
 }
 
 Ray Ray::toPixel(Camera &camera, Pixel &pixel) {
@@ -31,20 +35,39 @@ bool Ray::intersects(SceneObject *target, glm::vec3 &intersection) {
  * reference to save CPU time
  */
 bool Ray::intersects(SceneObject *target, glm::vec3 &intersection, float &distance) {
+    return intersects(target, intersection, distance, !target->doubleSided);
+}
+
+bool Ray::intersects(SceneObject *target, glm::vec3 &intersection, float &distance, bool cullBackfaces) {
+    SceneObject* hitObject;
+    return intersects(target, intersection, distance, cullBackfaces, hitObject);
+}
+
+bool Ray::intersects(SceneObject *target, glm::vec3 &intersection, float &distance, bool cullBackfaces, SceneObject* &hitObject) {
+    hitObject = target;
     switch(target->type) {
         case SceneObject::plane:
-            return hasPlaneIntersection((Plane*)target, intersection, distance);
+            return hasPlaneIntersection((Plane*)target, intersection, distance, cullBackfaces);
         case SceneObject::sphere:
-            return hasSphereIntersection((Sphere*)target, intersection, distance);
-        case SceneObject::triangle:
-            return hasTriangleIntersection((Triangle*)target, intersection, distance);
+            return hasSphereIntersection((Sphere*)target, intersection, distance, cullBackfaces);
+        case SceneObject::triangle: {
+            glm::vec2 barycentrics;
+            return hasTriangleIntersection((Triangle*)target, intersection, distance, cullBackfaces, barycentrics);
+        }
+        case SceneObject::mesh:
+            return hasMeshIntersection((Mesh*)target, intersection, distance, cullBackfaces, hitObject);
         default:
             return false;
     }
 
 }
 
-bool Ray::hasSphereIntersection(Sphere* target, glm::vec3 &intersection, float &t) {
+/**
+ * The near root is the outside of the sphere. The far root is
+ * its inside, which only counts as a hit when back faces are
+ * not culled, e.g. for shadow rays leaving the sphere.
+ */
+bool Ray::hasSphereIntersection(Sphere* target, glm::vec3 &intersection, float &t, bool cullBackfaces) {
     glm::vec3 c2e = origin - target->position;
 
     float a = glm::dot(direction, direction);
@@ -61,50 +84,236 @@ bool Ray::hasSphereIntersection(Sphere* target, glm::vec3 &intersection, float &
     float tNeg = (-b - sqrt(rad)) / (2.0f * a);
 
     t = std::fmin(tPos, tNeg);
+    if(t <= 0.0f && !cullBackfaces) {
+        t = std::fmax(tPos, tNeg);
+    }
 
     intersection = origin + (t * direction);
 
     return t > 0.0f;
 }
 
-bool Ray::hasTriangleIntersection(Triangle* triangle, glm::vec3 &intersection, float &t) {
-    float d = glm::dot(direction, triangle->normal);
+/**
+ * Möller–Trumbore test using the edges pre-computed by
+ * Triangle::precompute. The barycentric coordinates are
+ * compared against the unscaled determinant so that the
+ * division only happens for actual hits. Rays that are
+ * clearly inside or outside the triangle are decided right
+ * away; only rays within rounding distance of an edge are
+ * resolved by the watertight test, so that rays through a
+ * shared edge never slip between two triangles.
+ */
+bool Ray::hasTriangleIntersection(Triangle* triangle, glm::vec3 &intersection, float &t, bool cullBackfaces,
+                                  glm::vec2 &barycentrics) {
+    return hasTriangleIntersection(triangle->vertices[0], triangle->vertices[1], triangle->vertices[2],
+                                   triangle->edge1, triangle->edge2, intersection, t, cullBackfaces, barycentrics);
+}
 
-    //When d > 0, the normal of the surface is pointing
-    //outward and invisible to the camera
-    if(d < 0.0f) {
-        t = glm::dot(triangle->vertices[0] - origin, triangle->normal) / d;
+bool Ray::hasTriangleIntersection(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c,
+                                  const glm::vec3 &edge1, const glm::vec3 &edge2,
+                                  glm::vec3 &intersection, float &t, bool cullBackfaces,
+                                  glm::vec2 &barycentrics) {
+    glm::vec3 p = glm::cross(direction, edge2);
+    float det = glm::dot(edge1, p);
 
-        if(t < 0.0f) {
-            return false; //triangle plane is behind origin
+    //det is -dot(direction, normal) scaled by twice the area.
+    //When det <= 0, the normal of the surface is pointing
+    //outward and invisible to the camera. Back faces are
+    //mirrored into front faces when they are not culled.
+    float side = 1.0f;
+    if(det <= 0.0f) {
+        if(cullBackfaces || det == 0.0f) {
+            return false;
         }
+        side = -1.0f;
+        det = -det;
+    }
 
-        intersection = origin + (t * direction);
+    const float margin = EDGE_EPSILON * det;
 
-        glm::vec3 ba = triangle->vertices[1] - triangle->vertices[0];
-        glm::vec3 cb = triangle->vertices[2] - triangle->vertices[1];
-        glm::vec3 ac = triangle->vertices[0] - triangle->vertices[2];
+    glm::vec3 s = (origin - a) * side;
+    float u = glm::dot(s, p);
+    if(u < -margin || u > det + margin) {
+        return false;
+    }
 
-        glm::vec3 pa = intersection - triangle->vertices[0];
-        glm::vec3 pb = intersection - triangle->vertices[1];
-        glm::vec3 pc = intersection - triangle->vertices[2];
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(direction, q);
+    if(v < -margin || u + v > det + margin) {
+        return false;
+    }
+
+    if((u < margin || v < margin || u + v > det - margin) && !isInsideWatertight(a, b, c)) {
+        return false;
+    }
+
+    float inverseDet = 1.0f / det;
+    t = glm::dot(edge2, q) * inverseDet;
+    if(t < 0.0f) {
+        return false; //triangle is behind origin
+    }
+
+    //Interpolating the vertices keeps the point on the
+    //plane of the triangle, which is far more accurate
+    //than walking t units along the ray
+    barycentrics = glm::vec2(u * inverseDet, v * inverseDet);
+    intersection = a + barycentrics.x * edge1 + barycentrics.y * edge2;
+    return true;
+}
+
+/**
+ * Watertight inside test from Woop, Benthin and Wald (2013).
+ * The vertices are sheared into a space where the ray points
+ * along +z, and the 2D edge functions are evaluated the same
+ * way for both triangles sharing an edge, so their signs are
+ * consistent. Exact zeros are recomputed in double precision.
+ */
+bool Ray::isInsideWatertight(const glm::vec3 &va, const glm::vec3 &vb, const glm::vec3 &vc) {
+    int kz = std::fabs(direction.x) > std::fabs(direction.y) ?
+             (std::fabs(direction.x) > std::fabs(direction.z) ? 0 : 2) :
+             (std::fabs(direction.y) > std::fabs(direction.z) ? 1 : 2);
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+
+    float sx = direction[kx] / direction[kz];
+    float sy = direction[ky] / direction[kz];
+
+    glm::vec3 a = va - origin;
+    glm::vec3 b = vb - origin;
+    glm::vec3 c = vc - origin;
+
+    float ax = a[kx] - sx * a[kz], ay = a[ky] - sy * a[kz];
+    float bx = b[kx] - sx * b[kz], by = b[ky] - sy * b[kz];
+    float cx = c[kx] - sx * c[kz], cy = c[ky] - sy * c[kz];
 
-        float a = glm::dot(glm::cross(ba,pa), triangle->normal);
-        float b = glm::dot(glm::cross(cb,pb), triangle->normal);
-        float c = glm::dot(glm::cross(ac,pc), triangle->normal);
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
 
-        return a >= 0.0f && b >= 0.0f && c >= 0.0f;
+    if(u == 0.0f || v == 0.0f || w == 0.0f) {
+        u = (float)((double)cx * by - (double)cy * bx);
+        v = (float)((double)ax * cy - (double)ay * cx);
+        w = (float)((double)bx * ay - (double)by * ax);
     }
 
+    if((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) {
+        return false;
+    }
+
+    return u + v + w != 0.0f;
+}
+
+bool Ray::hasMeshIntersection(Mesh* mesh, glm::vec3 &intersection, float &t, bool cullBackfaces, SceneObject* &hitObject) {
+    float tNear;
+    if(!mesh->getBounds().intersects(origin, inverseDirection, HUGE_VALF, tNear)) {
+        return false;
+    }
+
+    t = HUGE_VALF;
+    meshHit.mesh = mesh;
+
+    if(mesh->isStreamed()) {
+        bool hit = mesh->getChunks()->intersect(origin, inverseDirection, t, *mesh->getGeometryCache(),
+                                                [&](const MeshChunk &chunk, int index, float &closest) {
+            return hasIndexedTriangleIntersection(chunk.positions.data(), &chunk.indices[index * 3],
+                                                  intersection, closest, cullBackfaces);
+        });
+        if(hit) {
+            hitObject = mesh;
+            meshHit.primitive = -1;
+        }
+        return hit;
+    }
+
+    if(mesh->isCompact()) {
+        const std::vector<glm::vec3> &positions = mesh->getPositions();
+        const std::vector<unsigned int> &indices = mesh->getIndices();
+        bool hit = mesh->getWideBVH().intersect(origin, inverseDirection, t, [&](int index, float &closest) {
+            if(hasIndexedTriangleIntersection(positions.data(), &indices[index * 3],
+                                              intersection, closest, cullBackfaces)) {
+                meshHit.primitive = index;
+                return true;
+            }
+            return false;
+        });
+        if(hit) {
+            hitObject = mesh;
+        }
+        return hit;
+    }
+
+    std::vector<Triangle*> &triangles = mesh->getTriangles();
+    return mesh->getBVH().intersect(origin, inverseDirection, t, [&](int index, float &closest) {
+        glm::vec3 point;
+        glm::vec2 barycentrics;
+        float d;
+        if(hasTriangleIntersection(triangles[index], point, d, cullBackfaces, barycentrics) && d < closest) {
+            closest = d;
+            intersection = point;
+            hitObject = triangles[index];
+            meshHit.primitive = index;
+            meshHit.barycentrics = barycentrics;
+            return true;
+        }
+        return false;
+    });
+}
+
+bool Ray::intersectsPrimitive(SceneObject *target, int64_t primitive, glm::vec3 &intersection, float &distance,
+                              bool cullBackfaces, SceneObject* &hitObject) {
+    if(target->type != SceneObject::mesh) {
+        return intersects(target, intersection, distance, cullBackfaces, hitObject);
+    }
+
+    Mesh* mesh = (Mesh*)target;
+    hitObject = mesh;
+    distance = HUGE_VALF;
+    meshHit.mesh = mesh;
+    meshHit.primitive = mesh->isStreamed() ? -1 : (int)primitive;
+
+    if(mesh->isStreamed()) {
+        std::shared_ptr<const MeshChunk> chunk = mesh->getGeometryCache()->acquire(
+                *mesh->getChunks(), ChunkedGeometry::getChunkOf(primitive));
+        int index = ChunkedGeometry::getIndexInChunk(primitive);
+        return hasIndexedTriangleIntersection(chunk->positions.data(), &chunk->indices[index * 3],
+                                              intersection, distance, cullBackfaces);
+    }
+
+    if(mesh->isCompact()) {
+        return hasIndexedTriangleIntersection(mesh->getPositions().data(), &mesh->getIndices()[primitive * 3],
+                                              intersection, distance, cullBackfaces);
+    }
+
+    hitObject = mesh->getTriangles()[primitive];
+    return hasTriangleIntersection((Triangle*)hitObject, intersection, distance, cullBackfaces, meshHit.barycentrics);
+}
+
+bool Ray::hasIndexedTriangleIntersection(const glm::vec3* positions, const unsigned int* indices,
+                                         glm::vec3 &intersection, float &closest, bool cullBackfaces) {
+    const glm::vec3 &a = positions[indices[0]];
+    const glm::vec3 &b = positions[indices[1]];
+    const glm::vec3 &c = positions[indices[2]];
+    glm::vec3 edge1 = b - a;
+    glm::vec3 edge2 = c - a;
+    glm::vec3 point;
+    glm::vec2 barycentrics;
+    float d;
+    if(hasTriangleIntersection(a, b, c, edge1, edge2, point, d, cullBackfaces, barycentrics) && d < closest) {
+        closest = d;
+        intersection = point;
+        meshHit.normal = glm::normalize(glm::cross(edge1, edge2));
+        meshHit.barycentrics = barycentrics;
+        return true;
+    }
     return false;
 }
 
-bool Ray::hasPlaneIntersection(Plane* plane, glm::vec3 &intersection, float &t) {
+bool Ray::hasPlaneIntersection(Plane* plane, glm::vec3 &intersection, float &t, bool cullBackfaces) {
     float d = glm::dot(direction, plane->normal);
 
     //When d > 0, the normal of the surface is pointing
     //outward and invisible to the camera
-    if(d < 0.0f) {
+    if(d < 0.0f || (!cullBackfaces && d > 0.0f)) {
         t = glm::dot(plane->position - origin, plane->normal) / d;
         intersection = origin + (t * direction);
         return t >= 0.0f;
@@ -119,12 +328,38 @@ Ray Ray::toObject(glm::vec3 &origin, glm::vec3 &destination, float bias) {
     return Ray(o, dir);
 }
 
-bool Ray::isLightBlockedBy(SceneObject* currentObject, Light* light, std::vector<SceneObject*> sceneObjects) {
+Ray Ray::toObject(const glm::vec3 &origin, const glm::vec3 &destination, const glm::vec3 &normal) {
+    glm::vec3 dir = glm::normalize(destination - origin);
+    glm::vec3 o = offsetOrigin(origin, glm::dot(dir, normal) < 0.0f ? -normal : normal);
+    return Ray(o, dir);
+}
+
+glm::vec3 Ray::offsetOrigin(const glm::vec3 &point, const glm::vec3 &normal) {
+    //Points close to the origin have tiny ulps, so they
+    //are offset by a fixed distance instead
+    const float nearOrigin = 1.0f / 32.0f;
+    const float floatScale = 1.0f / 65536.0f;
+    const float intScale = 256.0f;
+
+    glm::vec3 offset;
+    for(int i = 0; i < 3; i++) {
+        int ulps = (int)(intScale * normal[i]);
+        int32_t bits;
+        std::memcpy(&bits, &point[i], sizeof(bits));
+        bits += point[i] < 0.0f ? -ulps : ulps;
+        float moved;
+        std::memcpy(&moved, &bits, sizeof(moved));
+        offset[i] = std::fabs(point[i]) < nearOrigin ? point[i] + floatScale * normal[i] : moved;
+    }
+    return offset;
+}
+
+bool Ray::isLightBlockedBy(SceneObject* currentObject, Light* light, const std::vector<SceneObject*> &sceneObjects) {
     float t;
     float lightT = glm::length(light->position - origin);
     glm::vec3 intersection;
     for(auto & object : sceneObjects) {
-        if(currentObject != object && intersects(object, intersection, t)) {
+        if(currentObject != object && intersects(object, intersection, t, false)) {
             if(t < lightT) {
                 return true;
             }
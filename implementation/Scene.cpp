@@ -23,40 +23,97 @@
 #include <boost/filesystem.hpp>
 #include <cstdlib>
 #include <ctime>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include "Random.h"
 #include "ProgressBar.hpp"
+#include "Shading.h"
+#include "ImageWriter.h"
+#include "Denoiser.h"
+#include "Timeline.h"
+
+//std::min takes it by reference
+const int Scene::PENUMBRA_SAMPLES;
 
 /**
  * Loads the scene file and initializes all
  * data structures with the corresponding properties.
  */
-Scene::Scene(unsigned int width, unsigned int height, const std::string &filename) {
+Scene::Scene(unsigned int width, unsigned int height, const std::string &filename, const RenderOptions &options) {
 
     this->width = width;
     this->height = height;
 
-    size_t found;
-    found=filename.find_last_of("/\\");
-    this->scenePath = boost::filesystem::path(filename.substr(0,found));
+    //geometry is read by the threads of every node, so it
+    //is spread over all of them rather than left on this one
+    std::vector<NumaNode> loadNodes;
+    if(options.affinity != RenderOptions::unpinned) {
+        loadNodes = Topology::detect();
+    }
+    bool interleaved = loadNodes.size() > 1;
+    if(interleaved) {
+        Topology::setInterleaved(loadNodes, true);
+    }
 
-    Loader::loadScene(filename, sceneObjects, lights, camera, scenePath);
+    try {
+        {
+            Timeline::Span span("load");
+            geometry = std::make_shared<SceneGeometry>(filename, options, lights, camera);
+        }
 
-    if(isSceneLoaded()) {
-        camera->initializeCoordinateSystem();
-        if(width == 0 && height == 0) {
-            this->width = (int)camera->getViewWidth();
-            this->height = (int)camera->getViewHeight();
+        if(isSceneLoaded()) {
+            camera->initializeCoordinateSystem();
+            if(width == 0 && height == 0) {
+                this->width = (int)camera->getViewWidth();
+                this->height = (int)camera->getViewHeight();
+            }
+            initializeScreen();
+            Timeline::Span span("build");
+            geometry->buildAccelerationStructures(options);
+        } else {
+            throw std::invalid_argument("Unable to load the scene");
         }
-        initializeScreen();
-    } else {
-        throw std::invalid_argument("Unable to load the scene");
+    } catch (...) {
+        if(interleaved) {
+            Topology::setInterleaved(loadNodes, false);
+        }
+        deallocateResources();
+        throw;
+    }
+
+    if(interleaved) {
+        Topology::setInterleaved(loadNodes, false);
     }
 }
 
+void Scene::updateIndex() {
+    if(isGeometryShared()) {
+        throw std::invalid_argument("The objects of a copied scene are shared and cannot be changed");
+    }
+    geometry->updateIndex();
+}
+
+std::vector<SceneObject*>& Scene::editSceneObjects() {
+    if(isGeometryShared()) {
+        throw std::invalid_argument("The objects of a copied scene are shared and cannot be changed");
+    }
+    return geometry->getObjects();
+}
+
+void Scene::setMaterial(int object, const Material &material) {
+    if(object < 0 || object >= (int)getSceneObjects().size()) {
+        throw std::out_of_range("No object with index " + std::to_string(object));
+    }
+    materials[object] = material;
+}
+
 Scene::~Scene() {
     deallocateResources();
 }
 
 void Scene::initializeScreen() {
+    placedTileSize = 0;
     screen = new Pixel*[height];
     for(int i = 0; i < height; i++) {
         screen[i] = new Pixel[width];
@@ -70,230 +127,839 @@ void Scene::initializeScreen() {
 }
 
 bool Scene::isSceneLoaded() {
-    return camera != nullptr && sceneObjects.size() > 0 && lights.size() > 0;
+    return camera != nullptr && geometry != nullptr && !geometry->getObjects().empty() && !lights.empty();
 }
 
 /**
- * Creates 2 threads per logical core on the CPU to perform
- * the raytracing task. For each pixel on screen, the color
- * is calculated by calling the raytrace(x,y) function. After
- * all pixel colors are computed, the image is rendered to
- * screen and saved to disk at the given file path.
+ * Renders the screen tile by tile with the number of threads
+ * given in the options, two per logical core by default.
+ * For each pixel on screen, the color is calculated by calling
+ * the raytrace function. After all pixel colors are computed,
+ * the image is rendered to screen and saved to disk at the
+ * given file path.
  */
-void Scene::renderToImage(const char* filename) {
-    unsigned int threads = std::thread::hardware_concurrency() * 2;
+void Scene::renderToImage(const char* filename, const RenderOptions &options) {
+    render(options);
+    saveImage(filename, options);
+}
+
+void Scene::render(const RenderOptions &options) {
+    unsigned int threads = options.getThreadCount();
     int max = width * height;
 
-    //These atomic integers are necessary to
-    //keep track of which pixels have been
-    //completed while avoiding race conditions
-    //from the threads
-    volatile std::atomic<int> count(0);
-    volatile std::atomic<int> progress(0);
+    //This atomic integer is necessary to keep
+    //track of which pixels have been completed
+    //while avoiding race conditions from the threads
+    std::atomic<int> progress(0);
 
     ProgressBar progressBar(max, 70); //progress bar is for information purposes
-    std::vector<std::future<void>> futures;
-    futures.reserve(threads);
 
     std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
     std::cout << "Raytracing started with " << threads << " threads:" << std::endl;
 
-    for(int i = 0; i < threads; i++) {
-        futures.push_back(std::async(std::launch::async, [=, &threads, &count, &progress, &progressBar]() {
-            while(true) {
-                int index = count++;
-                if(index >= max) {
-                    break;
-                }
-
-                int x = index % width;
-                int y = floor(index / width);
-
-                raytrace(x, y); //actual color computation
-                progress++;
-            }
-        }));
-    }
+    RenderStats stats;
+    std::future<void> rendering = std::async(std::launch::async, [&]() {
+        stats = renderTiles(options, [&progress](int, int, int w, int h) {
+            progress += w * h;
+        });
+    });
 
-    while (progress < max){
+    while(rendering.wait_for(std::chrono::milliseconds(50)) != std::future_status::ready) {
         progressBar.setTicks(progress);
         progressBar.display();
     }
-    progressBar.display();
+    rendering.get();
+    progressBar.setTicks(progress);
     progressBar.done();
 
     std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> elapsed = end-start;
     std::cout << "Completed in " << elapsed.count() << " seconds." << std::endl;
+    std::cout << "Rays: " << stats.primaryRays << " primary, " << stats.shadowRays << " shadow, "
+              << (stats.primaryRays + stats.shadowRays) / elapsed.count() / 1e6 << " Mrays/s" << std::endl;
+    if(stats.areaLightHits > 0) {
+        std::cout << "Area lights: " << stats.areaShadowRays << " shadow rays, "
+                  << (double)stats.areaShadowRays / stats.areaLightHits << " per hit and light ("
+                  << stats.areaLightHits * options.lightSamples << " without penumbra detection), "
+                  << stats.penumbraHits * 100.0 / stats.areaLightHits << "% of hits in a penumbra" << std::endl;
+    }
+
+    if(options.denoise) {
+        Timeline::Span span("denoise");
+        std::chrono::high_resolution_clock::time_point denoiseStart = std::chrono::high_resolution_clock::now();
+        Denoiser::denoise(screen, width, height, std::max(1, options.samplesPerPixel), threads);
+        std::chrono::duration<double, std::milli> denoiseElapsed = std::chrono::high_resolution_clock::now() - denoiseStart;
+        std::cout << "Denoised in " << denoiseElapsed.count() << " ms, " << Denoiser::PASSES << " passes" << std::endl;
+    }
+
+    if(options.affinity != RenderOptions::unpinned) {
+        for(auto & node : nodeStats) {
+            std::cout << "Node " << node.node << ": " << node.threads << " threads, " << node.tiles << " tiles ("
+                      << node.stolenTiles << " from other nodes), "
+                      << (node.rays.primaryRays + node.rays.shadowRays) / std::max(node.seconds, 1e-9) / 1e6
+                      << " Mrays/s" << std::endl;
+        }
+    }
+
+    if(rasterized) {
+        RasterStats rasterStats = rasterizer.getStats();
+        std::cout << "Raster: " << rasterStats.setupSeconds * 1000.0 << " ms setup, " << rasterStats.triangles
+                  << " triangles and " << rasterStats.spheres << " spheres in " << rasterStats.binReferences
+                  << " bin entries, " << rasterStats.resolvedPixels * 100.0 / max
+                  << "% of pixels decided by the G-buffer" << std::endl;
+    }
+
+    const GeometryCache* geometryCache = getGeometryCache();
+    if(geometryCache != nullptr) {
+        CacheStats cacheStats = geometryCache->getStats();
+        std::cout << "Geometry cache: " << cacheStats.pageIns << " page-ins, " << cacheStats.evictions << " evictions, "
+                  << cacheStats.lookups << " lookups, " << cacheStats.bytesRead / 1048576.0 << " MB read, peak "
+                  << cacheStats.peakResidentBytes / 1048576.0 << " MB of " << geometryCache->getBudget() / 1048576.0
+                  << " MB budget" << std::endl;
+    }
+
+    const TextureCache* textureCache = getTextureCache();
+    if(textureCache != nullptr) {
+        CacheStats cacheStats = textureCache->getStats();
+        unsigned long long hits = cacheStats.lookups - cacheStats.pageIns;
+        std::cout << "Texture cache: " << hits << " hits, " << cacheStats.pageIns << " misses ("
+                  << hits * 100.0 / std::max(cacheStats.lookups, 1ull) << "% hit rate), " << cacheStats.evictions
+                  << " evictions, " << cacheStats.bytesRead / 1048576.0 << " MB read, peak "
+                  << cacheStats.peakResidentBytes / 1048576.0 << " MB of " << textureCache->getBudget() / 1048576.0
+                  << " MB budget" << std::endl;
+    }
+}
+
+/**
+ * Tiles are sorted by their distance to the center of the screen
+ * so that an interactive client sees the most relevant part of
+ * the image first.
+ */
+std::vector<glm::ivec2> Scene::getTileOrder(int tileSize) const {
+    std::vector<glm::ivec2> tiles;
+    for(int y = 0; y < height; y += tileSize) {
+        for(int x = 0; x < width; x += tileSize) {
+            tiles.emplace_back(x, y);
+        }
+    }
+
+    glm::vec2 center(width / 2.0f, height / 2.0f);
+    std::stable_sort(tiles.begin(), tiles.end(), [&](const glm::ivec2 &a, const glm::ivec2 &b) {
+        glm::vec2 da = glm::vec2(a.x + tileSize / 2.0f, a.y + tileSize / 2.0f) - center;
+        glm::vec2 db = glm::vec2(b.x + tileSize / 2.0f, b.y + tileSize / 2.0f) - center;
+        return glm::dot(da, da) < glm::dot(db, db);
+    });
+    return tiles;
+}
+
+/**
+ * Every node has its own queue of tiles, the ones in its band
+ * of the screen in center first order. Threads pull the next
+ * tile of their node from an atomic counter and help the other
+ * nodes once it runs dry, so which thread renders a tile varies
+ * from run to run, but the result of a tile only depends on its
+ * position. Counters are kept per tile and added up in tile order.
+ */
+RenderStats Scene::renderTiles(const RenderOptions &options, const std::function<void(int x, int y, int w, int h)> &onTileDone) {
+    unsigned int threads = options.getThreadCount();
+    int tileSize = options.tileSize > 0 ? options.tileSize : 16;
+    std::vector<glm::ivec2> tiles = getTileOrder(tileSize);
+
+    beginFrame(options);
+
+    int nodeCount = (int)nodes.size();
+    std::vector<std::vector<int>> queues(nodeCount);
+    for(int i = 0; i < (int)tiles.size(); i++) {
+        queues[getRowNode(tiles[i].y, tileSize)].push_back(i);
+    }
+    std::vector<std::atomic<int>> next(nodeCount);
+
+    //threads go round robin over the nodes, and
+    //over the processors within each node
+    std::vector<glm::ivec2> slots;
+    for(size_t cpu = 0; slots.size() < threads; cpu++) {
+        for(int node = 0; node < nodeCount && slots.size() < threads; node++) {
+            const std::vector<int> &cpus = nodes[node].cpus;
+            slots.emplace_back(node, cpus.empty() ? -1 : cpus[cpu % cpus.size()]);
+        }
+    }
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    std::vector<RenderStats> tileStats(tiles.size());
+    std::vector<NodeStats> threadStats(threads);
+    std::vector<std::future<void>> futures;
+    futures.reserve(threads);
+
+    for(unsigned int i = 0; i < threads; i++) {
+        futures.push_back(std::async(std::launch::async, [=, &tiles, &tileStats, &threadStats, &queues, &next, &options,
+                                                          &onTileDone]() {
+            Timeline::nameThread("render");
+            int home = slots[i].x;
+            if(options.affinity == RenderOptions::node) {
+                Topology::pinThread(nodes[home].cpus);
+            } else if(options.affinity == RenderOptions::core) {
+                Topology::pinThread(std::vector<int>(1, slots[i].y));
+            }
+
+            NodeStats &own = threadStats[i];
+            Wavefront wavefront;
+            for(int k = 0; k < nodeCount; k++) {
+                int node = (home + k) % nodeCount;
+                while(true) {
+                    int position = next[node]++;
+                    if(position >= (int)queues[node].size()) {
+                        break;
+                    }
+
+                    int index = queues[node][position];
+                    int tx = tiles[index].x;
+                    int ty = tiles[index].y;
+                    int tw = std::min(tileSize, width - tx);
+                    int th = std::min(tileSize, height - ty);
+
+                    {
+                        Timeline::Span span("tile", tx, ty);
+                        renderTile(tx, ty, tw, th, options, wavefront, tileStats[index]);
+                    }
+                    onTileDone(tx, ty, tw, th);
+
+                    own.tiles++;
+                    own.stolenTiles += k > 0 ? 1 : 0;
+                    own.rays += tileStats[index];
+                }
+            }
+
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            own.seconds = elapsed.count();
+        }));
+    }
+
+    for(auto & future : futures) {
+        future.get();
+    }
+
+    nodeStats.assign(nodeCount, NodeStats());
+    for(unsigned int i = 0; i < threads; i++) {
+        NodeStats &node = nodeStats[slots[i].x];
+        node.node = nodes[slots[i].x].id;
+        node.threads++;
+        node.tiles += threadStats[i].tiles;
+        node.stolenTiles += threadStats[i].stolenTiles;
+        node.seconds = std::max(node.seconds, threadStats[i].seconds);
+        node.rays += threadStats[i].rays;
+    }
+
+    RenderStats stats;
+    for(auto & tile : tileStats) {
+        stats += tile;
+    }
+    return stats;
+}
+
+/**
+ * The image is encoded from a copy of the screen, which
+ * the scene is free to overwrite in the meantime.
+ */
+std::future<void> Scene::saveImageAsync(const char* filename, const RenderOptions &options) const {
+    if(options.checksum) {
+        std::cout << "Checksum: " << std::hex << std::setw(16) << std::setfill('0') << getChecksum()
+                  << std::dec << std::setfill(' ') << std::endl;
+    }
+
     std::cout << "Saving image " << filename << std::endl;
 
-    cimg_library::CImg<float> image(width, height, 1, 3, 0);
-    for(int i = 0; i < width; i++) {
-        for(int j = 0; j < height; j++) {
-            image(i,j,0) = screen[j][i].color.x * 255.0f;
-            image(i,j,1) = screen[j][i].color.y * 255.0f;
-            image(i,j,2) = screen[j][i].color.z * 255.0f;
+    std::string path(filename);
+    unsigned int threads = options.getThreadCount();
+    return std::async(std::launch::async, [path, threads](const Image &image) {
+        Timeline::nameThread("save");
+        Timeline::Span span("encode");
+        if(!ImageWriter::write(path, image, threads)) {
+            //any other format CImg knows of
+            cimg_library::CImg<float> output(image.width, image.height, 1, 3, 0);
+            for(int j = 0; j < image.height; j++) {
+                const float* row = image.getRow(j);
+                for(int i = 0; i < image.width; i++) {
+                    output(i,j,0) = row[3 * i] * 255.0f;
+                    output(i,j,1) = row[3 * i + 1] * 255.0f;
+                    output(i,j,2) = row[3 * i + 2] * 255.0f;
+                }
+            }
+            output.save(path.c_str());
+        }
+    }, getImage());
+}
+
+void Scene::saveImage(const char* filename, const RenderOptions &options) {
+    std::future<void> saving = saveImageAsync(filename, options);
+
+    if(options.display) {
+        cimg_library::CImg<float> image(width, height, 1, 3, 0);
+        for(int i = 0; i < width; i++) {
+            for(int j = 0; j < height; j++) {
+                image(i,j,0) = screen[j][i].color.x * 255.0f;
+                image(i,j,1) = screen[j][i].color.y * 255.0f;
+                image(i,j,2) = screen[j][i].color.z * 255.0f;
+            }
+        }
+
+        cimg_library::CImgDisplay main_disp(image, "Render");
+        while(!main_disp.is_closed()) {
+            main_disp.wait();
+        }
+    }
+    saving.get();
+}
+
+Image Scene::getImage() const {
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize((size_t)width * height * 3);
+    for(int j = 0; j < height; j++) {
+        float* row = &image.pixels[(size_t)j * width * 3];
+        for(int i = 0; i < width; i++) {
+            row[3 * i] = screen[j][i].color.x;
+            row[3 * i + 1] = screen[j][i].color.y;
+            row[3 * i + 2] = screen[j][i].color.z;
+        }
+    }
+    return image;
+}
+
+void Scene::beginFrame(const RenderOptions &options) {
+    int tileSize = options.tileSize > 0 ? options.tileSize : 16;
+
+    if(options.affinity != RenderOptions::unpinned) {
+        nodes = Topology::detect();
+    } else {
+        nodes.assign(1, NumaNode());
+    }
+    if(nodes.size() > 1 && placedTileSize != tileSize) {
+        placeScreen(tileSize);
+    }
+
+    //the G-buffer only has the centers of the pixels
+    rasterized = options.raster && options.samplesPerPixel <= 1;
+    if(rasterized) {
+        rasterizer.setup(getSceneObjects(), *camera, screen, width, height, tileSize, options.getThreadCount());
+    }
+}
+
+/**
+ * A pinned thread per node copies the rows of its band to new
+ * memory, which the kernel takes from that node as the thread
+ * writes it for the first time.
+ */
+void Scene::placeScreen(int tileSize) {
+    std::vector<std::future<void>> futures;
+    for(int node = 0; node < (int)nodes.size(); node++) {
+        futures.push_back(std::async(std::launch::async, [this, node, tileSize]() {
+            Topology::pinThread(nodes[node].cpus);
+            for(int y = 0; y < height; y++) {
+                if(getRowNode(y, tileSize) != node) {
+                    continue;
+                }
+                Pixel* row = new Pixel[width];
+                std::copy(screen[y], screen[y] + width, row);
+                delete[] screen[y];
+                screen[y] = row;
+            }
+        }));
+    }
+
+    for(auto & future : futures) {
+        future.get();
+    }
+    placedTileSize = tileSize;
+}
+
+void Scene::renderTile(int tx, int ty, int tw, int th, const RenderOptions &options, Wavefront &wavefront,
+                       RenderStats &stats) {
+    if(rasterized) {
+        rasterizer.rasterizeTile(tx, ty, tw, th);
+    }
+
+    if(options.wavefront) {
+        raytraceTile(tx, ty, tw, th, options, wavefront, stats);
+    } else {
+        for(int y = ty; y < ty + th; y++) {
+            for(int x = tx; x < tx + tw; x++) {
+                raytrace(x, y, options, stats); //actual color computation
+            }
         }
     }
-    image.save(filename);
+}
 
-    cimg_library::CImgDisplay main_disp(image, "Render");
-    while(!main_disp.is_closed()) {
-        main_disp.wait();
+/**
+ * 64 bit FNV-1a hash of the framebuffer quantized to
+ * 8 bits per channel, in row order
+ */
+uint64_t Scene::getChecksum() const {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < height; i++) {
+        for(int j = 0; j < width; j++) {
+            const glm::vec3 &color = screen[i][j].color;
+            for(int c = 0; c < 3; c++) {
+                hash ^= (uint64_t)(glm::clamp(color[c], 0.0f, 1.0f) * 255.0f);
+                hash *= 0x100000001b3ULL;
+            }
+        }
+    }
+    return hash;
+}
+
+void Scene::resetView() {
+    camera->initializeCoordinateSystem();
+    for(int i = 0; i < height; i++) {
+        for(int j = 0; j < width; j++) {
+            screen[i][j].initialize(width, height, j, i, camera);
+        }
     }
 }
 
 Scene &Scene::operator=(const Scene& other) {
     if(this != &other) {
         deallocateResources();
-        deepCopy(other);
+        copyFrom(other);
     }
     return *this;
 }
 
 Scene::Scene(const Scene &other) {
-    deepCopy(other);
+    copyFrom(other);
 }
 
 /**
- * Since all the scene objects are allocated
- * on the heap, and there may be hundreds
- * of them, they have to be destructed
- * under different scenarios
+ * The camera, lights and screen are owned by each
+ * scene; the objects go with the last one sharing them
  */
 void Scene::deallocateResources() {
-
-    for(int i = 0; i < sceneObjects.size(); i++) {
-        delete sceneObjects[i];
-    }
-    sceneObjects.clear();
-
-    for(int i = 0; i < lights.size(); i++) {
-        delete lights[i];
+    for(auto & light : lights) {
+        delete light;
     }
     lights.clear();
 
-    if(screen != nullptr) {
-        delete camera;
-        camera = nullptr;
+    geometry.reset();
+    materials.clear();
+
+    delete camera;
+    camera = nullptr;
 
+    if(screen != nullptr) {
         for(int i = 0; i < height; i++) {
-            if(screen[i] != nullptr) {
-                delete[] screen[i];
-            }
+            delete[] screen[i];
         }
+        delete[] screen;
+        screen = nullptr;
     }
 }
 
-void Scene::deepCopy(const Scene& other) {
+/**
+ * Nothing is read from disk; only the lights, the camera
+ * and the pixels of the screen are allocated
+ */
+void Scene::copyFrom(const Scene& other) {
     width = other.width;
     height = other.height;
+    geometry = other.geometry;
+    materials = other.materials;
 
-    camera = new Camera();
-    camera->type = SceneObject::Type::camera;
-    camera->position = other.camera->position;
-    camera->focalLength = other.camera->focalLength;
-    camera->fieldOfView = other.camera->fieldOfView;
-    camera->aspectRatio = other.camera->aspectRatio;
-    camera->initializeCoordinateSystem();
-
-    sceneObjects = std::vector<SceneObject*>();
-    for(int i = 0; i < other.sceneObjects.size(); i++) {
-        SceneObject* o;
-        switch(other.sceneObjects[i]->type) {
-            case SceneObject::Type::camera:
-            case SceneObject::Type::light:
-                continue;
-            case SceneObject::Type::mesh:
-                o = new Mesh();
-                ((Mesh*)o)->loadObj(((Mesh*)other.sceneObjects[i])->getFilename(), this->scenePath);
-                break;
-            case SceneObject::Type::sphere:
-                o = new Sphere();
-                break;
-            case SceneObject::Type::plane:
-                o = new Plane();
-                break;
-        }
-        o->ambient = other.sceneObjects[i]->ambient;
-        o->type = other.sceneObjects[i]->type;
-        o->position = other.sceneObjects[i]->position;
-        o->shininess = other.sceneObjects[i]->shininess;
-        o->specular = other.sceneObjects[i]->specular;
-        o->diffuse = other.sceneObjects[i]->diffuse;
-        o->normal = other.sceneObjects[i]->normal;
-    }
-
-    lights = std::vector<Light*>();
-    for(int i = 0; i < other.lights.size(); i++) {
-        Light* o = new Light();
-        o->ambient = other.lights[i]->ambient;
-        o->type = other.lights[i]->type;
-        o->position = other.lights[i]->position;
-        o->shininess = other.lights[i]->shininess;
-        o->specular = other.lights[i]->specular;
-        o->diffuse = other.lights[i]->diffuse;
-        o->normal = other.lights[i]->normal;
+    camera = new Camera(*other.camera);
+    for(auto & light : other.lights) {
+        lights.push_back(new Light(*light));
     }
 
     initializeScreen();
 }
 
-void Scene::raytrace(int &x, int &y) {
-    Ray ray = Ray::toPixel(*camera, screen[y][x]);
-    //depth is initialized at +Infinity
-    float depth = HUGE_VALF;
-    for(auto & sceneObject : sceneObjects) {
-        glm::vec3 intersection;
-        //To avoid recomputing the depth
-        //a reference is used to reuse the value
-        //that was already computed during the
-        //intersection test
-        float d;
-        if(ray.intersects(sceneObject, intersection, d)) {
-            if(d < depth) {
-                screen[y][x].color = getIlluminationAt(ray, sceneObject, intersection);
-                depth = d;
+/**
+ * Each sample goes through a jittered point of the pixel.
+ * The jitter comes from a random sequence seeded with the
+ * pixel coordinates, so the pixel comes out the same no
+ * matter which thread renders it.
+ */
+void Scene::raytrace(int x, int y, const RenderOptions &options, RenderStats &stats) {
+    Pixel &pixel = screen[y][x];
+    int samples = std::max(1, options.samplesPerPixel);
+    Random random(options.seed, (uint32_t)x, (uint32_t)y);
+
+    PixelSamples sums;
+    for(int sample = 0; sample < samples; sample++) {
+        glm::vec3 target = pixel.position;
+        if(samples > 1) {
+            target += camera->getU() * ((random.nextFloat() - 0.5f) * pixel.width) -
+                      camera->getV() * ((random.nextFloat() - 0.5f) * pixel.height);
+        }
+        Ray ray = Ray::toObject(camera->position, target);
+        stats.primaryRays++;
+
+        //pixels that miss every object are black.
+        //For meshes the triangle that was hit is
+        //shaded instead of the mesh itself.
+        Hit hit;
+        glm::vec3 color(0.0f);
+        PixelFeatures features;
+        if(getPrimaryHit(x, y, ray, hit)) {
+            ray.meshHit = hit.meshHit;
+            color = getIlluminationAt(ray, hit.object, hit.point, options, x, y, sample, features, stats);
+        }
+        sums.add(color, features);
+    }
+
+    sums.store(pixel);
+}
+
+/**
+ * Camera rays are generated exactly as raytrace does, pixel by
+ * pixel and sample by sample. Shadow rays are traced in the
+ * order of their sort keys, and all results are stored by ray,
+ * so the shading and the sums over the lights and the samples
+ * happen in the same order as in raytrace and give the same
+ * image.
+ */
+void Scene::raytraceTile(int tx, int ty, int tw, int th, const RenderOptions &options, Wavefront &wavefront, RenderStats &stats) {
+    int samples = std::max(1, options.samplesPerPixel);
+
+    RayBatch &cameraRays = wavefront.cameraRays;
+    cameraRays.clear();
+    for(int y = ty; y < ty + th; y++) {
+        for(int x = tx; x < tx + tw; x++) {
+            Pixel &pixel = screen[y][x];
+            Random random(options.seed, (uint32_t)x, (uint32_t)y);
+            for(int sample = 0; sample < samples; sample++) {
+                glm::vec3 target = pixel.position;
+                if(samples > 1) {
+                    target += camera->getU() * ((random.nextFloat() - 0.5f) * pixel.width) -
+                              camera->getV() * ((random.nextFloat() - 0.5f) * pixel.height);
+                }
+                cameraRays.rays.push_back(Ray::toObject(camera->position, target));
+            }
+        }
+    }
+    stats.primaryRays += cameraRays.rays.size();
+
+    //camera rays share their origin and are created in
+    //scanline order, which is as coherent as sorting gets
+    wavefront.hits.assign(cameraRays.rays.size(), Hit());
+    for(size_t i = 0; i < cameraRays.rays.size(); i++) {
+        int pixel = (int)i / samples;
+        getPrimaryHit(tx + pixel % tw, ty + pixel / tw, cameraRays.rays[i], wavefront.hits[i]);
+    }
+
+    //one shadow ray per point light and the first samples
+    //of each area light for every shaded hit, the rays of a
+    //hit following each other in light order
+    ShadowRayBatch &shadowRays = wavefront.shadowRays;
+    shadowRays.clear();
+    wavefront.lightRays.clear();
+    wavefront.normals.resize(cameraRays.rays.size());
+    wavefront.geometricNormals.resize(cameraRays.rays.size());
+    wavefront.shaded.assign(cameraRays.rays.size(), 0);
+    wavefront.features.resize(cameraRays.rays.size());
+    int lightCount = (int)lights.size();
+    int initial = std::min(PENUMBRA_SAMPLES, options.lightSamples);
+    glm::vec3 targets[MAX_LIGHT_SAMPLES];
+    for(size_t i = 0; i < cameraRays.rays.size(); i++) {
+        Hit &hit = wavefront.hits[i];
+        Ray &ray = cameraRays.rays[i];
+        if(hit.object == nullptr) {
+            continue;
+        }
+        ray.meshHit = hit.meshHit;
+        if(!getShadingNormal(ray, hit.object, hit.point, wavefront.normals[i], wavefront.geometricNormals[i])) {
+            continue;
+        }
+        wavefront.shaded[i] = 1;
+
+        int pixel = (int)i / samples;
+        for(int light = 0; light < lightCount; light++) {
+            LightRays entry = {(int)i, light, (int)shadowRays.size(), 1, 0, 0};
+            targets[0] = lights[light]->position;
+            if(lights[light]->isArea()) {
+                entry.count = initial;
+                getLightTargets(light, hit.point, options, tx + pixel % tw, ty + pixel / tw, (int)i % samples, 0,
+                                initial, targets);
+            }
+            for(int k = 0; k < entry.count; k++) {
+                shadowRays.add(hit.point, targets[k], wavefront.geometricNormals[i], getShadowCaster(hit.object));
+            }
+            wavefront.lightRays.push_back(entry);
+        }
+    }
+
+    auto trace = [this](ShadowRayBatch &batch) {
+        batch.rays.sort();
+        batch.visible.assign(batch.size(), 0);
+        for(int i : batch.rays.order) {
+            batch.visible[i] = !geometry->getIndex().isOccluded(batch.rays.rays[i], batch.distances[i], batch.casters[i]);
+        }
+    };
+    trace(shadowRays);
+
+    //the rest of the samples of the area lights whose
+    //first samples did not agree on their visibility
+    ShadowRayBatch &penumbraRays = wavefront.penumbraRays;
+    penumbraRays.clear();
+    for(auto & entry : wavefront.lightRays) {
+        if(!lights[entry.light]->isArea()) {
+            continue;
+        }
+        int visible = 0;
+        for(int k = entry.first; k < entry.first + entry.count; k++) {
+            visible += shadowRays.visible[k];
+        }
+        int count = getLightSampleCount(visible, options);
+        stats.areaShadowRays += count;
+        stats.areaLightHits++;
+        if(count == entry.count) {
+            continue;
+        }
+        stats.penumbraHits++;
+
+        int pixel = entry.hit / samples;
+        const glm::vec3 &point = wavefront.hits[entry.hit].point;
+        entry.penumbraFirst = (int)penumbraRays.size();
+        entry.penumbraCount = count - entry.count;
+        getLightTargets(entry.light, point, options, tx + pixel % tw, ty + pixel / tw, entry.hit % samples,
+                        entry.count, entry.penumbraCount, targets);
+        for(int k = 0; k < entry.penumbraCount; k++) {
+            penumbraRays.add(point, targets[k], wavefront.geometricNormals[entry.hit],
+                             getShadowCaster(wavefront.hits[entry.hit].object));
+        }
+    }
+    trace(penumbraRays);
+    stats.shadowRays += shadowRays.size() + penumbraRays.size();
+
+    //shaded hits are batched in the order of their shadow
+    //rays, which hold the direction to each sample of each
+    //light. Samples an area light was not sent get no weight.
+    std::vector<Light*> &slotLights = wavefront.slotLights;
+    slotLights.clear();
+    for(auto & light : lights) {
+        slotLights.insert(slotLights.end(), light->isArea() ? options.lightSamples : 1, light);
+    }
+
+    ShadingBatch &batch = wavefront.shading;
+    batch.resize((int)std::count(wavefront.shaded.begin(), wavefront.shaded.end(), 1), (int)slotLights.size());
+    int shadedHit = 0;
+    const LightRays* entry = wavefront.lightRays.data();
+    for(size_t i = 0; i < cameraRays.rays.size(); i++) {
+        if(!wavefront.shaded[i]) {
+            continue;
+        }
+        Hit &hit = wavefront.hits[i];
+        Material material = getSurfaceMaterial(cameraRays.rays[i], hit.object, hit.point, wavefront.geometricNormals[i]);
+        batch.setHit(shadedHit, wavefront.normals[i], getViewDirection(camera->position, hit.point), material);
+        wavefront.features[i] = {material.diffuse, wavefront.normals[i], glm::length(hit.point - camera->position)};
+        int slot = 0;
+        for(int light = 0; light < lightCount; light++, entry++) {
+            if(!lights[light]->isArea()) {
+                batch.setLight(shadedHit, slot++, shadowRays.rays.rays[entry->first].direction,
+                               shadowRays.visible[entry->first] ? 1.0f : 0.0f);
+                continue;
+            }
+
+            int count = entry->count + entry->penumbraCount;
+            float weight = 1.0f / (float)count;
+            for(int k = 0; k < options.lightSamples; k++, slot++) {
+                if(k < entry->count) {
+                    int ray = entry->first + k;
+                    batch.setLight(shadedHit, slot, shadowRays.rays.rays[ray].direction,
+                                   shadowRays.visible[ray] ? weight : 0.0f);
+                } else if(k < count) {
+                    int ray = entry->penumbraFirst + k - entry->count;
+                    batch.setLight(shadedHit, slot, penumbraRays.rays.rays[ray].direction,
+                                   penumbraRays.visible[ray] ? weight : 0.0f);
+                } else {
+                    batch.setLight(shadedHit, slot, glm::vec3(0.0f), 0.0f);
+                }
             }
         }
+        shadedHit++;
     }
+    shadeBatch(batch, slotLights);
+
+    size_t ray = 0;
+    shadedHit = 0;
+    for(int y = ty; y < ty + th; y++) {
+        for(int x = tx; x < tx + tw; x++) {
+            PixelSamples sums;
+            for(int sample = 0; sample < samples; sample++, ray++) {
+                if(wavefront.shaded[ray]) {
+                    sums.add(batch.getColor(shadedHit++), wavefront.features[ray]);
+                } else {
+                    sums.add(glm::vec3(0.0f), PixelFeatures());
+                }
+            }
+            sums.store(screen[y][x]);
+        }
+    }
+}
+
+void Scene::getLightTargets(int light, const glm::vec3 &point, const RenderOptions &options, int x, int y, int sample,
+                            int first, int count, glm::vec3* targets) const {
+    Random random(options.seed, (uint32_t)x, (uint32_t)y, (uint32_t)(1 + sample * (int)lights.size() + light));
+    uint32_t scrambleX = random.next();
+    uint32_t scrambleY = random.next();
+
+    glm::vec2 samples[MAX_LIGHT_SAMPLES];
+    for(int i = 0; i < count; i++) {
+        samples[i] = getSobolPoint((uint32_t)(first + i), scrambleX, scrambleY);
+    }
+    lights[light]->sample(point, samples, count, targets);
+}
+
+bool Scene::getPrimaryHit(int x, int y, Ray &ray, Hit &hit) const {
+    if(!rasterized) {
+        return geometry->getIndex().closestHit(ray, hit);
+    }
+
+    SceneObject* object;
+    int64_t primitive;
+    if(rasterizer.getCoverage(x, y, object, primitive) == Rasterizer::unresolved) {
+        return geometry->getIndex().closestHit(ray, hit);
+    }
+    return geometry->getIndex().closestHit(ray, hit, object, primitive);
 }
 
-glm::vec3 Scene::getIlluminationAt(Ray &ray, SceneObject* &object, glm::vec3 &intersection) {
-    glm::vec3 normal;
-    float bias = 0.0001f;
+/**
+ * Each area light first gets a few shadow rays. When they all
+ * agree the light is taken to be fully visible or fully hidden,
+ * and only hits in the penumbra send the rest. The light of each
+ * sample is weighted by its share of all the samples sent, and
+ * added up sample after sample like the wavefront path does.
+ */
+glm::vec3 Scene::getIlluminationAt(Ray &ray, SceneObject* &object, glm::vec3 &intersection, const RenderOptions &options,
+                                   int x, int y, int sample, PixelFeatures &features, RenderStats &stats) {
+    glm::vec3 normal, geometricNormal;
+    if(!getShadingNormal(ray, object, intersection, normal, geometricNormal)) {
+        return glm::vec3(0.0f);
+    }
+
+    const SceneObject* shadowCaster = getShadowCaster(object);
+    Material material = getSurfaceMaterial(ray, object, intersection, geometricNormal);
+    glm::vec3 view = getViewDirection(camera->position, intersection);
+    float nv = glm::dot(normal, view);
+    features = {material.diffuse, normal, glm::length(intersection - camera->position)};
 
+    glm::vec3 lightContribution = glm::vec3(0.0f);
+    for(int i = 0; i < (int)lights.size(); i++) {
+        const Light* light = lights[i];
+        if(!light->isArea()) {
+            Ray shadowRay = Ray::toObject(intersection, light->position, geometricNormal);
+            stats.shadowRays++;
+            if(!geometry->getIndex().isOccluded(shadowRay, glm::length(light->position - shadowRay.origin), shadowCaster)) {
+                lightContribution += getPhongContribution(material, light, normal, view, nv, shadowRay.direction);
+            }
+            continue;
+        }
+
+        glm::vec3 targets[MAX_LIGHT_SAMPLES];
+        glm::vec3 directions[MAX_LIGHT_SAMPLES];
+        bool visible[MAX_LIGHT_SAMPLES];
+        auto trace = [&](int first, int count) {
+            getLightTargets(i, intersection, options, x, y, sample, first, count, targets + first);
+            int visibleCount = 0;
+            for(int k = first; k < first + count; k++) {
+                Ray shadowRay = Ray::toObject(intersection, targets[k], geometricNormal);
+                directions[k] = shadowRay.direction;
+                visible[k] = !geometry->getIndex().isOccluded(shadowRay, glm::length(targets[k] - shadowRay.origin), shadowCaster);
+                visibleCount += visible[k] ? 1 : 0;
+            }
+            return visibleCount;
+        };
+
+        int initial = std::min(PENUMBRA_SAMPLES, options.lightSamples);
+        int count = getLightSampleCount(trace(0, initial), options);
+        if(count > initial) {
+            trace(initial, count - initial);
+            stats.penumbraHits++;
+        }
+        stats.shadowRays += count;
+        stats.areaShadowRays += count;
+        stats.areaLightHits++;
+
+        float weight = 1.0f / (float)count;
+        for(int k = 0; k < count; k++) {
+            if(visible[k]) {
+                lightContribution += weight * getPhongContribution(material, light, normal, view, nv, directions[k]);
+            }
+        }
+    }
+
+    glm::vec3 color = material.ambient + lightContribution;
+
+    return glm::clamp(color, 0.0f, 1.0f);
+}
+
+/**
+ * Vertex normals that point to the other side of the triangle
+ * than its winding, as some exporters write them, are flipped
+ * so that both normals agree on which side is the front.
+ */
+bool Scene::getShadingNormal(const Ray &ray, SceneObject* object, const glm::vec3 &intersection, glm::vec3 &normal,
+                             glm::vec3 &geometricNormal) const {
     switch(object->type) {
         case SceneObject::plane:
         case SceneObject::triangle:
-            normal = object->normal;
+            geometricNormal = object->normal;
             break;
         case SceneObject::sphere:
-            normal = glm::normalize(intersection - object->position);
+            geometricNormal = glm::normalize(intersection - object->position);
+            break;
+        case SceneObject::mesh:
+            geometricNormal = ray.meshHit.normal;
             break;
         default:
-            return glm::vec3(0.0f);
+            return false;
     }
 
-    glm::vec3 lightContribution = glm::vec3(0.0f);
-    for(auto & light : lights) {
-        Ray shadowRay = Ray::toObject(intersection, light->position, bias);
-        if(!shadowRay.isLightBlockedBy(object, light, sceneObjects)) {
-            glm::vec3 l = shadowRay.direction;
-            glm::vec3 r = (2.0f * glm::dot(l, normal) * normal) - l;
-            glm::vec3 v = (camera->position != intersection) ? glm::normalize(camera->position - intersection) : glm::vec3(0.0f);
-
-            float ln = fmax(0.0f, glm::dot(l,normal));
-            float rv = fmax(0.0f, glm::dot(r,v));
+    normal = geometricNormal;
+    const MeshHit &meshHit = ray.meshHit;
+    if(meshHit.mesh != nullptr && meshHit.primitive >= 0 && meshHit.mesh->hasVertexNormals()) {
+        normal = meshHit.mesh->getVertexNormal(meshHit.primitive, meshHit.barycentrics);
+        if(glm::dot(normal, geometricNormal) < 0.0f) {
+            normal = -normal;
+        }
+    }
 
-            glm::vec3 dif = object->diffuse * light->diffuse * ln;
-            glm::vec3 spe = object->specular * light->specular * pow(rv,object->shininess);
+    //Double sided objects seen from behind are
+    //lit as if their normal faced the viewer
+    if(object->doubleSided && glm::dot(geometricNormal, ray.direction) > 0.0f) {
+        normal = -normal;
+        geometricNormal = -geometricNormal;
+    }
+    return true;
+}
 
-            lightContribution += (dif + spe);
-        }
+/**
+ * The level of detail follows Akenine-Möller et al., Texture
+ * Level of Detail Strategies for Real-Time Ray Tracing, Ray
+ * Tracing Gems (2019): the camera ray is a cone as wide as a
+ * pixel, whose footprint grows with the distance and with the
+ * slant of the surface, and is scaled from the scene onto the
+ * texture by the ratio of the areas of the triangle.
+ */
+Material Scene::getSurfaceMaterial(const Ray &ray, const SceneObject* object, const glm::vec3 &intersection,
+                                   const glm::vec3 &normal) const {
+    Material material = getMaterial(object);
+    const Mesh* mesh = ray.meshHit.mesh;
+    if(mesh == nullptr || mesh->getTexture() == nullptr || ray.meshHit.primitive < 0 || !mesh->hasTextureCoordinates()) {
+        return material;
     }
 
-    glm::vec3 color = object->ambient + lightContribution;
+    float areaRatio;
+    glm::vec2 uv = mesh->getTextureCoordinates(ray.meshHit.primitive, ray.meshHit.barycentrics, areaRatio);
 
-    return glm::clamp(color, 0.0f, 1.0f);
+    const TiledTexture* texture = mesh->getTexture();
+    float spread = screen[0][0].width / camera->focalLength;
+    float footprint = glm::length(intersection - ray.origin) * spread /
+                      std::max(std::fabs(glm::dot(normal, ray.direction)), 1e-3f);
+    float texels = std::sqrt(areaRatio * (float)texture->getWidth() * (float)texture->getHeight());
+    float lod = std::log2(std::max(footprint * texels, 1e-6f));
+
+    glm::vec3 color = texture->sample(uv, lod, *geometry->getTextureCache());
+    material.ambient *= color;
+    material.diffuse *= color;
+    return material;
 }
@@ -0,0 +1,362 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "SceneFile.h"
+#include "MappedFile.h"
+#include "Loader.h"
+#include "Mesh.h"
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+
+static const char MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+
+/**
+ * Type of an entry of the order array, in its top two bits
+ */
+enum OrderType : uint32_t {
+    planeOrder = 0, sphereOrder = 1, meshOrder = 2
+};
+
+static const uint32_t ORDER_SHIFT = 30;
+static const uint32_t ORDER_INDEX = (1u << ORDER_SHIFT) - 1;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t objectCount;
+    uint32_t planeCount;
+    uint32_t sphereCount;
+    uint32_t lightCount;
+    uint32_t meshCount;
+    uint32_t pathBytes;
+    uint32_t hasCamera;
+    float cameraPosition[3];
+    float fieldOfView;
+    float focalLength;
+    float aspectRatio;
+};
+
+/**
+ * The fields of SceneObject, and the radius of a
+ * sphere or the attenuation of a light
+ */
+struct ObjectRecord {
+    float position[3];
+    float normal[3];
+    float ambient[3];
+    float diffuse[3];
+    float specular[3];
+    float shininess;
+    float extra;
+    uint32_t doubleSided;
+};
+
+/**
+ * The radius and edges of a light, which
+ * are zero for point lights
+ */
+struct LightRecord {
+    ObjectRecord object;
+    float radius;
+    float edge1[3];
+    float edge2[3];
+};
+
+/**
+ * The texture path is empty for meshes without one
+ */
+struct MeshRecord {
+    ObjectRecord object;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+    uint32_t texturePathOffset;
+    uint32_t texturePathLength;
+};
+
+//records are read in place, so they must not have padding
+static_assert(sizeof(FileHeader) == 64, "FileHeader must be packed");
+static_assert(sizeof(ObjectRecord) == 72, "ObjectRecord must be packed");
+static_assert(sizeof(LightRecord) == 100, "LightRecord must be packed");
+static_assert(sizeof(MeshRecord) == 88, "MeshRecord must be packed");
+
+static void toFloats(const glm::vec3 &vector, float* out) {
+    out[0] = vector.x;
+    out[1] = vector.y;
+    out[2] = vector.z;
+}
+
+static glm::vec3 toVec3(const float* in) {
+    return glm::vec3(in[0], in[1], in[2]);
+}
+
+static ObjectRecord toRecord(const SceneObject* object, float extra) {
+    ObjectRecord record;
+    toFloats(object->position, record.position);
+    toFloats(object->normal, record.normal);
+    toFloats(object->ambient, record.ambient);
+    toFloats(object->diffuse, record.diffuse);
+    toFloats(object->specular, record.specular);
+    record.shininess = object->shininess;
+    record.extra = extra;
+    record.doubleSided = object->doubleSided ? 1 : 0;
+    return record;
+}
+
+static void fromRecord(const ObjectRecord &record, SceneObject* object) {
+    object->position = toVec3(record.position);
+    object->normal = toVec3(record.normal);
+    object->ambient = toVec3(record.ambient);
+    object->diffuse = toVec3(record.diffuse);
+    object->specular = toVec3(record.specular);
+    object->shininess = record.shininess;
+    object->doubleSided = record.doubleSided != 0;
+}
+
+template <typename T>
+static void writeArray(std::ofstream &file, const std::vector<T> &array) {
+    file.write((const char*)array.data(), (std::streamsize)(array.size() * sizeof(T)));
+}
+
+/**
+ * The directory of a scene file as Scene finds it,
+ * which .obj paths are relative to
+ */
+static boost::filesystem::path getDirectory(const std::string &filename) {
+    boost::filesystem::path directory = boost::filesystem::path(filename).parent_path();
+    return directory.empty() ? boost::filesystem::path(".") : directory;
+}
+
+size_t SceneFile::convert(const std::string &textFile, const std::string &binaryFile) {
+    std::vector<SceneObject*> objects;
+    std::vector<Light*> lights;
+    Camera* camera = nullptr;
+    boost::filesystem::path scenePath = getDirectory(textFile);
+
+    Loader::loadScene(textFile, objects, lights, camera, scenePath);
+
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    if(camera != nullptr) {
+        header.hasCamera = 1;
+        toFloats(camera->position, header.cameraPosition);
+        header.fieldOfView = camera->fieldOfView;
+        header.focalLength = camera->focalLength;
+        header.aspectRatio = camera->aspectRatio;
+    }
+
+    std::vector<uint32_t> order;
+    std::vector<ObjectRecord> planes, spheres;
+    std::vector<LightRecord> lightRecords;
+    std::vector<MeshRecord> meshes;
+    std::string paths;
+    boost::filesystem::path binaryDirectory = boost::filesystem::absolute(getDirectory(binaryFile));
+
+    for(auto & object : objects) {
+        switch(object->type) {
+            case SceneObject::plane:
+                order.push_back(planeOrder << ORDER_SHIFT | (uint32_t)planes.size());
+                planes.push_back(toRecord(object, 0.0f));
+                break;
+            case SceneObject::sphere:
+                order.push_back(sphereOrder << ORDER_SHIFT | (uint32_t)spheres.size());
+                spheres.push_back(toRecord(object, ((Sphere*)object)->radius));
+                break;
+            case SceneObject::mesh: {
+                Mesh* mesh = (Mesh*)object;
+                std::string path = boost::filesystem::relative(
+                        boost::filesystem::absolute(mesh->getFilename()), binaryDirectory).generic_string();
+                std::string texturePath;
+                if(!mesh->getTextureFile().empty()) {
+                    texturePath = boost::filesystem::relative(
+                            boost::filesystem::absolute(mesh->getTextureFile()), binaryDirectory).generic_string();
+                }
+                MeshRecord record;
+                record.object = toRecord(object, 0.0f);
+                record.pathOffset = (uint32_t)paths.size();
+                record.pathLength = (uint32_t)path.size();
+                paths += path;
+                record.texturePathOffset = (uint32_t)paths.size();
+                record.texturePathLength = (uint32_t)texturePath.size();
+                paths += texturePath;
+                order.push_back(meshOrder << ORDER_SHIFT | (uint32_t)meshes.size());
+                meshes.push_back(record);
+            }
+                break;
+            default:
+                break;
+        }
+    }
+    for(auto & light : lights) {
+        LightRecord record;
+        record.object = toRecord(light, light->attenuation);
+        record.radius = light->radius;
+        toFloats(light->edge1, record.edge1);
+        toFloats(light->edge2, record.edge2);
+        lightRecords.push_back(record);
+    }
+
+    header.objectCount = (uint32_t)order.size();
+    header.planeCount = (uint32_t)planes.size();
+    header.sphereCount = (uint32_t)spheres.size();
+    header.lightCount = (uint32_t)lightRecords.size();
+    header.meshCount = (uint32_t)meshes.size();
+    header.pathBytes = (uint32_t)paths.size();
+
+    for(auto & object : objects) {
+        delete object;
+    }
+    for(auto & light : lights) {
+        delete light;
+    }
+    delete camera;
+
+    std::ofstream file(binaryFile, std::ios::binary);
+    if(!file) {
+        throw std::runtime_error("Unable to write " + binaryFile);
+    }
+    file.write((const char*)&header, sizeof(header));
+    writeArray(file, order);
+    writeArray(file, planes);
+    writeArray(file, spheres);
+    writeArray(file, lightRecords);
+    writeArray(file, meshes);
+    file.write(paths.data(), (std::streamsize)paths.size());
+    if(!file) {
+        throw std::runtime_error("Unable to write " + binaryFile);
+    }
+    return (size_t)file.tellp();
+}
+
+bool SceneFile::isBinary(const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+/**
+ * The records are used where they lie in the mapping; the
+ * objects are constructed from them in a single pass per type.
+ */
+void SceneFile::load(const std::string &filename, std::vector<SceneObject*> &sceneObjects, std::vector<Light*> &lights,
+                     Camera* &camera, boost::filesystem::path &scenePath, GeometryCache* geometryCache,
+                     unsigned int threads, SceneArrays &arrays) {
+    MappedFile file(filename);
+    const char* data = file.getData();
+
+    FileHeader header;
+    if(file.getSize() < sizeof(header)) {
+        throw std::invalid_argument(filename + " is not a binary scene");
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if(std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+        throw std::invalid_argument(filename + " is not a binary scene of version " + std::to_string(VERSION));
+    }
+
+    uint64_t expected = sizeof(header) + (uint64_t)header.objectCount * sizeof(uint32_t) +
+                        ((uint64_t)header.planeCount + header.sphereCount) * sizeof(ObjectRecord) +
+                        (uint64_t)header.lightCount * sizeof(LightRecord) +
+                        (uint64_t)header.meshCount * sizeof(MeshRecord) + header.pathBytes;
+    if(expected != file.getSize()) {
+        throw std::invalid_argument(filename + " is truncated or corrupt");
+    }
+
+    //every array is a multiple of 4 bytes long and the mapping
+    //is page aligned, so the records can be read in place
+    const uint32_t* order = (const uint32_t*)(data + sizeof(header));
+    const ObjectRecord* planes = (const ObjectRecord*)(order + header.objectCount);
+    const ObjectRecord* spheres = planes + header.planeCount;
+    const LightRecord* lightRecords = (const LightRecord*)(spheres + header.sphereCount);
+    const MeshRecord* meshes = (const MeshRecord*)(lightRecords + header.lightCount);
+    const char* paths = (const char*)(meshes + header.meshCount);
+
+    arrays.planes.resize(header.planeCount);
+    for(uint32_t i = 0; i < header.planeCount; i++) {
+        fromRecord(planes[i], &arrays.planes[i]);
+    }
+    arrays.spheres.resize(header.sphereCount);
+    for(uint32_t i = 0; i < header.sphereCount; i++) {
+        fromRecord(spheres[i], &arrays.spheres[i]);
+        arrays.spheres[i].radius = spheres[i].extra;
+    }
+
+    std::vector<Mesh*> loaded;
+    try {
+        sceneObjects.reserve(sceneObjects.size() + header.objectCount);
+        for(uint32_t i = 0; i < header.objectCount; i++) {
+            uint32_t index = order[i] & ORDER_INDEX;
+            switch(order[i] >> ORDER_SHIFT) {
+                case planeOrder:
+                    if(index >= header.planeCount) {
+                        throw std::invalid_argument(filename + " is corrupt");
+                    }
+                    sceneObjects.push_back(&arrays.planes[index]);
+                    break;
+                case sphereOrder:
+                    if(index >= header.sphereCount) {
+                        throw std::invalid_argument(filename + " is corrupt");
+                    }
+                    sceneObjects.push_back(&arrays.spheres[index]);
+                    break;
+                case meshOrder: {
+                    if(index >= header.meshCount ||
+                       (uint64_t)meshes[index].pathOffset + meshes[index].pathLength > header.pathBytes ||
+                       (uint64_t)meshes[index].texturePathOffset + meshes[index].texturePathLength > header.pathBytes) {
+                        throw std::invalid_argument(filename + " is corrupt");
+                    }
+                    const MeshRecord &record = meshes[index];
+                    std::string path(paths + record.pathOffset, record.pathLength);
+                    Mesh* mesh = new Mesh();
+                    loaded.push_back(mesh);
+                    mesh->setGeometryCache(geometryCache, threads);
+                    mesh->loadObj(path, scenePath);
+                    fromRecord(record.object, mesh);
+                    mesh->setAmbient(mesh->ambient);
+                    mesh->setDiffuse(mesh->diffuse);
+                    mesh->setSpecular(mesh->specular);
+                    mesh->setShininess(mesh->shininess);
+                    mesh->setDoubleSided(mesh->doubleSided);
+                    if(record.texturePathLength > 0) {
+                        mesh->setTextureFile(std::string(paths + record.texturePathOffset, record.texturePathLength),
+                                             scenePath);
+                    }
+                    sceneObjects.push_back(mesh);
+                }
+                    break;
+                default:
+                    throw std::invalid_argument(filename + " is corrupt");
+            }
+        }
+    } catch (...) {
+        for(auto & mesh : loaded) {
+            delete mesh;
+        }
+        sceneObjects.clear();
+        throw;
+    }
+
+    for(uint32_t i = 0; i < header.lightCount; i++) {
+        Light* light = new Light();
+        fromRecord(lightRecords[i].object, light);
+        light->attenuation = lightRecords[i].object.extra;
+        light->radius = lightRecords[i].radius;
+        light->edge1 = toVec3(lightRecords[i].edge1);
+        light->edge2 = toVec3(lightRecords[i].edge2);
+        lights.push_back(light);
+    }
+
+    if(header.hasCamera != 0) {
+        camera = new Camera();
+        camera->position = toVec3(header.cameraPosition);
+        camera->fieldOfView = header.fieldOfView;
+        camera->focalLength = header.focalLength;
+        camera->aspectRatio = header.aspectRatio;
+    }
+}
@@ -0,0 +1,211 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "SceneGeometry.h"
+#include "Loader.h"
+#include "Mesh.h"
+#include "Timeline.h"
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+SceneGeometry::SceneGeometry(const std::string &filename, const RenderOptions &options, std::vector<Light*> &lights,
+                             Camera* &camera) : textureBudget(options.textureBudget) {
+    size_t found;
+    found=filename.find_last_of("/\\");
+    this->scenePath = boost::filesystem::path(filename.substr(0,found));
+
+    if(options.geometryBudget > 0) {
+        geometryCache = new GeometryCache(options.geometryBudget);
+    }
+
+    try {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        bool binary = SceneFile::isBinary(filename);
+        if(binary) {
+            arrays = new SceneArrays();
+            SceneFile::load(filename, objects, lights, camera, scenePath, geometryCache, options.getThreadCount(),
+                            *arrays);
+        } else {
+            Loader::loadScene(filename, objects, lights, camera, scenePath, geometryCache, options.getThreadCount());
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+        std::cout << (binary ? "Binary scene: " : "Scene: ") << objects.size() << " objects, " << lights.size()
+                  << " lights, loaded in " << elapsed.count() << " ms" << std::endl;
+        openTextures();
+    } catch (...) {
+        deallocateResources();
+        throw;
+    }
+
+    for(size_t i = 0; i < objects.size(); i++) {
+        objects[i]->id = (int)i;
+    }
+}
+
+SceneGeometry::~SceneGeometry() {
+    deallocateResources();
+}
+
+void SceneGeometry::deallocateResources() {
+    //only the meshes of a binary scene are allocated one by one
+    for(auto & object : objects) {
+        if(arrays == nullptr || object->type == SceneObject::mesh) {
+            delete object;
+        }
+    }
+    objects.clear();
+    delete arrays;
+    arrays = nullptr;
+
+    //meshes release their chunks when deleted,
+    //so the cache goes after them
+    delete geometryCache;
+    geometryCache = nullptr;
+
+    //as are the textures, which the meshes point to
+    for(auto & texture : textures) {
+        textureCache->release(*texture);
+        delete texture;
+    }
+    textures.clear();
+    delete textureCache;
+    textureCache = nullptr;
+}
+
+/**
+ * Like the chunk files of meshes, the tiled file of an image
+ * is written once and reused for as long as the image keeps
+ * its size and modification time. Opening it only reads the
+ * table of its levels; the tiles are read as rays reach them.
+ */
+void SceneGeometry::openTextures() {
+    for(auto & object : objects) {
+        if(object->type != SceneObject::mesh) {
+            continue;
+        }
+
+        Mesh* mesh = (Mesh*)object;
+        const std::string &image = mesh->getTextureFile();
+        if(image.empty() || mesh->getTexture() != nullptr) {
+            continue;
+        }
+        if(!mesh->hasTextureCoordinates()) {
+            std::cout << "Mesh " << mesh->getFilename() << " has no texture coordinates to map " << image
+                      << " with" << std::endl;
+            continue;
+        }
+
+        std::string path = image + ".mip";
+        auto found = std::find_if(textures.begin(), textures.end(), [&path](const TiledTexture* texture) {
+            return texture->getPath() == path;
+        });
+        if(found != textures.end()) {
+            mesh->setTexture(*found);
+            continue;
+        }
+
+        boost::filesystem::path source(image);
+        if(!boost::filesystem::exists(source)) {
+            throw std::invalid_argument("Texture " + image + " could not be loaded");
+        }
+        uint64_t sourceSize = boost::filesystem::file_size(source);
+        int64_t sourceTime = (int64_t)boost::filesystem::last_write_time(source);
+
+        TiledTexture* texture = new TiledTexture();
+        if(!texture->open(path, sourceSize, sourceTime)) {
+            try {
+                TiledTexture::write(path, image, sourceSize, sourceTime);
+            } catch (...) {
+                delete texture;
+                throw;
+            }
+            if(!texture->open(path, sourceSize, sourceTime)) {
+                delete texture;
+                throw std::runtime_error("Could not read back " + path);
+            }
+        }
+        if(textureCache == nullptr) {
+            textureCache = new TextureCache(textureBudget);
+        }
+        textures.push_back(texture);
+        mesh->setTexture(texture);
+
+        std::cout << "Texture " << image << ": " << texture->getWidth() << "x" << texture->getHeight() << ", "
+                  << texture->getLevelCount() << " levels" << std::endl;
+    }
+}
+
+void SceneGeometry::buildAccelerationStructures(const RenderOptions &options) {
+    unsigned int threads = options.getThreadCount();
+    bool compact = options.compactGeometry;
+    size_t geometryMemory = 0;
+    size_t bvhMemory = 0;
+
+    for(auto& object : objects) {
+        if(object->type != SceneObject::mesh) {
+            continue;
+        }
+
+        Mesh* mesh = (Mesh*)object;
+        if(mesh->isStreamed()) {
+            const ChunkedGeometry* chunks = mesh->getChunks();
+            std::cout << "Chunks " << chunks->getPath() << ": " << mesh->getTriangleCount() << " triangles in "
+                      << chunks->getChunkCount() << " chunks, " << chunks->getMemoryUsage() / 1024.0
+                      << " KB resident" << std::endl;
+            continue;
+        }
+
+        {
+            Timeline::Span span("build BVH");
+            mesh->buildBVH(threads, compact);
+        }
+        geometryMemory += mesh->getGeometryMemory();
+        bvhMemory += mesh->getBVHMemory();
+
+        const BVHStats &stats = mesh->getBVH().getStats();
+        std::cout << "BVH " << mesh->getFilename() << ": " << mesh->getTriangleCount() << " triangles, "
+                  << stats.buildSeconds * 1000.0 << " ms, SAH cost " << stats.sahCost << ", "
+                  << stats.nodeCount << " nodes, " << stats.leafCount << " leaves, depth " << stats.maxDepth << std::endl;
+        std::cout << "    leaf sizes:";
+        for(size_t i = 0; i < stats.leafSizes.size(); i++) {
+            std::cout << " " << (i + 1 < stats.leafSizes.size() ? std::to_string(i + 1) : std::string(">8"))
+                      << ":" << stats.leafSizes[i];
+        }
+        std::cout << std::endl;
+    }
+
+    if(geometryMemory > 0) {
+        std::cout << "Mesh memory (" << (compact ? "compact" : "binary") << " layout): "
+                  << geometryMemory / 1048576.0 << " MB triangles, "
+                  << bvhMemory / 1048576.0 << " MB BVH" << std::endl;
+    }
+
+    accelerator = options.accelerator;
+    {
+        Timeline::Span span("build index");
+        index.build(objects, threads, accelerator);
+    }
+
+    std::cout << "Scene index: " << index.getPlaneCount() << " planes, " << index.getBoundedCount() << " bounded objects";
+    if(index.isUsingGrid()) {
+        const GridStats &stats = index.getGrid().getStats();
+        const int* resolution = index.getGrid().getResolution();
+        std::cout << ", grid " << resolution[0] << "x" << resolution[1] << "x" << resolution[2] << ", "
+                  << stats.buildSeconds * 1000.0 << " ms, " << (double)stats.references / index.getBoundedCount()
+                  << " cells per object, " << stats.emptyCells * 100.0 / stats.cellCount << "% empty" << std::endl;
+    } else {
+        const BVHStats &stats = index.getBVH().getStats();
+        std::cout << ", BVH " << stats.buildSeconds * 1000.0 << " ms, SAH cost " << stats.sahCost << std::endl;
+    }
+}
+
+void SceneGeometry::updateIndex() {
+    openTextures();
+    index.build(objects, RenderOptions().getThreadCount(), accelerator);
+}
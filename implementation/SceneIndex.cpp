@@ -0,0 +1,255 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <SceneIndex.h>
+#include "Sphere.h"
+#include "Mesh.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void SceneIndex::build(const std::vector<SceneObject*> &objects, unsigned int threads,
+                       RenderOptions::Accelerator accelerator) {
+    planes.clear();
+    planeX.clear(); planeY.clear(); planeZ.clear();
+    normalX.clear(); normalY.clear(); normalZ.clear();
+    planeDoubleSided.clear();
+    boundedObjects.clear();
+
+    std::vector<SceneObject*> bounded;
+    std::vector<AABB> objectBounds;
+    for(auto & object : objects) {
+        AABB box;
+        switch(object->type) {
+            case SceneObject::plane:
+                planes.push_back((Plane*)object);
+                planeX.push_back(object->position.x);
+                planeY.push_back(object->position.y);
+                planeZ.push_back(object->position.z);
+                normalX.push_back(object->normal.x);
+                normalY.push_back(object->normal.y);
+                normalZ.push_back(object->normal.z);
+                planeDoubleSided.push_back(object->doubleSided);
+                continue;
+            case SceneObject::sphere:
+                box.expand(object->position - glm::vec3(((Sphere*)object)->radius));
+                box.expand(object->position + glm::vec3(((Sphere*)object)->radius));
+                break;
+            case SceneObject::mesh:
+                box = ((Mesh*)object)->getBounds();
+                break;
+            default:
+                continue;
+        }
+        bounded.push_back(object);
+        objectBounds.push_back(box);
+    }
+
+    useGrid = accelerator == RenderOptions::grid ||
+              (accelerator == RenderOptions::automatic && prefersGrid(bounded));
+
+    if(useGrid) {
+        bvh.clear();
+        grid.build(objectBounds, threads);
+        boundedObjects = bounded;
+        return;
+    }
+
+    grid.clear();
+    bvh.build(objectBounds, threads);
+
+    //the objects are stored in the order of the
+    //leaves, like the triangles of a mesh
+    for(auto & index : bvh.getOrder()) {
+        boundedObjects.push_back(bounded[index]);
+    }
+}
+
+/**
+ * A grid cell sized for the typical sphere then holds only a few
+ * of them. Spheres of very different sizes, or meshes with bounds
+ * far larger than their triangles, would crowd some cells while
+ * leaving most of them empty, where the BVH adapts.
+ */
+bool SceneIndex::prefersGrid(const std::vector<SceneObject*> &bounded) {
+    if((int)bounded.size() < GRID_MIN_OBJECTS) {
+        return false;
+    }
+
+    float minRadius = HUGE_VALF;
+    float maxRadius = 0.0f;
+    for(auto & object : bounded) {
+        if(object->type != SceneObject::sphere) {
+            return false;
+        }
+        minRadius = std::fmin(minRadius, ((Sphere*)object)->radius);
+        maxRadius = std::fmax(maxRadius, ((Sphere*)object)->radius);
+    }
+
+    return maxRadius <= minRadius * GRID_MAX_RADIUS_RATIO;
+}
+
+/**
+ * Same arithmetic as Ray::hasPlaneIntersection, over flat
+ * arrays, four planes at a time with SSE2. The lanes that pass
+ * are then taken in order like the planes left over, so the
+ * closest plane is the same as one at a time. When
+ * cullBackfaces is set, only double sided planes are hit from
+ * behind.
+ */
+int SceneIndex::intersectPlanes(const Ray &ray, float maxDistance, bool cullBackfaces, const SceneObject* skip, float &t) const {
+    int closest = -1;
+    t = maxDistance;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 directionX = _mm_set1_ps(ray.direction.x);
+    const __m128 directionY = _mm_set1_ps(ray.direction.y);
+    const __m128 directionZ = _mm_set1_ps(ray.direction.z);
+    const __m128 originX = _mm_set1_ps(ray.origin.x);
+    const __m128 originY = _mm_set1_ps(ray.origin.y);
+    const __m128 originZ = _mm_set1_ps(ray.origin.z);
+    for(; i + 4 <= planes.size(); i += 4) {
+        __m128 nx = _mm_loadu_ps(&normalX[i]);
+        __m128 ny = _mm_loadu_ps(&normalY[i]);
+        __m128 nz = _mm_loadu_ps(&normalZ[i]);
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, nx), _mm_mul_ps(directionY, ny)),
+                              _mm_mul_ps(directionZ, nz));
+        __m128 distance = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&planeX[i]), originX), nx),
+                                                           _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&planeY[i]), originY), ny)),
+                                                _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&planeZ[i]), originZ), nz)), d);
+
+        __m128 behind = _mm_cmpgt_ps(d, zero);
+        if(cullBackfaces) {
+            __m128i doubleSided = _mm_set_epi32(planeDoubleSided[i + 3], planeDoubleSided[i + 2],
+                                                planeDoubleSided[i + 1], planeDoubleSided[i]);
+            behind = _mm_and_ps(behind, _mm_castsi128_ps(_mm_cmpgt_epi32(doubleSided, _mm_setzero_si128())));
+        }
+        __m128 facing = _mm_or_ps(_mm_cmplt_ps(d, zero), behind);
+        __m128 inRange = _mm_and_ps(_mm_cmpge_ps(distance, zero), _mm_cmplt_ps(distance, _mm_set1_ps(t)));
+        int lanes = _mm_movemask_ps(_mm_and_ps(facing, inRange));
+        if(lanes == 0) {
+            continue;
+        }
+
+        float distances[4];
+        _mm_storeu_ps(distances, distance);
+        for(int lane = 0; lane < 4; lane++) {
+            if((lanes >> lane & 1) && distances[lane] < t && planes[i + lane] != skip) {
+                t = distances[lane];
+                closest = (int)(i + lane);
+            }
+        }
+    }
+#endif
+
+    for(; i < planes.size(); i++) {
+        float d = ray.direction.x * normalX[i] + ray.direction.y * normalY[i] + ray.direction.z * normalZ[i];
+        float distance = ((planeX[i] - ray.origin.x) * normalX[i] +
+                          (planeY[i] - ray.origin.y) * normalY[i] +
+                          (planeZ[i] - ray.origin.z) * normalZ[i]) / d;
+
+        bool facing = d < 0.0f || ((!cullBackfaces || planeDoubleSided[i]) && d > 0.0f);
+        if(facing && distance >= 0.0f && distance < t && planes[i] != skip) {
+            t = distance;
+            closest = (int)i;
+        }
+    }
+
+    return closest;
+}
+
+bool SceneIndex::closestHit(Ray &ray, Hit &hit) const {
+    float t;
+    int plane = intersectPlanes(ray, HUGE_VALF, true, nullptr, t);
+    if(plane >= 0) {
+        hit.object = planes[plane];
+        hit.distance = t;
+        hit.point = ray.origin + (t * ray.direction);
+    }
+
+    auto intersectObject = [&](int index, float &closest) {
+        SceneObject* object = boundedObjects[index];
+        SceneObject* hitObject;
+        glm::vec3 point;
+        float d;
+        if(ray.intersects(object, point, d, !object->doubleSided, hitObject) && d < closest) {
+            closest = d;
+            hit.object = hitObject;
+            hit.point = point;
+            //a later object can overwrite the mesh
+            //hit of the ray without being any closer
+            hit.meshHit = object->type == SceneObject::mesh ? ray.meshHit : MeshHit();
+            return true;
+        }
+        return false;
+    };
+
+    if(useGrid) {
+        grid.intersect(ray.origin, ray.direction, ray.inverseDirection, hit.distance, intersectObject);
+    } else {
+        bvh.intersect(ray.origin, ray.inverseDirection, hit.distance, intersectObject);
+    }
+
+    return hit.object != nullptr;
+}
+
+/**
+ * Planes win ties against the candidate, as they
+ * do in the full query
+ */
+bool SceneIndex::closestHit(Ray &ray, Hit &hit, SceneObject* candidate, int64_t primitive) const {
+    float t;
+    int plane = intersectPlanes(ray, HUGE_VALF, true, nullptr, t);
+    if(plane >= 0) {
+        hit.object = planes[plane];
+        hit.distance = t;
+        hit.point = ray.origin + (t * ray.direction);
+    }
+
+    if(candidate == nullptr) {
+        return hit.object != nullptr;
+    }
+
+    SceneObject* hitObject;
+    glm::vec3 point;
+    float d;
+    if(!ray.intersectsPrimitive(candidate, primitive, point, d, !candidate->doubleSided, hitObject)) {
+        hit = Hit();
+        return closestHit(ray, hit);
+    }
+
+    if(d < hit.distance) {
+        hit.object = hitObject;
+        hit.point = point;
+        hit.distance = d;
+        hit.meshHit = candidate->type == SceneObject::mesh ? ray.meshHit : MeshHit();
+    }
+    return true;
+}
+
+bool SceneIndex::isOccluded(Ray &ray, float maxDistance, const SceneObject* skip) const {
+    float t;
+    if(intersectPlanes(ray, maxDistance, false, skip, t) >= 0) {
+        return true;
+    }
+
+    auto isBlocking = [&](int index) {
+        SceneObject* object = boundedObjects[index];
+        glm::vec3 point;
+        float d;
+        return object != skip && ray.intersects(object, point, d, false) && d < maxDistance;
+    };
+
+    if(useGrid) {
+        return grid.occluded(ray.origin, ray.direction, ray.inverseDirection, maxDistance, isBlocking);
+    }
+    return bvh.occluded(ray.origin, ray.inverseDirection, maxDistance, isBlocking);
+}
@@ -0,0 +1,179 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "SceneParser.h"
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+/**
+ * Powers of ten that floats hold exactly
+ */
+static const float exactPowers[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+/**
+ * Largest integer below which every integer is a float
+ */
+static const uint32_t EXACT_MANTISSA = 1u << 24;
+
+SceneParser::SceneParser(const std::string &filename) {
+    file = new MappedFile(filename);
+    data = file->getData();
+    size = file->getSize();
+}
+
+SceneParser::SceneParser(boost::string_view text) {
+    data = text.data();
+    size = text.size();
+}
+
+SceneParser::~SceneParser() {
+    delete file;
+}
+
+bool SceneParser::next() {
+    wordCount = 0;
+    if(offset >= size) {
+        return false;
+    }
+
+    const char* start = data + offset;
+    const char* newline = (const char*)std::memchr(start, '\n', size - offset);
+    const char* end = newline != nullptr ? newline : data + size;
+    offset = end - data + 1;
+    lineNumber++;
+
+    const char* c = start;
+    while(c < end) {
+        while(c < end && (*c == ' ' || *c == '\t' || *c == '\r')) {
+            c++;
+        }
+        const char* word = c;
+        while(c < end && *c != ' ' && *c != '\t' && *c != '\r') {
+            c++;
+        }
+        if(c > word && wordCount < MAX_WORDS) {
+            words[wordCount++] = boost::string_view(word, c - word);
+        }
+    }
+    return true;
+}
+
+boost::string_view SceneParser::getWord(int index) const {
+    if(index >= wordCount) {
+        std::string name = wordCount > 0 ? words[0].to_string() : "line";
+        throw std::invalid_argument("Expected " + std::to_string(index) + (index == 1 ? " value" : " values") +
+                                    " for " + name);
+    }
+    return words[index];
+}
+
+float SceneParser::getFloat(int index) const {
+    float value;
+    if(!parseFloat(getWord(index), value)) {
+        throw std::invalid_argument("Expected a number for " + words[0].to_string() + ", got " +
+                                    words[index].to_string());
+    }
+    return value;
+}
+
+int SceneParser::getInt(int index) const {
+    int value;
+    if(!parseInt(getWord(index), value)) {
+        throw std::invalid_argument("Expected an integer for " + words[0].to_string() + ", got " +
+                                    words[index].to_string());
+    }
+    return value;
+}
+
+glm::vec3 SceneParser::getVec3(int index) const {
+    getWord(index + 2);
+    return glm::vec3(getFloat(index), getFloat(index + 1), getFloat(index + 2));
+}
+
+/**
+ * Decimals of at most seven digits without an exponent, which
+ * is nearly every number of a scene file, are one exact float
+ * times or over an exact power of ten, so a single correctly
+ * rounded operation gives what strtof gives. Anything else goes
+ * to strtof itself.
+ */
+bool SceneParser::parseFloat(boost::string_view word, float &value) {
+    const char* c = word.begin();
+    const char* end = word.end();
+
+    bool negative = c < end && *c == '-';
+    if(c < end && (*c == '-' || *c == '+')) {
+        c++;
+    }
+
+    uint32_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool exact = true;
+    for(; c < end && *c >= '0' && *c <= '9'; c++, digits++) {
+        mantissa = mantissa * 10 + (*c - '0');
+        exact = exact && mantissa <= EXACT_MANTISSA;
+    }
+    if(c < end && *c == '.') {
+        for(c++; c < end && *c >= '0' && *c <= '9'; c++, digits++) {
+            mantissa = mantissa * 10 + (*c - '0');
+            exponent--;
+            exact = exact && mantissa <= EXACT_MANTISSA;
+        }
+    }
+
+    if(c == end && digits > 0 && exact && exponent >= -10) {
+        value = exponent < 0 ? (float)mantissa / exactPowers[-exponent] : (float)mantissa;
+        value = negative ? -value : value;
+        return true;
+    }
+
+    //exponents, long numbers, inf and nan
+    char buffer[64];
+    if(word.empty() || word.size() >= sizeof(buffer)) {
+        return false;
+    }
+    std::memcpy(buffer, word.data(), word.size());
+    buffer[word.size()] = '\0';
+    char* parsed;
+    value = std::strtof(buffer, &parsed);
+    return parsed == buffer + word.size();
+}
+
+bool SceneParser::parseInt(boost::string_view word, int &value) {
+    const char* c = word.begin();
+    const char* end = word.end();
+
+    bool negative = c < end && *c == '-';
+    if(c < end && (*c == '-' || *c == '+')) {
+        c++;
+    }
+    if(c == end) {
+        return false;
+    }
+
+    long long result = 0;
+    for(; c < end; c++) {
+        if(*c < '0' || *c > '9') {
+            return false;
+        }
+        result = result * 10 + (*c - '0');
+        if(result > (long long)INT32_MAX + 1) {
+            return false;
+        }
+    }
+
+    result = negative ? -result : result;
+    if(result > INT32_MAX) {
+        return false;
+    }
+    value = (int)result;
+    return true;
+}
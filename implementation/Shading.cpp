@@ -0,0 +1,190 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <Shading.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void ShadingBatch::resize(int count, int lightCount) {
+    this->count = count;
+    this->lightCount = lightCount;
+
+    for(auto array : {&normalX, &normalY, &normalZ, &viewX, &viewY, &viewZ, &normalDotView,
+                      &ambientR, &ambientG, &ambientB, &diffuseR, &diffuseG, &diffuseB,
+                      &specularR, &specularG, &specularB, &shininess, &red, &green, &blue}) {
+        array->resize(count);
+    }
+    for(auto array : {&lightX, &lightY, &lightZ, &visible}) {
+        array->resize((size_t)count * lightCount);
+    }
+}
+
+#ifdef __SSE2__
+namespace {
+    /**
+     * fastLog2 of four floats, operation for operation
+     */
+    inline __m128 fastLog2(__m128 x) {
+        __m128i bits = _mm_castps_si128(x);
+        __m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+        bits = _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000));
+        __m128 t = _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(1.0f));
+
+        __m128 p = _mm_set1_ps(-0.02512318f);
+        p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(0.11929818f));
+        p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.27462318f));
+        p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(0.45552707f));
+        p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.71755785f));
+        p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.44247532f));
+        p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(2.1237527e-6f));
+        return _mm_add_ps(exponent, p);
+    }
+
+    /**
+     * fastExp2 of four floats, operation for operation
+     */
+    inline __m128 fastExp2(__m128 x) {
+        x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-126.0f)), _mm_set1_ps(126.0f));
+        __m128i whole = _mm_cvttps_epi32(x);
+        //the comparison is all ones, i.e. -1, where
+        //truncation rounded a negative number up
+        whole = _mm_add_epi32(whole, _mm_castps_si128(_mm_cmplt_ps(x, _mm_cvtepi32_ps(whole))));
+        __m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(whole));
+
+        __m128 p = _mm_set1_ps(0.0018762329f);
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.0089925844f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.0558236055f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.2401545346f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.6931529641f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+
+        __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(whole, _mm_set1_epi32(127)), 23));
+        return _mm_mul_ps(scale, p);
+    }
+
+    inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    inline __m128 fastPow(__m128 x, __m128 y) {
+        __m128 zero = _mm_setzero_ps();
+        __m128 exponent = _mm_mul_ps(y, fastLog2(x));
+        __m128 result = fastExp2(exponent);
+        __m128 power0 = _mm_and_ps(_mm_cmpeq_ps(y, zero), _mm_set1_ps(1.0f));
+        __m128 inRange = _mm_and_ps(_mm_cmpgt_ps(x, zero), _mm_cmpgt_ps(exponent, _mm_set1_ps(-100.0f)));
+        return select(inRange, result, power0);
+    }
+
+    inline __m128 dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+    }
+
+    /**
+     * Adds the weighted light of one channel to its sum
+     */
+    inline void accumulate(float* sum, const float* diffuse, const float* specular, __m128 lightDiffuse,
+                           __m128 lightSpecular, __m128 diffuseFactor, __m128 specularFactor, __m128 visible) {
+        __m128 color = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(diffuse), lightDiffuse), diffuseFactor),
+                                  _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(specular), lightSpecular), specularFactor));
+        _mm_storeu_ps(sum, _mm_add_ps(_mm_loadu_ps(sum), _mm_mul_ps(visible, color)));
+    }
+}
+#endif
+
+/**
+ * Four hits at a time in SSE registers, the rest one at a time
+ * with the scalar functions the depth first path shades with.
+ * Every lane runs the same float operations in the same order
+ * as those, so both paths give the same image. Lights that are
+ * not visible are added with a weight of zero rather than
+ * skipped, and the sums run light after light from zero.
+ */
+void shadeBatch(ShadingBatch &batch, const std::vector<Light*> &lights) {
+    const int count = batch.count;
+    float* red = batch.red.data();
+    float* green = batch.green.data();
+    float* blue = batch.blue.data();
+    std::fill(red, red + count, 0.0f);
+    std::fill(green, green + count, 0.0f);
+    std::fill(blue, blue + count, 0.0f);
+
+    //the pointers are taken once, since stores to the sums
+    //could otherwise alias the vectors holding them
+    const float* normalX = batch.normalX.data();
+    const float* normalY = batch.normalY.data();
+    const float* normalZ = batch.normalZ.data();
+    const float* viewX = batch.viewX.data();
+    const float* viewY = batch.viewY.data();
+    const float* viewZ = batch.viewZ.data();
+    const float* normalDotView = batch.normalDotView.data();
+    const float* shininess = batch.shininess.data();
+    const float* diffuseR = batch.diffuseR.data();
+    const float* diffuseG = batch.diffuseG.data();
+    const float* diffuseB = batch.diffuseB.data();
+    const float* specularR = batch.specularR.data();
+    const float* specularG = batch.specularG.data();
+    const float* specularB = batch.specularB.data();
+
+    for(int light = 0; light < batch.lightCount; light++) {
+        const size_t first = (size_t)light * count;
+        const float* lightX = batch.lightX.data() + first;
+        const float* lightY = batch.lightY.data() + first;
+        const float* lightZ = batch.lightZ.data() + first;
+        const float* visible = batch.visible.data() + first;
+        const glm::vec3 lightDiffuse = lights[light]->diffuse;
+        const glm::vec3 lightSpecular = lights[light]->specular;
+
+        int i = 0;
+#ifdef __SSE2__
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 two = _mm_set1_ps(2.0f);
+        for(; i + 4 <= count; i += 4) {
+            __m128 lx = _mm_loadu_ps(lightX + i);
+            __m128 ly = _mm_loadu_ps(lightY + i);
+            __m128 lz = _mm_loadu_ps(lightZ + i);
+            __m128 ln = dot(lx, ly, lz, _mm_loadu_ps(normalX + i), _mm_loadu_ps(normalY + i),
+                            _mm_loadu_ps(normalZ + i));
+            __m128 lv = dot(lx, ly, lz, _mm_loadu_ps(viewX + i), _mm_loadu_ps(viewY + i),
+                            _mm_loadu_ps(viewZ + i));
+
+            __m128 diffuse = _mm_max_ps(ln, zero);
+            __m128 rv = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(two, ln), _mm_loadu_ps(normalDotView + i)), lv);
+            __m128 specular = fastPow(_mm_max_ps(rv, zero), _mm_loadu_ps(shininess + i));
+            __m128 weight = _mm_loadu_ps(visible + i);
+
+            accumulate(red + i, diffuseR + i, specularR + i, _mm_set1_ps(lightDiffuse.x),
+                       _mm_set1_ps(lightSpecular.x), diffuse, specular, weight);
+            accumulate(green + i, diffuseG + i, specularG + i, _mm_set1_ps(lightDiffuse.y),
+                       _mm_set1_ps(lightSpecular.y), diffuse, specular, weight);
+            accumulate(blue + i, diffuseB + i, specularB + i, _mm_set1_ps(lightDiffuse.z),
+                       _mm_set1_ps(lightSpecular.z), diffuse, specular, weight);
+        }
+#endif
+        for(; i < count; i++) {
+            float ln = lightX[i] * normalX[i] + lightY[i] * normalY[i] + lightZ[i] * normalZ[i];
+            float lv = lightX[i] * viewX[i] + lightY[i] * viewY[i] + lightZ[i] * viewZ[i];
+            float diffuse, specular;
+            getPhongFactors(ln, normalDotView[i], lv, shininess[i], diffuse, specular);
+
+            red[i] += visible[i] * (diffuseR[i] * lightDiffuse.x * diffuse + specularR[i] * lightSpecular.x * specular);
+            green[i] += visible[i] * (diffuseG[i] * lightDiffuse.y * diffuse + specularG[i] * lightSpecular.y * specular);
+            blue[i] += visible[i] * (diffuseB[i] * lightDiffuse.z * diffuse + specularB[i] * lightSpecular.z * specular);
+        }
+    }
+
+    const float* ambientR = batch.ambientR.data();
+    const float* ambientG = batch.ambientG.data();
+    const float* ambientB = batch.ambientB.data();
+    for(int i = 0; i < count; i++) {
+        red[i] = clampUnit(ambientR[i] + red[i]);
+        green[i] = clampUnit(ambientG[i] + green[i]);
+        blue[i] = clampUnit(ambientB[i] + blue[i]);
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "SocketIO.h"
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/socket.h>
+
+bool SocketIO::takeLine(std::string &buffer, std::string &line) {
+    size_t end = buffer.find('\n');
+    if(end == std::string::npos) {
+        return false;
+    }
+
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    if(!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    return true;
+}
+
+bool SocketIO::readLine(int socket, std::string &buffer, std::string &line) {
+    while(!takeLine(buffer, line)) {
+        char chunk[4096];
+        ssize_t received = recv(socket, chunk, sizeof(chunk), 0);
+        if(received < 0 && errno == EINTR) {
+            continue;
+        }
+        if(received <= 0) {
+            return false;
+        }
+        buffer.append(chunk, (size_t)received);
+    }
+    return true;
+}
+
+void SocketIO::writeAll(int socket, const void* data, size_t length) {
+    const char* bytes = (const char*)data;
+    while(length > 0) {
+        ssize_t sent = send(socket, bytes, length, MSG_NOSIGNAL);
+        if(sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if(sent <= 0) {
+            throw std::runtime_error(std::string("Unable to write to socket: ") + strerror(errno));
+        }
+        bytes += sent;
+        length -= (size_t)sent;
+    }
+}
+
+void SocketIO::writeLine(int socket, const std::string &line) {
+    std::string message = line + "\n";
+    writeAll(socket, message.data(), message.size());
+}
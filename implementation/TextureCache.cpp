@@ -0,0 +1,12 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <TextureCache.h>
+#include "TiledTexture.h"
+
+template class LRUCache<TiledTexture, TextureTile>;
@@ -0,0 +1,420 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "TileCoordinator.h"
+#include "SocketIO.h"
+#include "ProgressBar.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+TileCoordinator::TileCoordinator(Scene &scene, const std::string &scenePath, const RenderOptions &options,
+                                 const std::string &programPath) : scene(scene) {
+    this->scenePath = boost::filesystem::absolute(scenePath).string();
+    this->programPath = programPath;
+    this->options = options;
+    tileSize = options.tileSize > 0 ? options.tileSize : 16;
+    tilesX = (scene.getWidth() + tileSize - 1) / tileSize;
+    int tilesY = (scene.getHeight() + tileSize - 1) / tileSize;
+
+    tiles.resize((size_t)tilesX * tilesY);
+    for(auto & corner : scene.getTileOrder(tileSize)) {
+        int index = getTileIndex(corner.x, corner.y);
+        tiles[index].x = corner.x;
+        tiles[index].y = corner.y;
+        tiles[index].w = std::min(tileSize, scene.getWidth() - corner.x);
+        tiles[index].h = std::min(tileSize, scene.getHeight() - corner.y);
+        queue.push_back(index);
+    }
+    remainingTiles = (int)tiles.size();
+}
+
+TileCoordinator::~TileCoordinator() {
+    for(auto & worker : workers) {
+        close(worker.socket);
+    }
+
+    //only left running if the frame failed
+    stopWorkers(0.0);
+
+    if(listenSocket >= 0) {
+        close(listenSocket);
+    }
+}
+
+/**
+ * Without a port, only workers on this host can connect.
+ * Sockets are closed on exec so that local workers do not
+ * keep the connections of the others open.
+ */
+void TileCoordinator::listen() {
+    listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenSocket < 0) {
+        throw std::runtime_error(std::string("Unable to create socket: ") + strerror(errno));
+    }
+    fcntl(listenSocket, F_SETFD, FD_CLOEXEC);
+
+    int reuse = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(options.listenPort >= 0 ? INADDR_ANY : INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)std::max(options.listenPort, 0));
+
+    if(bind(listenSocket, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(listenSocket, 16) < 0) {
+        throw std::runtime_error(std::string("Unable to listen for workers: ") + strerror(errno));
+    }
+
+    socklen_t length = sizeof(address);
+    getsockname(listenSocket, (sockaddr*)&address, &length);
+    port = ntohs(address.sin_port);
+    std::cout << "Coordinator listening for workers on port " << port << std::endl;
+}
+
+/**
+ * The output of local workers is discarded, their
+ * errors still go to the terminal
+ */
+void TileCoordinator::startWorker() {
+    unsigned int threads = std::max(1u, options.getThreadCount() / std::max(1u, options.workers));
+
+    std::vector<std::string> arguments = {programPath, "-worker", "127.0.0.1:" + std::to_string(port),
+                                          "-threads", std::to_string(threads)};
+    if(options.compactGeometry) {
+        arguments.emplace_back("-compact");
+    }
+    if(options.accelerator != RenderOptions::automatic) {
+        arguments.emplace_back("-accel");
+        arguments.emplace_back(options.accelerator == RenderOptions::grid ? "grid" : "bvh");
+    }
+    if(options.geometryBudget > 0) {
+        arguments.emplace_back("-geometry-budget");
+        arguments.emplace_back(std::to_string(options.geometryBudget / 1048576.0));
+    }
+    if(options.textureBudget != RenderOptions().textureBudget) {
+        arguments.emplace_back("-texture-budget");
+        arguments.emplace_back(std::to_string(options.textureBudget / 1048576.0));
+    }
+    if(options.wavefront) {
+        arguments.emplace_back("-wavefront");
+    }
+    if(options.raster) {
+        arguments.emplace_back("-raster");
+    }
+
+    std::vector<char*> argv;
+    for(auto & argument : arguments) {
+        argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+
+    pid_t process = fork();
+    if(process < 0) {
+        throw std::runtime_error(std::string("Unable to start a worker: ") + strerror(errno));
+    }
+    if(process == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if(null >= 0) {
+            dup2(null, STDOUT_FILENO);
+        }
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    processes.push_back(process);
+}
+
+void TileCoordinator::reapWorkers() {
+    for(size_t i = 0; i < processes.size();) {
+        int status = 0;
+        if(waitpid(processes[i], &status, WNOHANG) != processes[i]) {
+            i++;
+            continue;
+        }
+
+        std::cerr << "Worker process " << processes[i] << " exited with status "
+                  << (WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status)) << std::endl;
+        processes.erase(processes.begin() + i);
+
+        //a worker failing at startup would be restarted forever
+        if(remainingTiles > 0 && restarts < MAX_ATTEMPTS * (int)options.workers) {
+            restarts++;
+            startWorker();
+        }
+    }
+}
+
+/**
+ * A worker that was dropped for hanging may never exit,
+ * and a stopped process only reacts to SIGKILL.
+ */
+void TileCoordinator::stopWorkers(double gracePeriod) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while(!processes.empty()) {
+        for(size_t i = 0; i < processes.size();) {
+            if(waitpid(processes[i], nullptr, WNOHANG) == processes[i]) {
+                processes.erase(processes.begin() + i);
+            } else {
+                i++;
+            }
+        }
+
+        std::chrono::duration<double> waited = std::chrono::steady_clock::now() - start;
+        if(!processes.empty() && waited.count() >= gracePeriod) {
+            for(auto & process : processes) {
+                kill(process, SIGKILL);
+                waitpid(process, nullptr, 0);
+            }
+            processes.clear();
+        }
+        usleep(10000);
+    }
+}
+
+void TileCoordinator::acceptWorker() {
+    int client = accept(listenSocket, nullptr, nullptr);
+    if(client < 0) {
+        return;
+    }
+    fcntl(client, F_SETFD, FD_CLOEXEC);
+
+    Worker worker;
+    worker.socket = client;
+    worker.lastReply = std::chrono::steady_clock::now();
+    try {
+        SocketIO::writeLine(client, "scene " + std::to_string(options.samplesPerPixel) + " " +
+                                    std::to_string(options.lightSamples) + " " + std::to_string(options.seed) + " " +
+                                    std::to_string(tileSize) + " " + scenePath);
+    } catch (std::exception& e) {
+        close(client);
+        return;
+    }
+    workers.push_back(worker);
+}
+
+/**
+ * Colors follow their tile line as raw floats, which may
+ * arrive over several reads.
+ */
+void TileCoordinator::receive(Worker &worker) {
+    char chunk[65536];
+    ssize_t received = recv(worker.socket, chunk, sizeof(chunk), 0);
+    if(received < 0 && errno == EINTR) {
+        return;
+    }
+    if(received <= 0) {
+        throw std::runtime_error("disconnected");
+    }
+    worker.buffer.append(chunk, (size_t)received);
+
+    std::string line;
+    while(true) {
+        if(worker.receiving >= 0) {
+            if(worker.buffer.size() < worker.payloadBytes) {
+                break;
+            }
+
+            Tile &tile = tiles[worker.receiving];
+            const char* data = worker.buffer.data();
+            for(int y = tile.y; y < tile.y + tile.h; y++) {
+                for(int x = tile.x; x < tile.x + tile.w; x++) {
+                    float color[3];
+                    std::memcpy(color, data, sizeof(color));
+                    data += sizeof(color);
+                    scene.setColor(x, y, glm::vec3(color[0], color[1], color[2]));
+                }
+            }
+            worker.buffer.erase(0, worker.payloadBytes);
+
+            tile.done = true;
+            remainingTiles--;
+            worker.tiles.erase(std::find(worker.tiles.begin(), worker.tiles.end(), worker.receiving));
+            worker.receiving = -1;
+            continue;
+        }
+
+        if(!SocketIO::takeLine(worker.buffer, line)) {
+            break;
+        }
+
+        std::istringstream stream(line);
+        std::string reply;
+        stream >> reply;
+        if(reply == "error") {
+            throw std::runtime_error(line);
+        }
+
+        if(!worker.ready) {
+            int width = 0, height = 0, threads = 0;
+            if(reply != "ok" || !(stream >> width >> height >> threads)) {
+                throw std::runtime_error("unexpected reply " + line);
+            }
+            if(width != scene.getWidth() || height != scene.getHeight()) {
+                throw std::runtime_error("the scene is " + std::to_string(width) + "x" + std::to_string(height) +
+                                         " on the worker");
+            }
+            worker.ready = true;
+            worker.capacity = std::max(1, threads) * TILES_PER_THREAD;
+        } else {
+            int x = -1, y = -1, w = 0, h = 0;
+            int index = (reply == "tile" && (stream >> x >> y >> w >> h)) ? getTileIndex(x, y) : -1;
+            if(index < 0 || std::find(worker.tiles.begin(), worker.tiles.end(), index) == worker.tiles.end() ||
+               tiles[index].w != w || tiles[index].h != h) {
+                throw std::runtime_error("unexpected reply " + line);
+            }
+            worker.receiving = index;
+            worker.payloadBytes = (size_t)w * h * 3 * sizeof(float);
+        }
+        worker.lastReply = std::chrono::steady_clock::now();
+    }
+}
+
+void TileCoordinator::dispatch(Worker &worker) {
+    if(!worker.ready) {
+        return;
+    }
+
+    while((int)worker.tiles.size() < worker.capacity && !queue.empty()) {
+        int index = queue.front();
+        queue.pop_front();
+
+        //the timeout runs from when the worker has work
+        if(worker.tiles.empty()) {
+            worker.lastReply = std::chrono::steady_clock::now();
+        }
+        worker.tiles.push_back(index);
+        tiles[index].attempts++;
+
+        const Tile &tile = tiles[index];
+        SocketIO::writeLine(worker.socket, "tile " + std::to_string(tile.x) + " " + std::to_string(tile.y) + " " +
+                                           std::to_string(tile.w) + " " + std::to_string(tile.h));
+    }
+}
+
+void TileCoordinator::dropWorker(size_t index, const std::string &reason) {
+    Worker &worker = workers[index];
+    std::cerr << "Worker dropped: " << reason << std::endl;
+    close(worker.socket);
+
+    for(auto tile = worker.tiles.rbegin(); tile != worker.tiles.rend(); ++tile) {
+        if(tiles[*tile].attempts >= MAX_ATTEMPTS) {
+            throw std::runtime_error("The tile at " + std::to_string(tiles[*tile].x) + "," +
+                                     std::to_string(tiles[*tile].y) + " failed on " +
+                                     std::to_string(MAX_ATTEMPTS) + " workers");
+        }
+        queue.push_front(*tile);
+        retries++;
+    }
+    workers.erase(workers.begin() + index);
+}
+
+int TileCoordinator::getTileIndex(int x, int y) const {
+    if(x < 0 || y < 0 || x >= scene.getWidth() || y >= scene.getHeight() || x % tileSize != 0 || y % tileSize != 0) {
+        return -1;
+    }
+    return (y / tileSize) * tilesX + x / tileSize;
+}
+
+/**
+ * A single thread polls the connections, hands out tiles and
+ * copies the colors it gets back into the screen of the scene.
+ * Workers only ever get tiles nobody else is working on, so
+ * every tile is written once.
+ */
+void TileCoordinator::renderToImage(const char* filename) {
+    listen();
+    for(unsigned int i = 0; i < options.workers; i++) {
+        startWorker();
+    }
+
+    int max = scene.getWidth() * scene.getHeight();
+    int progress = 0;
+    ProgressBar progressBar(max, 70);
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    size_t peakWorkers = 0;
+
+    while(remainingTiles > 0) {
+        reapWorkers();
+        if(workers.empty() && processes.empty() && options.listenPort < 0) {
+            throw std::runtime_error("No workers left to render the frame");
+        }
+
+        std::vector<pollfd> descriptors;
+        descriptors.push_back({listenSocket, POLLIN, 0});
+        for(auto & worker : workers) {
+            descriptors.push_back({worker.socket, POLLIN, 0});
+        }
+        if(poll(descriptors.data(), descriptors.size(), 100) < 0 && errno != EINTR) {
+            throw std::runtime_error(std::string("Unable to poll workers: ") + strerror(errno));
+        }
+
+        //backwards, so that dropping a worker keeps
+        //the descriptors of the others in place
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for(size_t i = workers.size(); i-- > 0;) {
+            try {
+                if(descriptors[i + 1].revents != 0) {
+                    receive(workers[i]);
+                }
+                std::chrono::duration<double> silence = now - workers[i].lastReply;
+                if(!workers[i].tiles.empty() && silence.count() > WORKER_TIMEOUT) {
+                    throw std::runtime_error("no reply in " + std::to_string((int)WORKER_TIMEOUT) + " seconds");
+                }
+                dispatch(workers[i]);
+            } catch (std::runtime_error& e) {
+                dropWorker(i, e.what());
+            }
+        }
+
+        if(descriptors[0].revents & POLLIN) {
+            acceptWorker();
+        }
+        peakWorkers = std::max(peakWorkers, workers.size());
+
+        progress = 0;
+        for(auto & tile : tiles) {
+            progress += tile.done ? tile.w * tile.h : 0;
+        }
+        progressBar.setTicks(progress);
+        progressBar.display();
+    }
+    progressBar.done();
+
+    for(auto & worker : workers) {
+        try {
+            SocketIO::writeLine(worker.socket, "quit");
+        } catch (std::exception& e) {
+            //it has nothing left to do anyway
+        }
+        close(worker.socket);
+    }
+    workers.clear();
+
+    //the frame is complete, so stragglers can be killed
+    stopWorkers(5.0);
+
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end-start;
+    std::cout << "Completed in " << elapsed.count() << " seconds." << std::endl;
+    std::cout << "Workers: " << tiles.size() << " tiles on up to " << peakWorkers << " workers, " << retries
+              << " tiles handed out again, " << restarts << " workers restarted" << std::endl;
+
+    scene.saveImage(filename, options);
+}
@@ -0,0 +1,200 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "TileWorker.h"
+#include "Scene.h"
+#include "SocketIO.h"
+#include <iostream>
+#include <sstream>
+#include <array>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+
+TileWorker::TileWorker(const std::string &address, const RenderOptions &options) {
+    size_t colon = address.rfind(':');
+    if(colon == std::string::npos || colon == 0 || colon + 1 == address.size()) {
+        throw std::invalid_argument("The coordinator address must be host:port");
+    }
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    this->options = options;
+}
+
+int TileWorker::connectToCoordinator() {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addresses = nullptr;
+    int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+    if(error != 0) {
+        throw std::runtime_error("Unable to resolve " + host + ": " + gai_strerror(error));
+    }
+
+    int coordinator = -1;
+    for(addrinfo* address = addresses; address != nullptr && coordinator < 0; address = address->ai_next) {
+        coordinator = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if(coordinator >= 0 && connect(coordinator, address->ai_addr, address->ai_addrlen) < 0) {
+            close(coordinator);
+            coordinator = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if(coordinator < 0) {
+        throw std::runtime_error("Unable to connect to the coordinator at " + host + ":" + port);
+    }
+    return coordinator;
+}
+
+/**
+ * This thread reads the tiles into a queue, which the render
+ * threads empty. Tiles are written back by whichever thread
+ * finished them, so the writes are serialized with a mutex.
+ */
+void TileWorker::run() {
+    int coordinator = connectToCoordinator();
+    std::string buffer;
+    std::string line;
+
+    if(!SocketIO::readLine(coordinator, buffer, line)) {
+        close(coordinator);
+        return;
+    }
+
+    std::istringstream stream(line);
+    std::string command;
+    std::string scenePath;
+    RenderOptions frameOptions = options;
+    stream >> command >> frameOptions.samplesPerPixel >> frameOptions.lightSamples >> frameOptions.seed >> frameOptions.tileSize;
+    std::getline(stream >> std::ws, scenePath);
+
+    Scene* scene = nullptr;
+    try {
+        if(command != "scene" || stream.fail() || scenePath.empty() || frameOptions.lightSamples < 1 ||
+           frameOptions.lightSamples > Scene::MAX_LIGHT_SAMPLES) {
+            throw std::invalid_argument("expected scene [samples per pixel] [light samples] [seed] [tile size] [path]");
+        }
+        scene = new Scene(scenePath, frameOptions);
+        if(!scene->isSceneLoaded()) {
+            throw std::invalid_argument("unable to load " + scenePath);
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        SocketIO::writeLine(coordinator, std::string("error ") + e.what());
+        delete scene;
+        close(coordinator);
+        return;
+    }
+
+    std::mutex socketMutex;
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<std::array<int, 4>> queue;
+    bool closing = false;
+    std::vector<std::future<void>> futures;
+
+    try {
+        scene->beginFrame(frameOptions);
+        unsigned int threads = frameOptions.getThreadCount();
+        SocketIO::writeLine(coordinator, "ok " + std::to_string(scene->getWidth()) + " " +
+                                         std::to_string(scene->getHeight()) + " " + std::to_string(threads));
+
+        for(unsigned int i = 0; i < threads; i++) {
+            futures.push_back(std::async(std::launch::async, [&]() {
+                Wavefront wavefront;
+                RenderStats stats;
+                std::vector<float> colors;
+                while(true) {
+                    std::array<int, 4> tile;
+                    {
+                        std::unique_lock<std::mutex> lock(queueMutex);
+                        queueChanged.wait(lock, [&]() {return closing || !queue.empty();});
+                        if(queue.empty()) {
+                            break;
+                        }
+                        tile = queue.front();
+                        queue.pop_front();
+                    }
+
+                    int tx = tile[0], ty = tile[1], tw = tile[2], th = tile[3];
+                    scene->renderTile(tx, ty, tw, th, frameOptions, wavefront, stats);
+
+                    colors.clear();
+                    for(int y = ty; y < ty + th; y++) {
+                        for(int x = tx; x < tx + tw; x++) {
+                            const glm::vec3 &color = scene->getColor(x, y);
+                            colors.push_back(color.x);
+                            colors.push_back(color.y);
+                            colors.push_back(color.z);
+                        }
+                    }
+
+                    std::string header = "tile " + std::to_string(tx) + " " + std::to_string(ty) + " " +
+                                         std::to_string(tw) + " " + std::to_string(th) + "\n";
+
+                    std::lock_guard<std::mutex> lock(socketMutex);
+                    SocketIO::writeAll(coordinator, header.data(), header.size());
+                    SocketIO::writeAll(coordinator, colors.data(), colors.size() * sizeof(float));
+                }
+            }));
+        }
+
+        while(SocketIO::readLine(coordinator, buffer, line)) {
+            std::istringstream tileStream(line);
+            std::array<int, 4> tile;
+            tileStream >> command >> tile[0] >> tile[1] >> tile[2] >> tile[3];
+            if(command == "quit") {
+                break;
+            }
+
+            if(command != "tile" || tileStream.fail() || tile[0] < 0 || tile[1] < 0 || tile[2] <= 0 || tile[3] <= 0 ||
+               tile[0] + tile[2] > scene->getWidth() || tile[1] + tile[3] > scene->getHeight()) {
+                std::lock_guard<std::mutex> lock(socketMutex);
+                SocketIO::writeLine(coordinator, "error unexpected command " + line);
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queue.push_back(tile);
+            queueChanged.notify_one();
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+
+    //tiles still queued are of no use once
+    //the coordinator is gone
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.clear();
+        closing = true;
+    }
+    queueChanged.notify_all();
+
+    std::string failure;
+    for(auto & future : futures) {
+        try {
+            future.get();
+        } catch (std::exception& e) {
+            failure = e.what();
+        }
+    }
+
+    delete scene;
+    close(coordinator);
+    if(!failure.empty()) {
+        throw std::runtime_error(failure);
+    }
+}
@@ -0,0 +1,237 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <TiledTexture.h>
+#include "DerivedFile.h"
+#include <CImg.h>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+#include <unistd.h>
+
+namespace {
+    const char MAGIC[8] = {'R', 'T', 'M', 'I', 'P', 'M', 'A', 'P'};
+
+    /**
+     * The layout number is the tile size
+     */
+    struct TextureFileHeader {
+        DerivedFileHeader file;
+        uint32_t levelCount;
+        uint32_t reserved;
+    };
+
+    /**
+     * Index of a texel of a row or column of the given
+     * size, repeating the texture in both directions
+     */
+    uint32_t wrap(float coordinate, uint32_t size) {
+        bool representable = std::fabs(coordinate) < 1e18f;
+        long long index = representable ? (long long)coordinate % (long long)size : 0;
+        return (uint32_t)(index < 0 ? index + size : index);
+    }
+}
+
+TiledTexture::~TiledTexture() {
+    if(file >= 0) {
+        close(file);
+    }
+}
+
+/**
+ * The image is only decoded here, once, with all of its first
+ * level in memory. Each further level averages two by two
+ * texels of the one before; the last row or column of a level
+ * of odd size is dropped, as is usual for box filtered chains.
+ * Tiles at the right and bottom edges are padded with copies
+ * of the edge texels.
+ */
+void TiledTexture::write(const std::string &path, const std::string &image, uint64_t sourceSize, int64_t sourceTime) {
+    uint32_t width, height;
+    std::vector<unsigned char> texels;
+    try {
+        cimg_library::CImg<unsigned char> decoded(image.c_str());
+        width = (uint32_t)decoded.width();
+        height = (uint32_t)decoded.height();
+        if(width == 0 || height == 0) {
+            throw std::invalid_argument("Texture " + image + " could not be loaded");
+        }
+
+        //grayscale images repeat their only channel
+        texels.resize((size_t)width * height * 3);
+        int channels = decoded.spectrum();
+        for(uint32_t y = 0; y < height; y++) {
+            for(uint32_t x = 0; x < width; x++) {
+                for(int c = 0; c < 3; c++) {
+                    texels[((size_t)y * width + x) * 3 + c] = decoded((int)x, (int)y, 0, channels >= 3 ? c : 0);
+                }
+            }
+        }
+    } catch (std::invalid_argument &) {
+        throw;
+    } catch (std::exception &) {
+        throw std::invalid_argument("Texture " + image + " could not be loaded");
+    }
+
+    std::vector<LevelRecord> records;
+    uint64_t tiles = 0;
+    for(uint32_t w = width, h = height;; w = std::max(1u, w / 2), h = std::max(1u, h / 2)) {
+        LevelRecord record;
+        record.width = w;
+        record.height = h;
+        record.tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+        record.tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+        record.firstTile = tiles;
+        tiles += (uint64_t)record.tilesX * record.tilesY;
+        records.push_back(record);
+        if(w == 1 && h == 1) {
+            break;
+        }
+    }
+    if(tiles > UINT32_MAX) {
+        throw std::invalid_argument("Texture " + image + " is too large");
+    }
+
+    TextureFileHeader header;
+    header.file = DerivedFile::makeHeader(MAGIC, VERSION, TILE_SIZE, sourceSize, sourceTime);
+    header.levelCount = (uint32_t)records.size();
+    header.reserved = 0;
+
+    DerivedFile::Writer writer(path);
+    std::ofstream &output = writer.getStream();
+    output.write((const char*)&header, sizeof(header));
+    output.write((const char*)records.data(), records.size() * sizeof(LevelRecord));
+
+    std::vector<unsigned char> tile(TILE_BYTES);
+    for(size_t level = 0; level < records.size(); level++) {
+        const LevelRecord &record = records[level];
+        if(level > 0) {
+            const LevelRecord &previous = records[level - 1];
+            std::vector<unsigned char> half((size_t)record.width * record.height * 3);
+            for(uint32_t y = 0; y < record.height; y++) {
+                uint32_t y0 = std::min(y * 2, previous.height - 1);
+                uint32_t y1 = std::min(y * 2 + 1, previous.height - 1);
+                for(uint32_t x = 0; x < record.width; x++) {
+                    uint32_t x0 = std::min(x * 2, previous.width - 1);
+                    uint32_t x1 = std::min(x * 2 + 1, previous.width - 1);
+                    for(int c = 0; c < 3; c++) {
+                        unsigned int sum = texels[((size_t)y0 * previous.width + x0) * 3 + c] +
+                                           texels[((size_t)y0 * previous.width + x1) * 3 + c] +
+                                           texels[((size_t)y1 * previous.width + x0) * 3 + c] +
+                                           texels[((size_t)y1 * previous.width + x1) * 3 + c];
+                        half[((size_t)y * record.width + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+                    }
+                }
+            }
+            texels.swap(half);
+        }
+
+        for(uint32_t ty = 0; ty < record.tilesY; ty++) {
+            for(uint32_t tx = 0; tx < record.tilesX; tx++) {
+                for(int row = 0; row < TILE_SIZE; row++) {
+                    uint32_t y = std::min(ty * TILE_SIZE + row, record.height - 1);
+                    for(int column = 0; column < TILE_SIZE; column++) {
+                        uint32_t x = std::min(tx * TILE_SIZE + column, record.width - 1);
+                        std::memcpy(&tile[(row * TILE_SIZE + column) * 3], &texels[((size_t)y * record.width + x) * 3], 3);
+                    }
+                }
+                output.write((const char*)tile.data(), tile.size());
+            }
+        }
+    }
+
+    writer.commit();
+}
+
+bool TiledTexture::open(const std::string &path, uint64_t sourceSize, int64_t sourceTime) {
+    if(file >= 0) {
+        close(file);
+    }
+    this->path = path;
+    levels.clear();
+
+    TextureFileHeader header;
+    file = DerivedFile::open(path, &header, sizeof(header),
+                             DerivedFile::makeHeader(MAGIC, VERSION, TILE_SIZE, sourceSize, sourceTime));
+    if(file >= 0 && header.levelCount == 0) {
+        close(file);
+        file = -1;
+    }
+    if(file < 0) {
+        return false;
+    }
+
+    levels.resize(header.levelCount);
+    if(!DerivedFile::readAt(file, levels.data(), levels.size() * sizeof(LevelRecord), sizeof(header))) {
+        close(file);
+        file = -1;
+        levels.clear();
+        return false;
+    }
+    tileOffset = sizeof(header) + levels.size() * sizeof(LevelRecord);
+    return true;
+}
+
+TextureTile* TiledTexture::read(uint32_t tile) const {
+    TextureTile* loaded = new TextureTile();
+    loaded->texels.resize(TILE_BYTES);
+    if(!DerivedFile::readAt(file, loaded->texels.data(), TILE_BYTES, tileOffset + (uint64_t)tile * TILE_BYTES)) {
+        delete loaded;
+        throw std::runtime_error("Could not read tile " + std::to_string(tile) + " of " + path);
+    }
+    return loaded;
+}
+
+glm::vec3 TiledTexture::sample(const glm::vec2 &uv, float lod, TextureCache &cache) const {
+    float level = std::min(std::max(lod, 0.0f), (float)(levels.size() - 1));
+    int first = (int)level;
+    float blend = level - (float)first;
+
+    glm::vec3 color = sampleLevel(first, uv, cache);
+    if(blend > 0.0f) {
+        color = color * (1.0f - blend) + sampleLevel(first + 1, uv, cache) * blend;
+    }
+    return color;
+}
+
+/**
+ * The four texels mostly lie in the same tile, which is
+ * then only looked up in the cache once.
+ */
+glm::vec3 TiledTexture::sampleLevel(int level, const glm::vec2 &uv, TextureCache &cache) const {
+    const LevelRecord &record = levels[level];
+    float x = uv.x * (float)record.width - 0.5f;
+    float y = uv.y * (float)record.height - 0.5f;
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    float wx = x - fx;
+    float wy = y - fy;
+
+    uint32_t x0 = wrap(fx, record.width);
+    uint32_t y0 = wrap(fy, record.height);
+    uint32_t x1 = x0 + 1 < record.width ? x0 + 1 : 0;
+    uint32_t y1 = y0 + 1 < record.height ? y0 + 1 : 0;
+
+    std::shared_ptr<const TextureTile> tile;
+    uint64_t current = UINT64_MAX;
+    auto texel = [&](uint32_t tx, uint32_t ty) {
+        uint64_t index = record.firstTile + (uint64_t)(ty / TILE_SIZE) * record.tilesX + tx / TILE_SIZE;
+        if(index != current) {
+            tile = cache.acquire(*this, (uint32_t)index);
+            current = index;
+        }
+        const unsigned char* t = &tile->texels[((ty % TILE_SIZE) * TILE_SIZE + tx % TILE_SIZE) * 3];
+        return glm::vec3(t[0], t[1], t[2]);
+    };
+
+    glm::vec3 top = texel(x0, y0) * (1.0f - wx) + texel(x1, y0) * wx;
+    glm::vec3 bottom = texel(x0, y1) * (1.0f - wx) + texel(x1, y1) * wx;
+    return (top * (1.0f - wy) + bottom * wy) / 255.0f;
+}
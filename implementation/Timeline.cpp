@@ -0,0 +1,185 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "Timeline.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+
+/**
+ * The spans of one thread at a time. Only that thread writes to
+ * it; the count of spans ever recorded is published after each
+ * span so that the writer of the trace sees complete spans. The
+ * events are left uninitialized, so that the pages of a buffer
+ * are only touched as it fills up.
+ */
+struct TimelineBuffer {
+    std::unique_ptr<TimelineEvent[]> events;
+    std::atomic<uint64_t> recorded;
+    const char* name = nullptr;
+    int thread = 0;
+    TimelineBuffer* next = nullptr;
+
+    TimelineBuffer() : events(new TimelineEvent[Timeline::EVENTS_PER_THREAD]), recorded(0) {};
+};
+
+/**
+ * Hands the buffer of a thread to the next thread that starts
+ * recording once it exits
+ */
+struct TimelineOwner {
+    TimelineBuffer* buffer = nullptr;
+
+    ~TimelineOwner();
+};
+
+static std::atomic<bool> enabled(false);
+static std::chrono::steady_clock::time_point origin;
+static std::atomic<TimelineBuffer*> buffers(nullptr);
+static std::atomic<int> threadCount(0);
+static std::mutex freeMutex;
+static std::vector<TimelineBuffer*> freeBuffers;
+static thread_local TimelineBuffer* local = nullptr;
+static thread_local TimelineOwner owner;
+
+TimelineOwner::~TimelineOwner() {
+    if(buffer != nullptr) {
+        std::lock_guard<std::mutex> lock(freeMutex);
+        freeBuffers.push_back(buffer);
+    }
+}
+
+/**
+ * Buffer of the calling thread, taken on first use from a
+ * thread that has exited, or else allocated and registered
+ */
+static TimelineBuffer* getBuffer() {
+    if(local == nullptr) {
+        TimelineBuffer* buffer = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(freeMutex);
+            if(!freeBuffers.empty()) {
+                buffer = freeBuffers.back();
+                freeBuffers.pop_back();
+            }
+        }
+        if(buffer == nullptr) {
+            buffer = new TimelineBuffer();
+            buffer->thread = threadCount++;
+            buffer->next = buffers.load(std::memory_order_relaxed);
+            while(!buffers.compare_exchange_weak(buffer->next, buffer, std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+            }
+        }
+        buffer->name = nullptr;
+        owner.buffer = buffer;
+        local = buffer;
+    }
+    return local;
+}
+
+//the buffer is taken before the clock is read,
+//so that the first span of a thread does not
+//include taking it
+Timeline::Span::Span(const char* name, int x, int y) : name(name), begin(-1), x(x), y(y) {
+    if(isEnabled()) {
+        getBuffer();
+        begin = now();
+    }
+}
+
+Timeline::Span::~Span() {
+    if(begin >= 0) {
+        record(name, begin, now(), x, y);
+    }
+}
+
+void Timeline::start() {
+    origin = std::chrono::steady_clock::now();
+    enabled.store(true, std::memory_order_release);
+}
+
+bool Timeline::isEnabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void Timeline::nameThread(const char* name) {
+    if(isEnabled()) {
+        getBuffer()->name = name;
+    }
+}
+
+void Timeline::record(const char* name, int64_t begin, int64_t end, int x, int y) {
+    TimelineBuffer* buffer = getBuffer();
+    uint64_t count = buffer->recorded.load(std::memory_order_relaxed);
+    buffer->events[count & (EVENTS_PER_THREAD - 1)] = {name, begin, end, x, y};
+    buffer->recorded.store(count + 1, std::memory_order_release);
+}
+
+int64_t Timeline::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+/**
+ * Complete events ("ph": "X") with their start and duration in
+ * microseconds, and a metadata event naming each thread
+ */
+size_t Timeline::write(const std::string &filename) {
+    std::ofstream file(filename);
+    if(!file) {
+        throw std::runtime_error("Unable to write " + filename);
+    }
+
+    size_t written = 0;
+    char line[256];
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    const char* separator = "\n";
+    for(TimelineBuffer* buffer = buffers.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->next) {
+        std::string name = buffer->name != nullptr ? buffer->name : "thread";
+        std::snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                      "\"args\":{\"name\":\"%s %d\"}}", separator, buffer->thread, name.c_str(), buffer->thread);
+        file << line;
+        separator = ",\n";
+
+        uint64_t count = buffer->recorded.load(std::memory_order_acquire);
+        uint64_t first = count > EVENTS_PER_THREAD ? count - EVENTS_PER_THREAD : 0;
+        for(uint64_t i = first; i < count; i++) {
+            const TimelineEvent &event = buffer->events[i & (EVENTS_PER_THREAD - 1)];
+            int length = std::snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"raytracer\",\"ph\":\"X\","
+                                       "\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", event.name, buffer->thread,
+                                       event.begin / 1000.0, (event.end - event.begin) / 1000.0);
+            if(event.x >= 0) {
+                std::snprintf(line + length, sizeof(line) - length, ",\"args\":{\"x\":%d,\"y\":%d}}", event.x, event.y);
+            } else {
+                std::snprintf(line + length, sizeof(line) - length, "}");
+            }
+            file << line;
+            written++;
+        }
+    }
+    file << "\n]}\n";
+
+    if(!file) {
+        throw std::runtime_error("Unable to write " + filename);
+    }
+    return written;
+}
+
+size_t Timeline::getDroppedCount() {
+    size_t dropped = 0;
+    for(TimelineBuffer* buffer = buffers.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->next) {
+        uint64_t count = buffer->recorded.load(std::memory_order_acquire);
+        dropped += count > EVENTS_PER_THREAD ? count - EVENTS_PER_THREAD : 0;
+    }
+    return dropped;
+}
@@ -0,0 +1,140 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include "Topology.h"
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <cctype>
+#include <boost/filesystem.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+//policies of set_mempolicy(2), from linux/mempolicy.h
+#define RAYTRACER_MPOL_DEFAULT 0
+#define RAYTRACER_MPOL_INTERLEAVE 3
+#endif
+
+/**
+ * Parses a list of processors such as 0-3,8,10-11
+ */
+static std::vector<int> parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while(std::getline(stream, range, ',')) {
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for(int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        } catch (std::exception& e) {
+            //a blank line has no processors
+        }
+    }
+    return cpus;
+}
+
+/**
+ * Memory only nodes are left out, as are processors outside
+ * of the affinity mask the process was started with.
+ */
+std::vector<NumaNode> Topology::detect() {
+    std::vector<NumaNode> nodes;
+
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    boost::system::error_code error;
+    boost::filesystem::directory_iterator end;
+    for(boost::filesystem::directory_iterator entry("/sys/devices/system/node", error); !error && entry != end;
+        entry.increment(error)) {
+        std::string name = entry->path().filename().string();
+        if(name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+           !std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+            continue;
+        }
+
+        std::ifstream file((entry->path() / "cpulist").string());
+        std::string list;
+        std::getline(file, list);
+
+        NumaNode node;
+        node.id = std::stoi(name.substr(4));
+        for(int cpu : parseCpuList(list)) {
+            if(!restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) {
+                node.cpus.push_back(cpu);
+            }
+        }
+        if(!node.cpus.empty()) {
+            nodes.push_back(node);
+        }
+    }
+#endif
+
+    if(nodes.empty()) {
+        NumaNode node;
+        for(unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) {
+            node.cpus.push_back((int)cpu);
+        }
+        nodes.push_back(node);
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b) {
+        return a.id < b.id;
+    });
+    return nodes;
+}
+
+bool Topology::pinThread(const std::vector<int> &cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus) {
+        if(cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+void Topology::setInterleaved(const std::vector<NumaNode> &nodes, bool interleaved) {
+#ifdef __linux__
+    if(!interleaved) {
+        syscall(SYS_set_mempolicy, RAYTRACER_MPOL_DEFAULT, nullptr, 0);
+        return;
+    }
+
+    const int bits = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask;
+    for(auto & node : nodes) {
+        if((int)mask.size() <= node.id / bits) {
+            mask.resize(node.id / bits + 1, 0);
+        }
+        mask[node.id / bits] |= 1UL << (node.id % bits);
+    }
+
+    //the kernel reads one bit less than it is told to
+    if(!mask.empty()) {
+        syscall(SYS_set_mempolicy, RAYTRACER_MPOL_INTERLEAVE, mask.data(), mask.size() * bits + 1);
+    }
+#endif
+}
@@ -0,0 +1,17 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <Triangle.h>
+
+void Triangle::precompute() {
+    edge1 = vertices[1] - vertices[0];
+    edge2 = vertices[2] - vertices[0];
+    glm::vec3 n = glm::cross(edge1, edge2);
+    normal = glm::normalize(n);
+    area = glm::length(n) / 2.0f;
+}
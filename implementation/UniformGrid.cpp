@@ -0,0 +1,127 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <UniformGrid.h>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <memory>
+#include <functional>
+
+//std::min takes it by reference
+const int UniformGrid::MAX_RESOLUTION;
+
+/**
+ * Cells are filled in two passes over the primitives: the first
+ * counts the references of every cell, the second writes them at
+ * the offsets given by the running sum of the counts. Both passes
+ * split the primitives between the threads.
+ */
+void UniformGrid::build(const std::vector<AABB> &primitiveBounds, unsigned int threads) {
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    clear();
+    stats = GridStats();
+    bounds = AABB();
+    for(auto & box : primitiveBounds) {
+        bounds.expand(box);
+    }
+    if(primitiveBounds.empty()) {
+        return;
+    }
+
+    //Flat or degenerate scenes still need a volume
+    //to spread the cells over
+    glm::vec3 extent = bounds.getExtent();
+    float padding = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-3f)) * 1e-3f;
+    bounds.min -= glm::vec3(padding);
+    bounds.max += glm::vec3(padding);
+    extent = bounds.getExtent();
+
+    float volume = extent.x * extent.y * extent.z;
+    float cellsPerUnit = std::cbrt(DENSITY * primitiveBounds.size() / volume);
+    for(int axis = 0; axis < 3; axis++) {
+        resolution[axis] = std::min(std::max((int)std::ceil(extent[axis] * cellsPerUnit), 1), MAX_RESOLUTION);
+    }
+    while((long long)resolution[0] * resolution[1] * resolution[2] > MAX_CELLS) {
+        int* largest = std::max_element(resolution, resolution + 3);
+        *largest = (*largest + 1) / 2;
+    }
+    for(int axis = 0; axis < 3; axis++) {
+        cellSize[axis] = extent[axis] / resolution[axis];
+        inverseCellSize[axis] = 1.0f / cellSize[axis];
+    }
+
+    int cellCount = resolution[0] * resolution[1] * resolution[2];
+    std::unique_ptr<std::atomic<int>[]> counts(new std::atomic<int>[cellCount]);
+    for(int i = 0; i < cellCount; i++) {
+        counts[i] = 0;
+    }
+
+    threads = std::max(1u, std::min(threads, (unsigned int)(primitiveBounds.size() / 1024 + 1)));
+    auto forEachPrimitive = [&](const std::function<void(int primitive, int cell)> &action) {
+        std::vector<std::future<void>> tasks;
+        size_t chunk = (primitiveBounds.size() + threads - 1) / threads;
+        for(unsigned int t = 0; t < threads; t++) {
+            size_t begin = t * chunk;
+            size_t finish = std::min(primitiveBounds.size(), begin + chunk);
+            tasks.push_back(std::async(std::launch::async, [&, begin, finish]() {
+                int lower[3], upper[3];
+                for(size_t primitive = begin; primitive < finish; primitive++) {
+                    getCellRange(primitiveBounds[primitive], lower, upper);
+                    for(int z = lower[2]; z <= upper[2]; z++) {
+                        for(int y = lower[1]; y <= upper[1]; y++) {
+                            for(int x = lower[0]; x <= upper[0]; x++) {
+                                action((int)primitive, cellIndex(x, y, z));
+                            }
+                        }
+                    }
+                }
+            }));
+        }
+        for(auto & task : tasks) {
+            task.get();
+        }
+    };
+
+    forEachPrimitive([&](int, int cell) {
+        counts[cell]++;
+    });
+
+    cellStart.resize(cellCount + 1);
+    cellStart[0] = 0;
+    for(int i = 0; i < cellCount; i++) {
+        cellStart[i + 1] = cellStart[i] + counts[i];
+        stats.emptyCells += counts[i] == 0;
+        counts[i] = cellStart[i];
+    }
+
+    cellPrimitives.resize(cellStart[cellCount]);
+    forEachPrimitive([&](int primitive, int cell) {
+        cellPrimitives[counts[cell]++] = primitive;
+    });
+
+    for(int i = 0; i < cellCount; i++) {
+        std::sort(cellPrimitives.begin() + cellStart[i], cellPrimitives.begin() + cellStart[i + 1]);
+    }
+
+    stats.cellCount = cellCount;
+    stats.references = cellPrimitives.size();
+
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    stats.buildSeconds = std::chrono::duration<double>(end - start).count();
+}
+
+void UniformGrid::getCellRange(const AABB &box, int lower[3], int upper[3]) const {
+    for(int axis = 0; axis < 3; axis++) {
+        lower[axis] = (int)std::floor((box.min[axis] - bounds.min[axis]) * inverseCellSize[axis]);
+        upper[axis] = (int)std::floor((box.max[axis] - bounds.min[axis]) * inverseCellSize[axis]);
+        lower[axis] = std::min(std::max(lower[axis], 0), resolution[axis] - 1);
+        upper[axis] = std::min(std::max(upper[axis], 0), resolution[axis] - 1);
+    }
+}
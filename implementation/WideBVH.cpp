@@ -0,0 +1,140 @@
+/*
+ * Allan Pichardo
+ * #40051123
+ *
+ * COMP 371
+ * Final Project
+ */
+
+#include <WideBVH.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+void WideBVH::build(const BVH &binary) {
+    nodes.clear();
+
+    const std::vector<BVHNode> &binaryNodes = binary.getNodes();
+    if(binaryNodes.empty()) {
+        return;
+    }
+
+    nodes.reserve(binaryNodes.size() / 2 + 1);
+    collapse(binaryNodes, 0);
+    nodes.shrink_to_fit();
+}
+
+/**
+ * The children of a wide node are found by opening the binary
+ * child with the largest surface area until there are WIDTH of
+ * them or only leaves are left. Large children are the most
+ * likely to be hit, so they gain the most from being opened.
+ */
+int WideBVH::collapse(const std::vector<BVHNode> &binary, int binaryIndex) {
+    int children[WideBVHNode::WIDTH];
+    int childCount = 0;
+
+    if(binary[binaryIndex].isLeaf()) {
+        children[childCount++] = binaryIndex;
+    } else {
+        children[childCount++] = binary[binaryIndex].leftFirst;
+        children[childCount++] = binary[binaryIndex].leftFirst + 1;
+    }
+
+    while(childCount < WideBVHNode::WIDTH) {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for(int i = 0; i < childCount; i++) {
+            const BVHNode &child = binary[children[i]];
+            if(!child.isLeaf() && child.bounds.getHalfArea() > largestArea) {
+                largest = i;
+                largestArea = child.bounds.getHalfArea();
+            }
+        }
+        if(largest < 0) {
+            break;
+        }
+
+        int opened = children[largest];
+        children[largest] = binary[opened].leftFirst;
+        children[childCount++] = binary[opened].leftFirst + 1;
+    }
+
+    int index = (int)nodes.size();
+    nodes.emplace_back();
+
+    AABB bounds[WideBVHNode::WIDTH];
+    for(int i = 0; i < childCount; i++) {
+        bounds[i] = binary[children[i]].bounds;
+    }
+    quantize(nodes[index], bounds, childCount);
+
+    for(int i = 0; i < WideBVHNode::WIDTH; i++) {
+        nodes[index].child[i] = -1;
+        nodes[index].count[i] = 0;
+    }
+
+    for(int i = 0; i < childCount; i++) {
+        const BVHNode &child = binary[children[i]];
+        if(child.isLeaf()) {
+            if(child.count > UINT16_MAX) {
+                throw std::runtime_error("BVH leaf is too large to compress");
+            }
+            nodes[index].child[i] = child.leftFirst;
+            nodes[index].count[i] = (uint16_t)child.count;
+        } else {
+            //collapse may grow the vector, so the
+            //node is indexed again after the call
+            int wideChild = collapse(binary, children[i]);
+            nodes[index].child[i] = wideChild;
+        }
+    }
+
+    return index;
+}
+
+/**
+ * The grid step of each axis is the smallest power of two that
+ * covers the node in 255 steps. The rounding of each step is
+ * checked with the same arithmetic the traversal decodes it with.
+ */
+void WideBVH::quantize(WideBVHNode &node, const AABB* bounds, int childCount) {
+    AABB parent;
+    for(int i = 0; i < childCount; i++) {
+        parent.expand(bounds[i]);
+    }
+
+    for(int axis = 0; axis < 3; axis++) {
+        float origin = parent.min[axis];
+        float extent = parent.max[axis] - origin;
+        float scale = extent > 0.0f ? std::exp2(std::ceil(std::log2(extent / 255.0f))) : 1.0f;
+        while(origin + 255.0f * scale < parent.max[axis]) {
+            scale *= 2.0f;
+        }
+
+        node.origin[axis] = origin;
+        node.scale[axis] = scale;
+
+        for(int i = 0; i < WideBVHNode::WIDTH; i++) {
+            if(i >= childCount) {
+                node.lower[axis][i] = 0;
+                node.upper[axis][i] = 0;
+                continue;
+            }
+
+            float low = std::floor((bounds[i].min[axis] - origin) / scale);
+            float high = std::ceil((bounds[i].max[axis] - origin) / scale);
+            int lower = (int)std::min(std::max(low, 0.0f), 255.0f);
+            int upper = (int)std::min(std::max(high, 0.0f), 255.0f);
+            while(lower > 0 && origin + lower * scale > bounds[i].min[axis]) {
+                lower--;
+            }
+            while(upper < 255 && origin + upper * scale < bounds[i].max[axis]) {
+                upper++;
+            }
+
+            node.lower[axis][i] = (uint8_t)lower;
+            node.upper[axis][i] = (uint8_t)upper;
+        }
+    }
+}
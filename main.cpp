@@ -7,47 +7,273 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <future>
+#include <cstring>
+#include <string>
 #include "Scene.h"
+#include "RenderOptions.h"
+#include "PreviewServer.h"
+#include "TileCoordinator.h"
+#include "TileWorker.h"
+#include "SceneFile.h"
+#include "Timeline.h"
 
 
 void showUsage() {
     std::cerr << "Missing arguments." << std::endl;
-    std::cerr << "Usage: raytracer -in [scene file path] -out [image path]" << std::endl;
+    std::cerr << "Usage: raytracer -in [scene file path] -out [image path] [options]" << std::endl;
+    std::cerr << "       raytracer -serve [socket path]" << std::endl;
+    std::cerr << "       raytracer -worker [host:port] [options]" << std::endl;
+    std::cerr << "       raytracer -batch [list file] [options]" << std::endl;
+    std::cerr << "       raytracer -in [scene file path] -convert [binary scene path]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  -threads [count]    number of render threads, two per core by default" << std::endl;
+    std::cerr << "  -tile [size]        tile size in pixels" << std::endl;
+    std::cerr << "  -spp [count]        jittered samples per pixel" << std::endl;
+    std::cerr << "  -light-samples [count] most shadow rays per hit to an area light, a power of two, 16 by default" << std::endl;
+    std::cerr << "  -seed [number]      seed of the per-pixel random sequences" << std::endl;
+    std::cerr << "  -denoise            filter the noise of the image, guided by albedo, normal and depth" << std::endl;
+    std::cerr << "  -checksum           print a checksum of the rendered image" << std::endl;
+    std::cerr << "  -trace [json path]  record what every thread does, as Chrome trace events" << std::endl;
+    std::cerr << "  -nodisplay          do not show the rendered image in a window" << std::endl;
+    std::cerr << "  -compact            compressed BVH and triangle storage for large meshes" << std::endl;
+    std::cerr << "  -accel [auto|bvh|grid] structure over the spheres and meshes, auto by default" << std::endl;
+    std::cerr << "  -geometry-budget [MB] load meshes out of core, keeping this much of them in memory" << std::endl;
+    std::cerr << "  -texture-budget [MB] memory for texture tiles, 256 MB by default" << std::endl;
+    std::cerr << "  -wavefront          trace each tile in sorted waves of camera and shadow rays" << std::endl;
+    std::cerr << "  -raster             rasterize the camera hits instead of tracing them, with -spp 1" << std::endl;
+    std::cerr << "  -affinity [none|node|core] pin render threads to NUMA nodes or cores, none by default" << std::endl;
+    std::cerr << "  -workers [count]    render the tiles in this many worker processes" << std::endl;
+    std::cerr << "  -listen [port]      also accept workers from other hosts on this TCP port" << std::endl;
+}
+
+/**
+ * Waits for an image being saved, if any.
+ * Returns 1 if saving it failed.
+ */
+int finishSaving(std::future<void> &saving) {
+    if(!saving.valid()) {
+        return 0;
+    }
+
+    try {
+        saving.get();
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Renders the scenes listed in a file, one "[scene file path]
+ * [image path]" pair per line. Each image is encoded while the
+ * next scene loads and renders. Returns the number of failures.
+ */
+int renderBatch(const char* listFile, RenderOptions options) {
+    std::ifstream list(listFile);
+    if(!list) {
+        throw std::invalid_argument(std::string("Unable to read ") + listFile);
+    }
+    options.display = false;
+
+    int failures = 0;
+    std::future<void> saving;
+    std::string line;
+    while(std::getline(list, line)) {
+        std::istringstream stream(line);
+        std::string infile, outfile;
+        if(!(stream >> infile) || infile[0] == '#') {
+            continue;
+        }
+
+        try {
+            if(!(stream >> outfile)) {
+                throw std::invalid_argument("No image path for " + infile);
+            }
+
+            Scene scene(infile, options);
+            scene.render(options);
+
+            //only one image is encoded at a time
+            failures += finishSaving(saving);
+            saving = scene.saveImageAsync(outfile.c_str(), options);
+        } catch (std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            failures++;
+        }
+    }
+
+    failures += finishSaving(saving);
+    return failures;
 }
 
 int main(int argc, char* argv[]) {
-    if(argc == 5) {
-        char* infile;
-        char* outfile;
-
-        if(strcasecmp(argv[1], "-in") == 0) {
-            infile = argv[2];
-        }else if(strcasecmp(argv[1], "-out") == 0) {
-            outfile = argv[2];
-        } else {
-            showUsage();
-            return 0;
+    char* infile = nullptr;
+    char* outfile = nullptr;
+    char* socketPath = nullptr;
+    char* coordinatorAddress = nullptr;
+    char* batchFile = nullptr;
+    char* binaryFile = nullptr;
+    char* traceFile = nullptr;
+    RenderOptions options;
+
+    try {
+        for(int i = 1; i < argc; i++) {
+            //every option except the flags takes one value
+            auto value = [&]() -> char* {
+                if(i + 1 >= argc) {
+                    throw std::invalid_argument(std::string("Missing value for ") + argv[i]);
+                }
+                return argv[++i];
+            };
+
+            if(strcasecmp(argv[i], "-in") == 0) {
+                infile = value();
+            } else if(strcasecmp(argv[i], "-out") == 0) {
+                outfile = value();
+            } else if(strcasecmp(argv[i], "-serve") == 0) {
+                socketPath = value();
+            } else if(strcasecmp(argv[i], "-threads") == 0) {
+                options.threads = (unsigned int)std::stoul(value());
+            } else if(strcasecmp(argv[i], "-tile") == 0) {
+                options.tileSize = std::stoi(value());
+            } else if(strcasecmp(argv[i], "-spp") == 0) {
+                options.samplesPerPixel = std::stoi(value());
+            } else if(strcasecmp(argv[i], "-light-samples") == 0) {
+                options.lightSamples = std::stoi(value());
+                if(options.lightSamples < 1 || options.lightSamples > Scene::MAX_LIGHT_SAMPLES ||
+                   (options.lightSamples & (options.lightSamples - 1)) != 0) {
+                    throw std::invalid_argument("The light samples must be a power of two up to " +
+                                                std::to_string(Scene::MAX_LIGHT_SAMPLES));
+                }
+            } else if(strcasecmp(argv[i], "-seed") == 0) {
+                options.seed = (unsigned int)std::stoul(value());
+            } else if(strcasecmp(argv[i], "-denoise") == 0) {
+                options.denoise = true;
+            } else if(strcasecmp(argv[i], "-checksum") == 0) {
+                options.checksum = true;
+            } else if(strcasecmp(argv[i], "-trace") == 0) {
+                traceFile = value();
+            } else if(strcasecmp(argv[i], "-nodisplay") == 0) {
+                options.display = false;
+            } else if(strcasecmp(argv[i], "-wavefront") == 0) {
+                options.wavefront = true;
+            } else if(strcasecmp(argv[i], "-raster") == 0) {
+                options.raster = true;
+            } else if(strcasecmp(argv[i], "-affinity") == 0) {
+                char* affinity = value();
+                if(strcasecmp(affinity, "none") == 0) {
+                    options.affinity = RenderOptions::unpinned;
+                } else if(strcasecmp(affinity, "node") == 0) {
+                    options.affinity = RenderOptions::node;
+                } else if(strcasecmp(affinity, "core") == 0) {
+                    options.affinity = RenderOptions::core;
+                } else {
+                    throw std::invalid_argument(std::string("Unknown affinity ") + affinity);
+                }
+            } else if(strcasecmp(argv[i], "-workers") == 0) {
+                options.workers = (unsigned int)std::stoul(value());
+            } else if(strcasecmp(argv[i], "-listen") == 0) {
+                options.listenPort = std::stoi(value());
+                if(options.listenPort < 0 || options.listenPort > 65535) {
+                    throw std::invalid_argument("The port must be between 0 and 65535");
+                }
+            } else if(strcasecmp(argv[i], "-worker") == 0) {
+                coordinatorAddress = value();
+            } else if(strcasecmp(argv[i], "-batch") == 0) {
+                batchFile = value();
+            } else if(strcasecmp(argv[i], "-convert") == 0) {
+                binaryFile = value();
+            } else if(strcasecmp(argv[i], "-compact") == 0) {
+                options.compactGeometry = true;
+            } else if(strcasecmp(argv[i], "-accel") == 0) {
+                char* accelerator = value();
+                if(strcasecmp(accelerator, "auto") == 0) {
+                    options.accelerator = RenderOptions::automatic;
+                } else if(strcasecmp(accelerator, "bvh") == 0) {
+                    options.accelerator = RenderOptions::bvh;
+                } else if(strcasecmp(accelerator, "grid") == 0) {
+                    options.accelerator = RenderOptions::grid;
+                } else {
+                    throw std::invalid_argument(std::string("Unknown accelerator ") + accelerator);
+                }
+            } else if(strcasecmp(argv[i], "-geometry-budget") == 0) {
+                double megabytes = std::stod(value());
+                if(megabytes <= 0.0) {
+                    throw std::invalid_argument("The geometry budget must be positive");
+                }
+                options.geometryBudget = (size_t)(megabytes * 1048576.0);
+            } else if(strcasecmp(argv[i], "-texture-budget") == 0) {
+                double megabytes = std::stod(value());
+                if(megabytes <= 0.0) {
+                    throw std::invalid_argument("The texture budget must be positive");
+                }
+                options.textureBudget = (size_t)(megabytes * 1048576.0);
+            } else {
+                showUsage();
+                return 0;
+            }
         }
 
-        if(strcasecmp(argv[3], "-in") == 0) {
-            infile = argv[4];
-        }else if(strcasecmp(argv[3], "-out") == 0) {
-            outfile = argv[4];
+        if(options.raster && options.samplesPerPixel > 1) {
+            throw std::invalid_argument("-raster only renders one sample per pixel");
+        }
+        if(options.denoise && options.isDistributed()) {
+            throw std::invalid_argument("-denoise needs the features of every pixel, which workers do not send back");
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        showUsage();
+        return 1;
+    }
+
+    if(traceFile != nullptr) {
+        Timeline::start();
+        Timeline::nameThread("main");
+    }
+
+    int result = 0;
+    try {
+        if(socketPath != nullptr) {
+            PreviewServer server(socketPath);
+            server.run();
+        } else if(coordinatorAddress != nullptr) {
+            TileWorker worker(coordinatorAddress, options);
+            worker.run();
+        } else if(batchFile != nullptr) {
+            result = renderBatch(batchFile, options) > 0 ? 1 : 0;
+        } else if(infile != nullptr && binaryFile != nullptr) {
+            size_t bytes = SceneFile::convert(infile, binaryFile);
+            std::cout << "Converted " << infile << " to " << binaryFile << ", " << bytes / 1024.0 << " KB" << std::endl;
+        } else if(infile != nullptr && outfile != nullptr) {
+            Scene scene(infile, options);
+            if (scene.isSceneLoaded() && options.isDistributed()) {
+                TileCoordinator coordinator(scene, infile, options, argv[0]);
+                coordinator.renderToImage(outfile);
+            } else if (scene.isSceneLoaded()) {
+                scene.renderToImage(outfile, options);
+            }
         } else {
             showUsage();
-            return 0;
         }
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        result = 1;
+    }
 
+    //every thread is done by now, so the trace is complete
+    if(traceFile != nullptr) {
         try {
-            Scene scene(infile);
-            if (scene.isSceneLoaded()) {
-                scene.renderToImage(outfile);
-            }
+            size_t spans = Timeline::write(traceFile);
+            std::cout << "Trace: " << spans << " spans written to " << traceFile << ", "
+                      << Timeline::getDroppedCount() << " dropped" << std::endl;
         } catch (std::exception& e) {
             std::cerr << "Error: " << e.what() << std::endl;
-            return 1;
+            result = 1;
         }
-    } else {
-        showUsage();
     }
-}
\ No newline at end of file
+    return result;
+}